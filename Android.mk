@@ -1,9 +1,9 @@
 ifneq ($(filter sofia3gr, $(TARGET_BOARD_PLATFORM)),)
-    include $(call all-named-subdir-makefiles, mali)
+    include $(call all-named-subdir-makefiles, common mali)
 else ifneq ($(filter gsd, $(TARGET_BOARD_PLATFORM)),)
-    include $(call all-named-subdir-makefiles, mali)
+    include $(call all-named-subdir-makefiles, common mali)
 else ifneq ($(filter sofia_lte, $(TARGET_BOARD_PLATFORM)),)
-    include $(call all-named-subdir-makefiles, mali-midgard)
+    include $(call all-named-subdir-makefiles, common mali-midgard)
 else
-    include $(call all-named-subdir-makefiles, gen)
+    include $(call all-named-subdir-makefiles, common gen)
 endif
@@ -0,0 +1,287 @@
+# Copyright (C) 2014 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH := $(call my-dir)
+
+# Pieces shared by every platform variant of the memtrack HAL
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES += hardware/libhardware/include
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_SRC_FILES := adaptive.c aggregate.c async.c batch_io.c cache.c config.c core.c fdinfo.c guard.c history.c io_account.c logging.c pipeline.c proc_events.c procfs.c psi.c sampler.c scan.c shared_snapshot.c singleflight.c snapshot.c source.c stats.c subscribe.c topn.c zram.c
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
+# Phase tracing for debug builds, see trace.h
+ifeq ($(MEMTRACK_TRACE),true)
+LOCAL_SRC_FILES += trace.c
+LOCAL_CFLAGS += -DMEMTRACK_TRACE
+LOCAL_EXPORT_CFLAGS += -DMEMTRACK_TRACE
+endif
+# Hardware counter profiling, see perf.h
+ifeq ($(MEMTRACK_PERF),true)
+LOCAL_SRC_FILES += perf.c
+LOCAL_CFLAGS += -DMEMTRACK_PERF
+LOCAL_EXPORT_CFLAGS += -DMEMTRACK_PERF
+endif
+# Debug and verbose query logging, see logging.h
+ifeq ($(MEMTRACK_LOG_LEVEL),debug)
+LOCAL_CFLAGS += -DMEMTRACK_LOG_LEVEL=3
+LOCAL_EXPORT_CFLAGS += -DMEMTRACK_LOG_LEVEL=3
+else ifeq ($(MEMTRACK_LOG_LEVEL),verbose)
+LOCAL_CFLAGS += -DMEMTRACK_LOG_LEVEL=4
+LOCAL_EXPORT_CFLAGS += -DMEMTRACK_LOG_LEVEL=4
+endif
+LOCAL_MODULE := libmemtrack_intel_common
+LOCAL_PROPRIETARY_MODULE := true
+include $(BUILD_STATIC_LIBRARY)
+
+# Sampler driven by a PSI stand-in file on a fixture tree
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/psi_test.c
+LOCAL_MODULE := memtrack_psi_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Guarded source hung on a FIFO of a fixture tree
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/guard_test.c
+LOCAL_MODULE := memtrack_guard_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Chrome trace of a sweep over a fixture tree, needs MEMTRACK_TRACE
+ifeq ($(MEMTRACK_TRACE),true)
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/trace_test.c
+LOCAL_MODULE := memtrack_trace_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+endif
+
+# Async queries cut short by their deadline
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/async_test.c
+LOCAL_MODULE := memtrack_async_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Concurrent identical queries coalesced by single-flight
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/singleflight_test.c
+LOCAL_MODULE := memtrack_singleflight_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Seqlock snapshot readers racing the sampler's writer
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/snapshot_test.c
+LOCAL_MODULE := memtrack_snapshot_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Result cache hits, expiry and eviction
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/cache_test.c
+LOCAL_MODULE := memtrack_cache_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Change subscriptions fed by sampler sweeps
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/subscribe_test.c
+LOCAL_MODULE := memtrack_subscribe_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Per-pid size history rings and buckets
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/history_test.c
+LOCAL_MODULE := memtrack_history_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Readers of the shared snapshot following the writer
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/shared_snapshot_test.c
+LOCAL_MODULE := memtrack_shared_snapshot_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Per-uid and per-cgroup totals of sampler sweeps
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/aggregate_test.c
+LOCAL_MODULE := memtrack_aggregate_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Volatility scheduling of sampler sweeps
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/adaptive_test.c
+LOCAL_MODULE := memtrack_adaptive_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Resumable smaps walks under a deadline
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/scan_test.c
+LOCAL_MODULE := memtrack_scan_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Largest consumers against a full sort
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/topn_test.c
+LOCAL_MODULE := memtrack_topn_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Configuration loading and reloads
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/config_test.c
+LOCAL_MODULE := memtrack_config_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Cost based choice among provider sources
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/source_test.c
+LOCAL_MODULE := memtrack_source_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Rate limited logging events and query dumps
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/logging_test.c
+LOCAL_MODULE := memtrack_logging_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Pipelined sampler sweeps
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/pipeline_test.c
+LOCAL_MODULE := memtrack_pipeline_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Batched reads through io_uring and stdio
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/batch_io_test.c
+LOCAL_MODULE := memtrack_batch_io_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Measurements on the device fixture, run by hand
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := tests/memtrack_test.c tests/bench.c
+LOCAL_MODULE := memtrack_bench
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
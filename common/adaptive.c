@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adaptive.h"
+#include "memtrack_common.h"
+
+/* Weight of the newest observation in the rate and cost averages */
+#define RATE_ALPHA 0.5
+#define COST_ALPHA 0.1
+
+/*
+ * A new process is assumed to move fast enough to be sampled again after
+ * this fraction of the long interval, until it proves otherwise.
+ */
+#define NEW_PID_INTERVAL_DIVISOR 16
+
+struct pid_state {
+    pid_t pid;
+    uint32_t cost;
+    /* Bytes per second, averaged over the samples */
+    double rate;
+    uint64_t total;
+    uint64_t sampled_ns;
+};
+
+struct candidate {
+    size_t index;
+    double score;
+    double expected;
+};
+
+static bool enabled;
+static uint64_t budget_per_s;
+static uint64_t max_interval_ns;
+static double error_bytes;
+static double avg_cost = 16384;
+
+static struct pid_state *prev_states, *next_states;
+static size_t prev_count, next_count, capacity;
+/* Per planned pid: its index in prev_states or -1 */
+static long *matches;
+static const uint8_t *plan_actions;
+static struct candidate *candidates;
+static uint64_t plan_ns;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct memtrack_adaptive_stats stats;
+
+int adaptive_init(size_t max_pids, uint64_t budget_bytes_per_s,
+                  uint32_t max_interval_ms, uint64_t error)
+{
+    if (budget_bytes_per_s == 0 || max_interval_ms == 0 || error == 0) {
+        return -EINVAL;
+    }
+
+    prev_states = calloc(max_pids, sizeof(struct pid_state));
+    next_states = calloc(max_pids, sizeof(struct pid_state));
+    matches = calloc(max_pids, sizeof(long));
+    candidates = calloc(max_pids, sizeof(struct candidate));
+    if (prev_states == NULL || next_states == NULL || matches == NULL ||
+        candidates == NULL) {
+        free(prev_states);
+        free(next_states);
+        free(matches);
+        free(candidates);
+        return -ENOMEM;
+    }
+
+    capacity = max_pids;
+    budget_per_s = budget_bytes_per_s;
+    max_interval_ns = max_interval_ms * 1000000ULL;
+    error_bytes = error;
+    enabled = true;
+
+    return 0;
+}
+
+bool adaptive_enabled(void)
+{
+    return enabled;
+}
+
+static int compare_candidates(const void *a, const void *b)
+{
+    const struct candidate *ca = a;
+    const struct candidate *cb = b;
+
+    return (ca->score < cb->score) - (ca->score > cb->score);
+}
+
+void adaptive_plan(const pid_t *pids, size_t count, uint32_t tick_ms,
+                   uint8_t *actions)
+{
+    uint64_t budget = budget_per_s * tick_ms / 1000;
+    uint64_t spent = 0, fixed = 0, deferred = 0;
+    double drift = 0.0;
+    size_t cursor = 0, ncand = 0;
+    size_t i;
+
+    plan_ns = memtrack_now_ns();
+    plan_actions = actions;
+    next_count = 0;
+
+    for (i = 0; i < count && i < capacity; i++) {
+        const struct pid_state *st;
+        double age_ns, expected, score;
+
+        while (cursor < prev_count && prev_states[cursor].pid < pids[i]) {
+            cursor++;
+        }
+        if (cursor == prev_count || prev_states[cursor].pid != pids[i]) {
+            matches[i] = -1;
+            fixed += avg_cost;
+            candidates[ncand++] = (struct candidate){ i, 1e300, 0.0 };
+            continue;
+        }
+
+        matches[i] = cursor;
+        st = &prev_states[cursor];
+        fixed += st->cost;
+
+        age_ns = plan_ns - st->sampled_ns;
+        expected = st->rate * age_ns / 1e9;
+        score = expected / error_bytes + age_ns / max_interval_ns;
+        if (score < 1.0) {
+            actions[i] = ADAPTIVE_KEEP;
+            drift += expected;
+            continue;
+        }
+        candidates[ncand++] = (struct candidate){ i, score, expected };
+    }
+    for (; i < count; i++) {
+        actions[i] = ADAPTIVE_SKIP;
+    }
+
+    /* Largest expected drift first, unknown pids before everything */
+    qsort(candidates, ncand, sizeof(struct candidate), compare_candidates);
+    for (i = 0; i < ncand; i++) {
+        const struct candidate *c = &candidates[i];
+        long match = matches[c->index];
+        uint64_t cost = match < 0 ? avg_cost : prev_states[match].cost;
+
+        if (spent && spent + cost > budget) {
+            actions[c->index] = match < 0 ? ADAPTIVE_SKIP : ADAPTIVE_KEEP;
+            drift += c->expected;
+            deferred++;
+            continue;
+        }
+        actions[c->index] = ADAPTIVE_SAMPLE;
+        spent += cost;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    stats.ticks++;
+    stats.deferred += deferred;
+    stats.fixed_bytes += fixed;
+    stats.error_bytes = drift;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static uint64_t entry_total(const struct snapshot_entry *entry)
+{
+    uint64_t total = 0;
+    int type;
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (entry->ret[type] == 0 && entry->num_records[type]) {
+            total += entry->records[type][0].size_in_bytes;
+        }
+    }
+
+    return total;
+}
+
+void adaptive_record(size_t i, pid_t pid, const struct snapshot_entry *entry,
+                     uint64_t cost)
+{
+    const struct pid_state *old = NULL;
+    struct pid_state *st;
+
+    if (i >= capacity || next_count == capacity) {
+        return;
+    }
+    if (matches[i] >= 0) {
+        old = &prev_states[matches[i]];
+    }
+
+    st = &next_states[next_count++];
+    if (plan_actions[i] != ADAPTIVE_SAMPLE) {
+        *st = *old;
+        pthread_mutex_lock(&stats_lock);
+        stats.kept++;
+        pthread_mutex_unlock(&stats_lock);
+        return;
+    }
+
+    st->pid = pid;
+    st->cost = cost;
+    st->total = entry_total(entry);
+    st->sampled_ns = entry->sampled_ns;
+    if (old) {
+        double dt = (entry->sampled_ns - old->sampled_ns) / 1e9;
+        double delta = st->total > old->total ? st->total - old->total :
+                                                 old->total - st->total;
+
+        st->rate = old->rate * (1.0 - RATE_ALPHA) +
+                   delta / (dt > 1e-3 ? dt : 1e-3) * RATE_ALPHA;
+    } else {
+        st->rate = error_bytes * NEW_PID_INTERVAL_DIVISOR /
+                   (max_interval_ns / 1e9);
+    }
+    avg_cost = avg_cost * (1.0 - COST_ALPHA) + cost * COST_ALPHA;
+
+    pthread_mutex_lock(&stats_lock);
+    stats.sampled++;
+    stats.bytes_read += cost;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void adaptive_commit(void)
+{
+    struct pid_state *states = prev_states;
+
+    prev_states = next_states;
+    next_states = states;
+    prev_count = next_count;
+}
+
+void memtrack_adaptive_get_stats(struct memtrack_adaptive_stats *out)
+{
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    pthread_mutex_unlock(&stats_lock);
+}
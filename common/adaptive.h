@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_ADAPTIVE_H_
+#define _MEMTRACK_ADAPTIVE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "snapshot.h"
+
+/*
+ * Volatility aware scheduling of the sampler sweeps.
+ *
+ * Every pid carries an EWMA of how fast its total size moves and of how
+ * many bytes a sample of it reads.  A pid becomes due once its expected
+ * drift (rate * age) reaches error_bytes, or once it has not been sampled
+ * for max_interval_ms; stable processes therefore decay to the long
+ * interval.  Each tick samples the due pids with the largest expected
+ * drift until the tick's share of the per-second I/O budget is spent,
+ * the others keep their previous entry.
+ */
+
+enum adaptive_action {
+    /* Not sampled yet and not scheduled: left out of the snapshot */
+    ADAPTIVE_SKIP,
+    ADAPTIVE_KEEP,
+    ADAPTIVE_SAMPLE,
+};
+
+struct memtrack_adaptive_stats {
+    uint64_t ticks;
+    uint64_t sampled;
+    uint64_t kept;
+    /* Due pids left for a later tick by the budget */
+    uint64_t deferred;
+    uint64_t bytes_read;
+    /* What sampling every pid on every tick would have read */
+    uint64_t fixed_bytes;
+    /* Expected drift summed over the unsampled pids of the last tick */
+    uint64_t error_bytes;
+};
+
+int adaptive_init(size_t max_pids, uint64_t budget_bytes_per_s,
+                  uint32_t max_interval_ms, uint64_t error_bytes);
+bool adaptive_enabled(void);
+
+/*
+ * Sampler only.  Decides what to do with each of the count sorted pids
+ * for a tick of tick_ms, actions[i] being one of enum adaptive_action.
+ */
+void adaptive_plan(const pid_t *pids, size_t count, uint32_t tick_ms,
+                   uint8_t *actions);
+
+/*
+ * Reports the outcome for pids[i] of the last plan, in ascending order,
+ * for every pid that was kept or sampled.  cost is the bytes the sample
+ * read.
+ */
+void adaptive_record(size_t i, pid_t pid, const struct snapshot_entry *entry,
+                     uint64_t cost);
+void adaptive_commit(void);
+
+void memtrack_adaptive_get_stats(struct memtrack_adaptive_stats *stats);
+
+#endif
@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/log.h>
+
+#include "aggregate.h"
+#include "logging.h"
+#include "memtrack_common.h"
+#include "proc_events.h"
+#include "procfs.h"
+
+/* Open addressed, a power of two */
+#define AGG_MAX_UIDS 512
+#define AGG_MAX_CGROUPS 256
+#define AGG_CGROUP_PATH_MAX 128
+#define AGG_NO_CGROUP UINT16_MAX
+/* The table was full, resolved again on every sweep until it fits */
+#define AGG_CGROUP_OVERFLOW (UINT16_MAX - 1)
+#define UID_EMPTY ((uid_t)-1)
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+/*
+ * A new process may still change its uid or cgroup (zygote children
+ * specialize after the fork), so its identity is read again until it
+ * came out the same this many times in a row.
+ */
+#define IDENTITY_CONFIRMATIONS 2
+
+struct identity {
+    pid_t pid;
+    uid_t uid;
+    uint16_t cgroup;
+    uint16_t confirmations;
+    /* Only used when exits are not reported by the proc connector */
+    uint64_t start_time;
+};
+
+struct totals {
+    uid_t uids[AGG_MAX_UIDS];
+    struct memtrack_aggregate by_uid[AGG_MAX_UIDS];
+    struct memtrack_aggregate by_cgroup[AGG_MAX_CGROUPS];
+    size_t cgroups;
+    uint64_t timestamp_ns;
+};
+
+static bool enabled;
+
+/* Published totals, swapped under totals_lock */
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct totals bufs[2];
+static int published = -1;
+
+/* Sampler thread state */
+static struct totals *building;
+static struct identity *prev_ids, *next_ids;
+static size_t prev_count, next_count, capacity, cursor;
+static uint64_t prev_timestamp_ns;
+/* An empty path is a free slot, see reclaim_cgroups() */
+static char cgroup_paths[AGG_MAX_CGROUPS][AGG_CGROUP_PATH_MAX];
+static size_t cgroup_count;
+static bool uids_full_logged;
+static uint64_t cgroups_reclaimed, cgroups_overflowed;
+static uint64_t sweep_overflowed;
+
+/* Published with the totals, under totals_lock */
+static struct memtrack_aggregate_stats agg_stats;
+
+int memtrack_aggregate_init(size_t max_pids)
+{
+    prev_ids = calloc(max_pids, sizeof(struct identity));
+    next_ids = calloc(max_pids, sizeof(struct identity));
+    if (prev_ids == NULL || next_ids == NULL) {
+        free(prev_ids);
+        free(next_ids);
+        prev_ids = next_ids = NULL;
+        return -ENOMEM;
+    }
+
+    capacity = max_pids;
+    enabled = true;
+
+    return 0;
+}
+
+static uint16_t intern_cgroup(const char *path)
+{
+    size_t i, slot = cgroup_count;
+
+    if (path[0] == '\0') {
+        return AGG_NO_CGROUP;
+    }
+
+    for (i = 0; i < cgroup_count; i++) {
+        if (cgroup_paths[i][0] == '\0') {
+            slot = min(slot, i);
+        } else if (strcmp(cgroup_paths[i], path) == 0) {
+            return i;
+        }
+    }
+    if (slot == AGG_MAX_CGROUPS) {
+        sweep_overflowed++;
+        MEMTRACK_LOGW_EVENT("aggregate_cgroups_full",
+                            "more than %d live cgroups, %s left out of the "
+                            "cgroup totals", AGG_MAX_CGROUPS, path);
+        return AGG_CGROUP_OVERFLOW;
+    }
+
+    /*
+     * Readers only look at the first cgroups entries of a published
+     * buffer, and a reclaimed slot has no processes in the published one.
+     */
+    snprintf(cgroup_paths[slot], AGG_CGROUP_PATH_MAX, "%s", path);
+    if (slot == cgroup_count) {
+        cgroup_count++;
+    }
+
+    return slot;
+}
+
+/*
+ * Frees the cgroups no pid of the sweep just committed belonged to.  The
+ * identities carried over to the next sweep only refer to cgroups that
+ * had a process in it.
+ */
+static size_t reclaim_cgroups(const struct totals *t)
+{
+    size_t i, reclaimed = 0, used = 0;
+
+    for (i = 0; i < cgroup_count; i++) {
+        if (cgroup_paths[i][0] == '\0') {
+            continue;
+        }
+        if (t->by_cgroup[i].processes == 0) {
+            cgroup_paths[i][0] = '\0';
+            reclaimed++;
+        } else {
+            used++;
+        }
+    }
+    while (cgroup_count && cgroup_paths[cgroup_count - 1][0] == '\0') {
+        cgroup_count--;
+    }
+
+    if (reclaimed) {
+        MEMTRACK_LOGD("reclaimed %zu cgroups, %zu in use", reclaimed, used);
+        cgroups_reclaimed += reclaimed;
+    }
+
+    return used;
+}
+
+static bool resolve(pid_t pid, struct identity *id)
+{
+    char cgroup[AGG_CGROUP_PATH_MAX];
+    uid_t uid;
+
+    if (procfs_identity(pid, &uid, cgroup, sizeof(cgroup)) < 0) {
+        return false;
+    }
+
+    id->pid = pid;
+    id->uid = uid;
+    id->cgroup = intern_cgroup(cgroup);
+
+    return true;
+}
+
+static const struct identity *lookup_identity(pid_t pid)
+{
+    bool connector = proc_events_mode() == PROC_EVENTS_CONNECTOR;
+    const struct identity *prev = NULL;
+    struct identity *next, fresh;
+    uint64_t start_time = 0;
+
+    if (next_count == capacity) {
+        return NULL;
+    }
+
+    /* Without exit events the start time tells a reused pid apart */
+    if (!connector && procfs_start_time(pid, &start_time) < 0) {
+        return NULL;
+    }
+
+    while (cursor < prev_count && prev_ids[cursor].pid < pid) {
+        cursor++;
+    }
+    if (cursor < prev_count && prev_ids[cursor].pid == pid) {
+        prev = &prev_ids[cursor];
+        if (connector ? proc_events_exited_since(pid, prev_timestamp_ns) :
+                        prev->start_time != start_time) {
+            prev = NULL;
+        }
+    }
+
+    next = &next_ids[next_count];
+    if (prev && prev->confirmations >= IDENTITY_CONFIRMATIONS &&
+        prev->cgroup != AGG_CGROUP_OVERFLOW) {
+        *next = *prev;
+    } else {
+        if (!resolve(pid, &fresh)) {
+            return NULL;
+        }
+        fresh.start_time = start_time;
+        fresh.confirmations = prev && prev->uid == fresh.uid &&
+                              prev->cgroup == fresh.cgroup ?
+                              prev->confirmations + 1 : 0;
+        *next = fresh;
+    }
+    next_count++;
+
+    return next;
+}
+
+static struct memtrack_aggregate *uid_slot(struct totals *t, uid_t uid)
+{
+    size_t base = (uid * 2654435761U) & (AGG_MAX_UIDS - 1);
+    size_t i;
+
+    for (i = 0; i < AGG_MAX_UIDS; i++) {
+        size_t slot = (base + i) & (AGG_MAX_UIDS - 1);
+
+        if (t->uids[slot] == uid) {
+            return &t->by_uid[slot];
+        }
+        if (t->uids[slot] == UID_EMPTY) {
+            t->uids[slot] = uid;
+            return &t->by_uid[slot];
+        }
+    }
+
+    return NULL;
+}
+
+static void accumulate(struct memtrack_aggregate *agg,
+                       const struct snapshot_entry *entry)
+{
+    int type;
+
+    agg->processes++;
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (entry->ret[type] == 0 && entry->num_records[type]) {
+            agg->bytes[type] += entry->records[type][0].size_in_bytes;
+        }
+    }
+}
+
+void memtrack_aggregate_begin(void)
+{
+    if (!enabled) {
+        return;
+    }
+
+    building = &bufs[published == 0 ? 1 : 0];
+    memset(building, 0, sizeof(*building));
+    memset(building->uids, 0xff, sizeof(building->uids));
+    next_count = 0;
+    cursor = 0;
+}
+
+void memtrack_aggregate_add(pid_t pid, const struct snapshot_entry *entry)
+{
+    const struct identity *id;
+    struct memtrack_aggregate *agg;
+
+    if (!enabled) {
+        return;
+    }
+
+    id = lookup_identity(pid);
+    if (id == NULL) {
+        return;
+    }
+
+    agg = uid_slot(building, id->uid);
+    if (agg) {
+        accumulate(agg, entry);
+    } else if (!uids_full_logged) {
+        ALOGW("more than %d uids, memtrack aggregation truncated",
+              AGG_MAX_UIDS);
+        uids_full_logged = true;
+    }
+
+    if (id->cgroup < AGG_MAX_CGROUPS) {
+        accumulate(&building->by_cgroup[id->cgroup], entry);
+    }
+}
+
+void memtrack_aggregate_commit(uint64_t timestamp_ns)
+{
+    struct identity *ids;
+    size_t used;
+
+    if (!enabled) {
+        return;
+    }
+
+    building->cgroups = cgroup_count;
+    building->timestamp_ns = timestamp_ns;
+    cgroups_overflowed += sweep_overflowed;
+
+    pthread_mutex_lock(&totals_lock);
+    published = building - bufs;
+    agg_stats.cgroups_overflowed = cgroups_overflowed;
+    pthread_mutex_unlock(&totals_lock);
+
+    /* Nobody reads the previous buffer's cgroups any more */
+    used = reclaim_cgroups(building);
+    sweep_overflowed = 0;
+
+    pthread_mutex_lock(&totals_lock);
+    agg_stats.cgroups = used;
+    agg_stats.cgroups_reclaimed = cgroups_reclaimed;
+    pthread_mutex_unlock(&totals_lock);
+
+    ids = prev_ids;
+    prev_ids = next_ids;
+    next_ids = ids;
+    prev_count = next_count;
+    prev_timestamp_ns = timestamp_ns;
+}
+
+int memtrack_aggregate_uid(uid_t uid, struct memtrack_aggregate *agg,
+                           uint64_t *timestamp_ns)
+{
+    const struct totals *t;
+    size_t base = (uid * 2654435761U) & (AGG_MAX_UIDS - 1);
+    int ret = -ENOENT;
+    size_t i;
+
+    pthread_mutex_lock(&totals_lock);
+    if (published < 0) {
+        pthread_mutex_unlock(&totals_lock);
+        return -EAGAIN;
+    }
+
+    t = &bufs[published];
+    for (i = 0; i < AGG_MAX_UIDS; i++) {
+        size_t slot = (base + i) & (AGG_MAX_UIDS - 1);
+
+        if (t->uids[slot] == UID_EMPTY) {
+            break;
+        }
+        if (t->uids[slot] == uid) {
+            *agg = t->by_uid[slot];
+            *timestamp_ns = t->timestamp_ns;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&totals_lock);
+
+    return ret;
+}
+
+int memtrack_aggregate_cgroup(const char *cgroup,
+                              struct memtrack_aggregate *agg,
+                              uint64_t *timestamp_ns)
+{
+    const struct totals *t;
+    int ret = -ENOENT;
+    size_t i;
+
+    pthread_mutex_lock(&totals_lock);
+    if (published < 0) {
+        pthread_mutex_unlock(&totals_lock);
+        return -EAGAIN;
+    }
+
+    t = &bufs[published];
+    for (i = 0; i < t->cgroups; i++) {
+        /* The path of a slot without processes may be getting reused */
+        if (t->by_cgroup[i].processes &&
+            strcmp(cgroup_paths[i], cgroup) == 0) {
+            *agg = t->by_cgroup[i];
+            *timestamp_ns = t->timestamp_ns;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&totals_lock);
+
+    return ret;
+}
+
+int memtrack_aggregate_foreach_uid(memtrack_aggregate_uid_fn fn, void *arg)
+{
+    const struct totals *t;
+    size_t i;
+
+    pthread_mutex_lock(&totals_lock);
+    if (published < 0) {
+        pthread_mutex_unlock(&totals_lock);
+        return -EAGAIN;
+    }
+
+    t = &bufs[published];
+    for (i = 0; i < AGG_MAX_UIDS; i++) {
+        if (t->uids[i] != UID_EMPTY) {
+            fn(arg, t->uids[i], &t->by_uid[i]);
+        }
+    }
+    pthread_mutex_unlock(&totals_lock);
+
+    return 0;
+}
+
+int memtrack_aggregate_foreach_cgroup(memtrack_aggregate_cgroup_fn fn,
+                                      void *arg)
+{
+    const struct totals *t;
+    size_t i;
+
+    pthread_mutex_lock(&totals_lock);
+    if (published < 0) {
+        pthread_mutex_unlock(&totals_lock);
+        return -EAGAIN;
+    }
+
+    t = &bufs[published];
+    for (i = 0; i < t->cgroups; i++) {
+        if (t->by_cgroup[i].processes) {
+            fn(arg, cgroup_paths[i], &t->by_cgroup[i]);
+        }
+    }
+    pthread_mutex_unlock(&totals_lock);
+
+    return 0;
+}
+
+void memtrack_aggregate_get_stats(struct memtrack_aggregate_stats *stats)
+{
+    pthread_mutex_lock(&totals_lock);
+    *stats = agg_stats;
+    pthread_mutex_unlock(&totals_lock);
+}
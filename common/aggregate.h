@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_AGGREGATE_H_
+#define _MEMTRACK_AGGREGATE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware/memtrack.h>
+
+#include "snapshot.h"
+
+/*
+ * Per-uid and per-cgroup totals of every memtrack type, accumulated by
+ * the sampler while it sweeps the pids.  The uid and cgroup of a process
+ * are resolved once and carried over from sweep to sweep for as long as
+ * the same process (pid and start time) keeps showing up.
+ */
+
+struct memtrack_aggregate {
+    uint32_t processes;
+    uint64_t bytes[MEMTRACK_NUM_TYPES];
+};
+
+struct memtrack_aggregate_stats {
+    /* Distinct cgroups of the last sweep */
+    size_t cgroups;
+    /* Cgroups dropped because no live process belonged to them any more */
+    uint64_t cgroups_reclaimed;
+    /* Processes left out of the cgroup totals because the table was full */
+    uint64_t cgroups_overflowed;
+};
+
+typedef void (*memtrack_aggregate_uid_fn)(void *arg, uid_t uid,
+                                          const struct memtrack_aggregate *agg);
+typedef void (*memtrack_aggregate_cgroup_fn)(void *arg, const char *cgroup,
+                                             const struct memtrack_aggregate *agg);
+
+int memtrack_aggregate_init(size_t max_pids);
+
+/* Sampler only, pids are added in ascending order within a sweep */
+void memtrack_aggregate_begin(void);
+void memtrack_aggregate_add(pid_t pid, const struct snapshot_entry *entry);
+void memtrack_aggregate_commit(uint64_t timestamp_ns);
+
+/*
+ * Totals of the last completed sweep.  Return 0, -ENOENT for an unknown
+ * uid or cgroup, or -EAGAIN before the first sweep.
+ */
+int memtrack_aggregate_uid(uid_t uid, struct memtrack_aggregate *agg,
+                           uint64_t *timestamp_ns);
+int memtrack_aggregate_cgroup(const char *cgroup,
+                              struct memtrack_aggregate *agg,
+                              uint64_t *timestamp_ns);
+
+/* Calls fn for every uid or cgroup of the last completed sweep */
+int memtrack_aggregate_foreach_uid(memtrack_aggregate_uid_fn fn, void *arg);
+int memtrack_aggregate_foreach_cgroup(memtrack_aggregate_cgroup_fn fn,
+                                      void *arg);
+
+void memtrack_aggregate_get_stats(struct memtrack_aggregate_stats *stats);
+
+#endif
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "async.h"
+#include "config.h"
+#include "memtrack_common.h"
+
+#define ASYNC_MAX_THREADS 8
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+struct async_req {
+    struct async_req *next;
+    struct memtrack_async_completion completion;
+    struct memtrack_record *records;
+    uint64_t deadline_ns;
+};
+
+struct req_queue {
+    struct async_req *head;
+    struct async_req *tail;
+};
+
+struct memtrack_async {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct req_queue pending;
+    struct req_queue completed;
+    uint64_t next_id;
+    bool shutdown;
+    int efd;
+    unsigned int nthreads;
+    pthread_t threads[ASYNC_MAX_THREADS];
+};
+
+static void queue_push(struct req_queue *queue, struct async_req *req)
+{
+    req->next = NULL;
+    if (queue->tail) {
+        queue->tail->next = req;
+    } else {
+        queue->head = req;
+    }
+    queue->tail = req;
+}
+
+static struct async_req *queue_pop(struct req_queue *queue)
+{
+    struct async_req *req = queue->head;
+
+    if (req) {
+        queue->head = req->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+    }
+
+    return req;
+}
+
+static struct async_req *queue_remove(struct req_queue *queue, uint64_t id)
+{
+    struct async_req *prev = NULL;
+    struct async_req *req;
+
+    for (req = queue->head; req; prev = req, req = req->next) {
+        if (req->completion.id != id) {
+            continue;
+        }
+        if (prev) {
+            prev->next = req->next;
+        } else {
+            queue->head = req->next;
+        }
+        if (queue->tail == req) {
+            queue->tail = prev;
+        }
+        return req;
+    }
+
+    return NULL;
+}
+
+/* Called with ctx->lock held */
+static void complete(struct memtrack_async *ctx, struct async_req *req)
+{
+    uint64_t one = 1;
+
+    queue_push(&ctx->completed, req);
+    if (write(ctx->efd, &one, sizeof(one)) < 0) {
+        /* Counter overflow only, the completion is queued regardless */
+    }
+}
+
+/*
+ * Runs the query.  With a deadline, incremental scans stop at it, and an
+ * answer that comes after it is dropped.
+ */
+static void run(struct async_req *req)
+{
+    struct memtrack_async_completion *c = &req->completion;
+    uint64_t now = memtrack_now_ns();
+    bool stale;
+
+    if (req->deadline_ns == 0) {
+        c->ret = memtrack_core_get_memory(c->pid, c->type, req->records,
+                                          &c->num_records);
+        return;
+    }
+
+    c->ret = memtrack_core_get_memory_budget(c->pid, c->type, req->records,
+                                             &c->num_records,
+                                             min((req->deadline_ns - now) /
+                                                 1000, UINT32_MAX),
+                                             &stale);
+    if (memtrack_now_ns() > req->deadline_ns) {
+        c->ret = -ETIMEDOUT;
+        c->num_records = 0;
+    }
+}
+
+static void *async_worker(void *arg)
+{
+    struct memtrack_async *ctx = arg;
+
+    pthread_mutex_lock(&ctx->lock);
+    while (1) {
+        struct async_req *req;
+
+        while (!ctx->shutdown && ctx->pending.head == NULL) {
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        }
+        if (ctx->shutdown) {
+            break;
+        }
+
+        req = queue_pop(&ctx->pending);
+
+        if (req->deadline_ns && memtrack_now_ns() > req->deadline_ns) {
+            req->completion.ret = -ETIMEDOUT;
+            req->completion.num_records = 0;
+            complete(ctx, req);
+            continue;
+        }
+
+        pthread_mutex_unlock(&ctx->lock);
+        run(req);
+        pthread_mutex_lock(&ctx->lock);
+
+        complete(ctx, req);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+struct memtrack_async *memtrack_async_create(unsigned int threads)
+{
+    unsigned int max_threads = memtrack_config_get()->async_max_threads;
+    struct memtrack_async *ctx;
+    unsigned int i;
+
+    if (max_threads > ASYNC_MAX_THREADS) {
+        max_threads = ASYNC_MAX_THREADS;
+    }
+    if (threads == 0) {
+        threads = 1;
+    } else if (threads > max_threads) {
+        threads = max_threads;
+    }
+
+    ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    ctx->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ctx->efd < 0) {
+        free(ctx);
+        return NULL;
+    }
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->cond, NULL);
+    ctx->next_id = 1;
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&ctx->threads[i], NULL, async_worker, ctx)) {
+            break;
+        }
+        pthread_setname_np(ctx->threads[i], "memtrack_async");
+    }
+    ctx->nthreads = i;
+
+    if (ctx->nthreads == 0) {
+        close(ctx->efd);
+        pthread_cond_destroy(&ctx->cond);
+        pthread_mutex_destroy(&ctx->lock);
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+void memtrack_async_destroy(struct memtrack_async *ctx)
+{
+    struct async_req *req;
+    unsigned int i;
+
+    if (ctx == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->shutdown = true;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (i = 0; i < ctx->nthreads; i++) {
+        pthread_join(ctx->threads[i], NULL);
+    }
+
+    while ((req = queue_pop(&ctx->pending)) != NULL) {
+        free(req);
+    }
+    while ((req = queue_pop(&ctx->completed)) != NULL) {
+        free(req);
+    }
+
+    close(ctx->efd);
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+int memtrack_async_fd(struct memtrack_async *ctx)
+{
+    return ctx->efd;
+}
+
+int memtrack_async_submit(struct memtrack_async *ctx, pid_t pid, int type,
+                          struct memtrack_record *records,
+                          size_t num_records, uint32_t deadline_ms,
+                          uint64_t cookie, uint64_t *id)
+{
+    struct async_req *req;
+
+    if (memtrack_core_provider(type) == NULL) {
+        return -EINVAL;
+    }
+
+    req = calloc(1, sizeof(*req));
+    if (req == NULL) {
+        return -ENOMEM;
+    }
+
+    req->records = records;
+    req->completion.cookie = cookie;
+    req->completion.pid = pid;
+    req->completion.type = type;
+    req->completion.num_records = num_records;
+    if (deadline_ms) {
+        req->deadline_ns = memtrack_now_ns() + deadline_ms * 1000000ULL;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->shutdown) {
+        pthread_mutex_unlock(&ctx->lock);
+        free(req);
+        return -ESHUTDOWN;
+    }
+    req->completion.id = ctx->next_id++;
+    *id = req->completion.id;
+    queue_push(&ctx->pending, req);
+    pthread_cond_signal(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return 0;
+}
+
+int memtrack_async_cancel(struct memtrack_async *ctx, uint64_t id)
+{
+    struct async_req *req;
+    int ret = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    req = queue_remove(&ctx->pending, id);
+    if (req) {
+        req->completion.ret = -ECANCELED;
+        req->completion.num_records = 0;
+        complete(ctx, req);
+    } else if (id == 0 || id >= ctx->next_id) {
+        ret = -ENOENT;
+    } else {
+        /* Running, completed or already reaped */
+        ret = -EBUSY;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return ret;
+}
+
+size_t memtrack_async_reap(struct memtrack_async *ctx,
+                           struct memtrack_async_completion *out,
+                           size_t max)
+{
+    struct async_req *req;
+    uint64_t value;
+    size_t count = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    while (count < max && (req = queue_pop(&ctx->completed)) != NULL) {
+        out[count++] = req->completion;
+        free(req);
+    }
+
+    /* Reset the counter, re-arm it when completions were left behind */
+    if (read(ctx->efd, &value, sizeof(value)) == sizeof(value) &&
+        ctx->completed.head != NULL) {
+        value = 1;
+        if (write(ctx->efd, &value, sizeof(value)) < 0) {
+            /* cannot overflow right after the reset */
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return count;
+}
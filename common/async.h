@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_ASYNC_H_
+#define _MEMTRACK_ASYNC_H_
+
+#include <stdint.h>
+
+#include <hardware/memtrack.h>
+
+/*
+ * Submit/complete interface over memtrack_core_get_memory().
+ *
+ * Requests are executed by a small pool of worker threads.  Every
+ * submitted request produces exactly one completion; completions are
+ * queued and signalled on an eventfd the caller can poll or add to its
+ * own epoll set, then collected with memtrack_async_reap().
+ *
+ * The records buffer passed at submit time is owned by the executor until
+ * the completion for that request has been reaped.
+ */
+
+struct memtrack_async;
+
+struct memtrack_async_completion {
+    uint64_t id;
+    uint64_t cookie;
+    pid_t pid;
+    int type;
+    /*
+     * Return value of the query, -ECANCELED if it was cancelled and
+     * -ETIMEDOUT if its deadline passed before it completed.
+     */
+    int ret;
+    size_t num_records;
+};
+
+/* threads is capped by the async_max_threads config key */
+struct memtrack_async *memtrack_async_create(unsigned int threads);
+
+/* Cancels whatever is still queued and waits for the workers to exit */
+void memtrack_async_destroy(struct memtrack_async *ctx);
+
+/* eventfd, readable while completions are waiting to be reaped */
+int memtrack_async_fd(struct memtrack_async *ctx);
+
+/*
+ * Queues a query.  num_records is the capacity of records.  deadline_ms
+ * is relative to now, 0 means none.  A query with a deadline runs as
+ * memtrack_core_get_memory_budget() with the time left, so incremental
+ * scans stop at the deadline; whatever the provider, a query that has
+ * not completed by then reports -ETIMEDOUT and no records.  Returns 0
+ * and the request id in *id, or -errno.
+ */
+int memtrack_async_submit(struct memtrack_async *ctx, pid_t pid, int type,
+                          struct memtrack_record *records,
+                          size_t num_records, uint32_t deadline_ms,
+                          uint64_t cookie, uint64_t *id);
+
+/*
+ * Cancels a queued request, its completion reports -ECANCELED.  Returns
+ * -EBUSY when a worker already runs it and -ENOENT for unknown ids.
+ */
+int memtrack_async_cancel(struct memtrack_async *ctx, uint64_t id);
+
+/* Moves up to max completions to out and returns how many were moved */
+size_t memtrack_async_reap(struct memtrack_async *ctx,
+                           struct memtrack_async_completion *out,
+                           size_t max);
+
+#endif
@@ -0,0 +1,673 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cutils/log.h>
+
+#include "batch_io.h"
+#include "config.h"
+#include "io_account.h"
+#include "perf.h"
+#include "trace.h"
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_LINKED_FILE)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+/* Files in flight per io_uring_enter(), three SQEs each */
+#define BATCH_IO_SLOTS 32
+#define BATCH_IO_RING_ENTRIES 128
+
+/*
+ * A seq_file read returns roughly one page of records at a time, so a
+ * ring read at least this long, or one that filled the buffer, may have
+ * stopped short of EOF and the file is finished synchronously from where
+ * the ring left it.
+ */
+#define SEQ_FILE_SHORT_READ 2048
+
+#define STAGE_OPEN  0
+#define STAGE_READ  1
+#define STAGE_CLOSE 2
+
+static struct {
+    atomic_uint_fast64_t batches;
+    atomic_uint_fast64_t files;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t ring_enters;
+    atomic_uint_fast64_t ring_sqes;
+    atomic_uint_fast64_t sync_syscalls;
+    atomic_uint_fast64_t regrows;
+} stats;
+
+static void stat_add(atomic_uint_fast64_t *counter, uint64_t value)
+{
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static __thread const struct batch_io_prefetch *thread_prefetch;
+
+static void parse_data(struct batch_io_req *req, char *data, size_t len)
+{
+    if (req->parse) {
+        struct memtrack_perf_sample perf;
+
+        MEMTRACK_TRACE_BEGIN("parse", 0, req->path);
+        memtrack_perf_parse_begin(&perf);
+        req->parse(req->arg, data, len);
+        memtrack_perf_parse_end(&perf);
+        MEMTRACK_TRACE_END("parse", len);
+    }
+}
+
+static void parse_and_count(struct batch_io_req *req, char *data, size_t len)
+{
+    data[len] = '\0';
+    stat_add(&stats.bytes, len);
+    parse_data(req, data, len);
+}
+
+/*
+ * Plain open/read/close.  Reads until EOF, moving to a heap buffer when
+ * the content does not fit in the caller's one.  The first have bytes of
+ * req->buf are already read and the file is resumed after them.
+ */
+static void sync_read_from(struct batch_io_req *req, size_t have)
+{
+    char *buf = req->buf;
+    char *heap = NULL;
+    size_t cap = buf ? req->buf_size : 0;
+    size_t len = have;
+    int fd;
+
+    req->error = 0;
+
+    MEMTRACK_TRACE_BEGIN("open", 0, req->path);
+    fd = memtrack_io_open(req->path, O_RDONLY);
+    stat_add(&stats.sync_syscalls, 1);
+    MEMTRACK_TRACE_END("open", 0);
+    if (fd < 0) {
+        req->error = -errno;
+        return;
+    }
+
+    if (have && lseek(fd, have, SEEK_SET) < 0) {
+        /* Not seekable, start over */
+        len = 0;
+    }
+
+    MEMTRACK_TRACE_BEGIN("read", 0, req->path);
+    while (1) {
+        ssize_t ret;
+
+        if (len + 1 >= cap) {
+            size_t new_cap = cap < 4096 ? 4096 : cap * 2;
+            char *tmp = realloc(heap, new_cap);
+
+            if (tmp == NULL) {
+                req->error = -ENOMEM;
+                break;
+            }
+            if (heap == NULL && len) {
+                memcpy(tmp, buf, len);
+            }
+            heap = buf = tmp;
+            cap = new_cap;
+        }
+
+        ret = memtrack_io_read(fd, buf + len, cap - 1 - len);
+        stat_add(&stats.sync_syscalls, 1);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            req->error = -errno;
+            break;
+        }
+        if (ret == 0) {
+            break;
+        }
+        len += ret;
+    }
+    MEMTRACK_TRACE_END("read", len);
+
+    memtrack_io_close(fd);
+    stat_add(&stats.sync_syscalls, 1);
+
+    if (req->error == 0) {
+        parse_and_count(req, buf, len);
+    }
+
+    free(heap);
+}
+
+static void sync_read(struct batch_io_req *req)
+{
+    sync_read_from(req, 0);
+}
+
+#ifdef HAVE_IO_URING
+
+struct ring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+};
+
+static struct ring ring = { .fd = -1 };
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static atomic_bool ring_ok;
+
+static void ring_setup(void)
+{
+    struct io_uring_params p;
+    size_t sq_size, cq_size;
+    void *sq_ptr, *cq_ptr, *sqes;
+    int fds[BATCH_IO_SLOTS];
+    int fd, i;
+
+    if (!memtrack_config_get()->io_uring) {
+        return;
+    }
+
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, BATCH_IO_RING_ENTRIES, &p);
+    if (fd < 0) {
+        ALOGI("io_uring unavailable (%d), using synchronous reads", errno);
+        return;
+    }
+
+    /*
+     * Direct (fixed table) openat/close and links that carry the file to
+     * the next request need 5.17+; IORING_FEAT_LINKED_FILE marks those.
+     */
+    if (!(p.features & IORING_FEAT_LINKED_FILE)) {
+        close(fd);
+        return;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size > sq_size) {
+            sq_size = cq_size;
+        }
+        cq_size = sq_size;
+    }
+
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            munmap(sq_ptr, sq_size);
+            close(fd);
+            return;
+        }
+    }
+
+    sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        goto err_unmap;
+    }
+
+    /* Sparse fixed file table, openat fills a slot and close empties it */
+    for (i = 0; i < BATCH_IO_SLOTS; i++) {
+        fds[i] = -1;
+    }
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES,
+                fds, BATCH_IO_SLOTS) < 0) {
+        munmap(sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+        goto err_unmap;
+    }
+
+    ring.fd = fd;
+    ring.sq_head = (unsigned *)((char *)sq_ptr + p.sq_off.head);
+    ring.sq_tail = (unsigned *)((char *)sq_ptr + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)((char *)sq_ptr + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)((char *)sq_ptr + p.sq_off.array);
+    ring.cq_head = (unsigned *)((char *)cq_ptr + p.cq_off.head);
+    ring.cq_tail = (unsigned *)((char *)cq_ptr + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)((char *)cq_ptr + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)((char *)cq_ptr + p.cq_off.cqes);
+    ring.sqes = sqes;
+    atomic_store(&ring_ok, true);
+    return;
+
+err_unmap:
+    if (cq_ptr != sq_ptr) {
+        munmap(cq_ptr, cq_size);
+    }
+    munmap(sq_ptr, sq_size);
+    close(fd);
+}
+
+static struct io_uring_sqe *ring_get_sqe(unsigned *tail)
+{
+    unsigned index = (*tail)++ & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+
+    ring.sq_array[index] = index;
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+struct ring_slot {
+    int open_res;
+    int read_res;
+};
+
+static unsigned ring_reap(struct ring_slot *slots)
+{
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    unsigned reaped = 0;
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        size_t index = cqe->user_data >> 2;
+
+        switch (cqe->user_data & 3) {
+        case STAGE_OPEN:
+            slots[index].open_res = cqe->res;
+            break;
+        case STAGE_READ:
+            slots[index].read_res = cqe->res;
+            break;
+        }
+        head++;
+        reaped++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+    return reaped;
+}
+
+/*
+ * Submits up to BATCH_IO_SLOTS requests as openat -> read -> close chains
+ * and waits for every completion.  The read is hard linked to the close
+ * so that a short read, which is the normal case for these files, still
+ * releases the fixed file slot.
+ *
+ * Reads target the callers' buffers, so on failure whatever the kernel
+ * already accepted is still reaped before returning.
+ */
+static int ring_run_chunk(struct batch_io_req *reqs, size_t count,
+                          struct ring_slot *slots)
+{
+    unsigned submitted = 0, issued = 0, reaped = 0;
+    unsigned tail = *ring.sq_tail;
+    int error = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe;
+        const char *path;
+        int dirfd;
+
+        slots[i].open_res = -ECANCELED;
+        slots[i].read_res = -ECANCELED;
+        path = memtrack_io_at(reqs[i].path, &dirfd);
+
+        sqe = ring_get_sqe(&tail);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = dirfd;
+        sqe->addr = (uintptr_t)path;
+        /* Direct descriptors never reach the fd table, no O_CLOEXEC */
+        sqe->open_flags = O_RDONLY;
+        sqe->file_index = i + 1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = (i << 2) | STAGE_OPEN;
+
+        sqe = ring_get_sqe(&tail);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = i;
+        sqe->addr = (uintptr_t)reqs[i].buf;
+        sqe->len = reqs[i].buf_size - 1;
+        sqe->off = 0;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        sqe->user_data = (i << 2) | STAGE_READ;
+
+        sqe = ring_get_sqe(&tail);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = i + 1;
+        sqe->user_data = (i << 2) | STAGE_CLOSE;
+
+        submitted += 3;
+    }
+
+    MEMTRACK_TRACE_BEGIN("ring", 0, NULL);
+
+    /* Publish the SQEs only once they are completely filled in */
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+    stat_add(&stats.ring_sqes, submitted);
+
+    while (reaped < issued || (error == 0 && issued < submitted)) {
+        unsigned to_submit = error ? 0 : submitted - issued;
+        int ret;
+
+        if (error) {
+            /* Completions land in the mapped CQ without entering */
+            unsigned got = ring_reap(slots);
+
+            if (got == 0) {
+                usleep(1000);
+            }
+            reaped += got;
+            continue;
+        }
+
+        ret = syscall(__NR_io_uring_enter, ring.fd, to_submit,
+                      issued + to_submit - reaped, IORING_ENTER_GETEVENTS,
+                      NULL, 0);
+        stat_add(&stats.ring_enters, 1);
+        if (ret < 0) {
+            if (errno != EINTR && (errno != EBUSY || reaped == issued)) {
+                error = -errno;
+            }
+        } else if (to_submit) {
+            /* A partial submit returns without waiting, retry the rest */
+            issued += ret;
+            if (ret == 0) {
+                error = -EAGAIN;
+            }
+        }
+
+        reaped += ring_reap(slots);
+    }
+
+    MEMTRACK_TRACE_END("ring", 0);
+
+    return error;
+}
+
+static bool ring_run(struct batch_io_req *reqs, size_t count)
+{
+    struct ring_slot slots[BATCH_IO_SLOTS];
+    size_t done = 0;
+    uint64_t bytes;
+
+    pthread_once(&ring_once, ring_setup);
+    if (!atomic_load(&ring_ok)) {
+        return false;
+    }
+
+    /* Concurrent callers do not queue behind each other */
+    if (pthread_mutex_trylock(&ring_lock) != 0) {
+        return false;
+    }
+
+    while (done < count) {
+        size_t chunk = count - done;
+        size_t i;
+
+        if (chunk > BATCH_IO_SLOTS) {
+            chunk = BATCH_IO_SLOTS;
+        }
+
+        if (ring_run_chunk(reqs + done, chunk, slots) < 0) {
+            /* Completions may still be pending, never reuse this ring */
+            atomic_store(&ring_ok, false);
+            break;
+        }
+
+        bytes = 0;
+        for (i = 0; i < chunk; i++) {
+            if (slots[i].read_res > 0) {
+                bytes += slots[i].read_res;
+            }
+        }
+        memtrack_io_count_ring(chunk, bytes);
+
+        for (i = 0; i < chunk; i++) {
+            struct batch_io_req *req = &reqs[done + i];
+
+            if (slots[i].open_res == -EINVAL) {
+                /* Kernel refused direct open after all, stop using it */
+                atomic_store(&ring_ok, false);
+                sync_read(req);
+            } else if (slots[i].open_res < 0) {
+                req->error = slots[i].open_res;
+            } else if (slots[i].read_res < 0) {
+                req->error = slots[i].read_res;
+            } else if ((size_t)slots[i].read_res >= SEQ_FILE_SHORT_READ ||
+                       (size_t)slots[i].read_res == req->buf_size - 1) {
+                stat_add(&stats.regrows, 1);
+                sync_read_from(req, slots[i].read_res);
+            } else {
+                req->error = 0;
+                parse_and_count(req, req->buf, slots[i].read_res);
+            }
+        }
+
+        done += chunk;
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    /* A ring failure leaves the rest to the synchronous path */
+    while (done < count) {
+        sync_read(&reqs[done++]);
+    }
+
+    return true;
+}
+
+int batch_io_uring_available(void)
+{
+    pthread_once(&ring_once, ring_setup);
+    return atomic_load(&ring_ok);
+}
+
+#else
+
+static bool ring_run(struct batch_io_req *reqs, size_t count)
+{
+    return false;
+}
+
+int batch_io_uring_available(void)
+{
+    return 0;
+}
+
+#endif
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void scratch_key_create(void)
+{
+    pthread_key_create(&scratch_key, free);
+}
+
+char *batch_io_scratch(void)
+{
+    char *buf;
+
+    pthread_once(&scratch_once, scratch_key_create);
+    buf = pthread_getspecific(scratch_key);
+    if (buf == NULL) {
+        buf = malloc(BATCH_IO_SCRATCH_SIZE);
+        if (buf != NULL) {
+            pthread_setspecific(scratch_key, buf);
+        }
+    }
+
+    return buf;
+}
+
+static void read_batch(struct batch_io_req *reqs, size_t count)
+{
+    size_t i;
+    bool ring_usable = true;
+
+    /* The ring needs a caller buffer to read into */
+    for (i = 0; i < count; i++) {
+        if (reqs[i].buf == NULL || reqs[i].buf_size < 2) {
+            ring_usable = false;
+            break;
+        }
+    }
+
+    if (!ring_usable || !ring_run(reqs, count)) {
+        for (i = 0; i < count; i++) {
+            sync_read(&reqs[i]);
+        }
+    }
+}
+
+void batch_io_set_prefetch(const struct batch_io_prefetch *prefetch)
+{
+    thread_prefetch = prefetch;
+}
+
+static const struct batch_io_prefetched *
+find_prefetched(const struct batch_io_prefetch *prefetch, const char *path)
+{
+    size_t i;
+
+    for (i = 0; i < prefetch->count; i++) {
+        if (strcmp(prefetch->files[i].path, path) == 0) {
+            return &prefetch->files[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Parses what was prefetched and reads the rest as one batch */
+static bool prefetch_run(const struct batch_io_prefetch *prefetch,
+                         struct batch_io_req *reqs, size_t count)
+{
+    struct batch_io_req misses[BATCH_IO_SLOTS];
+    size_t index[BATCH_IO_SLOTS];
+    size_t i, nmisses = 0;
+    uint64_t bytes = 0;
+
+    if (count > BATCH_IO_SLOTS) {
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        const struct batch_io_prefetched *file;
+
+        file = find_prefetched(prefetch, reqs[i].path);
+        if (prefetch->observe) {
+            prefetch->observe(prefetch->arg, reqs[i].path, file != NULL);
+        }
+        if (file) {
+            reqs[i].error = 0;
+            bytes += file->len;
+            parse_data(&reqs[i], file->data, file->len);
+        } else {
+            index[nmisses] = i;
+            misses[nmisses++] = reqs[i];
+        }
+    }
+
+    /* Charged as if read here, the cost of the pid stays comparable */
+    memtrack_io_count_ring(count - nmisses, bytes);
+
+    if (nmisses) {
+        read_batch(misses, nmisses);
+        for (i = 0; i < nmisses; i++) {
+            reqs[index[i]].error = misses[i].error;
+        }
+    }
+
+    return true;
+}
+
+int batch_io_run(struct batch_io_req *reqs, size_t count)
+{
+    const struct batch_io_prefetch *prefetch = thread_prefetch;
+    size_t i;
+    int failed = 0;
+
+    stat_add(&stats.batches, 1);
+    stat_add(&stats.files, count);
+
+    if (prefetch == NULL || !prefetch_run(prefetch, reqs, count)) {
+        read_batch(reqs, count);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (reqs[i].error) {
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+int batch_io_read_file(const char *path, char *buf, size_t buf_size,
+                       batch_io_parse_fn parse, void *arg)
+{
+    struct batch_io_req req = {
+        .path = path,
+        .buf = buf,
+        .buf_size = buf_size,
+        .parse = parse,
+        .arg = arg,
+    };
+
+    batch_io_run(&req, 1);
+
+    return req.error;
+}
+
+void batch_io_get_stats(struct batch_io_stats *out)
+{
+    out->batches = atomic_load(&stats.batches);
+    out->files = atomic_load(&stats.files);
+    out->bytes = atomic_load(&stats.bytes);
+    out->ring_enters = atomic_load(&stats.ring_enters);
+    out->ring_sqes = atomic_load(&stats.ring_sqes);
+    out->sync_syscalls = atomic_load(&stats.sync_syscalls);
+    out->regrows = atomic_load(&stats.regrows);
+}
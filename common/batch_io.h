@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_BATCH_IO_H_
+#define _MEMTRACK_BATCH_IO_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Batched reader for the small procfs/sysfs/debugfs files the backends
+ * parse.  Backends describe the files they need as an array of requests and
+ * get the whole content of each one back in a parse callback; they never
+ * open or read files themselves.
+ *
+ * When io_uring is usable each file costs one linked openat/read/close
+ * chain and a whole batch is submitted with a single io_uring_enter().
+ * Otherwise (old kernel, seccomp, SELinux, ring busy on another thread)
+ * the same requests are served with plain open/read/close.
+ */
+
+typedef void (*batch_io_parse_fn)(void *arg, const char *data, size_t len);
+
+struct batch_io_req {
+    const char *path;
+    /* Caller scratch buffer, one byte is kept for the terminating NUL */
+    char *buf;
+    size_t buf_size;
+    /* Called with the NUL terminated content when the read succeeded */
+    batch_io_parse_fn parse;
+    void *arg;
+    /* 0 or -errno of the failing open/read, set by batch_io_run() */
+    int error;
+};
+
+struct batch_io_stats {
+    uint64_t batches;
+    uint64_t files;
+    uint64_t bytes;
+    /* io_uring_enter() calls and the SQEs they carried */
+    uint64_t ring_enters;
+    uint64_t ring_sqes;
+    /* open/read/close issued by the synchronous path */
+    uint64_t sync_syscalls;
+    /* files finished synchronously after a possibly short ring read */
+    uint64_t regrows;
+};
+
+/*
+ * Reads every file in reqs and calls its parse callback.  Returns the
+ * number of requests that failed; the individual errors are in req->error.
+ */
+int batch_io_run(struct batch_io_req *reqs, size_t count);
+
+/* Reads a single file, returns 0 or the -errno of the failing syscall. */
+int batch_io_read_file(const char *path, char *buf, size_t buf_size,
+                       batch_io_parse_fn parse, void *arg);
+
+/* Returns true once the io_uring engine has been set up successfully. */
+int batch_io_uring_available(void);
+
+void batch_io_get_stats(struct batch_io_stats *stats);
+
+/* Content of a file read ahead of time, NUL terminated at data[len] */
+struct batch_io_prefetched {
+    const char *path;
+    char *data;
+    size_t len;
+};
+
+struct batch_io_prefetch {
+    const struct batch_io_prefetched *files;
+    size_t count;
+    /* Called with every path requested, and whether files had it */
+    void (*observe)(void *arg, const char *path, bool hit);
+    void *arg;
+};
+
+/*
+ * Serves the requests of the calling thread for the files in prefetch
+ * from memory, without any syscall, until it is replaced; NULL stops.
+ * prefetch must stay valid meanwhile.
+ */
+void batch_io_set_prefetch(const struct batch_io_prefetch *prefetch);
+
+/*
+ * Per-thread buffer for large files such as smaps, allocated on first use
+ * and released when the thread exits.  Returns NULL on allocation failure,
+ * which batch_io_run() handles by reading into a heap buffer.
+ */
+#define BATCH_IO_SCRATCH_SIZE (256 * 1024)
+char *batch_io_scratch(void);
+
+/*
+ * fgets() over an in-memory buffer, so parsers keep the exact line
+ * splitting they had when they read through stdio.  Returns NULL at the
+ * end of the data.
+ */
+static inline char *batch_io_getline(char *line, size_t size,
+                                     const char **pos, const char *end)
+{
+    const char *p = *pos;
+    size_t n = 0;
+
+    if (size == 0 || p >= end) {
+        return NULL;
+    }
+
+    while (p < end && n < size - 1) {
+        char c = *p++;
+        line[n++] = c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    line[n] = '\0';
+    *pos = p;
+
+    return line;
+}
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "memtrack_common.h"
+
+/* Slots examined by a lookup or an insert, starting at the hash */
+#define CACHE_PROBE_WINDOW 8
+#define CACHE_MIN_SLOTS CACHE_PROBE_WINDOW
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+/*
+ * Structure of arrays: a lookup touches the version and key arrays of its
+ * window and only reads the payload arrays of the slot that matched.
+ */
+struct cache_table {
+    size_t mask;
+    atomic_uint *seq;
+    /* pid << 8 | type, 0 marks a free slot */
+    uint64_t *keys;
+    uint64_t *start_times;
+    uint64_t *sizes;
+    uint32_t *flags;
+    int32_t *rets;
+    uint8_t *num_records;
+    /* Insertion time in ns, for the TTL */
+    uint64_t *stamps;
+    /* Last hit in ms, approximate LRU ordering inside a window */
+    atomic_uint *access;
+};
+
+static struct cache_table table;
+static atomic_bool enabled;
+/* Changed by a config reload while lookups run */
+static atomic_uint ttl_ms[MEMTRACK_NUM_TYPES];
+
+static struct {
+    atomic_uint_fast64_t hits;
+    atomic_uint_fast64_t misses;
+    atomic_uint_fast64_t expired;
+    atomic_uint_fast64_t inserts;
+    atomic_uint_fast64_t evictions;
+    atomic_uint_fast64_t insert_races;
+    atomic_size_t used;
+} stats;
+
+static const size_t slot_bytes = sizeof(atomic_uint) + sizeof(uint64_t) * 4 +
+                                 sizeof(uint32_t) + sizeof(int32_t) +
+                                 sizeof(uint8_t) + sizeof(atomic_uint);
+
+static void stat_inc(atomic_uint_fast64_t *counter)
+{
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static uint64_t make_key(pid_t pid, int type)
+{
+    return ((uint64_t)(uint32_t)pid << 8) | (uint64_t)type;
+}
+
+static size_t hash_key(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return (size_t)key;
+}
+
+static uint32_t now_ms(uint64_t now_ns)
+{
+    return (uint32_t)(now_ns / 1000000ULL);
+}
+
+int memtrack_cache_init(size_t max_bytes,
+                        const uint32_t type_ttl_ms[MEMTRACK_NUM_TYPES])
+{
+    size_t slots = CACHE_MIN_SLOTS;
+
+    if (atomic_load(&enabled)) {
+        return 0;
+    }
+
+    if (max_bytes < CACHE_MIN_SLOTS * slot_bytes) {
+        return -EINVAL;
+    }
+
+    /* Largest power of two that stays under the ceiling */
+    while (slots * 2 * slot_bytes <= max_bytes) {
+        slots *= 2;
+    }
+
+    table.seq = calloc(slots, sizeof(*table.seq));
+    table.keys = calloc(slots, sizeof(*table.keys));
+    table.start_times = calloc(slots, sizeof(*table.start_times));
+    table.sizes = calloc(slots, sizeof(*table.sizes));
+    table.flags = calloc(slots, sizeof(*table.flags));
+    table.rets = calloc(slots, sizeof(*table.rets));
+    table.num_records = calloc(slots, sizeof(*table.num_records));
+    table.stamps = calloc(slots, sizeof(*table.stamps));
+    table.access = calloc(slots, sizeof(*table.access));
+    if (!table.seq || !table.keys || !table.start_times || !table.sizes ||
+        !table.flags || !table.rets || !table.num_records ||
+        !table.stamps || !table.access) {
+        free(table.seq);
+        free(table.keys);
+        free(table.start_times);
+        free(table.sizes);
+        free(table.flags);
+        free(table.rets);
+        free(table.num_records);
+        free(table.stamps);
+        free(table.access);
+        memset(&table, 0, sizeof(table));
+        return -ENOMEM;
+    }
+
+    table.mask = slots - 1;
+    memtrack_cache_set_ttl(type_ttl_ms);
+    atomic_store_explicit(&enabled, true, memory_order_release);
+
+    return 0;
+}
+
+void memtrack_cache_set_ttl(const uint32_t type_ttl_ms[MEMTRACK_NUM_TYPES])
+{
+    int type;
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        atomic_store_explicit(&ttl_ms[type], type_ttl_ms[type],
+                              memory_order_relaxed);
+    }
+}
+
+bool memtrack_cache_enabled(int type)
+{
+    return atomic_load_explicit(&enabled, memory_order_acquire) &&
+           type >= 0 && type < MEMTRACK_NUM_TYPES &&
+           atomic_load_explicit(&ttl_ms[type], memory_order_relaxed);
+}
+
+bool memtrack_cache_lookup(pid_t pid, uint64_t start_time, int type,
+                           uint32_t max_age_ms,
+                           struct memtrack_record *records,
+                           size_t *num_records, int *ret)
+{
+    uint64_t key = make_key(pid, type);
+    size_t base = hash_key(key);
+    uint64_t now = memtrack_now_ns();
+    uint64_t limit_ns;
+    size_t i;
+
+    if (!memtrack_cache_enabled(type)) {
+        return false;
+    }
+
+    limit_ns = (uint64_t)min(atomic_load_explicit(&ttl_ms[type],
+                                                  memory_order_relaxed),
+                             max_age_ms) * 1000000ULL;
+
+    for (i = 0; i < CACHE_PROBE_WINDOW; i++) {
+        size_t slot = (base + i) & table.mask;
+        unsigned int seq;
+        uint64_t slot_start, size, stamp;
+        uint32_t flags;
+        int32_t slot_ret;
+        uint8_t count;
+
+        seq = atomic_load_explicit(&table.seq[slot], memory_order_acquire);
+        if ((seq & 1) || table.keys[slot] != key) {
+            continue;
+        }
+
+        slot_start = table.start_times[slot];
+        size = table.sizes[slot];
+        flags = table.flags[slot];
+        slot_ret = table.rets[slot];
+        count = table.num_records[slot];
+        stamp = table.stamps[slot];
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&table.seq[slot],
+                                 memory_order_relaxed) != seq ||
+            table.keys[slot] != key) {
+            continue;
+        }
+
+        /* Same pid, earlier process: the insert will overwrite it */
+        if (slot_start != start_time) {
+            continue;
+        }
+
+        /* An insert racing this lookup can stamp after now */
+        if (stamp < now && now - stamp > limit_ns) {
+            stat_inc(&stats.expired);
+            break;
+        }
+
+        atomic_store_explicit(&table.access[slot], now_ms(now),
+                              memory_order_relaxed);
+        stat_inc(&stats.hits);
+
+        if (*num_records && count) {
+            records[0].size_in_bytes = size;
+            records[0].flags = flags;
+        }
+        *num_records = count;
+        *ret = slot_ret;
+        return true;
+    }
+
+    stat_inc(&stats.misses);
+    return false;
+}
+
+void memtrack_cache_insert(pid_t pid, uint64_t start_time, int type,
+                           const struct memtrack_record *records,
+                           size_t num_records, int ret)
+{
+    uint64_t key = make_key(pid, type);
+    size_t base = hash_key(key);
+    uint64_t now = memtrack_now_ns();
+    size_t victim = SIZE_MAX, lru = SIZE_MAX;
+    uint32_t lru_age = 0;
+    unsigned int seq;
+    bool was_free;
+    size_t i;
+
+    /* Only single record results fit in a slot */
+    if (!memtrack_cache_enabled(type) || num_records > 1) {
+        return;
+    }
+
+    for (i = 0; i < CACHE_PROBE_WINDOW; i++) {
+        size_t slot = (base + i) & table.mask;
+        uint32_t age;
+
+        if (atomic_load_explicit(&table.seq[slot],
+                                 memory_order_relaxed) & 1) {
+            continue;
+        }
+
+        if (table.keys[slot] == key) {
+            victim = slot;
+            break;
+        }
+
+        if (table.keys[slot] == 0) {
+            if (victim == SIZE_MAX) {
+                victim = slot;
+            }
+            continue;
+        }
+
+        age = now_ms(now) - atomic_load_explicit(&table.access[slot],
+                                                 memory_order_relaxed);
+        if (lru == SIZE_MAX || age > lru_age) {
+            lru = slot;
+            lru_age = age;
+        }
+    }
+
+    if (victim == SIZE_MAX) {
+        victim = lru;
+    }
+    if (victim == SIZE_MAX) {
+        stat_inc(&stats.insert_races);
+        return;
+    }
+
+    seq = atomic_load_explicit(&table.seq[victim], memory_order_relaxed);
+    if ((seq & 1) ||
+        !atomic_compare_exchange_strong_explicit(&table.seq[victim], &seq,
+                                                 seq + 1,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed)) {
+        stat_inc(&stats.insert_races);
+        return;
+    }
+    atomic_thread_fence(memory_order_release);
+
+    was_free = table.keys[victim] == 0;
+    if (!was_free && table.keys[victim] != key) {
+        stat_inc(&stats.evictions);
+    }
+
+    table.keys[victim] = key;
+    table.start_times[victim] = start_time;
+    table.sizes[victim] = num_records ? records[0].size_in_bytes : 0;
+    table.flags[victim] = num_records ? records[0].flags : 0;
+    table.rets[victim] = ret;
+    table.num_records[victim] = num_records;
+    table.stamps[victim] = now;
+    atomic_store_explicit(&table.access[victim], now_ms(now),
+                          memory_order_relaxed);
+
+    atomic_store_explicit(&table.seq[victim], seq + 2, memory_order_release);
+
+    stat_inc(&stats.inserts);
+    if (was_free) {
+        atomic_fetch_add_explicit(&stats.used, 1, memory_order_relaxed);
+    }
+}
+
+void memtrack_cache_evict_pid(pid_t pid)
+{
+    int type;
+
+    if (!atomic_load_explicit(&enabled, memory_order_acquire)) {
+        return;
+    }
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        uint64_t key = make_key(pid, type);
+        size_t base = hash_key(key);
+        size_t i;
+
+        for (i = 0; i < CACHE_PROBE_WINDOW; i++) {
+            size_t slot = (base + i) & table.mask;
+            unsigned int seq;
+
+            seq = atomic_load_explicit(&table.seq[slot], memory_order_relaxed);
+            if ((seq & 1) || table.keys[slot] != key) {
+                continue;
+            }
+
+            if (!atomic_compare_exchange_strong_explicit(&table.seq[slot],
+                        &seq, seq + 1, memory_order_acquire,
+                        memory_order_relaxed)) {
+                continue;
+            }
+            atomic_thread_fence(memory_order_release);
+
+            if (table.keys[slot] == key) {
+                table.keys[slot] = 0;
+                atomic_fetch_sub_explicit(&stats.used, 1,
+                                          memory_order_relaxed);
+            }
+            atomic_store_explicit(&table.seq[slot], seq + 2,
+                                  memory_order_release);
+        }
+    }
+}
+
+void memtrack_cache_get_stats(struct memtrack_cache_stats *out)
+{
+    bool on = atomic_load(&enabled);
+
+    out->hits = atomic_load(&stats.hits);
+    out->misses = atomic_load(&stats.misses);
+    out->expired = atomic_load(&stats.expired);
+    out->inserts = atomic_load(&stats.inserts);
+    out->evictions = atomic_load(&stats.evictions);
+    out->insert_races = atomic_load(&stats.insert_races);
+    out->capacity = on ? table.mask + 1 : 0;
+    out->used = atomic_load(&stats.used);
+    out->footprint_bytes = out->capacity * slot_bytes;
+}
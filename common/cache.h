@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_CACHE_H_
+#define _MEMTRACK_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hardware/memtrack.h>
+
+/*
+ * Process-wide result cache keyed by (pid, process start time, type).
+ *
+ * Open addressing over a power-of-two table kept as separate dense arrays
+ * (keys, start times, sizes, timestamps, ...).  Each slot has a version
+ * word: writers claim a slot by moving it to an odd value with a CAS and
+ * publish by making it even again, readers validate the version around
+ * their copy.  Probing is limited to a small window, and an insert into a
+ * full window evicts the least recently used slot of that window.
+ */
+
+struct memtrack_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t expired;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t insert_races;
+    size_t capacity;
+    size_t used;
+    size_t footprint_bytes;
+};
+
+/*
+ * Sizes the table to fit max_bytes.  ttl_ms[type] == 0 disables caching
+ * of that type.
+ */
+int memtrack_cache_init(size_t max_bytes,
+                        const uint32_t ttl_ms[MEMTRACK_NUM_TYPES]);
+bool memtrack_cache_enabled(int type);
+
+/* New TTLs for a running cache, entries are kept and judged by them */
+void memtrack_cache_set_ttl(const uint32_t ttl_ms[MEMTRACK_NUM_TYPES]);
+
+/*
+ * Returns true and fills records/num_records/ret when a cached result
+ * younger than min(ttl, max_age_ms) exists.
+ */
+bool memtrack_cache_lookup(pid_t pid, uint64_t start_time, int type,
+                           uint32_t max_age_ms,
+                           struct memtrack_record *records,
+                           size_t *num_records, int *ret);
+
+void memtrack_cache_insert(pid_t pid, uint64_t start_time, int type,
+                           const struct memtrack_record *records,
+                           size_t num_records, int ret);
+
+/* Drops every entry of pid, whatever its start time */
+void memtrack_cache_evict_pid(pid_t pid);
+
+void memtrack_cache_get_stats(struct memtrack_cache_stats *stats);
+
+#endif
@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <cutils/log.h>
+
+#include "config.h"
+#include "memtrack_common.h"
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+#define CONFIG_DEFAULT_PATH "/vendor/etc/memtrack.conf"
+#define CONFIG_PROPERTY_PREFIX "ro.vendor.memtrack."
+
+enum config_kind {
+    CONFIG_INT,
+    CONFIG_BOOL,
+    CONFIG_STRING,
+    CONFIG_PRECISION,
+};
+
+/* A configuration being built, with the values resolved at the end */
+struct config_load {
+    struct memtrack_config cfg;
+    int32_t cache_ttl_ms;
+    /* -1 uses cache_ttl_ms */
+    int32_t type_cache_ttl_ms[MEMTRACK_NUM_TYPES];
+};
+
+struct config_key {
+    const char *name;
+    enum config_kind kind;
+    /* Takes a ".<type>" suffix, the field is an array per type */
+    bool per_type;
+    size_t offset;
+    int32_t min;
+    int32_t max;
+    int32_t def;
+    const char *def_str;
+};
+
+#define INT_KEY(name, field, def, min, max) \
+    { name, CONFIG_INT, false, offsetof(struct config_load, field), \
+      min, max, def, NULL }
+#define BOOL_KEY(name, field, def) \
+    { name, CONFIG_BOOL, false, offsetof(struct config_load, field), \
+      0, 1, def, NULL }
+#define STRING_KEY(name, field, def) \
+    { name, CONFIG_STRING, false, offsetof(struct config_load, field), \
+      0, 0, 0, def }
+
+static const struct config_key keys[] = {
+    { "provider", CONFIG_BOOL, true,
+      offsetof(struct config_load, cfg.provider_enabled), 0, 1, 1, NULL },
+    { "precision", CONFIG_PRECISION, true,
+      offsetof(struct config_load, cfg.precision), 0, 0,
+      MEMTRACK_PRECISION_DEFAULT, NULL },
+    INT_KEY("cache_bytes", cfg.cache_bytes, 0, 0, INT32_MAX),
+    INT_KEY("cache_ttl_ms", cache_ttl_ms, 1000, 0, INT32_MAX),
+    { "cache_ttl_ms", CONFIG_INT, true,
+      offsetof(struct config_load, type_cache_ttl_ms), -1, INT32_MAX, -1,
+      NULL },
+    INT_KEY("coalesce_wait_ms", cfg.coalesce_wait_ms, 100, 0, INT32_MAX),
+    INT_KEY("max_staleness_ms", cfg.max_staleness_ms, -1, -1, INT32_MAX),
+    INT_KEY("zram_ratio_ttl_ms", cfg.zram_ratio_ttl_ms, 1000, 0, INT32_MAX),
+    { "read_timeout_ms", CONFIG_INT, true,
+      offsetof(struct config_load, cfg.read_timeout_ms), -1, INT32_MAX, -1,
+      NULL },
+    INT_KEY("read_backoff_max_ms", cfg.read_backoff_max_ms, 60000, 1,
+            INT32_MAX),
+    INT_KEY("sampler_interval_ms", cfg.sampler_interval_ms, 0, 0, INT32_MAX),
+    INT_KEY("sampler_idle_interval_ms", cfg.sampler_idle_interval_ms, -1,
+            -1, INT32_MAX),
+    INT_KEY("sampler_max_pids", cfg.sampler_max_pids, 2048, 1, 1 << 22),
+    INT_KEY("sampler_pipeline_depth", cfg.sampler_pipeline_depth, 0, 0, 64),
+    INT_KEY("io_budget_bytes", cfg.io_budget_bytes, 0, 0, INT32_MAX),
+    INT_KEY("adaptive_max_interval_ms", cfg.adaptive_max_interval_ms, 60000,
+            1, INT32_MAX),
+    INT_KEY("adaptive_error_bytes", cfg.adaptive_error_bytes, 1024 * 1024,
+            0, INT32_MAX),
+    INT_KEY("history_bytes", cfg.history_bytes, 0, 0, INT32_MAX),
+    BOOL_KEY("aggregate", cfg.aggregate, 0),
+    STRING_KEY("shared_snapshot", cfg.shared_snapshot, ""),
+    STRING_KEY("psi_trigger", cfg.psi_trigger, ""),
+    STRING_KEY("psi_path", cfg.psi_path, "/proc/pressure/memory"),
+    BOOL_KEY("proc_events", cfg.proc_events, 1),
+    INT_KEY("prewarm_delay_ms", cfg.prewarm_delay_ms, 0, 0, INT32_MAX),
+    BOOL_KEY("io_uring", cfg.io_uring, 1),
+    INT_KEY("async_max_threads", cfg.async_max_threads, 8, 1, 8),
+    STRING_KEY("io_budget_file", cfg.io_budget_file, ""),
+    BOOL_KEY("perf_counters", cfg.perf_counters, 0),
+    STRING_KEY("trace_file", cfg.trace_file, ""),
+    INT_KEY("log_interval_ms", cfg.log_interval_ms, 60000, 0, INT32_MAX),
+    INT_KEY("dump_pid", cfg.dump_pid, 0, -1, INT32_MAX),
+};
+
+/* The first load cannot fail for lack of memory */
+static struct config_load initial;
+static _Atomic(const struct memtrack_config *) current;
+static pthread_once_t load_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Set by memtrack_config_set_path(), wins over the property */
+static char path_override[PATH_MAX];
+
+static void *field_of(struct config_load *load, const struct config_key *key,
+                      int type)
+{
+    char *field = (char *)load + key->offset;
+
+    if (!key->per_type) {
+        return field;
+    }
+
+    return field + type * (key->kind == CONFIG_BOOL ? sizeof(bool) :
+                                                      sizeof(int32_t));
+}
+
+static int parse_bool(const char *value, int32_t *out)
+{
+    static const char *const truths[] = { "1", "y", "yes", "on", "true" };
+    static const char *const lies[] = { "0", "n", "no", "off", "false" };
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(truths); i++) {
+        if (strcasecmp(value, truths[i]) == 0) {
+            *out = 1;
+            return 0;
+        }
+        if (strcasecmp(value, lies[i]) == 0) {
+            *out = 0;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+static int parse_int(const char *value, const struct config_key *key,
+                     int32_t *out)
+{
+    char *end;
+    long long v;
+
+    errno = 0;
+    v = strtoll(value, &end, 0);
+    if (errno || end == value || *end != '\0' ||
+        v < key->min || v > key->max) {
+        return -EINVAL;
+    }
+
+    *out = (int32_t)v;
+
+    return 0;
+}
+
+static int set_value(struct config_load *load, const struct config_key *key,
+                     int type, const char *value)
+{
+    void *field = field_of(load, key, type);
+    int32_t v;
+
+    switch (key->kind) {
+    case CONFIG_INT:
+        if (parse_int(value, key, &v) < 0) {
+            return -EINVAL;
+        }
+        *(int32_t *)field = v;
+        return 0;
+    case CONFIG_BOOL:
+        if (parse_bool(value, &v) < 0) {
+            return -EINVAL;
+        }
+        *(bool *)field = v;
+        return 0;
+    case CONFIG_STRING:
+        if (strlen(value) >= PROPERTY_VALUE_MAX) {
+            return -EINVAL;
+        }
+        strcpy(field, value);
+        return 0;
+    case CONFIG_PRECISION:
+        if (strcmp(value, "exact") == 0) {
+            v = MEMTRACK_PRECISION_EXACT;
+        } else if (strcmp(value, "approximate") == 0) {
+            v = MEMTRACK_PRECISION_APPROXIMATE;
+        } else if (strcmp(value, "default") == 0) {
+            v = MEMTRACK_PRECISION_DEFAULT;
+        } else {
+            return -EINVAL;
+        }
+        *(int32_t *)field = v;
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+static void set_default(struct config_load *load, const struct config_key *key,
+                        int type)
+{
+    void *field = field_of(load, key, type);
+
+    switch (key->kind) {
+    case CONFIG_BOOL:
+        *(bool *)field = key->def;
+        break;
+    case CONFIG_STRING:
+        strcpy(field, key->def_str);
+        break;
+    default:
+        *(int32_t *)field = key->def;
+        break;
+    }
+}
+
+/* Splits "<key>[.<type>]", type is -1 for a key without suffix */
+static const struct config_key *find_key(const char *name, int *type)
+{
+    const char *dot = strrchr(name, '.');
+    size_t i;
+    int t;
+
+    for (i = 0; i < ARRAY_SIZE(keys); i++) {
+        if (!keys[i].per_type && strcmp(keys[i].name, name) == 0) {
+            *type = -1;
+            return &keys[i];
+        }
+    }
+
+    if (dot == NULL) {
+        return NULL;
+    }
+
+    for (t = 0; t < MEMTRACK_NUM_TYPES; t++) {
+        if (strcmp(dot + 1, memtrack_type_name(t)) == 0) {
+            break;
+        }
+    }
+    if (t == MEMTRACK_NUM_TYPES) {
+        return NULL;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(keys); i++) {
+        if (keys[i].per_type && strlen(keys[i].name) == (size_t)(dot - name) &&
+            strncmp(keys[i].name, name, dot - name) == 0) {
+            *type = t;
+            return &keys[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void load_properties(struct config_load *load)
+{
+    /* Longer than PROPERTY_KEY_MAX, which only bounds legacy names */
+    char name[128];
+    char value[PROPERTY_VALUE_MAX];
+    size_t i;
+    int type;
+
+    for (i = 0; i < ARRAY_SIZE(keys); i++) {
+        for (type = 0; type < (keys[i].per_type ? MEMTRACK_NUM_TYPES : 1);
+             type++) {
+            set_default(load, &keys[i], type);
+
+            if (keys[i].per_type) {
+                snprintf(name, sizeof(name), CONFIG_PROPERTY_PREFIX "%s.%s",
+                         keys[i].name, memtrack_type_name(type));
+            } else {
+                snprintf(name, sizeof(name), CONFIG_PROPERTY_PREFIX "%s",
+                         keys[i].name);
+            }
+            if (property_get(name, value, "") > 0 &&
+                set_value(load, &keys[i], type, value) < 0) {
+                ALOGW("ignoring invalid %s: %s", name, value);
+            }
+        }
+    }
+}
+
+static char *trim(char *s)
+{
+    char *end;
+
+    s += strspn(s, " \t");
+    end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t')) {
+        *--end = '\0';
+    }
+
+    return s;
+}
+
+/* Returns 0, 1 without a file, -errno for a file that has to be rejected */
+static int load_file(struct config_load *load, const char *path)
+{
+    char line[512];
+    unsigned int lineno = 0;
+    int ret = 0;
+    FILE *fp;
+
+    fp = fopen(path, "re");
+    if (fp == NULL) {
+        return errno == ENOENT ? 1 : -errno;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        const struct config_key *key;
+        char *name, *value;
+        int type;
+
+        lineno++;
+        line[strcspn(line, "#\n")] = '\0';
+        name = trim(line);
+        if (name[0] == '\0') {
+            continue;
+        }
+
+        value = strchr(name, '=');
+        if (value == NULL) {
+            ALOGE("%s:%u: expected <key> = <value>", path, lineno);
+            ret = -EINVAL;
+            continue;
+        }
+        *value++ = '\0';
+        name = trim(name);
+        value = trim(value);
+
+        key = find_key(name, &type);
+        if (key == NULL) {
+            ALOGE("%s:%u: unknown key %s", path, lineno, name);
+            ret = -EINVAL;
+        } else if (set_value(load, key, type < 0 ? 0 : type, value) < 0) {
+            ALOGE("%s:%u: invalid value for %s: %s", path, lineno, name, value);
+            ret = -EINVAL;
+        }
+    }
+    fclose(fp);
+
+    return ret;
+}
+
+static void resolve(struct config_load *load)
+{
+    struct memtrack_config *cfg = &load->cfg;
+    int type;
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        cfg->cache_ttl_ms[type] = load->type_cache_ttl_ms[type] >= 0 ?
+                                  load->type_cache_ttl_ms[type] :
+                                  load->cache_ttl_ms;
+    }
+
+    if (cfg->sampler_idle_interval_ms < 0) {
+        cfg->sampler_idle_interval_ms = cfg->sampler_interval_ms;
+    }
+}
+
+static int load_locked(void)
+{
+    const struct memtrack_config *old = atomic_load(&current);
+    char path[PATH_MAX];
+    struct config_load *load;
+    int ret;
+
+    load = old ? calloc(1, sizeof(*load)) : &initial;
+    if (load == NULL) {
+        return -ENOMEM;
+    }
+
+    load_properties(load);
+    if (path_override[0]) {
+        snprintf(path, sizeof(path), "%s", path_override);
+    } else {
+        property_get(CONFIG_PROPERTY_PREFIX "config", path,
+                     CONFIG_DEFAULT_PATH);
+    }
+    ret = load_file(load, path);
+    if (ret < 0) {
+        ALOGE("memtrack config %s rejected: %d", path, ret);
+        if (old) {
+            free(load);
+            return ret;
+        }
+        /* Nothing to keep at startup, run with the properties alone */
+        load_properties(load);
+    } else if (ret == 0) {
+        ALOGI("memtrack config loaded from %s", path);
+    }
+
+    resolve(load);
+    load->cfg.generation = old ? old->generation + 1 : 1;
+
+    /*
+     * The config is the first member, so the load is what gets published.
+     * Previous configurations may still be in use and are never freed.
+     */
+    atomic_store_explicit(&current, &load->cfg, memory_order_release);
+
+    return ret < 0 ? ret : 0;
+}
+
+static void load_first(void)
+{
+    pthread_mutex_lock(&load_lock);
+    load_locked();
+    pthread_mutex_unlock(&load_lock);
+}
+
+const struct memtrack_config *memtrack_config_get(void)
+{
+    const struct memtrack_config *cfg;
+
+    cfg = atomic_load_explicit(&current, memory_order_acquire);
+    if (cfg == NULL) {
+        pthread_once(&load_once, load_first);
+        cfg = atomic_load_explicit(&current, memory_order_acquire);
+    }
+
+    return cfg;
+}
+
+void memtrack_config_set_path(const char *path)
+{
+    pthread_mutex_lock(&load_lock);
+    snprintf(path_override, sizeof(path_override), "%s", path ? path : "");
+    pthread_mutex_unlock(&load_lock);
+}
+
+int memtrack_config_reload(void)
+{
+    int ret;
+
+    pthread_once(&load_once, load_first);
+
+    pthread_mutex_lock(&load_lock);
+    ret = load_locked();
+    pthread_mutex_unlock(&load_lock);
+
+    return ret;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_CONFIG_H_
+#define _MEMTRACK_CONFIG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <cutils/properties.h>
+#include <hardware/memtrack.h>
+
+/*
+ * Runtime configuration.
+ *
+ * Every knob has a built-in default, which the matching
+ * ro.vendor.memtrack.<key> property overrides, which the vendor config
+ * file (ro.vendor.memtrack.config, /vendor/etc/memtrack.conf by default)
+ * overrides in turn.  The file holds one "<key> = <value>" per line, '#'
+ * starts a comment, and per-type keys take the type name as a suffix:
+ *
+ *   provider.camera = off
+ *   precision.graphics = approximate
+ *   cache_ttl_ms.other = 5000
+ *
+ * where a per-type cache TTL, from either source, wins over cache_ttl_ms.
+ *
+ * The defaults keep the stateless HAL: every getMemory reads the sources
+ * and nothing runs in the background.  The result cache, which answers
+ * with values up to a TTL old, is enabled by giving it memory:
+ *
+ *   cache_bytes = 131072
+ *   cache_ttl_ms = 1000
+ *
+ * and the sampler by sampler_interval_ms.
+ *
+ * A load produces a validated, immutable memtrack_config.  A file with
+ * any unknown key or out of range value is rejected as a whole and the
+ * previous configuration stays in effect.  Configurations are published
+ * through an atomic pointer and never freed, so a reload does not
+ * disturb queries still using the previous one.  Provider selection,
+ * precision, cache TTLs, staleness, coalescing, the zram ratio TTL, read
+ * timeouts, the interval of a running sampler, the I/O budgets and the
+ * logging knobs follow a reload; the other knobs size or start machinery
+ * and wait for the next start.
+ */
+
+enum memtrack_precision {
+    /* Whatever the provider does by default */
+    MEMTRACK_PRECISION_DEFAULT,
+    MEMTRACK_PRECISION_EXACT,
+    /* Cheaper sources and longer reuse of system wide inputs */
+    MEMTRACK_PRECISION_APPROXIMATE,
+};
+
+struct memtrack_config {
+    /* Bumped by every successful load */
+    uint64_t generation;
+
+    /* A disabled type answers as if no provider was registered */
+    bool provider_enabled[MEMTRACK_NUM_TYPES];
+    int32_t precision[MEMTRACK_NUM_TYPES];
+
+    int32_t cache_bytes;
+    uint32_t cache_ttl_ms[MEMTRACK_NUM_TYPES];
+    int32_t coalesce_wait_ms;
+    /* -1 derives it from the sampler settings */
+    int32_t max_staleness_ms;
+    /* Only used with precision.other = approximate */
+    int32_t zram_ratio_ttl_ms;
+    /*
+     * Timeout of the sources that can block (see guard.h), -1 keeps the
+     * source's own and 0 reads inline without any.
+     */
+    int32_t read_timeout_ms[MEMTRACK_NUM_TYPES];
+    int32_t read_backoff_max_ms;
+
+    int32_t sampler_interval_ms;
+    int32_t sampler_idle_interval_ms;
+    int32_t sampler_max_pids;
+    /* Pids read ahead by pipelined sweeps, 0 reads them one by one */
+    int32_t sampler_pipeline_depth;
+    int32_t io_budget_bytes;
+    int32_t adaptive_max_interval_ms;
+    int32_t adaptive_error_bytes;
+    int32_t history_bytes;
+    bool aggregate;
+    /* File shared with other processes, see shared_snapshot.h for where */
+    char shared_snapshot[PROPERTY_VALUE_MAX];
+    char psi_trigger[PROPERTY_VALUE_MAX];
+    char psi_path[PROPERTY_VALUE_MAX];
+
+    /*
+     * Exit and exec tracking, only started along with the result cache or
+     * the sampler, whose state it keeps coherent
+     */
+    bool proc_events;
+    int32_t prewarm_delay_ms;
+    bool io_uring;
+    int32_t async_max_threads;
+
+    char io_budget_file[PROPERTY_VALUE_MAX];
+    bool perf_counters;
+    char trace_file[PROPERTY_VALUE_MAX];
+
+    /* Shortest time between two lines of the same event, see logging.h */
+    int32_t log_interval_ms;
+    /* Queries of this pid, -1 for all, are dumped to the log */
+    int32_t dump_pid;
+};
+
+/* The current configuration, loaded on first use */
+const struct memtrack_config *memtrack_config_get(void);
+
+/*
+ * Reads the properties and the config file again and publishes the
+ * result.  Returns 0, or -errno with the previous configuration kept.
+ */
+int memtrack_config_reload(void);
+
+/*
+ * Reads path instead of the ro.vendor.memtrack.config file from the next
+ * load on, NULL goes back to the property.  For tools and tests.
+ */
+void memtrack_config_set_path(const char *path);
+
+static inline bool memtrack_config_approximate(int type, bool fallback)
+{
+    int32_t precision = memtrack_config_get()->precision[type];
+
+    return precision == MEMTRACK_PRECISION_DEFAULT ?
+           fallback : precision == MEMTRACK_PRECISION_APPROXIMATE;
+}
+
+#endif
@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/log.h>
+
+#include "adaptive.h"
+#include "aggregate.h"
+#include "cache.h"
+#include "config.h"
+#include "history.h"
+#include "io_account.h"
+#include "logging.h"
+#include "memtrack_common.h"
+#include "perf.h"
+#include "proc_events.h"
+#include "procfs.h"
+#include "sampler.h"
+#include "scan.h"
+#include "shared_snapshot.h"
+#include "singleflight.h"
+#include "snapshot.h"
+#include "source.h"
+#include "stats.h"
+#include "topn.h"
+#include "trace.h"
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+static const char *type_names[MEMTRACK_NUM_TYPES] = {
+    [MEMTRACK_TYPE_OTHER] = "other",
+    [MEMTRACK_TYPE_GL] = "gl",
+    [MEMTRACK_TYPE_GRAPHICS] = "graphics",
+    [MEMTRACK_TYPE_MULTIMEDIA] = "multimedia",
+    [MEMTRACK_TYPE_CAMERA] = "camera",
+};
+
+static const struct memtrack_provider *providers_by_type[MEMTRACK_NUM_TYPES];
+static atomic_uint default_max_age_ms;
+/* A snapshot is kept up to date by this or another instance */
+static bool sampling;
+/* Staleness accepted by default with adaptive sampling, 0 without */
+static uint32_t adaptive_interval_ms;
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *memtrack_type_name(int type)
+{
+    if (type < 0 || type >= MEMTRACK_NUM_TYPES) {
+        return "unknown";
+    }
+
+    return type_names[type];
+}
+
+static void cache_init(const struct memtrack_config *cfg)
+{
+    if (cfg->cache_bytes <= 0) {
+        return;
+    }
+
+    if (memtrack_cache_init(cfg->cache_bytes, cfg->cache_ttl_ms) < 0) {
+        ALOGW("memtrack result cache disabled");
+    }
+}
+
+static void sampler_init(const struct memtrack_config *cfg)
+{
+    if (cfg->sampler_interval_ms <= 0) {
+        return;
+    }
+
+    /*
+     * With an I/O budget stable processes are only sampled every
+     * adaptive_max_interval_ms, by default that much staleness is accepted.
+     */
+    if (cfg->io_budget_bytes > 0) {
+        adaptive_interval_ms = cfg->adaptive_max_interval_ms;
+    }
+
+    /* With a shared snapshot only the instance holding its lock samples */
+    if (cfg->shared_snapshot[0] &&
+        shared_snapshot_init(cfg->shared_snapshot) == 0) {
+        sampling = true;
+        return;
+    }
+
+    if (cfg->io_budget_bytes > 0 &&
+        adaptive_init(cfg->sampler_max_pids, cfg->io_budget_bytes,
+                      cfg->adaptive_max_interval_ms,
+                      cfg->adaptive_error_bytes) < 0) {
+        ALOGW("memtrack adaptive sampling disabled");
+        adaptive_interval_ms = 0;
+    }
+
+    /* Fed by the sweeps, so it has to exist before the first one */
+    if (cfg->history_bytes > 0 &&
+        memtrack_history_init(cfg->history_bytes) < 0) {
+        ALOGW("memtrack history disabled");
+    }
+
+    if (cfg->aggregate &&
+        memtrack_aggregate_init(cfg->sampler_max_pids) < 0) {
+        ALOGW("memtrack aggregation disabled");
+    }
+
+    /* Sweep at full rate only while the system is under memory pressure */
+    if (cfg->psi_trigger[0] &&
+        memtrack_sampler_set_pressure(cfg->psi_path, cfg->psi_trigger,
+                                      cfg->sampler_idle_interval_ms) < 0) {
+        ALOGW("memtrack PSI triggers disabled");
+    }
+
+    if (cfg->sampler_pipeline_depth > 0 &&
+        memtrack_sampler_set_pipeline(cfg->sampler_pipeline_depth) < 0) {
+        ALOGW("memtrack pipelined sweeps disabled");
+    }
+
+    /* Not fatal, every query just reads live data */
+    sampling = memtrack_sampler_start(cfg->sampler_interval_ms,
+                                      cfg->sampler_max_pids) == 0;
+}
+
+static bool any_cache_enabled(void)
+{
+    int type;
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (memtrack_cache_enabled(type)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void proc_events_init(const struct memtrack_config *cfg)
+{
+    if (!cfg->proc_events) {
+        return;
+    }
+
+    /* Nothing to keep coherent without cached state */
+    if (!any_cache_enabled() && !memtrack_sampler_running()) {
+        return;
+    }
+
+    proc_events_add_exit_listener(memtrack_cache_evict_pid);
+    proc_events_start(cfg->prewarm_delay_ms);
+}
+
+static void budgets_load(const struct memtrack_config *cfg)
+{
+    if (!cfg->io_budget_file[0]) {
+        memtrack_io_budget_load(NULL);
+    } else if (memtrack_io_budget_load(cfg->io_budget_file) < 0) {
+        ALOGW("memtrack I/O budgets not loaded from %s", cfg->io_budget_file);
+    }
+}
+
+/* Snapshot answers are accepted up to this age by default */
+static uint32_t default_max_age(const struct memtrack_config *cfg)
+{
+    if (!sampling) {
+        return 0;
+    }
+    if (cfg->max_staleness_ms >= 0) {
+        return (uint32_t)cfg->max_staleness_ms;
+    }
+
+    /* Sampling, so the interval is positive */
+    return adaptive_interval_ms ? adaptive_interval_ms :
+                                  2 * (uint32_t)cfg->sampler_interval_ms;
+}
+
+/* The knobs that can change under running queries */
+static void apply_config(const struct memtrack_config *cfg)
+{
+    zram_memtrack_set_ratio_ttl(cfg->zram_ratio_ttl_ms);
+    memtrack_cache_set_ttl(cfg->cache_ttl_ms);
+    atomic_store(&default_max_age_ms, default_max_age(cfg));
+    budgets_load(cfg);
+    memtrack_log_set_dump_pid(cfg->dump_pid);
+
+    if (memtrack_sampler_running() &&
+        memtrack_sampler_set_interval(cfg->sampler_interval_ms,
+                                      cfg->sampler_idle_interval_ms) < 0) {
+        ALOGW("memtrack sampler interval kept, stopping it needs a restart");
+    }
+}
+
+int memtrack_core_init(const struct memtrack_provider *providers,
+                       size_t count)
+{
+    const struct memtrack_config *cfg = memtrack_config_get();
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (providers[i].type < 0 ||
+            providers[i].type >= MEMTRACK_NUM_TYPES) {
+            return -EINVAL;
+        }
+        providers_by_type[providers[i].type] = &providers[i];
+    }
+
+    pthread_mutex_lock(&reload_lock);
+    zram_memtrack_set_ratio_ttl(cfg->zram_ratio_ttl_ms);
+#ifdef MEMTRACK_TRACE
+    /* Rewritten with the events of each sampler sweep */
+    memtrack_trace_init(cfg->trace_file);
+#endif
+    budgets_load(cfg);
+    memtrack_log_set_dump_pid(cfg->dump_pid);
+#ifdef MEMTRACK_PERF
+    if (cfg->perf_counters && memtrack_perf_init() < 0) {
+        ALOGW("memtrack perf counter profiling disabled");
+    }
+#else
+    if (cfg->perf_counters) {
+        ALOGW("memtrack perf_counters needs a MEMTRACK_PERF build");
+    }
+#endif
+    cache_init(cfg);
+    sampler_init(cfg);
+    atomic_store(&default_max_age_ms, default_max_age(cfg));
+    proc_events_init(cfg);
+    pthread_mutex_unlock(&reload_lock);
+
+    return 0;
+}
+
+int memtrack_core_reload_config(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&reload_lock);
+    ret = memtrack_config_reload();
+    if (ret == 0) {
+        apply_config(memtrack_config_get());
+    }
+    pthread_mutex_unlock(&reload_lock);
+
+    return ret;
+}
+
+const struct memtrack_provider *memtrack_core_provider(int type)
+{
+    if (type < 0 || type >= MEMTRACK_NUM_TYPES) {
+        return NULL;
+    }
+
+    return providers_by_type[type];
+}
+
+bool memtrack_core_enabled(int type)
+{
+    return memtrack_core_provider(type) != NULL &&
+           memtrack_config_get()->provider_enabled[type];
+}
+
+static void dump_result(pid_t pid, const struct memtrack_provider *provider,
+                        int ret, const struct memtrack_record *records,
+                        size_t num_records, size_t allocated)
+{
+    size_t i;
+
+    ALOGI("memtrack dump pid %d %s: %d, %zu records", pid, provider->name,
+          ret, num_records);
+    for (i = 0; ret == 0 && i < num_records && i < allocated; i++) {
+        ALOGI("  record %zu: %zu bytes, flags 0x%x", i,
+              records[i].size_in_bytes, records[i].flags);
+    }
+}
+
+int memtrack_core_read_live(pid_t pid, int type,
+                            struct memtrack_record *records,
+                            size_t *num_records, bool *stale)
+{
+    const struct memtrack_provider *provider = memtrack_core_provider(type);
+    struct memtrack_stats_call call;
+    struct memtrack_perf_sample perf;
+    size_t allocated = *num_records;
+    bool last_value;
+    int ret;
+
+    if (stale) {
+        *stale = false;
+    }
+
+    if (!memtrack_core_enabled(type)) {
+        return -EINVAL;
+    }
+
+    memtrack_stats_call_begin(&call);
+    MEMTRACK_TRACE_BEGIN(provider->name, pid, NULL);
+    memtrack_perf_call_begin(type, &perf);
+    ret = memtrack_source_get_memory(provider, pid, type, records, num_records,
+                                     &last_value);
+    memtrack_perf_call_end(type, &perf);
+    MEMTRACK_TRACE_END(provider->name,
+                       memtrack_trace_thread_bytes() - call.io.bytes);
+    memtrack_stats_call_end(type, &call, ret);
+    memtrack_io_budget_check(ret < 0 ? MEMTRACK_IO_UNAVAILABLE :
+                                       MEMTRACK_IO_CALL,
+                             provider->name, &call.io);
+
+    if (memtrack_log_dump_wanted(pid)) {
+        dump_result(pid, provider, ret, records, *num_records, allocated);
+    }
+    if (stale) {
+        *stale = last_value;
+    }
+
+    return ret;
+}
+
+/* Live read shared with concurrent callers asking the same question */
+static int read_coalesced(pid_t pid, int type,
+                          struct memtrack_record *records,
+                          size_t *num_records, bool *stale)
+{
+    return memtrack_singleflight(pid, type, records, num_records,
+                                 memtrack_config_get()->coalesce_wait_ms,
+                                 memtrack_core_read_live, stale);
+}
+
+/*
+ * Live read through the result cache.  The cache key includes the process
+ * start time, so a reused pid never sees the previous process' result.
+ */
+static int read_cached(pid_t pid, int type,
+                       struct memtrack_record *records,
+                       size_t *num_records, uint32_t max_age_ms, bool *stale)
+{
+    size_t allocated = *num_records;
+    uint64_t start_time;
+    int ret;
+
+    *stale = false;
+
+    if (allocated == 0) {
+        memtrack_stats_query(type, MEMTRACK_STATS_LIVE);
+        return memtrack_core_read_live(pid, type, records, num_records,
+                                       stale);
+    }
+
+    if (max_age_ms == 0 || !memtrack_cache_enabled(type) ||
+        procfs_start_time(pid, &start_time) < 0) {
+        memtrack_stats_query(type, MEMTRACK_STATS_LIVE);
+        return read_coalesced(pid, type, records, num_records, stale);
+    }
+
+    if (memtrack_cache_lookup(pid, start_time, type, max_age_ms,
+                              records, num_records, &ret)) {
+        memtrack_stats_query(type, MEMTRACK_STATS_CACHE);
+        return ret;
+    }
+
+    memtrack_stats_query(type, MEMTRACK_STATS_LIVE);
+
+    ret = read_coalesced(pid, type, records, num_records, stale);
+    /* A stale answer is kept by the guard, it would outlive it here */
+    if (*num_records <= allocated && !*stale) {
+        memtrack_cache_insert(pid, start_time, type, records,
+                              *num_records, ret);
+        proc_events_watch(pid);
+    }
+
+    return ret;
+}
+
+/* Answer from the local or the shared sampler snapshot */
+static bool lookup_snapshots(pid_t pid, int type,
+                             struct memtrack_record *records,
+                             size_t *num_records, uint32_t max_age_ms,
+                             int *ret)
+{
+    if (snapshot_lookup(pid, type, max_age_ms * 1000000ULL,
+                        records, num_records, ret)) {
+        memtrack_stats_query(type, MEMTRACK_STATS_SNAPSHOT);
+        return true;
+    }
+    if (shared_snapshot_lookup(pid, type, max_age_ms * 1000000ULL,
+                               records, num_records, ret)) {
+        memtrack_stats_query(type, MEMTRACK_STATS_SHARED_SNAPSHOT);
+        return true;
+    }
+
+    return false;
+}
+
+static int get_memory(pid_t pid, int type,
+                      struct memtrack_record *records, size_t *num_records,
+                      uint32_t snapshot_max_age_ms, uint32_t cache_max_age_ms,
+                      bool *stale)
+{
+    int ret;
+
+    *stale = false;
+    if (!memtrack_core_enabled(type)) {
+        return -EINVAL;
+    }
+
+    /* The record count query is free, never worth a snapshot lookup */
+    if (*num_records && snapshot_max_age_ms &&
+        lookup_snapshots(pid, type, records, num_records,
+                         snapshot_max_age_ms, &ret)) {
+        return ret;
+    }
+
+    return read_cached(pid, type, records, num_records, cache_max_age_ms,
+                       stale);
+}
+
+int memtrack_core_get_memory_fresh(pid_t pid, int type,
+                                   struct memtrack_record *records,
+                                   size_t *num_records,
+                                   uint32_t max_age_ms)
+{
+    bool stale;
+
+    return get_memory(pid, type, records, num_records,
+                      max_age_ms, max_age_ms, &stale);
+}
+
+int memtrack_core_get_memory(pid_t pid, int type,
+                             struct memtrack_record *records,
+                             size_t *num_records)
+{
+    bool stale;
+
+    /* The cache applies its per-type TTL */
+    return get_memory(pid, type, records, num_records,
+                      atomic_load_explicit(&default_max_age_ms,
+                                           memory_order_relaxed),
+                      UINT32_MAX, &stale);
+}
+
+int memtrack_core_get_memory_budget(pid_t pid, int type,
+                                    struct memtrack_record *records,
+                                    size_t *num_records,
+                                    uint32_t budget_us, bool *stale)
+{
+    const struct memtrack_provider *provider = memtrack_core_provider(type);
+    uint32_t max_age_ms = atomic_load_explicit(&default_max_age_ms,
+                                               memory_order_relaxed);
+    int ret;
+
+    *stale = false;
+
+    if (!memtrack_core_enabled(type) || provider->scan == NULL ||
+        *num_records == 0) {
+        return get_memory(pid, type, records, num_records, max_age_ms,
+                          UINT32_MAX, stale);
+    }
+
+    if (max_age_ms &&
+        lookup_snapshots(pid, type, records, num_records,
+                         max_age_ms, &ret)) {
+        return ret;
+    }
+
+    memtrack_stats_query(type, MEMTRACK_STATS_LIVE);
+
+    return memtrack_scan_run(pid, type, provider->scan, records, num_records,
+                             memtrack_now_ns() + budget_us * 1000ULL, stale);
+}
+
+ssize_t memtrack_core_top(unsigned int type_mask,
+                          struct memtrack_top_entry *out, size_t n)
+{
+    struct memtrack_top_entry *all;
+    struct snapshot_entry *entries;
+    uint64_t timestamp_ns;
+    pid_t *pids;
+    size_t capacity, used = 0;
+    ssize_t count, i;
+    int type;
+
+    if (type_mask == 0 || type_mask >= TOPN_MASKS) {
+        return -EINVAL;
+    }
+    if (!snapshot_ready()) {
+        return -ENODEV;
+    }
+
+    /* Types without a provider add nothing, and have no kept lists */
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (memtrack_core_provider(type) == NULL) {
+            type_mask &= ~(1u << type);
+        }
+    }
+    if (type_mask == 0) {
+        return 0;
+    }
+    if (n <= MEMTRACK_TOP_MAX) {
+        return snapshot_top(type_mask, out, n);
+    }
+
+    /* Beyond the kept lists, select from a copy of the whole snapshot */
+    capacity = snapshot_capacity();
+    pids = malloc(capacity * sizeof(*pids));
+    entries = malloc(capacity * sizeof(*entries));
+    all = malloc(capacity * sizeof(*all));
+    if (pids == NULL || entries == NULL || all == NULL) {
+        count = -ENOMEM;
+        goto out;
+    }
+
+    count = snapshot_copy(pids, entries, capacity, &timestamp_ns);
+    for (i = 0; i < count; i++) {
+        all[used].pid = pids[i];
+        all[used].size = topn_entry_size(&entries[i], type_mask);
+        if (all[used].size) {
+            used++;
+        }
+    }
+    if (count >= 0) {
+        count = topn_select(all, used, n);
+        memcpy(out, all, count * sizeof(*out));
+    }
+
+out:
+    free(pids);
+    free(entries);
+    free(all);
+
+    return count;
+}
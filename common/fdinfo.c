@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "batch_io.h"
+#include "fdinfo.h"
+#include "io_account.h"
+
+#define FDINFO_BATCH 16
+#define FDINFO_BUF 2048
+/* Distinct buffers or clients remembered, any more may count twice */
+#define FDINFO_MAX_SEEN 512
+
+struct fdinfo_total {
+    uint64_t bytes;
+    uint64_t seen[FDINFO_MAX_SEEN];
+    size_t num_seen;
+};
+
+/* Returns false when id was counted already */
+static bool first_seen(struct fdinfo_total *total, uint64_t id)
+{
+    size_t i;
+
+    for (i = 0; i < total->num_seen; i++) {
+        if (total->seen[i] == id) {
+            return false;
+        }
+    }
+    if (total->num_seen < FDINFO_MAX_SEEN) {
+        total->seen[total->num_seen++] = id;
+    }
+
+    return true;
+}
+
+static void parse_dmabuf(void *arg, const char *data, size_t len)
+{
+    struct fdinfo_total *total = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[256];
+    uint64_t ino = 0, size = 0;
+    bool exported = false;
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        if (strncmp(line, "exp_name:", 9) == 0) {
+            exported = true;
+        } else {
+            sscanf(line, "ino: %" SCNu64, &ino);
+            sscanf(line, "size: %" SCNu64, &size);
+        }
+    }
+
+    if (exported && first_seen(total, ino)) {
+        total->bytes += size;
+    }
+}
+
+static uint64_t drm_value(const char *value)
+{
+    char unit[8] = "";
+    uint64_t v;
+
+    if (sscanf(value, "%" SCNu64 " %7s", &v, unit) < 1) {
+        return 0;
+    }
+    if (strcmp(unit, "KiB") == 0) {
+        return v * 1024;
+    }
+    if (strcmp(unit, "MiB") == 0) {
+        return v * 1024 * 1024;
+    }
+
+    return v;
+}
+
+static void parse_drm(void *arg, const char *data, size_t len)
+{
+    struct fdinfo_total *total = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[256];
+    uint64_t client = 0, resident = 0, all = 0;
+    bool is_client = false;
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        char *colon = strchr(line, ':');
+
+        if (colon == NULL || strncmp(line, "drm-", 4) != 0) {
+            continue;
+        }
+        if (sscanf(line, "drm-client-id: %" SCNu64, &client) == 1) {
+            is_client = true;
+        } else if (strncmp(line, "drm-resident-", 13) == 0) {
+            resident += drm_value(colon + 1);
+        } else if (strncmp(line, "drm-total-", 10) == 0) {
+            all += drm_value(colon + 1);
+        }
+    }
+
+    if (is_client && first_seen(total, client)) {
+        total->bytes += resident ? resident : all;
+    }
+}
+
+static int for_each_fd(pid_t pid, batch_io_parse_fn parse,
+                       struct fdinfo_total *total)
+{
+    char paths[FDINFO_BATCH][48];
+    char bufs[FDINFO_BATCH][FDINFO_BUF];
+    struct batch_io_req reqs[FDINFO_BATCH];
+    struct memtrack_dir *dir;
+    const char *name;
+    char path[32];
+    size_t nreqs = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/fdinfo", pid);
+    dir = memtrack_io_opendir(path);
+    if (dir == NULL) {
+        return -errno;
+    }
+
+    memset(reqs, 0, sizeof(reqs));
+    do {
+        name = memtrack_io_readdir(dir);
+        if (name != NULL) {
+            snprintf(paths[nreqs], sizeof(paths[nreqs]), "%s/%s", path, name);
+            reqs[nreqs].path = paths[nreqs];
+            reqs[nreqs].buf = bufs[nreqs];
+            reqs[nreqs].buf_size = sizeof(bufs[nreqs]);
+            reqs[nreqs].parse = parse;
+            reqs[nreqs].arg = total;
+            nreqs++;
+        }
+
+        /* fds closed meanwhile fail on their own */
+        if (nreqs == FDINFO_BATCH || (name == NULL && nreqs)) {
+            batch_io_run(reqs, nreqs);
+            nreqs = 0;
+        }
+    } while (name != NULL);
+    memtrack_io_closedir(dir);
+
+    return 0;
+}
+
+int fdinfo_dmabuf_bytes(pid_t pid, uint64_t *bytes)
+{
+    struct fdinfo_total total;
+    int ret;
+
+    total.bytes = 0;
+    total.num_seen = 0;
+    ret = for_each_fd(pid, parse_dmabuf, &total);
+    *bytes = total.bytes;
+
+    return ret;
+}
+
+int fdinfo_drm_bytes(pid_t pid, uint64_t *bytes)
+{
+    struct fdinfo_total total;
+    int ret;
+
+    total.bytes = 0;
+    total.num_seen = 0;
+    ret = for_each_fd(pid, parse_drm, &total);
+    *bytes = total.bytes;
+
+    return ret;
+}
+
+bool fdinfo_available(void)
+{
+    struct memtrack_dir *dir = memtrack_io_opendir("/proc/self/fdinfo");
+
+    if (dir == NULL) {
+        return false;
+    }
+    memtrack_io_closedir(dir);
+
+    return true;
+}
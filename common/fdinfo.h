@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_FDINFO_H_
+#define _MEMTRACK_FDINFO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Totals over /proc/<pid>/fdinfo, the per-process view of buffers that
+ * newer kernels offer where the driver debugfs tables are gone.  A
+ * buffer or DRM client is counted once however many fds refer to it.
+ * Return 0 or -errno.
+ */
+
+/* dma-bufs held through fds, by inode (exp_name, ino and size lines) */
+int fdinfo_dmabuf_bytes(pid_t pid, uint64_t *bytes);
+
+/* drm-resident-* of every DRM client, drm-total-* if nothing is resident */
+int fdinfo_drm_bytes(pid_t pid, uint64_t *bytes);
+
+/* The calling process' fdinfo can be read */
+bool fdinfo_available(void);
+
+#endif
@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <cutils/log.h>
+
+#include "config.h"
+#include "guard.h"
+#include "io_account.h"
+#include "logging.h"
+#include "perf.h"
+#include "source.h"
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+#define GUARD_BACKOFF_MIN_MS 1000
+#define GUARD_PID_SLOTS 1024
+
+struct helper {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* Owned by a caller, or by a hung call nobody waits for any more */
+    atomic_bool busy;
+    bool started;
+
+    /* The job, under lock */
+    uint64_t job;
+    uint64_t done;
+    bool abandoned;
+    const struct memtrack_source *source;
+    int type;
+    size_t index;
+    pid_t pid;
+    struct memtrack_record records[GUARD_MAX_RECORDS];
+    size_t num_records;
+    int ret;
+    /* What the call cost, charged to the caller */
+    struct memtrack_io_counters io;
+    struct memtrack_perf_sample perf;
+};
+
+struct circuit {
+    /* Consecutive timeouts, 0 while closed */
+    atomic_uint failures;
+    _Atomic uint64_t open_until_ns;
+    atomic_uint backoff_ms;
+    atomic_bool probing;
+    /* Helpers still inside the source */
+    atomic_int inflight;
+
+    _Atomic uint64_t calls;
+    _Atomic uint64_t timeouts;
+    _Atomic uint64_t short_circuits;
+    _Atomic uint64_t stale;
+};
+
+struct last_value {
+    pid_t pid;
+    int ret;
+    size_t num_records;
+    struct memtrack_record records[GUARD_MAX_RECORDS];
+};
+
+static struct helper helpers[GUARD_MAX_HELPERS];
+static atomic_int num_helpers;
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct circuit circuits[MEMTRACK_NUM_TYPES][MEMTRACK_SOURCES_MAX];
+
+static pthread_mutex_t last_lock[MEMTRACK_NUM_TYPES];
+static struct last_value last_values[MEMTRACK_NUM_TYPES][GUARD_PID_SLOTS];
+static pthread_once_t last_once = PTHREAD_ONCE_INIT;
+
+static void count(_Atomic uint64_t *counter)
+{
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static void last_init(void)
+{
+    int type;
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        pthread_mutex_init(&last_lock[type], NULL);
+    }
+}
+
+static void last_store(int type, pid_t pid, int ret,
+                       const struct memtrack_record *records,
+                       size_t num_records)
+{
+    struct last_value *v = &last_values[type][pid % GUARD_PID_SLOTS];
+
+    pthread_once(&last_once, last_init);
+    pthread_mutex_lock(&last_lock[type]);
+    v->pid = pid;
+    v->ret = ret;
+    v->num_records = num_records;
+    memcpy(v->records, records, sizeof(struct memtrack_record) *
+           min(num_records, GUARD_MAX_RECORDS));
+    pthread_mutex_unlock(&last_lock[type]);
+}
+
+static int last_load(int type, pid_t pid, struct memtrack_record *records,
+                     size_t *num_records)
+{
+    struct last_value *v = &last_values[type][pid % GUARD_PID_SLOTS];
+    int ret = -ETIMEDOUT;
+
+    pthread_once(&last_once, last_init);
+    pthread_mutex_lock(&last_lock[type]);
+    if (v->pid == pid && v->num_records) {
+        memcpy(records, v->records, sizeof(struct memtrack_record) *
+               min(min(*num_records, v->num_records), GUARD_MAX_RECORDS));
+        *num_records = v->num_records;
+        ret = v->ret;
+    }
+    pthread_mutex_unlock(&last_lock[type]);
+
+    return ret;
+}
+
+static void io_since(struct memtrack_io_counters *io,
+                     const struct memtrack_io_counters *start)
+{
+    memtrack_io_thread_counters(io);
+    io->opens -= start->opens;
+    io->reads -= start->reads;
+    io->closes -= start->closes;
+    io->getdents -= start->getdents;
+    io->bytes -= start->bytes;
+}
+
+static void *helper_main(void *arg)
+{
+    struct helper *h = arg;
+    uint64_t job = 0;
+
+    pthread_mutex_lock(&h->lock);
+    while (1) {
+        struct memtrack_record records[GUARD_MAX_RECORDS];
+        const struct memtrack_source *source;
+        struct memtrack_io_counters io_start, io;
+        struct memtrack_perf_sample perf_start, perf;
+        struct circuit *c;
+        size_t num_records;
+        pid_t pid;
+        int type, ret;
+
+        while (h->job == job) {
+            pthread_cond_wait(&h->cond, &h->lock);
+        }
+        job = h->job;
+        source = h->source;
+        type = h->type;
+        pid = h->pid;
+        num_records = h->num_records;
+        c = &circuits[type][h->index];
+        pthread_mutex_unlock(&h->lock);
+
+        memtrack_io_thread_counters(&io_start);
+        memtrack_perf_offload_begin(type, &perf_start);
+        ret = source->get_memory(pid, type, records, &num_records);
+        memtrack_perf_offload_end(&perf_start, &perf);
+        io_since(&io, &io_start);
+        atomic_fetch_sub(&c->inflight, 1);
+        if (ret == 0) {
+            last_store(type, pid, ret, records, num_records);
+        }
+
+        pthread_mutex_lock(&h->lock);
+        memcpy(h->records, records, sizeof(records));
+        h->num_records = num_records;
+        h->ret = ret;
+        h->io = io;
+        h->perf = perf;
+        h->done = job;
+        if (h->abandoned) {
+            /* Nobody waits, the helper is free again */
+            h->abandoned = false;
+            atomic_store(&h->busy, false);
+        } else {
+            pthread_cond_broadcast(&h->cond);
+        }
+    }
+
+    return NULL;
+}
+
+static int helper_start(struct helper *h)
+{
+    pthread_condattr_t attr;
+    pthread_attr_t thread_attr;
+    pthread_t thread;
+    int ret;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&h->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&h->lock, NULL);
+
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &thread_attr, helper_main, h);
+    pthread_attr_destroy(&thread_attr);
+    if (ret) {
+        pthread_cond_destroy(&h->cond);
+        pthread_mutex_destroy(&h->lock);
+        return -ret;
+    }
+    pthread_setname_np(thread, "memtrack_guard");
+    h->started = true;
+
+    return 0;
+}
+
+/* An idle helper, now owned by the caller, or NULL when all are busy */
+static struct helper *helper_get(void)
+{
+    struct helper *h = NULL;
+    int i, n;
+
+    n = atomic_load(&num_helpers);
+    for (i = 0; i < n; i++) {
+        bool expected = false;
+
+        if (atomic_compare_exchange_strong(&helpers[i].busy, &expected,
+                                           true)) {
+            return &helpers[i];
+        }
+    }
+
+    pthread_mutex_lock(&spawn_lock);
+    n = atomic_load(&num_helpers);
+    if (n < GUARD_MAX_HELPERS) {
+        h = &helpers[n];
+        atomic_store(&h->busy, true);
+        if (helper_start(h) == 0) {
+            atomic_store(&num_helpers, n + 1);
+        } else {
+            atomic_store(&h->busy, false);
+            h = NULL;
+        }
+    }
+    pthread_mutex_unlock(&spawn_lock);
+
+    return h;
+}
+
+/* 0 when the helper answered in time, -ETIMEDOUT otherwise */
+static int helper_run(struct helper *h, const struct memtrack_source *source,
+                      int type, size_t index, pid_t pid,
+                      uint32_t timeout_ms, struct memtrack_record *records,
+                      size_t *num_records, int *ret)
+{
+    struct timespec deadline;
+    uint64_t job, ns;
+    int err = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    ns = deadline.tv_nsec + timeout_ms * 1000000ULL;
+    deadline.tv_sec += ns / 1000000000ULL;
+    deadline.tv_nsec = ns % 1000000000ULL;
+
+    atomic_fetch_add(&circuits[type][index].inflight, 1);
+
+    pthread_mutex_lock(&h->lock);
+    h->source = source;
+    h->type = type;
+    h->index = index;
+    h->pid = pid;
+    h->num_records = min(*num_records, GUARD_MAX_RECORDS);
+    job = ++h->job;
+    pthread_cond_broadcast(&h->cond);
+
+    while (h->done != job && err == 0) {
+        err = pthread_cond_timedwait(&h->cond, &h->lock, &deadline);
+    }
+    if (h->done != job) {
+        h->abandoned = true;
+        pthread_mutex_unlock(&h->lock);
+        return -ETIMEDOUT;
+    }
+
+    memcpy(records, h->records, sizeof(struct memtrack_record) *
+           min(min(*num_records, h->num_records), GUARD_MAX_RECORDS));
+    *num_records = h->num_records;
+    *ret = h->ret;
+    memtrack_io_add_thread_counters(&h->io);
+    memtrack_perf_offload_add(&h->perf);
+    pthread_mutex_unlock(&h->lock);
+    atomic_store(&h->busy, false);
+
+    return 0;
+}
+
+/* Whether this call may use the source, and as the probe of an open one */
+static bool circuit_admit(struct circuit *c, uint64_t now, bool *probe)
+{
+    bool expected = false;
+
+    *probe = false;
+    if (atomic_load(&c->failures) == 0) {
+        return true;
+    }
+    if (now < atomic_load(&c->open_until_ns) ||
+        atomic_load(&c->inflight) > 0) {
+        return false;
+    }
+
+    *probe = atomic_compare_exchange_strong(&c->probing, &expected, true);
+
+    return *probe;
+}
+
+static void circuit_timeout(struct circuit *c, const char *name)
+{
+    uint32_t max_ms = memtrack_config_get()->read_backoff_max_ms;
+    uint32_t backoff_ms = atomic_load(&c->backoff_ms);
+
+    backoff_ms = backoff_ms ? min(backoff_ms * 2ULL, max_ms) :
+                              min(GUARD_BACKOFF_MIN_MS, max_ms);
+    atomic_store(&c->backoff_ms, backoff_ms);
+    atomic_store(&c->open_until_ns,
+                 memtrack_now_ns() + backoff_ms * 1000000ULL);
+    atomic_fetch_add(&c->failures, 1);
+
+    MEMTRACK_LOGW_EVENT("source_timeout", "memtrack source %s timed out, "
+                        "retried in %u ms", name, backoff_ms);
+}
+
+int memtrack_guard_call(const struct memtrack_source *source, int type,
+                        size_t index, uint32_t timeout_ms, pid_t pid,
+                        struct memtrack_record *records,
+                        size_t *num_records, bool *stale)
+{
+    struct circuit *c = &circuits[type][index];
+    struct helper *h = NULL;
+    bool probe;
+    int ret;
+
+    *stale = false;
+    count(&c->calls);
+
+    /* The observer sees the caller's opens only, see memtrack_capture */
+    if (memtrack_io_observed()) {
+        return source->get_memory(pid, type, records, num_records);
+    }
+
+    if (!circuit_admit(c, memtrack_now_ns(), &probe)) {
+        count(&c->short_circuits);
+    } else if ((h = helper_get()) == NULL) {
+        count(&c->short_circuits);
+        if (probe) {
+            atomic_store(&c->probing, false);
+        }
+    } else if (helper_run(h, source, type, index, pid, timeout_ms,
+                          records, num_records, &ret) == 0) {
+        if (probe || atomic_load(&c->failures)) {
+            atomic_store(&c->failures, 0);
+            atomic_store(&c->backoff_ms, 0);
+            atomic_store(&c->probing, false);
+        }
+        return ret;
+    } else {
+        count(&c->timeouts);
+        circuit_timeout(c, source->name);
+        if (probe) {
+            atomic_store(&c->probing, false);
+        }
+    }
+
+    *stale = true;
+    count(&c->stale);
+
+    return last_load(type, pid, records, num_records);
+}
+
+bool memtrack_guard_open(int type, size_t index)
+{
+    struct circuit *c = &circuits[type][index];
+
+    return atomic_load(&c->failures) &&
+           (memtrack_now_ns() < atomic_load(&c->open_until_ns) ||
+            atomic_load(&c->inflight) > 0);
+}
+
+void memtrack_guard_get_stats(int type, size_t index,
+                              struct memtrack_guard_stats *stats)
+{
+    struct circuit *c = &circuits[type][index];
+
+    stats->calls = atomic_load(&c->calls);
+    stats->timeouts = atomic_load(&c->timeouts);
+    stats->short_circuits = atomic_load(&c->short_circuits);
+    stats->stale = atomic_load(&c->stale);
+    stats->open = memtrack_guard_open(type, index);
+}
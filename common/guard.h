@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _MEMTRACK_GUARD_H_
+#define _MEMTRACK_GUARD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memtrack_common.h"
+
+/*
+ * Isolation of sources that can hang, such as debugfs files read under
+ * GPU driver locks.
+ *
+ * A guarded call runs on a helper thread while the caller waits at most
+ * the source's timeout.  A call that times out is answered with the last
+ * value the type had for the pid, flagged stale, or -ETIMEDOUT without
+ * one, and opens the circuit of the source: calls are answered the same
+ * way without touching the source until a backoff, doubled by every
+ * further timeout up to read_backoff_max_ms, has passed and the hung
+ * helper has returned.  Then a single call probes the source and closes
+ * the circuit when it answers in time.
+ *
+ * Hung helpers cannot be interrupted and stay busy until the kernel
+ * returns; with GUARD_MAX_HELPERS of them busy, guarded calls are
+ * answered right away from the last values.
+ *
+ * The I/O and perf counts of a helper's call are charged to the caller,
+ * so budgets, traces and profiles see guarded sources like any other; a
+ * call that timed out is charged to nobody.  A thread with an I/O observer
+ * calls the source itself, the observer would miss the helper's opens.
+ */
+
+#define GUARD_MAX_HELPERS 8
+/* Records kept as the last value, and passed through a helper */
+#define GUARD_MAX_RECORDS 4
+
+struct memtrack_guard_stats {
+    uint64_t calls;
+    uint64_t timeouts;
+    /* Calls answered without the source while its circuit was open */
+    uint64_t short_circuits;
+    /* Answers given from the last value */
+    uint64_t stale;
+    bool open;
+};
+
+/*
+ * Calls source, the index'th of the type's provider, within timeout_ms.
+ * *stale tells whether the answer is the last value instead of a fresh
+ * one.
+ */
+int memtrack_guard_call(const struct memtrack_source *source, int type,
+                        size_t index, uint32_t timeout_ms, pid_t pid,
+                        struct memtrack_record *records,
+                        size_t *num_records, bool *stale);
+
+/* The source is not being called at the moment */
+bool memtrack_guard_open(int type, size_t index);
+
+void memtrack_guard_get_stats(int type, size_t index,
+                              struct memtrack_guard_stats *stats);
+
+#endif
@@ -0,0 +1,592 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+#include "memtrack_common.h"
+#include "proc_events.h"
+
+/*
+ * Ring sizes in bytes, an unchanged sample costs 2 bytes, a bucket 4.  A
+ * 1 min bucket whose average, min and max stay within 8 MiB of the
+ * previous one takes at most 7, so L2 keeps the last 10 minutes or more.
+ */
+#define RAW_BYTES 32
+#define L1_BYTES 28
+#define L2_BYTES 80
+
+#define L1_PERIOD_S 10
+#define L2_PERIOD_S 60
+
+#define HISTORY_PROBE_WINDOW 8
+#define HISTORY_MIN_SERIES HISTORY_PROBE_WINDOW
+
+/* Raw entries are (dt, dvalue), buckets add (avg - min, max - avg) */
+#define RAW_FIELDS 2
+#define BUCKET_FIELDS 4
+#define MAX_ENTRY_BYTES (BUCKET_FIELDS * 10)
+/* Entries of every ring and both open buckets */
+#define HISTORY_MAX_POINTS (RAW_BYTES / RAW_FIELDS + \
+                            L1_BYTES / BUCKET_FIELDS + \
+                            L2_BYTES / BUCKET_FIELDS + 2)
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
+
+enum series_state {
+    SERIES_FREE,
+    SERIES_LIVE,
+    /* The process exited, the next sample of the pid starts over */
+    SERIES_DEAD,
+};
+
+/*
+ * Byte ring of delta encoded entries.  Times are seconds since init and
+ * values KiB, both relative to the previous entry; base is the point the
+ * oldest entry is relative to.
+ */
+struct vring {
+    uint8_t len;
+    uint8_t count;
+    uint32_t base_time;
+    uint32_t base_value;
+    uint32_t last_time;
+    uint32_t last_value;
+};
+
+/* Bucket being filled */
+struct bucket_acc {
+    uint32_t start;
+    uint32_t min;
+    uint32_t max;
+    uint32_t count;
+    uint64_t sum;
+};
+
+struct history_series {
+    pid_t pid;
+    uint8_t type;
+    uint8_t state;
+    uint32_t updated;
+    struct bucket_acc l1_acc;
+    struct bucket_acc l2_acc;
+    struct vring raw;
+    struct vring l1;
+    struct vring l2;
+    uint8_t raw_bytes[RAW_BYTES];
+    uint8_t l1_bytes[L1_BYTES];
+    uint8_t l2_bytes[L2_BYTES];
+};
+
+/* Decoded entry */
+struct history_entry {
+    uint32_t time;
+    uint32_t value;
+    uint32_t min;
+    uint32_t max;
+};
+
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct history_series *series;
+static size_t series_mask;
+static size_t series_used;
+static uint64_t recycled;
+static uint64_t epoch_ns;
+
+static size_t varint_put(uint8_t *p, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+
+    return n;
+}
+
+static size_t varint_get(const uint8_t *p, uint64_t *v)
+{
+    size_t n = 0;
+    int shift = 0;
+
+    *v = 0;
+    do {
+        *v |= (uint64_t)(p[n] & 0x7f) << shift;
+        shift += 7;
+    } while (p[n++] & 0x80);
+
+    return n;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* Decodes one entry at p relative to prev, returns its length */
+static size_t vring_decode(const uint8_t *p, int fields,
+                           const struct history_entry *prev,
+                           struct history_entry *entry)
+{
+    uint64_t v;
+    size_t n;
+
+    n = varint_get(p, &v);
+    entry->time = prev->time + (uint32_t)v;
+    n += varint_get(p + n, &v);
+    entry->value = prev->value + (uint32_t)unzigzag(v);
+    entry->min = entry->max = entry->value;
+    if (fields == BUCKET_FIELDS) {
+        n += varint_get(p + n, &v);
+        entry->min = entry->value - (uint32_t)v;
+        n += varint_get(p + n, &v);
+        entry->max = entry->value + (uint32_t)v;
+    }
+
+    return n;
+}
+
+static void vring_pop(struct vring *ring, uint8_t *bytes, int fields)
+{
+    struct history_entry base = {
+        .time = ring->base_time,
+        .value = ring->base_value,
+    };
+    struct history_entry oldest;
+    size_t n;
+
+    n = vring_decode(bytes, fields, &base, &oldest);
+    ring->base_time = oldest.time;
+    ring->base_value = oldest.value;
+    memmove(bytes, bytes + n, ring->len - n);
+    ring->len -= n;
+    ring->count--;
+}
+
+static void vring_push(struct vring *ring, uint8_t *bytes, size_t size,
+                       int fields, const struct history_entry *entry)
+{
+    uint8_t buf[MAX_ENTRY_BYTES];
+    size_t n;
+
+    if (ring->count == 0) {
+        ring->base_time = ring->last_time = entry->time;
+        ring->base_value = ring->last_value = entry->value;
+    }
+
+    n = varint_put(buf, entry->time - ring->last_time);
+    n += varint_put(buf + n,
+                    zigzag((int64_t)entry->value - (int64_t)ring->last_value));
+    if (fields == BUCKET_FIELDS) {
+        n += varint_put(buf + n, entry->value - entry->min);
+        n += varint_put(buf + n, entry->max - entry->value);
+    }
+
+    while (ring->count && ring->len + n > size) {
+        vring_pop(ring, bytes, fields);
+    }
+    if (n > size) {
+        return;
+    }
+
+    memcpy(bytes + ring->len, buf, n);
+    ring->len += n;
+    ring->count++;
+    ring->last_time = entry->time;
+    ring->last_value = entry->value;
+}
+
+/* Decodes every entry of ring into out, oldest first */
+static size_t vring_read(const struct vring *ring, const uint8_t *bytes,
+                         int fields, struct history_entry *out)
+{
+    struct history_entry prev = {
+        .time = ring->base_time,
+        .value = ring->base_value,
+    };
+    size_t pos = 0;
+    size_t i;
+
+    for (i = 0; i < ring->count; i++) {
+        pos += vring_decode(bytes + pos, fields, &prev, &out[i]);
+        prev = out[i];
+    }
+
+    return ring->count;
+}
+
+static void acc_add(struct bucket_acc *acc, uint32_t start, uint32_t lo,
+                    uint32_t hi, uint64_t sum, uint32_t count)
+{
+    if (acc->count == 0) {
+        acc->start = start;
+        acc->min = lo;
+        acc->max = hi;
+    } else {
+        acc->min = min(acc->min, lo);
+        acc->max = max(acc->max, hi);
+    }
+    acc->sum += sum;
+    acc->count += count;
+}
+
+static void acc_entry(const struct bucket_acc *acc,
+                      struct history_entry *entry)
+{
+    entry->time = acc->start;
+    entry->value = acc->sum / acc->count;
+    entry->min = acc->min;
+    entry->max = acc->max;
+}
+
+/* Closes the 1 min bucket once a 10 s bucket of another minute arrives */
+static void l2_add(struct history_series *s, const struct bucket_acc *l1)
+{
+    struct history_entry entry;
+    uint32_t start = l1->start - l1->start % L2_PERIOD_S;
+
+    if (s->l2_acc.count && s->l2_acc.start != start) {
+        acc_entry(&s->l2_acc, &entry);
+        vring_push(&s->l2, s->l2_bytes, L2_BYTES, BUCKET_FIELDS, &entry);
+        s->l2_acc.count = 0;
+        s->l2_acc.sum = 0;
+    }
+    acc_add(&s->l2_acc, start, l1->min, l1->max, l1->sum, l1->count);
+}
+
+static void series_add(struct history_series *s, uint32_t now, uint32_t kib)
+{
+    struct history_entry sample = {
+        .time = now,
+        .value = kib,
+        .min = kib,
+        .max = kib,
+    };
+    struct history_entry entry;
+    uint32_t start = now - now % L1_PERIOD_S;
+
+    /* Two sweeps within the same second keep the first sample */
+    if (s->raw.count && s->raw.last_time == now) {
+        return;
+    }
+
+    vring_push(&s->raw, s->raw_bytes, RAW_BYTES, RAW_FIELDS, &sample);
+
+    if (s->l1_acc.count && s->l1_acc.start != start) {
+        acc_entry(&s->l1_acc, &entry);
+        vring_push(&s->l1, s->l1_bytes, L1_BYTES, BUCKET_FIELDS, &entry);
+        l2_add(s, &s->l1_acc);
+        s->l1_acc.count = 0;
+        s->l1_acc.sum = 0;
+    }
+    acc_add(&s->l1_acc, start, kib, kib, kib, 1);
+    s->updated = now;
+}
+
+static size_t hash_key(pid_t pid, int type)
+{
+    uint64_t key = ((uint64_t)(uint32_t)pid << 8) | (uint64_t)type;
+
+    key *= 0x9e3779b97f4a7c15ULL;
+    return (size_t)(key >> 32);
+}
+
+static struct history_series *series_find(pid_t pid, int type)
+{
+    size_t base = hash_key(pid, type);
+    size_t i;
+
+    for (i = 0; i < HISTORY_PROBE_WINDOW; i++) {
+        struct history_series *s = &series[(base + i) & series_mask];
+
+        if (s->state != SERIES_FREE && s->pid == pid && s->type == type) {
+            return s;
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns a reset series for (pid, type), recycling the stalest one */
+static struct history_series *series_create(pid_t pid, int type)
+{
+    size_t base = hash_key(pid, type);
+    struct history_series *victim = NULL;
+    size_t i;
+
+    for (i = 0; i < HISTORY_PROBE_WINDOW; i++) {
+        struct history_series *s = &series[(base + i) & series_mask];
+
+        if (s->state == SERIES_FREE) {
+            victim = s;
+            series_used++;
+            break;
+        }
+        if (victim == NULL || s->updated < victim->updated) {
+            victim = s;
+        }
+    }
+    if (victim->state != SERIES_FREE) {
+        recycled++;
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->pid = pid;
+    victim->type = type;
+    victim->state = SERIES_LIVE;
+
+    return victim;
+}
+
+static void history_evict_pid(pid_t pid)
+{
+    int type;
+
+    pthread_mutex_lock(&history_lock);
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        struct history_series *s = series_find(pid, type);
+
+        /* Kept for after-the-fact queries until its slot is needed */
+        if (s) {
+            s->state = SERIES_DEAD;
+        }
+    }
+    pthread_mutex_unlock(&history_lock);
+}
+
+int memtrack_history_init(size_t max_bytes)
+{
+    size_t count = HISTORY_MIN_SERIES;
+
+    while (count * 2 * sizeof(struct history_series) <= max_bytes) {
+        count *= 2;
+    }
+
+    series = calloc(count, sizeof(struct history_series));
+    if (series == NULL) {
+        return -ENOMEM;
+    }
+    series_mask = count - 1;
+    epoch_ns = memtrack_now_ns();
+
+    proc_events_add_exit_listener(history_evict_pid);
+
+    return 0;
+}
+
+void memtrack_history_record(const struct snapshot_view *view)
+{
+    uint32_t now;
+    size_t i;
+    int type;
+
+    if (series == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&history_lock);
+    for (i = 0; i < view->count; i++) {
+        const struct snapshot_entry *entry = &view->entries[i];
+
+        /* Entries carried over unsampled repeat their last second */
+        now = (entry->sampled_ns - epoch_ns) / 1000000000ULL;
+
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            struct history_series *s;
+            uint32_t kib;
+
+            if (entry->ret[type] != 0 || entry->num_records[type] == 0) {
+                continue;
+            }
+            kib = entry->records[type][0].size_in_bytes / 1024;
+
+            s = series_find(view->pids[i], type);
+            if (s == NULL || s->state == SERIES_DEAD) {
+                if (s) {
+                    memset(s, 0, sizeof(*s));
+                    series_used--;
+                }
+                /* Types a process never uses do not get a series */
+                if (kib == 0) {
+                    continue;
+                }
+                s = series_create(view->pids[i], type);
+            }
+            series_add(s, now, kib);
+        }
+    }
+    pthread_mutex_unlock(&history_lock);
+}
+
+static uint64_t to_ms(uint32_t time)
+{
+    return epoch_ns / 1000000ULL + (uint64_t)time * 1000ULL;
+}
+
+/*
+ * A ring that dropped entries has its base at the newest one dropped.
+ * Returns true and that time when ring dropped any.
+ */
+static bool vring_dropped(const struct vring *ring,
+                          const struct history_entry *oldest, uint32_t *time)
+{
+    if (ring->count == 0 || ring->base_time == oldest->time) {
+        return false;
+    }
+    *time = ring->base_time;
+
+    return true;
+}
+
+static void emit(struct memtrack_history_point *out, size_t *n,
+                 uint32_t span_s, const struct history_entry *entry)
+{
+    out[*n].time_ms = to_ms(entry->time);
+    out[*n].span_s = span_s;
+    out[*n].min_bytes = (uint64_t)entry->min * 1024;
+    out[*n].max_bytes = (uint64_t)entry->max * 1024;
+    out[*n].avg_bytes = (uint64_t)entry->value * 1024;
+    (*n)++;
+}
+
+size_t memtrack_history_range(pid_t pid, int type, uint64_t from_ms,
+                              uint64_t to_ms_,
+                              struct memtrack_history_point *out,
+                              size_t max)
+{
+    struct history_entry raw[RAW_BYTES / RAW_FIELDS];
+    struct history_entry l1[L1_BYTES / BUCKET_FIELDS + 1];
+    struct history_entry l2[L2_BYTES / BUCKET_FIELDS + 1];
+    struct memtrack_history_point points[HISTORY_MAX_POINTS];
+    struct history_series *s;
+    size_t raw_count, l1_count, l2_count;
+    uint32_t raw_dropped = 0, l1_dropped = 0;
+    bool raw_lost, l1_lost;
+    size_t count = 0, n = 0;
+    size_t i;
+
+    if (series == NULL || type < 0 || type >= MEMTRACK_NUM_TYPES) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&history_lock);
+    s = series_find(pid, type);
+    if (s == NULL || s->raw.count == 0) {
+        pthread_mutex_unlock(&history_lock);
+        return 0;
+    }
+
+    raw_count = vring_read(&s->raw, s->raw_bytes, RAW_FIELDS, raw);
+    l1_count = vring_read(&s->l1, s->l1_bytes, BUCKET_FIELDS, l1);
+    l2_count = vring_read(&s->l2, s->l2_bytes, BUCKET_FIELDS, l2);
+    raw_lost = vring_dropped(&s->raw, &raw[0], &raw_dropped);
+    l1_lost = l1_count && vring_dropped(&s->l1, &l1[0], &l1_dropped);
+
+    /*
+     * Oldest first, each period at the finest resolution still kept: a
+     * coarser level only where the finer one dropped entries, the open
+     * buckets included.
+     */
+    for (i = 0; l1_lost && i < l2_count && l2[i].time <= l1_dropped; i++) {
+        emit(points, &count, L2_PERIOD_S, &l2[i]);
+    }
+    if (l1_lost && s->l2_acc.count && s->l2_acc.start <= l1_dropped) {
+        acc_entry(&s->l2_acc, &l2[l2_count]);
+        emit(points, &count, L2_PERIOD_S, &l2[l2_count]);
+    }
+    for (i = 0; raw_lost && i < l1_count && l1[i].time <= raw_dropped; i++) {
+        emit(points, &count, L1_PERIOD_S, &l1[i]);
+    }
+    if (raw_lost && s->l1_acc.count && s->l1_acc.start <= raw_dropped) {
+        acc_entry(&s->l1_acc, &l1[l1_count]);
+        emit(points, &count, L1_PERIOD_S, &l1[l1_count]);
+    }
+    for (i = 0; i < raw_count; i++) {
+        uint32_t span = i + 1 < raw_count ? raw[i + 1].time - raw[i].time : 1;
+
+        emit(points, &count, span, &raw[i]);
+    }
+    pthread_mutex_unlock(&history_lock);
+
+    /* A coarse bucket only covers the time up to the next finer point */
+    for (i = 0; i < count; i++) {
+        if (i + 1 < count) {
+            points[i].span_s = min(points[i].span_s,
+                                   (points[i + 1].time_ms -
+                                    points[i].time_ms) / 1000);
+        }
+        if (points[i].time_ms + points[i].span_s * 1000ULL > from_ms &&
+            points[i].time_ms <= to_ms_ && n < max) {
+            out[n++] = points[i];
+        }
+    }
+
+    return n;
+}
+
+int memtrack_history_aggregate(pid_t pid, int type, uint64_t from_ms,
+                               uint64_t to_ms_,
+                               struct memtrack_history_point *out)
+{
+    struct memtrack_history_point points[HISTORY_MAX_POINTS];
+    uint64_t weighted = 0;
+    uint64_t span = 0;
+    size_t count, i;
+
+    count = memtrack_history_range(pid, type, from_ms, to_ms_, points,
+                                   ARRAY_SIZE(points));
+    if (count == 0) {
+        return -ENOENT;
+    }
+
+    out->time_ms = points[0].time_ms;
+    out->min_bytes = points[0].min_bytes;
+    out->max_bytes = points[0].max_bytes;
+    for (i = 0; i < count; i++) {
+        out->min_bytes = min(out->min_bytes, points[i].min_bytes);
+        out->max_bytes = max(out->max_bytes, points[i].max_bytes);
+        weighted += points[i].avg_bytes * points[i].span_s;
+        span += points[i].span_s;
+    }
+    out->span_s = span;
+    out->avg_bytes = weighted / span;
+
+    return 0;
+}
+
+void memtrack_history_get_stats(struct memtrack_history_stats *stats)
+{
+    pthread_mutex_lock(&history_lock);
+    stats->capacity = series ? series_mask + 1 : 0;
+    stats->used = series_used;
+    stats->bytes_per_series = sizeof(struct history_series);
+    stats->footprint_bytes = stats->capacity * sizeof(struct history_series);
+    stats->recycled = recycled;
+    pthread_mutex_unlock(&history_lock);
+}
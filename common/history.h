@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_HISTORY_H_
+#define _MEMTRACK_HISTORY_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "snapshot.h"
+
+/*
+ * In-memory history of the sampled sizes, one fixed-size series per
+ * (pid, type), created once the type first reports a non-zero size.
+ *
+ * A series keeps three rings: raw samples, 10 s buckets and 1 min buckets
+ * (min/max/avg).  Every ring entry is stored as varint deltas against the
+ * previous one, so a process whose size does not move costs a couple of
+ * bytes per sample.  When a ring is full its oldest entries are dropped;
+ * they have already been folded into the coarser level.  The series
+ * table is sized once from a byte budget and the least recently updated
+ * series is recycled when it is full.
+ */
+
+struct memtrack_history_point {
+    /* CLOCK_MONOTONIC ms of the sample or of the bucket start */
+    uint64_t time_ms;
+    /* Seconds covered by the point, 10 or 60 for buckets */
+    uint32_t span_s;
+    uint64_t min_bytes;
+    uint64_t max_bytes;
+    uint64_t avg_bytes;
+};
+
+struct memtrack_history_stats {
+    size_t capacity;
+    size_t used;
+    size_t bytes_per_series;
+    size_t footprint_bytes;
+    uint64_t recycled;
+};
+
+int memtrack_history_init(size_t max_bytes);
+
+/* Sampler only: appends every successfully sampled size of view */
+void memtrack_history_record(const struct snapshot_view *view);
+
+/*
+ * Copies the points of (pid, type) overlapping [from_ms, to_ms] to out,
+ * oldest first, at the finest resolution still available for each
+ * period.  Returns the number of points copied.
+ */
+size_t memtrack_history_range(pid_t pid, int type, uint64_t from_ms,
+                              uint64_t to_ms,
+                              struct memtrack_history_point *out,
+                              size_t max);
+
+/*
+ * Time weighted min/max/avg of (pid, type) over [from_ms, to_ms].
+ * Returns 0, or -ENOENT when there is no sample in the range.
+ */
+int memtrack_history_aggregate(pid_t pid, int type, uint64_t from_ms,
+                               uint64_t to_ms,
+                               struct memtrack_history_point *out);
+
+void memtrack_history_get_stats(struct memtrack_history_stats *stats);
+
+#endif
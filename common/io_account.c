@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cutils/log.h>
+
+#include "io_account.h"
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+#define IO_BUDGETS_MAX 64
+#define IO_DIR_BUF 4096
+
+struct io_budget {
+    int scenario;
+    char provider[16];
+    uint64_t max_ops;
+    uint64_t max_bytes;
+    atomic_bool logged;
+};
+
+/* Replaced as a whole by a reload, a replaced table is never freed */
+struct io_budget_table {
+    size_t count;
+    struct io_budget budgets[IO_BUDGETS_MAX];
+};
+
+static _Atomic(struct io_budget_table *) budget_table;
+static _Atomic uint64_t violations;
+
+static const char *scenario_names[MEMTRACK_IO_NUM_SCENARIOS] = {
+    [MEMTRACK_IO_CALL] = "call",
+    [MEMTRACK_IO_UNAVAILABLE] = "unavailable",
+    [MEMTRACK_IO_SWEEP] = "sweep",
+};
+
+static __thread struct memtrack_io_counters thread_counters;
+static __thread memtrack_io_observer_fn thread_observer;
+static __thread void *thread_observer_arg;
+static int root_fd = AT_FDCWD;
+
+struct memtrack_dir {
+    int fd;
+    size_t pos;
+    size_t len;
+    char buf[IO_DIR_BUF];
+};
+
+/* Layout of the records returned by getdents64 */
+struct io_dirent {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+int memtrack_io_set_root(const char *root)
+{
+    int fd = open(root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return -errno;
+    }
+    if (root_fd != AT_FDCWD) {
+        close(root_fd);
+    }
+    root_fd = fd;
+
+    return 0;
+}
+
+void memtrack_io_set_observer(memtrack_io_observer_fn fn, void *arg)
+{
+    thread_observer = fn;
+    thread_observer_arg = arg;
+}
+
+bool memtrack_io_observed(void)
+{
+    return thread_observer != NULL;
+}
+
+const char *memtrack_io_at(const char *path, int *dirfd)
+{
+    if (thread_observer) {
+        thread_observer(thread_observer_arg, path);
+    }
+
+    *dirfd = root_fd;
+    if (root_fd == AT_FDCWD) {
+        return path;
+    }
+
+    /* Relative to the root directory instead of absolute */
+    while (*path == '/') {
+        path++;
+    }
+
+    return *path ? path : ".";
+}
+
+int memtrack_io_open(const char *path, int flags)
+{
+    int dirfd;
+
+    path = memtrack_io_at(path, &dirfd);
+    thread_counters.opens++;
+
+    return openat(dirfd, path, flags | O_CLOEXEC);
+}
+
+ssize_t memtrack_io_read(int fd, void *buf, size_t len)
+{
+    ssize_t ret = read(fd, buf, len);
+
+    thread_counters.reads++;
+    if (ret > 0) {
+        thread_counters.bytes += ret;
+    }
+
+    return ret;
+}
+
+ssize_t memtrack_io_pread(int fd, void *buf, size_t len, off_t offset)
+{
+    ssize_t ret = pread(fd, buf, len, offset);
+
+    thread_counters.reads++;
+    if (ret > 0) {
+        thread_counters.bytes += ret;
+    }
+
+    return ret;
+}
+
+int memtrack_io_close(int fd)
+{
+    thread_counters.closes++;
+    return close(fd);
+}
+
+struct memtrack_dir *memtrack_io_opendir(const char *path)
+{
+    struct memtrack_dir *dir = malloc(sizeof(*dir));
+    int saved_errno;
+
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    dir->fd = memtrack_io_open(path, O_RDONLY | O_DIRECTORY);
+    if (dir->fd < 0) {
+        saved_errno = errno;
+        free(dir);
+        errno = saved_errno;
+        return NULL;
+    }
+    dir->pos = 0;
+    dir->len = 0;
+
+    return dir;
+}
+
+const char *memtrack_io_readdir(struct memtrack_dir *dir)
+{
+    while (1) {
+        struct io_dirent *d;
+        long ret;
+
+        if (dir->pos >= dir->len) {
+            ret = syscall(__NR_getdents64, dir->fd, dir->buf, sizeof(dir->buf));
+            thread_counters.getdents++;
+            if (ret <= 0) {
+                return NULL;
+            }
+            dir->len = ret;
+            dir->pos = 0;
+        }
+
+        d = (struct io_dirent *)(dir->buf + dir->pos);
+        dir->pos += d->d_reclen;
+
+        if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0) {
+            return d->d_name;
+        }
+    }
+}
+
+void memtrack_io_closedir(struct memtrack_dir *dir)
+{
+    memtrack_io_close(dir->fd);
+    free(dir);
+}
+
+void memtrack_io_count_ring(uint64_t files, uint64_t bytes)
+{
+    thread_counters.opens += files;
+    thread_counters.reads += files;
+    thread_counters.closes += files;
+    thread_counters.bytes += bytes;
+}
+
+void memtrack_io_thread_counters(struct memtrack_io_counters *counters)
+{
+    *counters = thread_counters;
+}
+
+void memtrack_io_add_thread_counters(const struct memtrack_io_counters *c)
+{
+    thread_counters.opens += c->opens;
+    thread_counters.reads += c->reads;
+    thread_counters.closes += c->closes;
+    thread_counters.getdents += c->getdents;
+    thread_counters.bytes += c->bytes;
+}
+
+static int parse_scenario(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(scenario_names); i++) {
+        if (strcmp(name, scenario_names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static uint64_t parse_limit(const char *value)
+{
+    return strcmp(value, "-") == 0 ? UINT64_MAX : strtoull(value, NULL, 0);
+}
+
+int memtrack_io_budget_load(const char *path)
+{
+    struct io_budget_table *table;
+    char line[256];
+    unsigned int lineno = 0;
+    FILE *fp;
+
+    if (path == NULL) {
+        atomic_store_explicit(&budget_table, NULL, memory_order_release);
+        return 0;
+    }
+
+    fp = fopen(path, "re");
+    if (fp == NULL) {
+        return -errno;
+    }
+
+    table = calloc(1, sizeof(*table));
+    if (table == NULL) {
+        fclose(fp);
+        return -ENOMEM;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char scenario[16], provider[16], ops[24], bytes[24];
+        struct io_budget *b;
+        int id;
+
+        lineno++;
+        line[strcspn(line, "#\n")] = '\0';
+        if (sscanf(line, "%15s", scenario) != 1) {
+            continue;
+        }
+
+        if (sscanf(line, "%15s %15s %23s %23s", scenario, provider,
+                   ops, bytes) != 4 ||
+            (id = parse_scenario(scenario)) < 0) {
+            ALOGW("%s:%u: invalid I/O budget", path, lineno);
+            continue;
+        }
+        if (table->count == IO_BUDGETS_MAX) {
+            ALOGW("%s: more than %d I/O budgets", path, IO_BUDGETS_MAX);
+            break;
+        }
+
+        b = &table->budgets[table->count++];
+        b->scenario = id;
+        snprintf(b->provider, sizeof(b->provider), "%s", provider);
+        b->max_ops = parse_limit(ops);
+        b->max_bytes = parse_limit(bytes);
+        atomic_init(&b->logged, false);
+    }
+    fclose(fp);
+
+    atomic_store_explicit(&budget_table, table, memory_order_release);
+
+    return 0;
+}
+
+static struct io_budget *find_budget(struct io_budget_table *table,
+                                     int scenario, const char *provider)
+{
+    struct io_budget *any = NULL;
+    size_t i;
+
+    for (i = 0; i < table->count; i++) {
+        struct io_budget *b = &table->budgets[i];
+
+        if (b->scenario != scenario) {
+            continue;
+        }
+        if (provider && strcmp(b->provider, provider) == 0) {
+            return b;
+        }
+        if (strcmp(b->provider, "*") == 0) {
+            any = b;
+        }
+    }
+
+    return any;
+}
+
+void memtrack_io_budget_check(int scenario, const char *provider,
+                              const struct memtrack_io_counters *start)
+{
+    struct io_budget_table *table;
+    struct io_budget *b;
+    uint64_t ops, bytes;
+
+    table = atomic_load_explicit(&budget_table, memory_order_acquire);
+    if (table == NULL) {
+        return;
+    }
+
+    b = find_budget(table, scenario, provider);
+    if (b == NULL) {
+        return;
+    }
+
+    ops = memtrack_io_ops(&thread_counters) - memtrack_io_ops(start);
+    bytes = thread_counters.bytes - start->bytes;
+    if (ops <= b->max_ops && bytes <= b->max_bytes) {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&violations, 1, memory_order_relaxed);
+    if (!atomic_exchange(&b->logged, true)) {
+        ALOGW("%s %s I/O budget exceeded: %" PRIu64 "/%" PRIu64 " ops, %"
+              PRIu64 "/%" PRIu64 " bytes", scenario_names[scenario],
+              provider ? provider : "*", ops, b->max_ops, bytes, b->max_bytes);
+    }
+}
+
+uint64_t memtrack_io_budget_violations(void)
+{
+    return atomic_load_explicit(&violations, memory_order_relaxed);
+}
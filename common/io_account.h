@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_IO_ACCOUNT_H_
+#define _MEMTRACK_IO_ACCOUNT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Accounting of the file operations behind every answer.
+ *
+ * All procfs, sysfs and debugfs access of the providers and the sampler
+ * goes through the wrappers below, which count per thread.  An operation
+ * is counted once whether it is a syscall or an io_uring SQE, since the
+ * kernel generates the file content either way.
+ *
+ * Optional budgets, ro.vendor.memtrack.io_budget_file, cap the operations
+ * and bytes of a scenario.  One budget per line, '#' starts a comment:
+ *
+ *   <scenario> <provider|*> <max ops> <max bytes>
+ *
+ * where scenario is "call" (one provider call), "unavailable" (a provider
+ * call that failed) or "sweep" (a full sampler sweep, provider "*").  An
+ * exceeded budget is logged once and counted, never fatal.  Each platform
+ * keeps its budgets in io_budgets.conf, which memtrack_io_budget_test
+ * enforces on a fixture tree, so a regression such as an extra smaps walk
+ * fails the test instead of shipping.
+ */
+
+struct memtrack_io_counters {
+    uint64_t opens;
+    uint64_t reads;
+    uint64_t closes;
+    uint64_t getdents;
+    uint64_t bytes;
+};
+
+enum memtrack_io_scenario {
+    MEMTRACK_IO_CALL,
+    MEMTRACK_IO_UNAVAILABLE,
+    MEMTRACK_IO_SWEEP,
+    MEMTRACK_IO_NUM_SCENARIOS,
+};
+
+/*
+ * Resolves every absolute path below root from now on, so a host run can
+ * read a directory tree captured from a device.  Returns 0 or -errno.
+ */
+int memtrack_io_set_root(const char *root);
+
+/*
+ * Calls fn with the absolute path of every file and directory the calling
+ * thread opens from now on, before it is opened; NULL stops.  Used to
+ * capture exactly what the providers read.
+ */
+typedef void (*memtrack_io_observer_fn)(void *arg, const char *path);
+void memtrack_io_set_observer(memtrack_io_observer_fn fn, void *arg);
+/* The calling thread has an observer */
+bool memtrack_io_observed(void);
+
+/* Directory fd and path to pass to an *at() call or io_uring openat */
+const char *memtrack_io_at(const char *path, int *dirfd);
+
+int memtrack_io_open(const char *path, int flags);
+ssize_t memtrack_io_read(int fd, void *buf, size_t len);
+ssize_t memtrack_io_pread(int fd, void *buf, size_t len, off_t offset);
+int memtrack_io_close(int fd);
+
+/* Directory listing on top of getdents64, skipping "." and ".." */
+struct memtrack_dir;
+struct memtrack_dir *memtrack_io_opendir(const char *path);
+/* Next entry name, NULL at the end or on error */
+const char *memtrack_io_readdir(struct memtrack_dir *dir);
+void memtrack_io_closedir(struct memtrack_dir *dir);
+
+/* Counts files read through io_uring, one open, read and close each */
+void memtrack_io_count_ring(uint64_t files, uint64_t bytes);
+
+/* Running totals of the calling thread */
+void memtrack_io_thread_counters(struct memtrack_io_counters *counters);
+/* Charges the calling thread with what another thread did on its behalf */
+void memtrack_io_add_thread_counters(const struct memtrack_io_counters *c);
+
+static inline uint64_t memtrack_io_ops(const struct memtrack_io_counters *c)
+{
+    return c->opens + c->reads + c->closes + c->getdents;
+}
+
+/*
+ * Replaces the budgets with those in path, NULL drops them.  Returns 0 or
+ * -errno with the previous budgets kept.
+ */
+int memtrack_io_budget_load(const char *path);
+
+/*
+ * Checks what the calling thread did since start against the budget of
+ * scenario for provider (NULL for "*" only).
+ */
+void memtrack_io_budget_check(int scenario, const char *provider,
+                              const struct memtrack_io_counters *start);
+
+/* Budgets exceeded so far */
+uint64_t memtrack_io_budget_violations(void);
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+
+#include "batch_io.h"
+#include "config.h"
+#include "logging.h"
+#include "memtrack_common.h"
+
+_Atomic pid_t memtrack_log_dump_pid;
+
+static _Atomic(struct memtrack_log_event *) events;
+
+bool memtrack_log_event(struct memtrack_log_event *event, uint64_t *count)
+{
+    uint64_t now, quiet_until;
+
+    *count = atomic_fetch_add_explicit(&event->count, 1,
+                                       memory_order_relaxed) + 1;
+
+    if (!atomic_exchange(&event->listed, true)) {
+        struct memtrack_log_event *head = atomic_load(&events);
+
+        do {
+            event->next = head;
+        } while (!atomic_compare_exchange_weak(&events, &head, event));
+    }
+
+    now = memtrack_now_ns();
+    quiet_until = atomic_load_explicit(&event->quiet_until_ns,
+                                       memory_order_relaxed);
+    if (now < quiet_until) {
+        return false;
+    }
+
+    /* One of the racing callers writes the line */
+    return atomic_compare_exchange_strong(
+        &event->quiet_until_ns, &quiet_until,
+        now + memtrack_config_get()->log_interval_ms * 1000000ULL);
+}
+
+const struct memtrack_log_event *memtrack_log_events(void)
+{
+    return atomic_load(&events);
+}
+
+void memtrack_log_set_dump_pid(pid_t pid)
+{
+    atomic_store(&memtrack_log_dump_pid, pid);
+}
+
+static void dump_lines(void *arg, const char *data, size_t len)
+{
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        ALOGI("  %s", line);
+    }
+}
+
+int memtrack_log_dump_file(const char *path)
+{
+    ALOGI("memtrack dump %s:", path);
+
+    return batch_io_read_file(path, batch_io_scratch(), BATCH_IO_SCRATCH_SIZE,
+                              dump_lines, NULL);
+}
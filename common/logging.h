@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _MEMTRACK_LOGGING_H_
+#define _MEMTRACK_LOGGING_H_
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <cutils/log.h>
+
+/*
+ * Logging for the query paths.
+ *
+ * Debug and verbose lines are compiled out unless MEMTRACK_LOG_LEVEL
+ * (MEMTRACK_LOG_LEVEL := debug or verbose in the environment of the build)
+ * lets them through; the arguments are still type checked.
+ *
+ * Conditions that can repeat on every query, a missing file or an
+ * exceeded budget, are logged as events: each call site counts its
+ * occurrences and writes at most one line per log_interval_ms (see
+ * config.h) carrying the count since boot.  The counts are part of the
+ * stats dump.
+ */
+
+#define MEMTRACK_LOG_ERROR 0
+#define MEMTRACK_LOG_WARN 1
+#define MEMTRACK_LOG_INFO 2
+#define MEMTRACK_LOG_DEBUG 3
+#define MEMTRACK_LOG_VERBOSE 4
+
+#ifndef MEMTRACK_LOG_LEVEL
+#define MEMTRACK_LOG_LEVEL MEMTRACK_LOG_INFO
+#endif
+
+#if MEMTRACK_LOG_LEVEL >= MEMTRACK_LOG_DEBUG
+#define MEMTRACK_LOGD(...) ALOGD(__VA_ARGS__)
+#else
+#define MEMTRACK_LOGD(...) do { if (0) ALOGD(__VA_ARGS__); } while (0)
+#endif
+
+#if MEMTRACK_LOG_LEVEL >= MEMTRACK_LOG_VERBOSE
+#define MEMTRACK_LOGV(...) ALOGD(__VA_ARGS__)
+#else
+#define MEMTRACK_LOGV(...) do { if (0) ALOGD(__VA_ARGS__); } while (0)
+#endif
+
+struct memtrack_log_event {
+    /* Stats label, a string literal */
+    const char *name;
+    _Atomic uint64_t count;
+    /* No line is written before this time */
+    _Atomic uint64_t quiet_until_ns;
+    atomic_bool listed;
+    struct memtrack_log_event *next;
+};
+
+/*
+ * Counts an occurrence of event.  Returns true, with the count so far,
+ * when the caller should write its line.
+ */
+bool memtrack_log_event(struct memtrack_log_event *event, uint64_t *count);
+
+/* Every event that occurred at least once, linked through next */
+const struct memtrack_log_event *memtrack_log_events(void);
+
+#define MEMTRACK_LOG_EVENT_(log, event_name, fmt, ...)                      \
+    do {                                                                    \
+        static struct memtrack_log_event event_ = { .name = event_name };   \
+        uint64_t count_;                                                    \
+                                                                            \
+        if (memtrack_log_event(&event_, &count_)) {                         \
+            log(fmt ", %" PRIu64 " times since boot", ##__VA_ARGS__,        \
+                count_);                                                    \
+        }                                                                   \
+    } while (0)
+
+#define MEMTRACK_LOGE_EVENT(name, fmt, ...) \
+    MEMTRACK_LOG_EVENT_(ALOGE, name, fmt, ##__VA_ARGS__)
+#define MEMTRACK_LOGW_EVENT(name, fmt, ...) \
+    MEMTRACK_LOG_EVENT_(ALOGW, name, fmt, ##__VA_ARGS__)
+
+/*
+ * Diagnostic dumps of single queries, requested with the dump_pid
+ * config key: a pid, or -1 for every process.  Providers check
+ * memtrack_log_dump_wanted() before writing their details, a single
+ * relaxed load while no dump is requested.
+ */
+extern _Atomic pid_t memtrack_log_dump_pid;
+
+void memtrack_log_set_dump_pid(pid_t pid);
+
+static inline bool memtrack_log_dump_wanted(pid_t pid)
+{
+    pid_t want = atomic_load_explicit(&memtrack_log_dump_pid,
+                                      memory_order_relaxed);
+
+    return want != 0 && (want == pid || want == -1);
+}
+
+/* Writes every line of the file at path to the log, 0 or -errno */
+int memtrack_log_dump_file(const char *path);
+
+#endif
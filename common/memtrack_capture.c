@@ -0,0 +1,706 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * memtrack_capture: archives the memtrack sources of a live device.
+ *
+ * Every enabled provider is called once per process while the file opens
+ * of the calling thread are observed (memtrack_io_set_observer()), so the
+ * archive holds exactly the files and directories the backends read, as
+ * they were.  It is a plain ustar archive, gzip it for transport; once
+ * extracted on a host the tree is a root for memtrack_top -r or anything
+ * else calling memtrack_io_set_root().
+ *
+ * With -a pids are replaced by sequential ones from 1000 on, in paths,
+ * in the pid fields of /proc/<pid>/stat and status, in cgroup paths and
+ * in the pid columns of the driver tables.  Sizes that happen to equal a
+ * pid in those tables are rewritten too.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <hardware/memtrack.h>
+
+#include "io_account.h"
+#include "memtrack_common.h"
+#include "procfs.h"
+
+#define TAR_BLOCK 512
+#define CAPTURE_MAX_RECORDS 16
+/* First pid handed out by -a */
+#define ANON_PID_BASE 1000
+
+extern struct memtrack_module HAL_MODULE_INFO_SYM;
+
+struct path_list {
+    char **paths;
+    size_t count;
+    size_t size;
+};
+
+struct out_buf {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+struct tar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+enum rewrite {
+    REWRITE_NONE,
+    /* Fields 1, 4, 5, 6 and 8 of /proc/<pid>/stat */
+    REWRITE_STAT,
+    /* The *Pid and *Tgid lines of /proc/<pid>/status */
+    REWRITE_STATUS,
+    /* pid_<n> components of /proc/<pid>/cgroup */
+    REWRITE_CGROUP,
+    /* Any number equal to a captured pid */
+    REWRITE_TABLE,
+};
+
+static pid_t *pids;
+static size_t num_pids;
+/* Pids found in the files that were not captured themselves, for -a */
+static pid_t *extra_pids;
+static size_t num_extra_pids;
+static bool anonymise;
+static time_t capture_time;
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-a] [-r root] [-p pid]... -o archive.tar\n"
+            "  -a  anonymise pids\n"
+            "  -r  read /proc, /sys and /d below root instead\n"
+            "  -p  capture this process only, repeatable\n"
+            "  -o  output archive, - for stdout\n", argv0);
+}
+
+static int compare_pids(const void *a, const void *b)
+{
+    pid_t pa = *(const pid_t *)a;
+    pid_t pb = *(const pid_t *)b;
+
+    return (pa > pb) - (pa < pb);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int push_pid(pid_t **list, size_t *count, pid_t pid)
+{
+    pid_t *grown;
+
+    /* Powers of two are where the array is full */
+    if ((*count & (*count - 1)) == 0) {
+        grown = realloc(*list, (*count ? *count * 2 : 64) * sizeof(pid_t));
+        if (grown == NULL) {
+            return -ENOMEM;
+        }
+        *list = grown;
+    }
+    (*list)[(*count)++] = pid;
+
+    return 0;
+}
+
+static void record_path(void *arg, const char *path)
+{
+    struct path_list *list = arg;
+    char **grown;
+
+    if (list->count == list->size) {
+        grown = realloc(list->paths,
+                        (list->size ? list->size * 2 : 256) * sizeof(char *));
+        if (grown == NULL) {
+            return;
+        }
+        list->paths = grown;
+        list->size = list->size ? list->size * 2 : 256;
+    }
+
+    list->paths[list->count] = strdup(path);
+    if (list->paths[list->count]) {
+        list->count++;
+    }
+}
+
+/* Adds the ancestors of every path, then sorts and drops duplicates */
+static void complete_paths(struct path_list *list)
+{
+    size_t count = list->count;
+    size_t i, unique;
+
+    for (i = 0; i < count; i++) {
+        char *slash = list->paths[i];
+
+        while ((slash = strchr(slash + 1, '/')) != NULL) {
+            *slash = '\0';
+            record_path(list, list->paths[i]);
+            *slash = '/';
+        }
+    }
+
+    qsort(list->paths, list->count, sizeof(char *), compare_paths);
+    for (i = 0, unique = 0; i < list->count; i++) {
+        if (unique && strcmp(list->paths[unique - 1], list->paths[i]) == 0) {
+            free(list->paths[i]);
+            continue;
+        }
+        list->paths[unique++] = list->paths[i];
+    }
+    list->count = unique;
+}
+
+static long map_pid(long pid, bool add)
+{
+    pid_t *found;
+    size_t i;
+
+    found = bsearch(&(pid_t){ pid }, pids, num_pids, sizeof(pid_t),
+                    compare_pids);
+    if (found) {
+        return ANON_PID_BASE + (found - pids);
+    }
+
+    for (i = 0; i < num_extra_pids; i++) {
+        if (extra_pids[i] == pid) {
+            return ANON_PID_BASE + num_pids + i;
+        }
+    }
+    if (!add || pid <= 0 || push_pid(&extra_pids, &num_extra_pids, pid) < 0) {
+        return -1;
+    }
+
+    return ANON_PID_BASE + num_pids + num_extra_pids - 1;
+}
+
+static int out_reserve(struct out_buf *out, size_t len)
+{
+    char *grown;
+    size_t size = out->size ? out->size : 4096;
+
+    while (out->len + len > size) {
+        size *= 2;
+    }
+    if (size != out->size) {
+        grown = realloc(out->data, size);
+        if (grown == NULL) {
+            return -ENOMEM;
+        }
+        out->data = grown;
+        out->size = size;
+    }
+
+    return 0;
+}
+
+static void out_append(struct out_buf *out, const char *data, size_t len)
+{
+    if (out_reserve(out, len) == 0) {
+        memcpy(out->data + out->len, data, len);
+        out->len += len;
+    }
+}
+
+static bool is_word(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '-';
+}
+
+/* Copies data, replacing the whole numbers that are known pids */
+static void rewrite_numbers(struct out_buf *out, const char *data, size_t len,
+                            bool add)
+{
+    size_t i = 0;
+
+    while (i < len) {
+        size_t start = i;
+        char num[24];
+        long mapped;
+
+        if (!isdigit((unsigned char)data[i]) || (i && is_word(data[i - 1]))) {
+            out_append(out, &data[i++], 1);
+            continue;
+        }
+
+        while (i < len && isdigit((unsigned char)data[i])) {
+            i++;
+        }
+        if ((i < len && is_word(data[i])) || i - start >= sizeof(num)) {
+            out_append(out, &data[start], i - start);
+            continue;
+        }
+
+        memcpy(num, &data[start], i - start);
+        num[i - start] = '\0';
+        mapped = map_pid(strtol(num, NULL, 10), add);
+        if (mapped < 0) {
+            out_append(out, &data[start], i - start);
+        } else {
+            snprintf(num, sizeof(num), "%ld", mapped);
+            out_append(out, num, strlen(num));
+        }
+    }
+}
+
+static void rewrite_stat(struct out_buf *out, const char *data, size_t len)
+{
+    const char *comm_end = memrchr(data, ')', len);
+    const char *p, *end = data + len;
+    int field = 2;
+
+    if (comm_end == NULL) {
+        out_append(out, data, len);
+        return;
+    }
+
+    /* Field 1, the pid, then the comm copied as is */
+    p = memchr(data, ' ', comm_end - data);
+    p = p ? p : data;
+    rewrite_numbers(out, data, p - data, true);
+    out_append(out, p, comm_end + 1 - p);
+
+    for (p = comm_end + 1; p < end; ) {
+        const char *token_end;
+
+        if (*p == ' ') {
+            out_append(out, p++, 1);
+            field++;
+            continue;
+        }
+        token_end = p + strcspn(p, " ");
+        if (token_end > end) {
+            token_end = end;
+        }
+        if (field == 4 || field == 5 || field == 6 || field == 8) {
+            rewrite_numbers(out, p, token_end - p, true);
+        } else {
+            out_append(out, p, token_end - p);
+        }
+        p = token_end;
+    }
+}
+
+static void rewrite_lines(struct out_buf *out, const char *data, size_t len,
+                          enum rewrite rewrite)
+{
+    const char *line = data, *end = data + len;
+
+    while (line < end) {
+        const char *eol = memchr(line, '\n', end - line);
+        const char *next = eol ? eol + 1 : end;
+        const char *p = line, *colon, *digits;
+
+        if (rewrite == REWRITE_STATUS) {
+            colon = memchr(line, ':', next - line);
+            if (colon && ((colon - line >= 3 &&
+                           strncasecmp(colon - 3, "pid", 3) == 0) ||
+                          (colon - line >= 4 &&
+                           strncasecmp(colon - 4, "tgid", 4) == 0))) {
+                out_append(out, line, colon - line);
+                rewrite_numbers(out, colon, next - colon, true);
+            } else {
+                out_append(out, line, next - line);
+            }
+            line = next;
+            continue;
+        }
+
+        /* Only the number following pid_ */
+        while ((digits = memmem(p, next - p, "pid_", 4)) != NULL) {
+            digits += 4;
+            out_append(out, p, digits - p);
+            p = digits;
+            while (p < next && isdigit((unsigned char)*p)) {
+                p++;
+            }
+            rewrite_numbers(out, digits, p - digits, true);
+        }
+        out_append(out, p, next - p);
+        line = next;
+    }
+}
+
+static enum rewrite rewrite_of(const char *path)
+{
+    const char *name = strrchr(path, '/') + 1;
+
+    if (strncmp(path, "/proc/", 6) != 0) {
+        return strncmp(path, "/sys/block/", 11) == 0 ? REWRITE_NONE :
+                                                        REWRITE_TABLE;
+    }
+    if (strcmp(name, "stat") == 0) {
+        return REWRITE_STAT;
+    }
+    if (strcmp(name, "status") == 0) {
+        return REWRITE_STATUS;
+    }
+    if (strcmp(name, "cgroup") == 0) {
+        return REWRITE_CGROUP;
+    }
+
+    /* smaps, meminfo, comm, ... hold sizes and names only */
+    return REWRITE_NONE;
+}
+
+/* Maps the components that are a pid, or <pid>_<n> like Mali contexts */
+static void map_path(const char *path, char *out, size_t size)
+{
+    struct out_buf buf = { 0 };
+    const char *p = path;
+
+    while (*p) {
+        size_t len = strcspn(p + 1, "/") + 1;
+        size_t digits = strspn(p + 1, "0123456789");
+
+        if (digits && (digits + 1 == len || p[1 + digits] == '_')) {
+            out_append(&buf, "/", 1);
+            rewrite_numbers(&buf, p + 1, digits, false);
+            out_append(&buf, p + 1 + digits, len - 1 - digits);
+        } else {
+            out_append(&buf, p, len);
+        }
+        p += len;
+    }
+
+    snprintf(out, size, "%.*s", (int)buf.len, buf.data ? buf.data : "");
+    free(buf.data);
+}
+
+/* Reads path below the root in full, sizes of procfs files are 0 */
+static int read_file(const char *path, struct out_buf *out)
+{
+    ssize_t ret;
+    int fd;
+
+    out->len = 0;
+    fd = memtrack_io_open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    do {
+        if (out_reserve(out, 65536 + 1) < 0) {
+            memtrack_io_close(fd);
+            return -ENOMEM;
+        }
+        ret = memtrack_io_read(fd, out->data + out->len, 65536);
+        if (ret > 0) {
+            out->len += ret;
+        }
+    } while (ret > 0 || (ret < 0 && errno == EINTR));
+    memtrack_io_close(fd);
+
+    if (ret < 0) {
+        return -errno;
+    }
+    out->data[out->len] = '\0';
+
+    return 0;
+}
+
+static void octal(char *field, size_t size, unsigned long long value)
+{
+    snprintf(field, size, "%0*llo", (int)size - 1, value);
+}
+
+static int write_header(FILE *fp, const char *path, char type, size_t size)
+{
+    struct tar_header h;
+    const char *name = path + 1;
+    size_t len = strlen(name);
+    const char *split = NULL;
+    unsigned int sum = 0;
+    size_t i;
+
+    memset(&h, 0, sizeof(h));
+
+    /*
+     * Longer names go into prefix and name, split at a slash; both stay
+     * NUL terminated, which ustar readers do not require but tools do.
+     */
+    if (len >= sizeof(h.name)) {
+        for (split = name + len - sizeof(h.name); *split && *split != '/';
+             split++) {
+        }
+        if (*split != '/' || split - name >= (long)sizeof(h.prefix)) {
+            return -ENAMETOOLONG;
+        }
+        memcpy(h.prefix, name, split - name);
+        name = split + 1;
+    }
+    snprintf(h.name, sizeof(h.name), "%s", name);
+
+    octal(h.mode, sizeof(h.mode), type == '5' ? 0755 : 0644);
+    octal(h.uid, sizeof(h.uid), 0);
+    octal(h.gid, sizeof(h.gid), 0);
+    octal(h.size, sizeof(h.size), size);
+    octal(h.mtime, sizeof(h.mtime), capture_time);
+    h.typeflag = type;
+    memcpy(h.magic, "ustar", 6);
+    memcpy(h.version, "00", 2);
+    strcpy(h.uname, "root");
+    strcpy(h.gname, "root");
+
+    memset(h.chksum, ' ', sizeof(h.chksum));
+    for (i = 0; i < sizeof(h); i++) {
+        sum += ((unsigned char *)&h)[i];
+    }
+    snprintf(h.chksum, sizeof(h.chksum), "%06o", sum);
+
+    return fwrite(&h, sizeof(h), 1, fp) == 1 ? 0 : -EIO;
+}
+
+static int write_data(FILE *fp, const char *data, size_t len)
+{
+    static const char zeros[TAR_BLOCK];
+    size_t pad = (TAR_BLOCK - len % TAR_BLOCK) % TAR_BLOCK;
+
+    if (fwrite(data, 1, len, fp) != len || fwrite(zeros, 1, pad, fp) != pad) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int write_entry(FILE *fp, const char *path, struct out_buf *content,
+                       struct out_buf *rewritten, size_t *bytes)
+{
+    char name[PATH_MAX];
+    const struct out_buf *data = content;
+    enum rewrite rewrite;
+    const char *at;
+    struct stat st;
+    int dirfd, ret;
+
+    /* Probed by a provider but missing, e.g. a pid the driver does not know */
+    at = memtrack_io_at(path, &dirfd);
+    if (fstatat(dirfd, at, &st, 0) < 0) {
+        return 0;
+    }
+
+    if (anonymise) {
+        map_path(path, name, sizeof(name));
+    } else {
+        snprintf(name, sizeof(name), "%s", path);
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        return write_header(fp, name, '5', 0);
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    ret = read_file(path, content);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+        return 0;
+    }
+
+    rewrite = anonymise ? rewrite_of(path) : REWRITE_NONE;
+    if (rewrite != REWRITE_NONE) {
+        rewritten->len = 0;
+        if (rewrite == REWRITE_STAT) {
+            rewrite_stat(rewritten, content->data, content->len);
+        } else if (rewrite == REWRITE_TABLE) {
+            rewrite_numbers(rewritten, content->data, content->len, false);
+        } else {
+            rewrite_lines(rewritten, content->data, content->len, rewrite);
+        }
+        data = rewritten;
+    }
+
+    ret = write_header(fp, name, '0', data->len);
+    if (ret == 0) {
+        ret = write_data(fp, data->data, data->len);
+    }
+    *bytes += data->len;
+
+    return ret;
+}
+
+static int list_pids(void)
+{
+    struct memtrack_dir *pdir;
+    const char *name;
+
+    pdir = memtrack_io_opendir("/proc");
+    if (pdir == NULL) {
+        return -errno;
+    }
+
+    while ((name = memtrack_io_readdir(pdir)) != NULL) {
+        if (isdigit((unsigned char)name[0]) &&
+            push_pid(&pids, &num_pids, atoi(name)) < 0) {
+            break;
+        }
+    }
+    memtrack_io_closedir(pdir);
+
+    return 0;
+}
+
+/* Everything the HAL may read about pid, in any configuration */
+static void capture_pid(pid_t pid)
+{
+    struct memtrack_record records[CAPTURE_MAX_RECORDS];
+    uint64_t start_time;
+    char cgroup[256];
+    char path[32];
+    uid_t uid;
+    int type, fd;
+
+    procfs_start_time(pid, &start_time);
+    procfs_identity(pid, &uid, cgroup, sizeof(cgroup));
+
+    /* For memtrack_top */
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    fd = memtrack_io_open(path, O_RDONLY);
+    if (fd >= 0) {
+        memtrack_io_close(fd);
+    }
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        size_t num_records = CAPTURE_MAX_RECORDS;
+
+        if (memtrack_core_enabled(type)) {
+            memtrack_core_read_live(pid, type, records, &num_records, NULL);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct path_list list = { 0 };
+    struct out_buf content = { 0 }, rewritten = { 0 };
+    const char *output = NULL;
+    size_t i, bytes = 0;
+    FILE *fp;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "ar:p:o:h")) != -1) {
+        switch (opt) {
+        case 'a':
+            anonymise = true;
+            break;
+        case 'r':
+            ret = memtrack_io_set_root(optarg);
+            if (ret < 0) {
+                fprintf(stderr, "%s: %s\n", optarg, strerror(-ret));
+                return 1;
+            }
+            break;
+        case 'p':
+            if (push_pid(&pids, &num_pids, atoi(optarg)) < 0) {
+                return 1;
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (output == NULL) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ret = HAL_MODULE_INFO_SYM.init(&HAL_MODULE_INFO_SYM);
+    if (ret < 0) {
+        fprintf(stderr, "memtrack init failed: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    /* Only this thread's opens, a sampler the module may run is ignored */
+    memtrack_io_set_observer(record_path, &list);
+    if (num_pids == 0 && (ret = list_pids()) < 0) {
+        fprintf(stderr, "/proc: %s\n", strerror(-ret));
+        return 1;
+    }
+    qsort(pids, num_pids, sizeof(pid_t), compare_pids);
+    for (i = 0; i < num_pids; i++) {
+        capture_pid(pids[i]);
+    }
+    memtrack_io_set_observer(NULL, NULL);
+
+    complete_paths(&list);
+
+    fp = strcmp(output, "-") == 0 ? stdout : fopen(output, "we");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: %s\n", output, strerror(errno));
+        return 1;
+    }
+
+    capture_time = time(NULL);
+    for (i = 0; i < list.count; i++) {
+        ret = write_entry(fp, list.paths[i], &content, &rewritten, &bytes);
+        if (ret == -ENAMETOOLONG) {
+            fprintf(stderr, "%s: name too long, skipped\n", list.paths[i]);
+        } else if (ret < 0) {
+            fprintf(stderr, "%s: %s\n", output, strerror(-ret));
+            return 1;
+        }
+    }
+
+    /* End of archive, two zero blocks */
+    if (fwrite(&(struct tar_header){ 0 }, TAR_BLOCK, 1, fp) != 1 ||
+        fwrite(&(struct tar_header){ 0 }, TAR_BLOCK, 1, fp) != 1 ||
+        fclose(fp) != 0) {
+        fprintf(stderr, "%s: %s\n", output, strerror(errno));
+        return 1;
+    }
+
+    fprintf(stderr, "captured %zu paths, %zu bytes, %zu processes\n",
+            list.count, bytes, num_pids);
+
+    return 0;
+}
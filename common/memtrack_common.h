@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_COMMON_H_
+#define _MEMTRACK_COMMON_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <hardware/memtrack.h>
+
+/*
+ * Pieces shared by every platform variant, built into
+ * libmemtrack_intel_common.
+ */
+
+typedef int (*memtrack_get_memory_fn)(pid_t pid, enum memtrack_type type,
+                                      struct memtrack_record *records,
+                                      size_t *num_records);
+
+/*
+ * Incremental form of a provider whose cost is a /proc/<pid>/smaps walk,
+ * so the walk can be spread over several deadline bounded calls.  state
+ * is state_size bytes, zeroed before begin().
+ */
+struct memtrack_scan_ops {
+    size_t state_size;
+    /* 1 when the value is known without walking smaps, 0 to walk, -errno */
+    int (*begin)(pid_t pid, void *state);
+    void (*line)(void *state, const char *line);
+    /* error is 0 or the -errno that ended the walk */
+    int (*finish)(pid_t pid, void *state, int error,
+                  struct memtrack_record *records, size_t *num_records);
+};
+
+/*
+ * One of several ways a provider can obtain its answer, e.g. the full
+ * smaps or smaps_rollup.  See source.h for how one is picked per call.
+ */
+struct memtrack_source {
+    const char *name;
+    /* Only used when the configured precision of the type allows it */
+    bool approximate;
+    memtrack_get_memory_fn get_memory;
+    /* Optional, false when the kernel lacks the source; asked once */
+    bool (*available)(void);
+    /*
+     * Reads files behind driver locks that can block; when non-zero the
+     * call runs on a helper thread for at most this long (see guard.h).
+     */
+    uint32_t timeout_ms;
+};
+
+/* Timeout of the sources reading debugfs files under GPU driver locks */
+#define MEMTRACK_DEBUGFS_TIMEOUT_MS 200
+
+/* One backend answering a single memtrack type */
+struct memtrack_provider {
+    const char *name;
+    enum memtrack_type type;
+    memtrack_get_memory_fn get_memory;
+    /* Optional, enables memtrack_core_get_memory_budget() for the type */
+    const struct memtrack_scan_ops *scan;
+    /*
+     * Optional alternatives to get_memory, the first being the reference
+     * that every other one is measured against.
+     */
+    const struct memtrack_source *sources;
+    size_t num_sources;
+};
+
+/*
+ * Registers the platform's providers and starts the optional background
+ * machinery.  The table must stay valid for the lifetime of the module.
+ */
+int memtrack_core_init(const struct memtrack_provider *providers,
+                       size_t count);
+
+/* Returns the provider registered for type, or NULL */
+const struct memtrack_provider *memtrack_core_provider(int type);
+
+/* A provider is registered for type and the configuration enables it */
+bool memtrack_core_enabled(int type);
+
+/*
+ * Loads the runtime configuration again (see config.h) and applies what
+ * can change under running queries.  Returns 0, or -errno with the
+ * previous configuration kept.
+ */
+int memtrack_core_reload_config(void);
+
+/*
+ * getMemory entry point: served from the sampler snapshot when it is
+ * fresh enough, then from the result cache, from the providers otherwise.
+ */
+int memtrack_core_get_memory(pid_t pid, int type,
+                             struct memtrack_record *records,
+                             size_t *num_records);
+
+/*
+ * Same as memtrack_core_get_memory() with an explicit tolerance: neither a
+ * snapshot nor a cached result older than max_age_ms is used.  0 always
+ * reads live.
+ */
+int memtrack_core_get_memory_fresh(pid_t pid, int type,
+                                   struct memtrack_record *records,
+                                   size_t *num_records,
+                                   uint32_t max_age_ms);
+
+/*
+ * Deadline bounded getMemory.  A provider with scan ops works on pid for
+ * at most budget_us per call and resumes where it stopped on the next
+ * call; meanwhile the last complete value is returned with *stale set.
+ * Returns -EAGAIN while no complete value exists yet and -EBUSY when
+ * another thread is working on the same pid and type.  Other providers
+ * are read in full, with *stale set when a source that can block timed
+ * out (see guard.h).
+ */
+int memtrack_core_get_memory_budget(pid_t pid, int type,
+                                    struct memtrack_record *records,
+                                    size_t *num_records,
+                                    uint32_t budget_us, bool *stale);
+
+/* Largest lists kept with every sampler snapshot */
+#define MEMTRACK_TOP_MAX 32
+
+struct memtrack_top_entry {
+    pid_t pid;
+    uint64_t size;
+};
+
+/*
+ * The n processes using the most memory of the types in type_mask
+ * (1 << type each), largest first, from the latest sampler snapshot.  Up
+ * to MEMTRACK_TOP_MAX are kept ready with the snapshot; a larger n is
+ * selected from a copy of it.  Processes using none are left out.
+ * Returns the number of entries, -ENODEV when this process runs no
+ * sampler or -EINVAL for an empty or unknown type_mask.
+ */
+ssize_t memtrack_core_top(unsigned int type_mask,
+                          struct memtrack_top_entry *out, size_t n);
+
+/* Short lowercase name of a memtrack type, "unknown" if out of range */
+const char *memtrack_type_name(int type);
+
+/*
+ * Calls the provider directly, bypassing every snapshot.  *stale, unless
+ * stale is NULL, tells whether a source that can block timed out and the
+ * answer is its last value (see guard.h).
+ */
+int memtrack_core_read_live(pid_t pid, int type,
+                            struct memtrack_record *records,
+                            size_t *num_records, bool *stale);
+
+static inline uint64_t memtrack_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int zram_memtrack_get_memory(pid_t pid, enum memtrack_type type,
+                             struct memtrack_record *records,
+                             size_t *num_records);
+
+/*
+ * With precision.other = approximate, the system wide zram compression
+ * ratio is reused for ttl_ms across queries; 0 reads it with every query.
+ * Otherwise every query reads it.
+ */
+void zram_memtrack_set_ratio_ttl(uint32_t ttl_ms);
+
+/* Reads the zram compression ratio again right away */
+int zram_memtrack_refresh_ratio(void);
+
+/* PSwap from the full smaps, then from smaps_rollup */
+#define ZRAM_MEMTRACK_NUM_SOURCES 2
+extern const struct memtrack_source zram_memtrack_sources[];
+
+extern const struct memtrack_scan_ops zram_scan_ops;
+
+#endif
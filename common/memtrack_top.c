@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * memtrack_top: per-process memtrack usage, refreshed periodically.
+ *
+ * Built with a platform's providers, it runs the regular sampler
+ * in-process.  With an I/O budget (-B, on by default) stable processes
+ * are only sampled again every few seconds, see adaptive.h, which keeps a
+ * 1 Hz refresh of a few hundred processes cheap.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "adaptive.h"
+#include "batch_io.h"
+#include "io_account.h"
+#include "memtrack_common.h"
+#include "sampler.h"
+#include "snapshot.h"
+
+#define TOP_MAX_PIDS 4096
+#define TOP_COMM_MAX 32
+/* Column that sorts by the sum of every type */
+#define SORT_TOTAL -1
+#define SORT_PID -2
+
+extern struct memtrack_module HAL_MODULE_INFO_SYM;
+
+struct row {
+    pid_t pid;
+    uint64_t sizes[MEMTRACK_NUM_TYPES];
+    uint64_t total;
+    char comm[TOP_COMM_MAX];
+};
+
+static int sort_column = SORT_TOTAL;
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-b] [-d interval_ms] [-n iterations] [-N rows]\n"
+            "       [-s total|pid|<provider>|<type>] [-B io_bytes_per_s]"
+            " [-r root]\n"
+            "  -b  CSV output, one block of rows per refresh\n"
+            "  -d  refresh interval, default 1000\n"
+            "  -n  refreshes before exiting, default 0 (forever)\n"
+            "  -N  rows per refresh, default 20, 0 for all\n"
+            "  -s  sort column, default total\n"
+            "  -B  sampler I/O budget, default 4194304, 0 samples every\n"
+            "      process on every refresh\n"
+            "  -r  read /proc, /sys and /d below root, e.g. a captured"
+            " fixture\n", argv0);
+}
+
+static int parse_column(const char *name)
+{
+    int type;
+
+    if (strcmp(name, "total") == 0) {
+        return SORT_TOTAL;
+    }
+    if (strcmp(name, "pid") == 0) {
+        return SORT_PID;
+    }
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        const struct memtrack_provider *provider = memtrack_core_provider(type);
+
+        if (provider && (strcmp(name, provider->name) == 0 ||
+                         strcmp(name, memtrack_type_name(type)) == 0)) {
+            return type;
+        }
+    }
+
+    return -EINVAL;
+}
+
+static uint64_t row_key(const struct row *row)
+{
+    switch (sort_column) {
+    case SORT_TOTAL:
+        return row->total;
+    case SORT_PID:
+        return row->pid;
+    default:
+        return row->sizes[sort_column];
+    }
+}
+
+static int compare_rows(const void *a, const void *b)
+{
+    uint64_t ka = row_key(a);
+    uint64_t kb = row_key(b);
+
+    if (sort_column == SORT_PID) {
+        return (ka > kb) - (ka < kb);
+    }
+
+    return (ka < kb) - (ka > kb);
+}
+
+static void parse_comm(void *arg, const char *data, size_t len)
+{
+    struct row *row = arg;
+
+    snprintf(row->comm, sizeof(row->comm), "%.*s",
+             (int)strcspn(data, "\n"), data);
+}
+
+/* One batch for all the rows that are shown */
+static void read_comms(struct row *rows, size_t count)
+{
+    char paths[64][32];
+    char bufs[64][TOP_COMM_MAX + 1];
+    struct batch_io_req reqs[64];
+    size_t done, i;
+
+    for (done = 0; done < count; done += i) {
+        memset(reqs, 0, sizeof(reqs));
+        for (i = 0; i < 64 && done + i < count; i++) {
+            struct row *row = &rows[done + i];
+
+            strcpy(row->comm, "?");
+            snprintf(paths[i], sizeof(paths[i]), "/proc/%d/comm", row->pid);
+            reqs[i].path = paths[i];
+            reqs[i].buf = bufs[i];
+            reqs[i].buf_size = sizeof(bufs[i]);
+            reqs[i].parse = parse_comm;
+            reqs[i].arg = row;
+        }
+        batch_io_run(reqs, i);
+    }
+}
+
+static size_t build_rows(const pid_t *pids, const struct snapshot_entry *entries,
+                         size_t count, struct row *rows)
+{
+    size_t i, out = 0;
+    int type;
+
+    for (i = 0; i < count; i++) {
+        struct row *row = &rows[out];
+
+        row->pid = pids[i];
+        row->total = 0;
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            size_t r, num = entries[i].num_records[type];
+
+            row->sizes[type] = 0;
+            if (entries[i].ret[type] != 0) {
+                continue;
+            }
+            for (r = 0; r < num && r < SNAPSHOT_MAX_RECORDS; r++) {
+                row->sizes[type] += entries[i].records[type][r].size_in_bytes;
+            }
+            row->total += row->sizes[type];
+        }
+
+        /* Idle processes would only push the interesting ones off screen */
+        if (row->total || sort_column == SORT_PID) {
+            out++;
+        }
+    }
+
+    return out;
+}
+
+static void print_header(bool csv)
+{
+    int type;
+
+    printf(csv ? "timestamp_ms,pid,name" : "\n%7s", "PID");
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        const struct memtrack_provider *provider = memtrack_core_provider(type);
+
+        if (provider) {
+            printf(csv ? ",%s" : " %10s", provider->name);
+        }
+    }
+    printf(csv ? ",total\n" : " %10s  NAME\n", "TOTAL");
+}
+
+static void print_row(const struct row *row, bool csv, uint64_t timestamp_ms)
+{
+    int type;
+
+    if (csv) {
+        printf("%" PRIu64 ",%d,\"%s\"", timestamp_ms, row->pid, row->comm);
+    } else {
+        printf("%7d", row->pid);
+    }
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (memtrack_core_provider(type)) {
+            printf(csv ? ",%" PRIu64 : " %9" PRIu64 "K",
+                   csv ? row->sizes[type] : row->sizes[type] / 1024);
+        }
+    }
+
+    if (csv) {
+        printf(",%" PRIu64 "\n", row->total);
+    } else {
+        printf(" %9" PRIu64 "K  %s\n", row->total / 1024, row->comm);
+    }
+}
+
+static void sleep_ms(uint32_t ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *sort_name = "total";
+    uint32_t interval_ms = 1000;
+    uint64_t budget = 4 * 1024 * 1024;
+    unsigned long iterations = 0, n;
+    size_t max_rows = 20;
+    bool csv = false;
+    pid_t *pids;
+    struct snapshot_entry *entries;
+    struct row *rows;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "bd:n:N:s:B:r:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            csv = true;
+            break;
+        case 'd':
+            interval_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 'N':
+            max_rows = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            sort_name = optarg;
+            break;
+        case 'B':
+            budget = strtoull(optarg, NULL, 0);
+            break;
+        case 'r':
+            ret = memtrack_io_set_root(optarg);
+            if (ret < 0) {
+                fprintf(stderr, "%s: %s\n", optarg, strerror(-ret));
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (interval_ms == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ret = HAL_MODULE_INFO_SYM.init(&HAL_MODULE_INFO_SYM);
+    if (ret < 0) {
+        fprintf(stderr, "memtrack init failed: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    sort_column = parse_column(sort_name);
+    if (sort_column == -EINVAL) {
+        fprintf(stderr, "unknown sort column %s\n", sort_name);
+        return 1;
+    }
+
+    /* The module may already run a sampler configured by properties */
+    if (!memtrack_sampler_running()) {
+        if (budget && adaptive_init(TOP_MAX_PIDS, budget, 10 * interval_ms,
+                                    1024 * 1024) < 0) {
+            fprintf(stderr, "incremental sweeps unavailable\n");
+        }
+        ret = memtrack_sampler_start(interval_ms, TOP_MAX_PIDS);
+        if (ret < 0) {
+            fprintf(stderr, "sampler failed to start: %s\n", strerror(-ret));
+            return 1;
+        }
+    }
+
+    pids = calloc(TOP_MAX_PIDS, sizeof(*pids));
+    entries = calloc(TOP_MAX_PIDS, sizeof(*entries));
+    rows = calloc(TOP_MAX_PIDS, sizeof(*rows));
+    if (pids == NULL || entries == NULL || rows == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    if (csv) {
+        print_header(true);
+    }
+
+    for (n = 0; iterations == 0 || n < iterations; n++) {
+        uint64_t timestamp_ns = 0;
+        ssize_t count;
+        size_t num_rows, shown, i;
+
+        sleep_ms(interval_ms);
+
+        count = snapshot_copy(pids, entries, TOP_MAX_PIDS, &timestamp_ns);
+        if (count <= 0) {
+            /* Before the first sweep or while racing with one */
+            continue;
+        }
+
+        num_rows = build_rows(pids, entries, count, rows);
+        qsort(rows, num_rows, sizeof(*rows), compare_rows);
+        shown = max_rows && max_rows < num_rows ? max_rows : num_rows;
+        read_comms(rows, shown);
+
+        if (!csv) {
+            /* Home and clear, like top */
+            printf("\033[H\033[2Jmemtrack_top: %zd processes, %zu using memory,"
+                   " sampled %" PRIu64 " ms ago\n", count, num_rows,
+                   (memtrack_now_ns() - timestamp_ns) / 1000000);
+            print_header(false);
+        }
+        for (i = 0; i < shown; i++) {
+            print_row(&rows[i], csv, timestamp_ns / 1000000);
+        }
+        fflush(stdout);
+    }
+
+    return 0;
+}
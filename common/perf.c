@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <cutils/log.h>
+
+#include "memtrack_common.h"
+#include "perf.h"
+
+struct perf_thread {
+    int fds[MEMTRACK_PERF_NUM_COUNTERS];
+    /* Position of each counter in a group read, -1 if not opened */
+    int slot[MEMTRACK_PERF_NUM_COUNTERS];
+    int leader;
+    size_t nr;
+    /* The enclosing provider call, -1 outside of one */
+    int type;
+    /* Counted by other threads for the enclosing call */
+    uint64_t offloaded[MEMTRACK_PERF_NUM_COUNTERS];
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} counter_defs[MEMTRACK_PERF_NUM_COUNTERS] = {
+    [MEMTRACK_PERF_CYCLES] =
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    [MEMTRACK_PERF_INSTRUCTIONS] =
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    [MEMTRACK_PERF_CACHE_MISSES] =
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache_misses" },
+    [MEMTRACK_PERF_USER_CYCLES] =
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "user_cycles" },
+    [MEMTRACK_PERF_TASK_CLOCK_NS] =
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task_clock_ns" },
+};
+
+static atomic_bool enabled;
+/* perf_event_paranoid >= 2 only allows counting user space */
+static bool user_only;
+static unsigned int available;
+
+static _Atomic uint64_t counts[MEMTRACK_NUM_TYPES][MEMTRACK_PERF_NUM_PHASES];
+static _Atomic uint64_t totals[MEMTRACK_NUM_TYPES][MEMTRACK_PERF_NUM_PHASES]
+                              [MEMTRACK_PERF_NUM_COUNTERS];
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+static __thread struct perf_thread *local_thread;
+
+static int open_counter(int counter, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_defs[counter].type;
+    attr.config = counter_defs[counter].config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_hv = 1;
+    attr.exclude_kernel = user_only || counter == MEMTRACK_PERF_USER_CYCLES;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd,
+                   PERF_FLAG_FD_CLOEXEC);
+}
+
+static void thread_close(struct perf_thread *t)
+{
+    int i;
+
+    for (i = 0; i < MEMTRACK_PERF_NUM_COUNTERS; i++) {
+        if (t->fds[i] >= 0) {
+            close(t->fds[i]);
+        }
+    }
+}
+
+/*
+ * Opens the counters in mask as one group for the calling thread.  Returns
+ * the mask of the opened ones, *error is the first failure.
+ */
+static unsigned int thread_open(struct perf_thread *t, unsigned int mask,
+                                int *error)
+{
+    unsigned int opened = 0;
+    int i;
+
+    t->leader = -1;
+    t->nr = 0;
+    t->type = -1;
+    *error = 0;
+
+    for (i = 0; i < MEMTRACK_PERF_NUM_COUNTERS; i++) {
+        t->fds[i] = -1;
+        t->slot[i] = -1;
+
+        /* Without kernel counts user cycles would just repeat cycles */
+        if (!(mask & (1u << i)) ||
+            (user_only && i == MEMTRACK_PERF_USER_CYCLES)) {
+            continue;
+        }
+
+        t->fds[i] = open_counter(i, t->leader);
+        if (t->fds[i] < 0) {
+            if (*error == 0) {
+                *error = -errno;
+            }
+            continue;
+        }
+        if (t->leader < 0) {
+            t->leader = t->fds[i];
+        }
+        t->slot[i] = t->nr++;
+        opened |= 1u << i;
+    }
+
+    return opened;
+}
+
+static void thread_release(void *arg)
+{
+    struct perf_thread *t = arg;
+
+    thread_close(t);
+    free(t);
+}
+
+static void thread_key_create(void)
+{
+    pthread_key_create(&thread_key, thread_release);
+}
+
+static struct perf_thread *get_thread(void)
+{
+    struct perf_thread *t = local_thread;
+    int error;
+
+    if (t) {
+        return t->leader >= 0 ? t : NULL;
+    }
+
+    pthread_once(&thread_once, thread_key_create);
+    t = malloc(sizeof(*t));
+    if (t == NULL) {
+        return NULL;
+    }
+    thread_open(t, available, &error);
+
+    pthread_setspecific(thread_key, t);
+    local_thread = t;
+
+    return t->leader >= 0 ? t : NULL;
+}
+
+static bool read_counters(struct perf_thread *t, uint64_t *out)
+{
+    uint64_t buf[3 + MEMTRACK_PERF_NUM_COUNTERS];
+    ssize_t len = sizeof(uint64_t) * (3 + t->nr);
+    int i;
+
+    if (read(t->leader, buf, len) != len || buf[0] != t->nr) {
+        return false;
+    }
+
+    for (i = 0; i < MEMTRACK_PERF_NUM_COUNTERS; i++) {
+        uint64_t value;
+
+        if (t->slot[i] < 0) {
+            out[i] = 0;
+            continue;
+        }
+
+        /* Scale up when the group shared the PMU with other events */
+        value = buf[3 + t->slot[i]];
+        if (buf[2] && buf[2] < buf[1]) {
+            value = (uint64_t)((double)value * buf[1] / buf[2]);
+        }
+        out[i] = value;
+    }
+
+    return true;
+}
+
+static void begin(struct perf_thread *t, struct memtrack_perf_sample *sample)
+{
+    sample->valid = t && read_counters(t, sample->counters);
+}
+
+static void end(struct perf_thread *t, int type, int phase,
+                const struct memtrack_perf_sample *sample)
+{
+    uint64_t now[MEMTRACK_PERF_NUM_COUNTERS];
+    int i;
+
+    if (!read_counters(t, now)) {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&counts[type][phase], 1, memory_order_relaxed);
+    for (i = 0; i < MEMTRACK_PERF_NUM_COUNTERS; i++) {
+        uint64_t value = now[i] - sample->counters[i];
+
+        if (phase == MEMTRACK_PERF_CALL) {
+            value += t->offloaded[i];
+        }
+        atomic_fetch_add_explicit(&totals[type][phase][i], value,
+                                  memory_order_relaxed);
+    }
+}
+
+void memtrack_perf_call_begin(int type, struct memtrack_perf_sample *sample)
+{
+    struct perf_thread *t;
+
+    sample->valid = false;
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed) ||
+        type < 0 || type >= MEMTRACK_NUM_TYPES) {
+        return;
+    }
+
+    t = get_thread();
+    begin(t, sample);
+    if (sample->valid) {
+        t->type = type;
+        memset(t->offloaded, 0, sizeof(t->offloaded));
+    }
+}
+
+void memtrack_perf_call_end(int type, const struct memtrack_perf_sample *sample)
+{
+    if (!sample->valid) {
+        return;
+    }
+
+    end(local_thread, type, MEMTRACK_PERF_CALL, sample);
+    local_thread->type = -1;
+}
+
+void memtrack_perf_parse_begin(struct memtrack_perf_sample *sample)
+{
+    struct perf_thread *t = local_thread;
+
+    sample->valid = false;
+    if (t && t->type >= 0) {
+        begin(t, sample);
+    }
+}
+
+void memtrack_perf_parse_end(const struct memtrack_perf_sample *sample)
+{
+    if (sample->valid) {
+        end(local_thread, local_thread->type, MEMTRACK_PERF_PARSE, sample);
+    }
+}
+
+void memtrack_perf_offload_begin(int type, struct memtrack_perf_sample *sample)
+{
+    memtrack_perf_call_begin(type, sample);
+}
+
+void memtrack_perf_offload_end(const struct memtrack_perf_sample *sample,
+                               struct memtrack_perf_sample *delta)
+{
+    int i;
+
+    delta->valid = sample->valid &&
+                   read_counters(local_thread, delta->counters);
+    if (!sample->valid) {
+        return;
+    }
+
+    for (i = 0; i < MEMTRACK_PERF_NUM_COUNTERS; i++) {
+        delta->counters[i] -= sample->counters[i];
+    }
+    local_thread->type = -1;
+}
+
+void memtrack_perf_offload_add(const struct memtrack_perf_sample *delta)
+{
+    struct perf_thread *t = local_thread;
+    int i;
+
+    if (!delta->valid || t == NULL || t->type < 0) {
+        return;
+    }
+
+    for (i = 0; i < MEMTRACK_PERF_NUM_COUNTERS; i++) {
+        t->offloaded[i] += delta->counters[i];
+    }
+}
+
+int memtrack_perf_init(void)
+{
+    struct perf_thread probe;
+    unsigned int all = (1u << MEMTRACK_PERF_NUM_COUNTERS) - 1;
+    int error;
+
+    available = thread_open(&probe, all, &error);
+    thread_close(&probe);
+
+    if (error == -EACCES) {
+        unsigned int user;
+
+        user_only = true;
+        user = thread_open(&probe, all, &error);
+        thread_close(&probe);
+        if (user) {
+            available = user;
+        } else {
+            user_only = false;
+        }
+    }
+
+    if (available == 0) {
+        ALOGW("perf counters unavailable (%d)", error);
+        return error ? error : -ENODEV;
+    }
+
+    ALOGI("perf counters 0x%x%s", available,
+          user_only ? ", user space only" : "");
+    atomic_store(&enabled, true);
+
+    return 0;
+}
+
+unsigned int memtrack_perf_available(void)
+{
+    return atomic_load(&enabled) ? available : 0;
+}
+
+int memtrack_perf_get(int type, int phase, struct memtrack_perf_stats *stats)
+{
+    int i;
+
+    if (type < 0 || type >= MEMTRACK_NUM_TYPES ||
+        phase < 0 || phase >= MEMTRACK_PERF_NUM_PHASES) {
+        return -EINVAL;
+    }
+
+    stats->count = atomic_load_explicit(&counts[type][phase],
+                                        memory_order_relaxed);
+    for (i = 0; i < MEMTRACK_PERF_NUM_COUNTERS; i++) {
+        stats->counters[i] = atomic_load_explicit(&totals[type][phase][i],
+                                                  memory_order_relaxed);
+    }
+
+    return 0;
+}
+
+struct dump {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static void dump_printf(struct dump *d, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(d->len < d->size ? d->buf + d->len : NULL,
+                  d->len < d->size ? d->size - d->len : 0, fmt, ap);
+    va_end(ap);
+
+    if (n > 0) {
+        d->len += n;
+    }
+}
+
+static void dump_phase(struct dump *d, int type, const char *phase,
+                       const struct memtrack_perf_stats *s)
+{
+    const uint64_t *c = s->counters;
+    int i;
+
+    dump_printf(d, "%s %s %s: count=%" PRIu64,
+                memtrack_core_provider(type)->name, memtrack_type_name(type),
+                phase, s->count);
+    for (i = 0; i < MEMTRACK_PERF_NUM_COUNTERS; i++) {
+        if (memtrack_perf_available() & (1u << i)) {
+            dump_printf(d, " %s=%" PRIu64, counter_defs[i].name, c[i]);
+        }
+    }
+
+    if (c[MEMTRACK_PERF_CYCLES] && c[MEMTRACK_PERF_INSTRUCTIONS]) {
+        dump_printf(d, " ipc=%.2f", (double)c[MEMTRACK_PERF_INSTRUCTIONS] /
+                                    c[MEMTRACK_PERF_CYCLES]);
+    }
+    if (c[MEMTRACK_PERF_INSTRUCTIONS] &&
+        (memtrack_perf_available() & (1u << MEMTRACK_PERF_CACHE_MISSES))) {
+        dump_printf(d, " misses_per_kinstr=%.2f",
+                    1000.0 * c[MEMTRACK_PERF_CACHE_MISSES] /
+                    c[MEMTRACK_PERF_INSTRUCTIONS]);
+    }
+    if (c[MEMTRACK_PERF_CYCLES] &&
+        (memtrack_perf_available() & (1u << MEMTRACK_PERF_USER_CYCLES))) {
+        dump_printf(d, " kernel_pct=%.1f",
+                    100.0 - 100.0 * c[MEMTRACK_PERF_USER_CYCLES] /
+                    c[MEMTRACK_PERF_CYCLES]);
+    }
+    dump_printf(d, "\n");
+}
+
+size_t memtrack_perf_dump(char *buf, size_t size)
+{
+    struct dump d = { buf, size, 0 };
+    int type, i;
+
+    if (size) {
+        buf[0] = '\0';
+    }
+
+    if (!memtrack_perf_available()) {
+        dump_printf(&d, "perf counters disabled\n");
+        return d.len;
+    }
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        struct memtrack_perf_stats call, parse, other;
+
+        if (memtrack_core_provider(type) == NULL) {
+            continue;
+        }
+
+        memtrack_perf_get(type, MEMTRACK_PERF_CALL, &call);
+        memtrack_perf_get(type, MEMTRACK_PERF_PARSE, &parse);
+
+        /* I/O and everything else the provider does besides parsing */
+        other.count = call.count;
+        for (i = 0; i < MEMTRACK_PERF_NUM_COUNTERS; i++) {
+            other.counters[i] = call.counters[i] > parse.counters[i] ?
+                                call.counters[i] - parse.counters[i] : 0;
+        }
+
+        dump_phase(&d, type, "call", &call);
+        dump_phase(&d, type, "parse", &parse);
+        dump_phase(&d, type, "other", &other);
+    }
+
+    return d.len;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_PERF_H_
+#define _MEMTRACK_PERF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hardware counter profiling of the providers, ro.vendor.memtrack.perf_counters.
+ * Built only with -DMEMTRACK_PERF (MEMTRACK_PERF := true in the environment
+ * of the build), otherwise the brackets below compile to nothing.
+ *
+ * Every live provider call, and every parse callback within it, is
+ * bracketed by reads of a per-thread perf_event_open() group.  Counters the
+ * kernel or the CPU refuses are left out: a VM without a PMU still gets the
+ * task clock, and perf_event_paranoid 2 still gets user space counts, only
+ * without the kernel share.
+ */
+
+enum memtrack_perf_counter {
+    MEMTRACK_PERF_CYCLES,
+    MEMTRACK_PERF_INSTRUCTIONS,
+    MEMTRACK_PERF_CACHE_MISSES,
+    /* Cycles spent in user space, the rest of CYCLES is kernel time */
+    MEMTRACK_PERF_USER_CYCLES,
+    MEMTRACK_PERF_TASK_CLOCK_NS,
+    MEMTRACK_PERF_NUM_COUNTERS,
+};
+
+enum memtrack_perf_phase {
+    /* The whole provider call */
+    MEMTRACK_PERF_CALL,
+    /* Parse callbacks run by batch_io during the call */
+    MEMTRACK_PERF_PARSE,
+    MEMTRACK_PERF_NUM_PHASES,
+};
+
+struct memtrack_perf_stats {
+    uint64_t count;
+    uint64_t counters[MEMTRACK_PERF_NUM_COUNTERS];
+};
+
+/* Counter values at the start of a bracketed section */
+struct memtrack_perf_sample {
+    bool valid;
+    uint64_t counters[MEMTRACK_PERF_NUM_COUNTERS];
+};
+
+#ifdef MEMTRACK_PERF
+
+/*
+ * Opens the counters for the calling thread to find out which ones are
+ * usable and enables profiling.  Returns -errno when none is.
+ */
+int memtrack_perf_init(void);
+
+/* Bitmask of the usable counters, 1 << enum memtrack_perf_counter */
+unsigned int memtrack_perf_available(void);
+
+void memtrack_perf_call_begin(int type, struct memtrack_perf_sample *sample);
+void memtrack_perf_call_end(int type, const struct memtrack_perf_sample *sample);
+void memtrack_perf_parse_begin(struct memtrack_perf_sample *sample);
+void memtrack_perf_parse_end(const struct memtrack_perf_sample *sample);
+
+/*
+ * Brackets a provider call run on another thread on behalf of a caller,
+ * see guard.h.  Its parse callbacks count as usual; the call itself is
+ * left in *delta for memtrack_perf_offload_add() on the calling thread,
+ * which charges it to the call the caller is in.
+ */
+void memtrack_perf_offload_begin(int type, struct memtrack_perf_sample *sample);
+void memtrack_perf_offload_end(const struct memtrack_perf_sample *sample,
+                               struct memtrack_perf_sample *delta);
+void memtrack_perf_offload_add(const struct memtrack_perf_sample *delta);
+
+/* Totals of type in phase, -EINVAL when out of range */
+int memtrack_perf_get(int type, int phase, struct memtrack_perf_stats *stats);
+
+/*
+ * Writes IPC, cache misses per thousand instructions and the user/kernel
+ * split per provider and phase.  Returns the length of the full dump like
+ * snprintf().
+ */
+size_t memtrack_perf_dump(char *buf, size_t size);
+
+#else
+
+static inline void memtrack_perf_call_begin(
+    int type, struct memtrack_perf_sample *sample)
+{
+}
+
+static inline void memtrack_perf_call_end(
+    int type, const struct memtrack_perf_sample *sample)
+{
+}
+
+static inline void memtrack_perf_parse_begin(
+    struct memtrack_perf_sample *sample)
+{
+}
+
+static inline void memtrack_perf_parse_end(
+    const struct memtrack_perf_sample *sample)
+{
+}
+
+static inline void memtrack_perf_offload_begin(
+    int type, struct memtrack_perf_sample *sample)
+{
+}
+
+static inline void memtrack_perf_offload_end(
+    const struct memtrack_perf_sample *sample,
+    struct memtrack_perf_sample *delta)
+{
+    delta->valid = false;
+}
+
+static inline void memtrack_perf_offload_add(
+    const struct memtrack_perf_sample *delta)
+{
+}
+
+#endif
+
+#endif
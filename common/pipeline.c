@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "batch_io.h"
+#include "memtrack_common.h"
+#include "pipeline.h"
+
+/* Per-process files read ahead, and the arena space of one pid */
+#define PIPELINE_MAX_FILES 6
+#define PIPELINE_SLOT_BYTES (2 * BATCH_IO_SCRATCH_SIZE)
+#define PIPELINE_PATH_MAX 96
+/* A missed wakeup only costs this much */
+#define PIPELINE_WAIT_NS 10000000
+
+struct spsc {
+    /* Next index to pop, written by the consumer only */
+    atomic_uint head;
+    atomic_bool head_waiting;
+    char pad[64];
+    /* Next index to push, written by the producer only */
+    atomic_uint tail;
+    atomic_bool tail_waiting;
+    unsigned int mask;
+    uint32_t *items;
+};
+
+struct slot {
+    pid_t pid;
+    struct batch_io_prefetch prefetch;
+    struct batch_io_prefetched files[PIPELINE_MAX_FILES];
+    char paths[PIPELINE_MAX_FILES][PIPELINE_PATH_MAX];
+    char *data;
+};
+
+/* A per-process path, prefix<pid>suffix */
+struct path_template {
+    char prefix[PIPELINE_PATH_MAX];
+    char suffix[PIPELINE_PATH_MAX];
+};
+
+static size_t num_slots;
+static struct slot *slots;
+static char *arena;
+/* Filled slots to the sweep thread, empty ones back */
+static struct spsc full_q, free_q;
+
+static pthread_t prefetch_thread;
+static atomic_bool stop;
+static const pid_t *sweep_pids;
+static size_t sweep_count;
+/* The slot the sweep thread is parsing, -1 for none */
+static long held = -1;
+
+/* Read by the prefetch thread, learned by the sweep thread */
+static struct path_template templates[PIPELINE_MAX_FILES];
+static size_t num_templates;
+static struct path_template learned[PIPELINE_MAX_FILES];
+static size_t num_learned;
+
+static struct {
+    atomic_uint_fast64_t sweeps;
+    atomic_uint_fast64_t hits;
+    atomic_uint_fast64_t misses;
+    atomic_uint_fast64_t prefetched_bytes;
+    atomic_uint_fast64_t stall_ns;
+} stats;
+
+static void stat_add(atomic_uint_fast64_t *counter, uint64_t value)
+{
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static int spsc_init(struct spsc *q, size_t capacity)
+{
+    size_t size = 1;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    q->items = calloc(size, sizeof(uint32_t));
+    if (q->items == NULL) {
+        return -ENOMEM;
+    }
+    q->mask = size - 1;
+
+    return 0;
+}
+
+static void futex_wait(atomic_uint *word, unsigned int old)
+{
+    struct timespec ts = { 0, PIPELINE_WAIT_NS };
+
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, old, &ts, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Never fails, a queue holds every slot */
+static void spsc_push(struct spsc *q, uint32_t item)
+{
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    q->items[tail & q->mask] = item;
+    atomic_store(&q->tail, tail + 1);
+    if (atomic_load(&q->tail_waiting)) {
+        futex_wake(&q->tail);
+    }
+}
+
+static bool spsc_pop(struct spsc *q, uint32_t *item)
+{
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (atomic_load_explicit(&q->tail, memory_order_acquire) == head) {
+        return false;
+    }
+
+    *item = q->items[head & q->mask];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+/* Pops an item, sleeping while the queue is empty; false once stopped */
+static bool spsc_pop_wait(struct spsc *q, uint32_t *item)
+{
+    while (!spsc_pop(q, item)) {
+        unsigned int tail;
+
+        if (atomic_load(&stop)) {
+            return false;
+        }
+
+        atomic_store(&q->tail_waiting, true);
+        tail = atomic_load(&q->tail);
+        if (tail == atomic_load_explicit(&q->head, memory_order_relaxed)) {
+            futex_wait(&q->tail, tail);
+        }
+        atomic_store(&q->tail_waiting, false);
+    }
+
+    return true;
+}
+
+static void spsc_reset(struct spsc *q)
+{
+    atomic_store(&q->head, 0);
+    atomic_store(&q->tail, 0);
+}
+
+int pipeline_init(size_t depth)
+{
+    size_t i;
+
+    if (slots) {
+        return 0;
+    }
+    if (depth == 0) {
+        return -EINVAL;
+    }
+
+    arena = malloc(depth * PIPELINE_SLOT_BYTES);
+    slots = calloc(depth, sizeof(struct slot));
+    if (arena == NULL || slots == NULL || spsc_init(&full_q, depth) < 0 ||
+        spsc_init(&free_q, depth) < 0) {
+        free(arena);
+        free(slots);
+        free(full_q.items);
+        free(free_q.items);
+        arena = NULL;
+        slots = NULL;
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < depth; i++) {
+        slots[i].data = arena + i * PIPELINE_SLOT_BYTES;
+    }
+    num_slots = depth;
+
+    return 0;
+}
+
+bool pipeline_enabled(void)
+{
+    return slots != NULL;
+}
+
+struct fill_arg {
+    char *buf;
+    size_t len;
+    bool fits;
+};
+
+static void keep_len(void *arg, const char *data, size_t len)
+{
+    struct fill_arg *fill = arg;
+
+    /* Content that outgrew the slot was read into a heap buffer */
+    fill->fits = data == fill->buf;
+    fill->len = len;
+}
+
+static void fill_slot(struct slot *slot, pid_t pid)
+{
+    size_t used = 0;
+    size_t i, n = 0;
+
+    slot->pid = pid;
+
+    for (i = 0; i < num_templates && used + 2 < PIPELINE_SLOT_BYTES; i++) {
+        struct fill_arg fill = { slot->data + used, 0, false };
+        int len;
+
+        len = snprintf(slot->paths[n], PIPELINE_PATH_MAX, "%s%d%s",
+                       templates[i].prefix, pid, templates[i].suffix);
+        if (len >= PIPELINE_PATH_MAX ||
+            batch_io_read_file(slot->paths[n], fill.buf,
+                               PIPELINE_SLOT_BYTES - used, keep_len,
+                               &fill) < 0 ||
+            !fill.fits) {
+            continue;
+        }
+
+        slot->files[n].path = slot->paths[n];
+        slot->files[n].data = fill.buf;
+        slot->files[n].len = fill.len;
+        stat_add(&stats.prefetched_bytes, fill.len);
+        used += fill.len + 1;
+        n++;
+    }
+
+    slot->prefetch.files = slot->files;
+    slot->prefetch.count = n;
+}
+
+static void *prefetch_main(void *arg)
+{
+    size_t i;
+
+    for (i = 0; i < sweep_count; i++) {
+        uint32_t index;
+
+        if (!spsc_pop_wait(&free_q, &index)) {
+            break;
+        }
+        fill_slot(&slots[index], sweep_pids[i]);
+        spsc_push(&full_q, index);
+    }
+
+    return NULL;
+}
+
+/* Splits path around the component that is pid */
+static void learn(void *arg, const char *path, bool hit)
+{
+    const struct slot *slot = arg;
+    struct path_template t;
+    char component[16];
+    const char *p;
+    size_t i, len;
+
+    stat_add(hit ? &stats.hits : &stats.misses, 1);
+
+    len = snprintf(component, sizeof(component), "/%d", slot->pid);
+    for (p = strstr(path, component); p; p = strstr(p + 1, component)) {
+        if (p[len] == '/' || p[len] == '\0') {
+            break;
+        }
+    }
+    if (p == NULL || (size_t)(p - path) + 1 >= sizeof(t.prefix) ||
+        strlen(p + len) >= sizeof(t.suffix)) {
+        return;
+    }
+
+    snprintf(t.prefix, sizeof(t.prefix), "%.*s", (int)(p - path) + 1, path);
+    snprintf(t.suffix, sizeof(t.suffix), "%s", p + len);
+
+    for (i = 0; i < num_learned; i++) {
+        if (strcmp(learned[i].prefix, t.prefix) == 0 &&
+            strcmp(learned[i].suffix, t.suffix) == 0) {
+            return;
+        }
+    }
+    if (num_learned < PIPELINE_MAX_FILES) {
+        learned[num_learned++] = t;
+    }
+}
+
+int pipeline_begin(const pid_t *pids, size_t count)
+{
+    size_t i;
+    int ret;
+
+    if (slots == NULL) {
+        return -ENODEV;
+    }
+
+    spsc_reset(&full_q);
+    spsc_reset(&free_q);
+    for (i = 0; i < num_slots; i++) {
+        slots[i].prefetch.observe = learn;
+        slots[i].prefetch.arg = &slots[i];
+        spsc_push(&free_q, i);
+    }
+
+    atomic_store(&stop, false);
+    sweep_pids = pids;
+    sweep_count = count;
+    held = -1;
+    num_learned = 0;
+
+    ret = pthread_create(&prefetch_thread, NULL, prefetch_main, NULL);
+    if (ret) {
+        return -ret;
+    }
+    pthread_setname_np(prefetch_thread, "memtrack_prefch");
+    stat_add(&stats.sweeps, 1);
+
+    return 0;
+}
+
+static void release_held(void)
+{
+    batch_io_set_prefetch(NULL);
+    if (held >= 0) {
+        spsc_push(&free_q, held);
+        held = -1;
+    }
+}
+
+void pipeline_next(pid_t pid)
+{
+    uint64_t start_ns = memtrack_now_ns();
+    uint32_t index;
+
+    release_held();
+
+    if (!spsc_pop_wait(&full_q, &index)) {
+        return;
+    }
+    stat_add(&stats.stall_ns, memtrack_now_ns() - start_ns);
+
+    held = index;
+    /* Out of order, the reads go live */
+    if (slots[index].pid == pid) {
+        batch_io_set_prefetch(&slots[index].prefetch);
+    }
+}
+
+void pipeline_end(void)
+{
+    release_held();
+
+    atomic_store(&stop, true);
+    futex_wake(&free_q.tail);
+    pthread_join(prefetch_thread, NULL);
+
+    /* Paths nobody asked for in this sweep are not read in the next */
+    memcpy(templates, learned, sizeof(templates[0]) * num_learned);
+    num_templates = num_learned;
+}
+
+void pipeline_get_stats(struct pipeline_stats *out)
+{
+    out->sweeps = atomic_load(&stats.sweeps);
+    out->hits = atomic_load(&stats.hits);
+    out->misses = atomic_load(&stats.misses);
+    out->prefetched_bytes = atomic_load(&stats.prefetched_bytes);
+    out->stall_ns = atomic_load(&stats.stall_ns);
+}
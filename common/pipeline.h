@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _MEMTRACK_PIPELINE_H_
+#define _MEMTRACK_PIPELINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Pipelined sampler sweeps.
+ *
+ * A prefetch thread reads the per-process files of the pids a sweep is
+ * about to sample, one slot of a fixed arena per pid, while the sweep
+ * thread parses the pid before.  Filled slots travel to the sweep thread
+ * and empty ones back through two bounded single-producer single-consumer
+ * rings, so neither stage takes a lock or allocates once the arena
+ * exists.  The sweep thread installs each slot with
+ * batch_io_set_prefetch(), the providers' reads of those files are then
+ * served from memory.
+ *
+ * The files to prefetch are learned: every path of a sweep that has the
+ * sampled pid as a component, /proc/<pid>/smaps or
+ * /sys/class/drm/card0/gfx_memtrack/<pid>, is read ahead in the next one.
+ */
+
+struct pipeline_stats {
+    uint64_t sweeps;
+    /* Provider reads served from a slot and read live */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t prefetched_bytes;
+    /* Time the sweep thread waited for the prefetch thread */
+    uint64_t stall_ns;
+};
+
+/* Sets up depth slots, 0 or -errno */
+int pipeline_init(size_t depth);
+bool pipeline_enabled(void);
+
+/*
+ * Starts reading ahead for pids, which are sampled in this order and
+ * must stay untouched until pipeline_end().  Returns 0 or -errno, in
+ * which case the sweep reads everything itself.
+ */
+int pipeline_begin(const pid_t *pids, size_t count);
+
+/* Waits for the files of pid, the next one, and installs them */
+void pipeline_next(pid_t pid);
+
+void pipeline_end(void);
+
+void pipeline_get_stats(struct pipeline_stats *stats);
+
+#endif
@@ -0,0 +1,515 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <cutils/log.h>
+
+#include "async.h"
+#include "logging.h"
+#include "memtrack_common.h"
+#include "proc_events.h"
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+/* Recent exits, indexed by pid hash; older ones are overwritten */
+#define EXIT_SLOTS 1024
+/* Pids followed with a pidfd when the connector is unavailable */
+#define WATCH_MAX 256
+#define PREWARM_MAX 64
+/* Prewarm queries handed to the async worker and not reaped yet */
+#define PREWARM_INFLIGHT_MAX (PREWARM_MAX * MEMTRACK_NUM_TYPES)
+#define MAX_LISTENERS 8
+
+#define CONNECTOR_TAG UINT64_MAX
+#define ASYNC_TAG (UINT64_MAX - 1)
+
+static atomic_int mode = PROC_EVENTS_OFF;
+static int epfd = -1;
+static int nl_sock = -1;
+static uint32_t prewarm_delay_ms;
+
+static proc_events_exit_fn listeners[MAX_LISTENERS];
+static size_t nlisteners;
+
+/* pid << 32 | exit time in ms, truncated */
+static _Atomic uint64_t exits[EXIT_SLOTS];
+
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    pid_t pid;
+    int fd;
+} watches[WATCH_MAX];
+static size_t nwatches;
+
+/* Only touched by the tracker thread */
+static struct {
+    pid_t pid;
+    uint64_t due_ns;
+} prewarms[PREWARM_MAX];
+static size_t nprewarms;
+static struct memtrack_async *prewarm_async;
+static size_t prewarm_inflight;
+
+static size_t exit_slot(pid_t pid)
+{
+    return ((uint32_t)pid * 2654435761U) % EXIT_SLOTS;
+}
+
+int proc_events_add_exit_listener(proc_events_exit_fn fn)
+{
+    if (nlisteners == MAX_LISTENERS) {
+        return -ENOSPC;
+    }
+    listeners[nlisteners++] = fn;
+
+    return 0;
+}
+
+static void notify_exit(pid_t pid)
+{
+    uint64_t now_ms = memtrack_now_ns() / 1000000ULL;
+    size_t i;
+
+    atomic_store_explicit(&exits[exit_slot(pid)],
+                          ((uint64_t)(uint32_t)pid << 32) | (uint32_t)now_ms,
+                          memory_order_release);
+
+    for (i = 0; i < nlisteners; i++) {
+        listeners[i](pid);
+    }
+}
+
+bool proc_events_exited_since(pid_t pid, uint64_t since_ns)
+{
+    uint64_t value;
+
+    if (atomic_load_explicit(&mode, memory_order_relaxed) == PROC_EVENTS_OFF) {
+        return false;
+    }
+
+    value = atomic_load_explicit(&exits[exit_slot(pid)],
+                                 memory_order_acquire);
+    if ((pid_t)(value >> 32) != pid) {
+        return false;
+    }
+
+    /* Wrap-safe comparison of the truncated timestamps */
+    return (int32_t)((uint32_t)value - (uint32_t)(since_ns / 1000000ULL)) >= 0;
+}
+
+static int pidfd_open(pid_t pid)
+{
+#ifdef __NR_pidfd_open
+    return syscall(__NR_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void proc_events_watch(pid_t pid)
+{
+    struct epoll_event ev;
+    size_t i;
+    int fd;
+
+    if (atomic_load_explicit(&mode, memory_order_relaxed) != PROC_EVENTS_PIDFD) {
+        return;
+    }
+
+    pthread_mutex_lock(&watch_lock);
+    for (i = 0; i < nwatches; i++) {
+        if (watches[i].pid == pid) {
+            pthread_mutex_unlock(&watch_lock);
+            return;
+        }
+    }
+
+    /* Past the cap, start-time keys still keep results correct */
+    if (nwatches == WATCH_MAX) {
+        pthread_mutex_unlock(&watch_lock);
+        return;
+    }
+
+    fd = pidfd_open(pid);
+    if (fd < 0) {
+        pthread_mutex_unlock(&watch_lock);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((uint64_t)(uint32_t)pid << 32) | (uint32_t)fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        pthread_mutex_unlock(&watch_lock);
+        return;
+    }
+
+    watches[nwatches].pid = pid;
+    watches[nwatches].fd = fd;
+    nwatches++;
+    pthread_mutex_unlock(&watch_lock);
+}
+
+static void handle_pidfd(uint64_t data)
+{
+    pid_t pid = data >> 32;
+    int fd = (int)(uint32_t)data;
+    size_t i;
+
+    pthread_mutex_lock(&watch_lock);
+    for (i = 0; i < nwatches; i++) {
+        if (watches[i].fd == fd) {
+            watches[i] = watches[--nwatches];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&watch_lock);
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+
+    notify_exit(pid);
+}
+
+static void schedule_prewarm(pid_t pid)
+{
+    size_t i;
+
+    if (prewarm_delay_ms == 0) {
+        return;
+    }
+
+    /* exec of a pid already queued only pushes the deadline */
+    for (i = 0; i < nprewarms; i++) {
+        if (prewarms[i].pid == pid) {
+            break;
+        }
+    }
+    if (i == PREWARM_MAX) {
+        return;
+    }
+    if (i == nprewarms) {
+        nprewarms++;
+    }
+
+    prewarms[i].pid = pid;
+    prewarms[i].due_ns = memtrack_now_ns() + prewarm_delay_ms * 1000000ULL;
+}
+
+static void run_prewarms(void)
+{
+    uint64_t now = memtrack_now_ns();
+    size_t i = 0;
+
+    while (i < nprewarms) {
+        pid_t pid = prewarms[i].pid;
+        int type;
+
+        if (prewarms[i].due_ns > now) {
+            i++;
+            continue;
+        }
+
+        prewarms[i] = prewarms[--nprewarms];
+
+        /* Short-lived processes are gone by now */
+        if (kill(pid, 0) < 0 && errno == ESRCH) {
+            continue;
+        }
+
+        /*
+         * The queries run on the async worker, a slow provider must not
+         * keep this thread from draining the connector socket.
+         */
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            struct memtrack_record *record;
+            uint64_t id;
+
+            if (!memtrack_core_enabled(type) ||
+                prewarm_inflight == PREWARM_INFLIGHT_MAX) {
+                continue;
+            }
+
+            record = malloc(sizeof(*record));
+            if (record == NULL) {
+                continue;
+            }
+            /* A prewarm still queued after another delay is not worth it */
+            if (memtrack_async_submit(prewarm_async, pid, type, record, 1,
+                                      prewarm_delay_ms, (uintptr_t)record,
+                                      &id) < 0) {
+                free(record);
+                continue;
+            }
+            prewarm_inflight++;
+        }
+    }
+}
+
+static void reap_prewarms(void)
+{
+    struct memtrack_async_completion done[16];
+    size_t n, i;
+
+    do {
+        n = memtrack_async_reap(prewarm_async, done, ARRAY_SIZE(done));
+        for (i = 0; i < n; i++) {
+            free((void *)(uintptr_t)done[i].cookie);
+        }
+        prewarm_inflight -= n;
+    } while (n == ARRAY_SIZE(done));
+}
+
+static int next_prewarm_timeout_ms(void)
+{
+    uint64_t now = memtrack_now_ns();
+    uint64_t next = UINT64_MAX;
+    size_t i;
+
+    for (i = 0; i < nprewarms; i++) {
+        if (prewarms[i].due_ns < next) {
+            next = prewarms[i].due_ns;
+        }
+    }
+
+    if (next == UINT64_MAX) {
+        return -1;
+    }
+
+    return next <= now ? 0 : (int)((next - now) / 1000000ULL) + 1;
+}
+
+static void handle_connector(void)
+{
+    char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct nlmsghdr *nlh;
+    ssize_t len;
+
+    len = recv(nl_sock, buf, sizeof(buf), MSG_DONTWAIT);
+    if (len < 0) {
+        if (errno == ENOBUFS) {
+            MEMTRACK_LOGW_EVENT("proc_events_overrun",
+                                "proc connector overrun, exit events lost");
+        }
+        return;
+    }
+
+    for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+        struct cn_msg *msg;
+        struct proc_event event;
+
+        if (nlh->nlmsg_type == NLMSG_NOOP) {
+            continue;
+        }
+        if (nlh->nlmsg_type == NLMSG_ERROR || nlh->nlmsg_type == NLMSG_OVERRUN) {
+            break;
+        }
+
+        msg = NLMSG_DATA(nlh);
+        if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC) {
+            continue;
+        }
+
+        /* The event sits at offset 36 of the message, copy it out aligned */
+        if (msg->len < offsetof(struct proc_event, event_data)) {
+            continue;
+        }
+        memset(&event, 0, sizeof(event));
+        memcpy(&event, msg->data,
+               msg->len < sizeof(event) ? msg->len : sizeof(event));
+        switch (event.what) {
+        case PROC_EVENT_EXEC:
+            schedule_prewarm(event.event_data.exec.process_tgid);
+            break;
+        case PROC_EVENT_EXIT:
+            /* Thread exits do not end the process */
+            if (event.event_data.exit.process_pid ==
+                event.event_data.exit.process_tgid) {
+                notify_exit(event.event_data.exit.process_tgid);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static int connector_open(void)
+{
+    char buf[NLMSG_SPACE(sizeof(struct cn_msg) +
+                         sizeof(enum proc_cn_mcast_op))]
+        __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    struct cn_msg *msg = NLMSG_DATA(nlh);
+    enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+    struct sockaddr_nl addr;
+    int sock;
+
+    sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (sock < 0) {
+        return -errno;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        goto err;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+    nlh->nlmsg_type = NLMSG_DONE;
+    nlh->nlmsg_pid = getpid();
+    msg->id.idx = CN_IDX_PROC;
+    msg->id.val = CN_VAL_PROC;
+    msg->len = sizeof(op);
+    memcpy(msg->data, &op, sizeof(op));
+
+    if (send(sock, nlh, nlh->nlmsg_len, 0) < 0) {
+        goto err;
+    }
+
+    return sock;
+
+err:
+    {
+        int ret = -errno;
+
+        close(sock);
+        return ret;
+    }
+}
+
+static void *tracker_thread(void *arg)
+{
+    struct epoll_event events[16];
+
+    while (1) {
+        int n, i;
+
+        n = epoll_wait(epfd, events, ARRAY_SIZE(events),
+                       next_prewarm_timeout_ms());
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.u64 == CONNECTOR_TAG) {
+                handle_connector();
+            } else if (events[i].data.u64 == ASYNC_TAG) {
+                reap_prewarms();
+            } else {
+                handle_pidfd(events[i].data.u64);
+            }
+        }
+
+        run_prewarms();
+    }
+
+    return NULL;
+}
+
+int proc_events_start(uint32_t delay_ms)
+{
+    struct epoll_event ev;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int new_mode;
+    int ret;
+
+    if (atomic_load(&mode) != PROC_EVENTS_OFF || epfd >= 0) {
+        return 0;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        return -errno;
+    }
+
+    nl_sock = connector_open();
+    if (nl_sock >= 0) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = CONNECTOR_TAG;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, nl_sock, &ev);
+        new_mode = PROC_EVENTS_CONNECTOR;
+
+        if (delay_ms) {
+            prewarm_async = memtrack_async_create(1);
+        }
+        if (prewarm_async) {
+            ev.data.u64 = ASYNC_TAG;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, memtrack_async_fd(prewarm_async),
+                      &ev);
+            prewarm_delay_ms = delay_ms;
+        } else if (delay_ms) {
+            ALOGW("no async worker for prewarm queries, prewarm off");
+        }
+    } else {
+        int fd = pidfd_open(getpid());
+
+        if (fd < 0) {
+            ALOGI("no proc connector (%d) nor pidfd, lifecycle tracking off",
+                  nl_sock);
+            close(epfd);
+            epfd = -1;
+            return -ENOSYS;
+        }
+        close(fd);
+        new_mode = PROC_EVENTS_PIDFD;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, tracker_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        if (nl_sock >= 0) {
+            close(nl_sock);
+            nl_sock = -1;
+        }
+        memtrack_async_destroy(prewarm_async);
+        prewarm_async = NULL;
+        prewarm_delay_ms = 0;
+        close(epfd);
+        epfd = -1;
+        return -ret;
+    }
+    pthread_setname_np(thread, "memtrack_procev");
+
+    atomic_store(&mode, new_mode);
+
+    return 0;
+}
+
+enum proc_events_mode proc_events_mode(void)
+{
+    return atomic_load(&mode);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_PROC_EVENTS_H_
+#define _MEMTRACK_PROC_EVENTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Process lifecycle tracker.
+ *
+ * Listens to the netlink proc connector for exec/exit events.  Without
+ * CAP_NET_ADMIN the connector is not available; the tracker then holds a
+ * pidfd for every pid handed to proc_events_watch() and learns about
+ * exits from epoll.  Exits are forwarded to the registered listeners so
+ * per-pid state can be dropped at once, and recorded so that a snapshot
+ * taken before the exit is not used for a reused pid.
+ */
+
+enum proc_events_mode {
+    PROC_EVENTS_OFF,
+    PROC_EVENTS_CONNECTOR,
+    PROC_EVENTS_PIDFD,
+};
+
+typedef void (*proc_events_exit_fn)(pid_t pid);
+
+/*
+ * Starts the tracker thread.  With prewarm_delay_ms != 0, processes that
+ * exec and are still alive that long afterwards get queried once on an
+ * async worker so their first real query hits the cache.
+ */
+int proc_events_start(uint32_t prewarm_delay_ms);
+enum proc_events_mode proc_events_mode(void);
+
+/* Must be called before proc_events_start() */
+int proc_events_add_exit_listener(proc_events_exit_fn fn);
+
+/* pidfd mode only: report the exit of pid, a no-op otherwise */
+void proc_events_watch(pid_t pid);
+
+/* True when pid is known to have exited at or after since_ns */
+bool proc_events_exited_since(pid_t pid, uint64_t since_ns);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "batch_io.h"
+#include "procfs.h"
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+struct start_time_arg {
+    uint64_t start_time;
+    int error;
+};
+
+static void parse_stat(void *arg, const char *data, size_t len)
+{
+    struct start_time_arg *st = arg;
+    const char *p;
+    int field;
+
+    /* comm may contain spaces and parentheses, the fields follow the last ')' */
+    p = strrchr(data, ')');
+    if (p == NULL) {
+        st->error = -EINVAL;
+        return;
+    }
+
+    /* p points before field 3 (state), skip to field 22 (starttime) */
+    for (field = 2; field < 22 && p != NULL; field++) {
+        p = strchr(p + 1, ' ');
+    }
+
+    if (p == NULL || sscanf(p, " %" SCNu64, &st->start_time) != 1) {
+        st->error = -EINVAL;
+    }
+}
+
+int procfs_start_time(pid_t pid, uint64_t *start_time)
+{
+    struct start_time_arg st = { 0, 0 };
+    char path[32];
+    char buf[512];
+    int ret;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    ret = batch_io_read_file(path, buf, sizeof(buf), parse_stat, &st);
+    if (ret < 0) {
+        return ret;
+    }
+    if (st.error) {
+        return st.error;
+    }
+
+    *start_time = st.start_time;
+
+    return 0;
+}
+
+struct identity_arg {
+    uid_t uid;
+    int found_uid;
+    char *cgroup;
+    size_t size;
+    /* 2 for the v1 memory controller, 1 for the v2 hierarchy */
+    int cgroup_rank;
+};
+
+static void parse_status(void *arg, const char *data, size_t len)
+{
+    struct identity_arg *id = arg;
+    const char *p = strstr(data, "\nUid:");
+    unsigned long uid;
+
+    if (p && sscanf(p + 5, "%lu", &uid) == 1) {
+        id->uid = uid;
+        id->found_uid = 1;
+    }
+}
+
+static void parse_cgroup(void *arg, const char *data, size_t len)
+{
+    struct identity_arg *id = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[256];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        char *controllers, *path, *last;
+        int rank;
+
+        /* hierarchy-ID:controller-list:cgroup-path */
+        controllers = strchr(line, ':');
+        path = controllers ? strchr(controllers + 1, ':') : NULL;
+        if (path == NULL) {
+            continue;
+        }
+        *path++ = '\0';
+        controllers++;
+        path[strcspn(path, "\n")] = '\0';
+
+        if (strstr(controllers, "memory") != NULL) {
+            rank = 2;
+        } else if (strcmp(line, "0") == 0 && controllers[0] == '\0') {
+            rank = 1;
+        } else {
+            continue;
+        }
+        if (rank <= id->cgroup_rank) {
+            continue;
+        }
+
+        /* Per-process leaf groups (.../pid_<n>) hold a single process */
+        last = strrchr(path, '/');
+        if (last && last != path && strncmp(last, "/pid_", 5) == 0) {
+            *last = '\0';
+        }
+
+        snprintf(id->cgroup, id->size, "%s", path);
+        id->cgroup_rank = rank;
+    }
+}
+
+int procfs_identity(pid_t pid, uid_t *uid, char *cgroup, size_t size)
+{
+    struct identity_arg id = {
+        .cgroup = cgroup,
+        .size = size,
+    };
+    char status_path[32], cgroup_path[32];
+    char status_buf[2048], cgroup_buf[1024];
+    struct batch_io_req reqs[] = {
+        { status_path, status_buf, sizeof(status_buf), parse_status, &id, 0 },
+        { cgroup_path, cgroup_buf, sizeof(cgroup_buf), parse_cgroup, &id, 0 },
+    };
+
+    snprintf(status_path, sizeof(status_path), "/proc/%d/status", pid);
+    snprintf(cgroup_path, sizeof(cgroup_path), "/proc/%d/cgroup", pid);
+    if (size) {
+        cgroup[0] = '\0';
+    }
+
+    if (batch_io_run(reqs, ARRAY_SIZE(reqs)) && reqs[0].error) {
+        return reqs[0].error;
+    }
+    if (!id.found_uid) {
+        return -EINVAL;
+    }
+
+    *uid = id.uid;
+
+    return 0;
+}
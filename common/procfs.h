@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_PROCFS_H_
+#define _MEMTRACK_PROCFS_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Start time of pid in clock ticks since boot (field 22 of
+ * /proc/<pid>/stat).  Together with the pid it identifies a process
+ * across pid reuse.  Returns 0 or -errno.
+ */
+int procfs_start_time(pid_t pid, uint64_t *start_time);
+
+/*
+ * Real uid of pid and the path of its memory cgroup (the v1 memory
+ * controller, otherwise the v2 hierarchy), read with a single batch.
+ * Returns 0 or -errno.
+ */
+int procfs_identity(pid_t pid, uid_t *uid, char *cgroup, size_t size);
+
+#endif
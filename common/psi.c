@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+#include <cutils/log.h>
+
+#include "batch_io.h"
+#include "io_account.h"
+#include "memtrack_common.h"
+#include "psi.h"
+
+#ifndef PROC_SUPER_MAGIC
+#define PROC_SUPER_MAGIC 0x9fa0
+#endif
+
+/* How often a stand-in file is read */
+#define PSI_POLL_INTERVAL_MS 100
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+static int psi_fd = -1;
+static bool kernel_trigger;
+static char stand_in_path[128];
+/* Stand-in only: avg10 percentage that fires, and the minimum spacing */
+static double fire_avg10;
+static uint64_t window_ns;
+static uint64_t last_fire_ns;
+
+int psi_init(const char *path, const char *trigger)
+{
+    unsigned long stall_us, win_us;
+    char kind[8];
+    struct statfs fs;
+    bool proc;
+    int fd;
+
+    if (sscanf(trigger, "%7s %lu %lu", kind, &stall_us, &win_us) != 3 ||
+        (strcmp(kind, "some") != 0 && strcmp(kind, "full") != 0) ||
+        win_us == 0 || stall_us > win_us) {
+        ALOGE("invalid memtrack PSI trigger \"%s\"", trigger);
+        return -EINVAL;
+    }
+
+    /* Below the I/O root like every other read, see io_account.h */
+    fd = memtrack_io_open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    proc = fstatfs(fd, &fs) == 0 && fs.f_type == PROC_SUPER_MAGIC;
+    memtrack_io_close(fd);
+
+    if (proc) {
+        fd = memtrack_io_open(path, O_RDWR | O_NONBLOCK);
+        if (fd < 0) {
+            return -errno;
+        }
+        if (write(fd, trigger, strlen(trigger) + 1) < 0) {
+            int ret = -errno;
+
+            ALOGE("failed to register PSI trigger on %s: %s", path,
+                  strerror(errno));
+            close(fd);
+            return ret;
+        }
+        psi_fd = fd;
+        kernel_trigger = true;
+        return 0;
+    }
+
+    snprintf(stand_in_path, sizeof(stand_in_path), "%s", path);
+    fire_avg10 = 100.0 * stall_us / win_us;
+    window_ns = win_us * 1000ULL;
+
+    return 0;
+}
+
+static void parse_avg10(void *arg, const char *data, size_t len)
+{
+    double *avg10 = arg;
+
+    sscanf(data, "some avg10=%lf", avg10);
+}
+
+static int wait_stand_in(uint64_t deadline_ns)
+{
+    char buf[256];
+
+    while (1) {
+        uint64_t now = memtrack_now_ns();
+        double avg10 = 0.0;
+        struct timespec ts;
+        uint64_t sleep_ns;
+
+        if (now - last_fire_ns >= window_ns &&
+            batch_io_read_file(stand_in_path, buf, sizeof(buf),
+                               parse_avg10, &avg10) == 0 &&
+            avg10 >= fire_avg10) {
+            last_fire_ns = now;
+            return 1;
+        }
+        if (now >= deadline_ns) {
+            return 0;
+        }
+
+        sleep_ns = min(deadline_ns - now, PSI_POLL_INTERVAL_MS * 1000000ULL);
+        ts.tv_sec = sleep_ns / 1000000000ULL;
+        ts.tv_nsec = sleep_ns % 1000000000ULL;
+        nanosleep(&ts, NULL);
+    }
+}
+
+int psi_wait(uint64_t deadline_ns)
+{
+    struct pollfd pfd;
+    uint64_t now;
+    int ret;
+
+    if (!kernel_trigger) {
+        if (stand_in_path[0] == '\0') {
+            return -ENODEV;
+        }
+        return wait_stand_in(deadline_ns);
+    }
+
+    pfd.fd = psi_fd;
+    pfd.events = POLLPRI;
+
+    while (1) {
+        now = memtrack_now_ns();
+        if (now >= deadline_ns) {
+            return 0;
+        }
+
+        /* Round up so the deadline is never missed by less than 1 ms */
+        ret = poll(&pfd, 1, (deadline_ns - now + 999999) / 1000000);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            return -errno;
+        }
+        if (ret == 0) {
+            return 0;
+        }
+        if (pfd.revents & POLLERR) {
+            return -EIO;
+        }
+        if (pfd.revents & POLLPRI) {
+            return 1;
+        }
+    }
+}
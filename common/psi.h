@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_PSI_H_
+#define _MEMTRACK_PSI_H_
+
+#include <stdint.h>
+
+/*
+ * Memory pressure notifications for the sampler.
+ *
+ * On a PSI file (/proc/pressure/memory) the trigger, e.g.
+ * "some 150000 1000000", is registered with the kernel and events are
+ * delivered as POLLPRI.  Any other file is treated as a stand-in that
+ * holds the same text as the PSI file; it is polled and fires when its
+ * "some avg10" is at least the stall share of the trigger window, at most
+ * once per window.
+ */
+
+int psi_init(const char *path, const char *trigger);
+
+/*
+ * Waits until deadline_ns (CLOCK_MONOTONIC) or until pressure is
+ * signalled.  Returns 1 on pressure, 0 on timeout, -errno on error.
+ */
+int psi_wait(uint64_t deadline_ns);
+
+#endif
@@ -0,0 +1,534 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <cutils/log.h>
+
+#include "adaptive.h"
+#include "aggregate.h"
+#include "history.h"
+#include "io_account.h"
+#include "logging.h"
+#include "memtrack_common.h"
+#include "pipeline.h"
+#include "psi.h"
+#include "sampler.h"
+#include "shared_snapshot.h"
+#include "snapshot.h"
+#include "subscribe.h"
+#include "topn.h"
+#include "trace.h"
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+/* Processes per type refreshed right away when memory pressure fires */
+#define PRESSURE_TOP_N 8
+
+static atomic_bool running;
+static pthread_mutex_t sweep_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Changed by a config reload while the sampler runs */
+static atomic_uint sampler_interval_ms;
+static atomic_uint idle_interval_ms;
+static bool psi_enabled;
+static uint8_t *actions;
+/* The pids a pipelined adaptive sweep samples, in order */
+static pid_t *planned;
+static uint64_t last_sweep_ns;
+
+static int compare_pids(const void *a, const void *b)
+{
+    pid_t pa = *(const pid_t *)a;
+    pid_t pb = *(const pid_t *)b;
+
+    return (pa > pb) - (pa < pb);
+}
+
+/* Fills pids with the numeric entries of /proc, sorted ascending */
+static size_t list_pids(pid_t *pids, size_t capacity)
+{
+    struct memtrack_dir *pdir;
+    const char *name;
+    size_t count = 0;
+
+    pdir = memtrack_io_opendir("/proc");
+    if (pdir == NULL) {
+        return 0;
+    }
+
+    while ((name = memtrack_io_readdir(pdir)) != NULL) {
+        if (!isdigit((unsigned char)name[0])) {
+            continue;
+        }
+        if (count == capacity) {
+            MEMTRACK_LOGW_EVENT("sampler_truncated",
+                                "more than %zu processes, sampler snapshot "
+                                "truncated", capacity);
+            break;
+        }
+        pids[count++] = atoi(name);
+    }
+    memtrack_io_closedir(pdir);
+
+    qsort(pids, count, sizeof(pid_t), compare_pids);
+
+    return count;
+}
+
+static long find_pid(const pid_t *pids, size_t count, pid_t pid)
+{
+    size_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (pids[mid] < pid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (lo < count && pids[lo] == pid) ? (long)lo : -1;
+}
+
+/*
+ * A source that timed out answers with its last value, see guard.h, which
+ * must not be published as sampled now.  The type keeps its entry in prev
+ * instead, and the entry its older sample time; without one it is
+ * published as -ETIMEDOUT.
+ */
+static void sample_pid(const struct snapshot_view *prev, pid_t pid,
+                       struct snapshot_entry *entry)
+{
+    const struct snapshot_entry *old = NULL;
+    long index;
+    int type;
+
+    index = find_pid(prev->pids, prev->count, pid);
+    if (index >= 0) {
+        old = &prev->entries[index];
+    }
+    entry->sampled_ns = memtrack_now_ns();
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        size_t num_records = SNAPSHOT_MAX_RECORDS;
+        bool stale;
+
+        memset(entry->records[type], 0, sizeof(entry->records[type]));
+
+        if (memtrack_core_provider(type) == NULL) {
+            entry->ret[type] = -EINVAL;
+            entry->num_records[type] = 0;
+            continue;
+        }
+
+        entry->ret[type] = memtrack_core_read_live(pid, type,
+                                                   entry->records[type],
+                                                   &num_records, &stale);
+        entry->num_records[type] = num_records > UINT8_MAX ?
+                                   UINT8_MAX : num_records;
+        if (!stale) {
+            continue;
+        }
+
+        if (old == NULL) {
+            entry->ret[type] = -ETIMEDOUT;
+            entry->num_records[type] = 0;
+            continue;
+        }
+        entry->ret[type] = old->ret[type];
+        entry->num_records[type] = old->num_records[type];
+        memcpy(entry->records[type], old->records[type],
+               sizeof(entry->records[type]));
+        entry->sampled_ns = min(entry->sampled_ns, old->sampled_ns);
+    }
+}
+
+/* Bytes read by this thread, other readers do not inflate a pid's cost */
+static uint64_t bytes_read(void)
+{
+    struct memtrack_io_counters io;
+
+    memtrack_io_thread_counters(&io);
+    return io.bytes;
+}
+
+/* Samples only what the scheduler picked, the other known pids keep prev */
+static size_t sample_scheduled(const struct snapshot_view *prev,
+                               struct snapshot_view *view, size_t count,
+                               uint32_t tick_ms)
+{
+    size_t cursor = 0, out = 0;
+    size_t i, num_planned = 0;
+    bool pipelined;
+
+    adaptive_plan(view->pids, count, tick_ms, actions);
+
+    for (i = 0; planned && i < count; i++) {
+        if (actions[i] == ADAPTIVE_SAMPLE) {
+            planned[num_planned++] = view->pids[i];
+        }
+    }
+    pipelined = planned && pipeline_begin(planned, num_planned) == 0;
+
+    for (i = 0; i < count; i++) {
+        pid_t pid = view->pids[i];
+        uint64_t cost = 0;
+
+        if (actions[i] == ADAPTIVE_SAMPLE) {
+            if (pipelined) {
+                pipeline_next(pid);
+            }
+            cost = bytes_read();
+            sample_pid(prev, pid, &view->entries[out]);
+            cost = bytes_read() - cost;
+        } else if (actions[i] == ADAPTIVE_KEEP) {
+            while (cursor < prev->count && prev->pids[cursor] < pid) {
+                cursor++;
+            }
+            if (cursor == prev->count || prev->pids[cursor] != pid) {
+                continue;
+            }
+            view->entries[out] = prev->entries[cursor];
+        } else {
+            continue;
+        }
+
+        /* out <= i, the pids still to be planned are not overwritten */
+        view->pids[out] = pid;
+        adaptive_record(i, pid, &view->entries[out], cost);
+        memtrack_aggregate_add(pid, &view->entries[out]);
+        out++;
+    }
+    adaptive_commit();
+
+    if (pipelined) {
+        pipeline_end();
+    }
+
+    return out;
+}
+
+int memtrack_sampler_sweep(void)
+{
+    struct snapshot_view prev, view;
+    struct memtrack_io_counters io;
+    uint64_t start_ns, tick_ms;
+    uint32_t interval_ms;
+    size_t count, i;
+
+    if (!snapshot_ready()) {
+        return -ENODEV;
+    }
+
+    /* Only one writer may own the inactive buffer */
+    pthread_mutex_lock(&sweep_lock);
+
+    start_ns = memtrack_now_ns();
+    interval_ms = atomic_load_explicit(&sampler_interval_ms,
+                                       memory_order_relaxed);
+    tick_ms = last_sweep_ns ? (start_ns - last_sweep_ns) / 1000000 :
+                              interval_ms;
+    last_sweep_ns = start_ns;
+    memtrack_io_thread_counters(&io);
+    MEMTRACK_TRACE_BEGIN("sweep", 0, NULL);
+
+    snapshot_write_current(&prev);
+    snapshot_write_begin(&view);
+    count = list_pids(view.pids, view.capacity);
+    memtrack_aggregate_begin();
+    if (actions) {
+        /* A long pause must not turn into one huge burst */
+        count = sample_scheduled(&prev, &view, count,
+                                 min(tick_ms, 4 * interval_ms));
+    } else if (pipeline_begin(view.pids, count) == 0) {
+        for (i = 0; i < count; i++) {
+            pipeline_next(view.pids[i]);
+            sample_pid(&prev, view.pids[i], &view.entries[i]);
+            memtrack_aggregate_add(view.pids[i], &view.entries[i]);
+        }
+        pipeline_end();
+    } else {
+        for (i = 0; i < count; i++) {
+            sample_pid(&prev, view.pids[i], &view.entries[i]);
+            memtrack_aggregate_add(view.pids[i], &view.entries[i]);
+        }
+    }
+    snapshot_write_commit(&view, count, start_ns);
+    memtrack_aggregate_commit(start_ns);
+    shared_snapshot_publish(&view);
+    memtrack_history_record(&view);
+
+    /* prev stays intact until the next sweep starts rewriting it */
+    memtrack_subscriptions_notify(&prev, &view);
+
+    MEMTRACK_TRACE_END("sweep", 0);
+    memtrack_io_budget_check(MEMTRACK_IO_SWEEP, NULL, &io);
+    pthread_mutex_unlock(&sweep_lock);
+
+    memtrack_subscriptions_dispatch();
+    MEMTRACK_TRACE_FLUSH(start_ns);
+
+    return 0;
+}
+
+int memtrack_sampler_refresh(const pid_t *pids, size_t count)
+{
+    struct snapshot_view prev, view;
+    size_t i;
+    long index;
+
+    if (!snapshot_ready()) {
+        return -ENODEV;
+    }
+
+    pthread_mutex_lock(&sweep_lock);
+
+    snapshot_write_current(&prev);
+    if (prev.generation == 0) {
+        pthread_mutex_unlock(&sweep_lock);
+        return -EAGAIN;
+    }
+
+    snapshot_write_begin(&view);
+    memcpy(view.pids, prev.pids, prev.count * sizeof(pid_t));
+    memcpy(view.entries, prev.entries,
+           prev.count * sizeof(struct snapshot_entry));
+    for (i = 0; i < count; i++) {
+        index = find_pid(view.pids, prev.count, pids[i]);
+        if (index >= 0) {
+            sample_pid(&prev, pids[i], &view.entries[index]);
+        }
+    }
+    /* The untouched entries still date from the last full sweep */
+    snapshot_write_commit(&view, prev.count, prev.timestamp_ns);
+
+    shared_snapshot_publish(&view);
+    memtrack_subscriptions_notify(&prev, &view);
+
+    pthread_mutex_unlock(&sweep_lock);
+
+    memtrack_subscriptions_dispatch();
+
+    return 0;
+}
+
+static void on_pressure(void)
+{
+    const struct memtrack_provider *other;
+    pid_t pids[PRESSURE_TOP_N * MEMTRACK_NUM_TYPES];
+    struct snapshot_view view;
+    size_t count = 0;
+    size_t i, unique;
+    int type;
+
+    other = memtrack_core_provider(MEMTRACK_TYPE_OTHER);
+    if (other && other->get_memory == zram_memtrack_get_memory) {
+        zram_memtrack_refresh_ratio();
+    }
+
+    pthread_mutex_lock(&sweep_lock);
+    snapshot_write_current(&view);
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        const struct topn_list *top = &view.tops[1u << type];
+
+        for (i = 0; i < top->count && i < PRESSURE_TOP_N; i++) {
+            pids[count++] = top->entries[i].pid;
+        }
+    }
+    pthread_mutex_unlock(&sweep_lock);
+
+    /* A process can be among the largest of several types */
+    qsort(pids, count, sizeof(pid_t), compare_pids);
+    for (i = 0, unique = 0; i < count; i++) {
+        if (unique == 0 || pids[unique - 1] != pids[i]) {
+            pids[unique++] = pids[i];
+        }
+    }
+
+    memtrack_sampler_refresh(pids, unique);
+}
+
+static void sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline_ns / 1000000000ULL;
+    ts.tv_nsec = deadline_ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static void *sampler_thread(void *arg)
+{
+    uint64_t interval_ns, idle_ns, period_ns, now_ns;
+    uint64_t last_pressure_ns = 0;
+    uint64_t next_ns;
+    int ret;
+
+    setpriority(PRIO_PROCESS, 0, 10);
+    next_ns = memtrack_now_ns();
+
+    while (1) {
+        memtrack_sampler_sweep();
+
+        interval_ns = atomic_load_explicit(&sampler_interval_ms,
+                                           memory_order_relaxed) * 1000000ULL;
+        idle_ns = atomic_load_explicit(&idle_interval_ms,
+                                       memory_order_relaxed) * 1000000ULL;
+
+        /* Without recent pressure the sweeps are spread out */
+        now_ns = memtrack_now_ns();
+        if (psi_enabled && idle_ns && now_ns - last_pressure_ns > idle_ns) {
+            period_ns = idle_ns;
+        } else {
+            period_ns = interval_ns;
+        }
+        next_ns += period_ns;
+
+        /*
+         * Skip the missed periods instead of sweeping back to back, the
+         * next sweep starts on the first period boundary after now.
+         */
+        if (next_ns <= now_ns) {
+            next_ns += ((now_ns - next_ns) / period_ns + 1) * period_ns;
+        }
+
+        if (!psi_enabled) {
+            sleep_until(next_ns);
+            continue;
+        }
+
+        while ((ret = psi_wait(next_ns)) > 0) {
+            on_pressure();
+            last_pressure_ns = memtrack_now_ns();
+            if (next_ns > last_pressure_ns + interval_ns) {
+                next_ns = last_pressure_ns + interval_ns;
+            }
+        }
+        if (ret < 0) {
+            ALOGW("memtrack PSI wait failed: %d, sampling at a fixed rate",
+                  ret);
+            psi_enabled = false;
+            sleep_until(next_ns);
+        }
+    }
+
+    return NULL;
+}
+
+int memtrack_sampler_set_pressure(const char *psi_path, const char *trigger,
+                                  uint32_t idle_ms)
+{
+    int ret;
+
+    if (atomic_load(&running)) {
+        return -EBUSY;
+    }
+
+    ret = psi_init(psi_path, trigger);
+    if (ret < 0) {
+        return ret;
+    }
+
+    atomic_store(&idle_interval_ms, idle_ms);
+    psi_enabled = true;
+
+    return 0;
+}
+
+int memtrack_sampler_set_pipeline(size_t depth)
+{
+    return pipeline_init(depth);
+}
+
+int memtrack_sampler_start(uint32_t interval_ms, size_t max_pids)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    bool expected = false;
+    int ret;
+
+    if (interval_ms == 0 || max_pids == 0) {
+        return -EINVAL;
+    }
+
+    if (!atomic_compare_exchange_strong(&running, &expected, true)) {
+        return 0;
+    }
+
+    ret = snapshot_init(max_pids);
+    if (ret < 0) {
+        atomic_store(&running, false);
+        return ret;
+    }
+
+    /* Without it every sweep samples every pid */
+    if (adaptive_enabled()) {
+        actions = malloc(max_pids);
+        if (actions && pipeline_enabled()) {
+            planned = malloc(max_pids * sizeof(pid_t));
+        }
+    }
+
+    atomic_store(&sampler_interval_ms, interval_ms);
+    if (atomic_load(&idle_interval_ms) < interval_ms) {
+        atomic_store(&idle_interval_ms, interval_ms);
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, sampler_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        ALOGE("failed to start memtrack sampler: %d", ret);
+        atomic_store(&running, false);
+        return -ret;
+    }
+
+    pthread_setname_np(thread, "memtrack_smplr");
+
+    return 0;
+}
+
+bool memtrack_sampler_running(void)
+{
+    return atomic_load(&running);
+}
+
+int memtrack_sampler_set_interval(uint32_t interval_ms, uint32_t idle_ms)
+{
+    if (interval_ms == 0) {
+        return -EINVAL;
+    }
+    if (!atomic_load(&running)) {
+        return -ENODEV;
+    }
+
+    /* Picked up after the sweep in progress */
+    atomic_store(&sampler_interval_ms, interval_ms);
+    atomic_store(&idle_interval_ms, idle_ms > interval_ms ? idle_ms :
+                                                            interval_ms);
+
+    return 0;
+}
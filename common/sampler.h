@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_SAMPLER_H_
+#define _MEMTRACK_SAMPLER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Background thread refreshing the pid -> records snapshot every
+ * interval_ms with the registered providers.  Only one sampler runs per
+ * process; later calls are no-ops.
+ */
+int memtrack_sampler_start(uint32_t interval_ms, size_t max_pids);
+bool memtrack_sampler_running(void);
+
+/*
+ * Changes the intervals of the running sampler from its next period on.
+ * Returns -ENODEV when no sampler runs.
+ */
+int memtrack_sampler_set_interval(uint32_t interval_ms, uint32_t idle_ms);
+
+/* Runs one full sweep on the calling thread and publishes it */
+int memtrack_sampler_sweep(void);
+
+/*
+ * Samples pids again and publishes them with the rest of the current
+ * snapshot unchanged.  pids missing from the snapshot are ignored.
+ */
+int memtrack_sampler_refresh(const pid_t *pids, size_t count);
+
+/*
+ * Must be called before memtrack_sampler_start().  While the PSI trigger
+ * does not fire the sampler only sweeps every idle_ms; when it fires the
+ * zram ratio and the largest processes of every type are refreshed at
+ * once and the regular interval is used again.
+ */
+int memtrack_sampler_set_pressure(const char *psi_path, const char *trigger,
+                                  uint32_t idle_ms);
+
+/*
+ * Must be called before memtrack_sampler_start().  Sweeps read the files
+ * of the next depth pids on a second thread while they parse the current
+ * one, see pipeline.h.
+ */
+int memtrack_sampler_set_pipeline(size_t depth);
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "io_account.h"
+#include "memtrack_common.h"
+#include "procfs.h"
+#include "scan.h"
+
+#define SCAN_SLOTS 32
+#define SCAN_STATE_MAX 64
+/* A call overruns its deadline by at most one read of this size */
+#define SCAN_CHUNK 8192
+#define SCAN_LINE_MAX 1024
+#define SCAN_MAX_RECORDS 1
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+struct scan_slot {
+    pthread_mutex_t lock;
+    pid_t pid;
+    int type;
+    uint64_t start_time;
+    uint64_t used_ns;
+    /* Walk in progress: fd is open and state holds the parse so far */
+    bool walking;
+    int fd;
+    size_t carry_len;
+    char carry[SCAN_LINE_MAX];
+    uint64_t state[SCAN_STATE_MAX / sizeof(uint64_t)];
+    /* Result of the last completed walk */
+    bool have_last;
+    int last_ret;
+    size_t last_num;
+    struct memtrack_record last[SCAN_MAX_RECORDS];
+};
+
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct scan_slot slots[SCAN_SLOTS];
+static pthread_once_t slots_once = PTHREAD_ONCE_INIT;
+
+static void slots_init(void)
+{
+    size_t i;
+
+    for (i = 0; i < SCAN_SLOTS; i++) {
+        pthread_mutex_init(&slots[i].lock, NULL);
+    }
+}
+
+static void slot_reset(struct scan_slot *slot, pid_t pid, int type,
+                       uint64_t start_time)
+{
+    if (slot->walking) {
+        memtrack_io_close(slot->fd);
+    }
+    slot->walking = false;
+    slot->have_last = false;
+    slot->pid = pid;
+    slot->type = type;
+    slot->start_time = start_time;
+}
+
+/*
+ * Returns the locked cursor of (pid, type), recycling the least recently
+ * used idle one.  NULL when it is held by another thread.
+ */
+static struct scan_slot *slot_acquire(pid_t pid, int type,
+                                      uint64_t start_time)
+{
+    struct scan_slot *victim = NULL;
+    size_t i;
+
+    pthread_once(&slots_once, slots_init);
+    pthread_mutex_lock(&table_lock);
+
+    for (i = 0; i < SCAN_SLOTS; i++) {
+        struct scan_slot *slot = &slots[i];
+
+        if (slot->pid != pid || slot->type != type) {
+            continue;
+        }
+        if (pthread_mutex_trylock(&slot->lock)) {
+            pthread_mutex_unlock(&table_lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&table_lock);
+
+        if (slot->start_time != start_time) {
+            slot_reset(slot, pid, type, start_time);
+        }
+        return slot;
+    }
+
+    for (i = 0; i < SCAN_SLOTS; i++) {
+        struct scan_slot *slot = &slots[i];
+
+        if (victim && slot->used_ns >= victim->used_ns) {
+            continue;
+        }
+        if (pthread_mutex_trylock(&slot->lock)) {
+            continue;
+        }
+        if (victim) {
+            pthread_mutex_unlock(&victim->lock);
+        }
+        victim = slot;
+    }
+    if (victim) {
+        slot_reset(victim, pid, type, start_time);
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    return victim;
+}
+
+static void copy_result(const struct scan_slot *slot,
+                        struct memtrack_record *records, size_t *num_records)
+{
+    memcpy(records, slot->last,
+           sizeof(struct memtrack_record) *
+           min(min(*num_records, slot->last_num), SCAN_MAX_RECORDS));
+    *num_records = slot->last_num;
+}
+
+static void complete(struct scan_slot *slot, pid_t pid,
+                     const struct memtrack_scan_ops *ops, int error)
+{
+    if (slot->walking) {
+        memtrack_io_close(slot->fd);
+        slot->walking = false;
+    }
+
+    slot->last_num = SCAN_MAX_RECORDS;
+    slot->last_ret = ops->finish(pid, slot->state, error, slot->last,
+                                 &slot->last_num);
+    slot->have_last = true;
+}
+
+static void feed(struct scan_slot *slot, const struct memtrack_scan_ops *ops,
+                 const char *data, size_t len)
+{
+    const char *end = data + len;
+
+    while (data < end) {
+        const char *nl = memchr(data, '\n', end - data);
+        size_t n = (nl ? nl + 1 : end) - data;
+        size_t room = sizeof(slot->carry) - 1 - slot->carry_len;
+
+        /* Overlong lines are cut, like fgets() into a fixed buffer would */
+        memcpy(slot->carry + slot->carry_len, data, min(n, room));
+        slot->carry_len += min(n, room);
+        data += n;
+
+        if (nl) {
+            slot->carry[slot->carry_len] = '\0';
+            ops->line(slot->state, slot->carry);
+            slot->carry_len = 0;
+        }
+    }
+}
+
+/* Returns 1 once the walk completed, 0 when the deadline passed first */
+static int walk(struct scan_slot *slot, pid_t pid,
+                const struct memtrack_scan_ops *ops, uint64_t deadline_ns)
+{
+    char buf[SCAN_CHUNK];
+    char path[32];
+    int ret;
+
+    if (!slot->walking) {
+        memset(slot->state, 0, ops->state_size);
+        ret = ops->begin(pid, slot->state);
+        if (ret != 0) {
+            complete(slot, pid, ops, ret < 0 ? ret : 0);
+            return 1;
+        }
+
+        snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+        slot->fd = memtrack_io_open(path, O_RDONLY);
+        if (slot->fd < 0) {
+            complete(slot, pid, ops, -errno);
+            return 1;
+        }
+        slot->walking = true;
+        slot->carry_len = 0;
+    }
+
+    /* At least one chunk per call, so every call makes progress */
+    do {
+        ssize_t n = memtrack_io_read(slot->fd, buf, sizeof(buf));
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            complete(slot, pid, ops, -errno);
+            return 1;
+        }
+        if (n == 0) {
+            if (slot->carry_len) {
+                slot->carry[slot->carry_len] = '\0';
+                ops->line(slot->state, slot->carry);
+            }
+            complete(slot, pid, ops, 0);
+            return 1;
+        }
+        feed(slot, ops, buf, n);
+    } while (memtrack_now_ns() < deadline_ns);
+
+    return 0;
+}
+
+int memtrack_scan_run(pid_t pid, int type, const struct memtrack_scan_ops *ops,
+                      struct memtrack_record *records, size_t *num_records,
+                      uint64_t deadline_ns, bool *stale)
+{
+    struct scan_slot *slot;
+    uint64_t start_time;
+    int ret;
+
+    if (ops->state_size > SCAN_STATE_MAX) {
+        return -EINVAL;
+    }
+
+    ret = procfs_start_time(pid, &start_time);
+    if (ret < 0) {
+        return ret;
+    }
+
+    slot = slot_acquire(pid, type, start_time);
+    if (slot == NULL) {
+        return -EBUSY;
+    }
+    slot->used_ns = memtrack_now_ns();
+
+    if (walk(slot, pid, ops, deadline_ns)) {
+        *stale = false;
+    } else if (slot->have_last) {
+        *stale = true;
+    } else {
+        pthread_mutex_unlock(&slot->lock);
+        return -EAGAIN;
+    }
+
+    copy_result(slot, records, num_records);
+    ret = slot->last_ret;
+    pthread_mutex_unlock(&slot->lock);
+
+    return ret;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_SCAN_H_
+#define _MEMTRACK_SCAN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "memtrack_common.h"
+
+/*
+ * Resumable smaps walks.  A fixed table of cursors keyed by (pid, type)
+ * keeps the open smaps file, the partial last line and the provider's
+ * parse state between calls, plus the last value a walk completed with.
+ * A cursor whose process was replaced (new start time) starts over.
+ */
+
+/*
+ * Runs ops for (pid, type) until the walk completes or deadline_ns
+ * (CLOCK_MONOTONIC) passes.  Same return values as
+ * memtrack_core_get_memory_budget().
+ */
+int memtrack_scan_run(pid_t pid, int type, const struct memtrack_scan_ops *ops,
+                      struct memtrack_record *records, size_t *num_records,
+                      uint64_t deadline_ns, bool *stale);
+
+#endif
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cutils/log.h>
+
+#include "memtrack_common.h"
+#include "proc_events.h"
+#include "shared_snapshot.h"
+
+/* How often a reader without a usable file looks for one again */
+#define SHARED_SNAPSHOT_RETRY_NS 1000000000ULL
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+/* Snapshots can name every process on the device, see shared_snapshot.h */
+#define SHARED_SNAPSHOT_MODE 0640
+
+struct shared_layout {
+    size_t pids;
+    size_t sampled_ns;
+    size_t sizes;
+    size_t flags;
+    size_t rets;
+    size_t num_records;
+    size_t total;
+};
+
+struct shared_map {
+    const uint8_t *base;
+    size_t size;
+    const struct shared_snapshot_header *header;
+    struct shared_layout layout;
+};
+
+static char snapshot_path[PATH_MAX];
+static char tmp_path[PATH_MAX];
+
+/* Writer state */
+static int published_fd = -1;
+static uint8_t *write_buf;
+static size_t write_buf_size;
+
+/* Reader state, the rwlock only keeps a remap from unmapping under a lookup */
+static pthread_rwlock_t map_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t remap_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shared_map map;
+static _Atomic uint64_t next_attempt_ns;
+static bool reader;
+
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+static void layout_of(size_t count, struct shared_layout *layout)
+{
+    size_t types = MEMTRACK_NUM_TYPES;
+
+    layout->pids = align8(sizeof(struct shared_snapshot_header));
+    layout->sampled_ns = align8(layout->pids + count * sizeof(pid_t));
+    layout->sizes = layout->sampled_ns + count * sizeof(uint64_t);
+    layout->flags = layout->sizes + types * count * sizeof(uint64_t);
+    layout->rets = layout->flags + types * count * sizeof(uint32_t);
+    layout->num_records = layout->rets + types * count * sizeof(int32_t);
+    layout->total = layout->num_records + types * count * sizeof(uint8_t);
+}
+
+int shared_snapshot_init(const char *path)
+{
+    char lock_path[PATH_MAX];
+    int fd;
+
+    if (snprintf(snapshot_path, sizeof(snapshot_path), "%s", path) >=
+            (int)sizeof(snapshot_path) ||
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+            (int)sizeof(tmp_path) ||
+        snprintf(lock_path, sizeof(lock_path), "%s.lock", path) >=
+            (int)sizeof(lock_path)) {
+        return -ENAMETOOLONG;
+    }
+
+    /* Held for the life of the process, released by the kernel on exit */
+    fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, SHARED_SNAPSHOT_MODE);
+    if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        return 1;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    reader = true;
+
+    return 0;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, data, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+void shared_snapshot_publish(const struct snapshot_view *view)
+{
+    struct shared_snapshot_header *header;
+    struct shared_layout layout;
+    uint32_t superseded = 1;
+    size_t count = view->count;
+    size_t i;
+    int type;
+    int fd;
+
+    if (snapshot_path[0] == '\0' || reader) {
+        return;
+    }
+
+    layout_of(count, &layout);
+    if (layout.total > write_buf_size) {
+        uint8_t *buf = realloc(write_buf, layout.total);
+
+        if (buf == NULL) {
+            return;
+        }
+        write_buf = buf;
+        write_buf_size = layout.total;
+    }
+
+    memset(write_buf, 0, layout.total);
+    header = (struct shared_snapshot_header *)write_buf;
+    header->magic = SHARED_SNAPSHOT_MAGIC;
+    header->version = SHARED_SNAPSHOT_VERSION;
+    header->num_types = MEMTRACK_NUM_TYPES;
+    header->count = count;
+    header->generation = view->generation;
+    header->timestamp_ns = view->timestamp_ns;
+
+    memcpy(write_buf + layout.pids, view->pids, count * sizeof(pid_t));
+    for (i = 0; i < count; i++) {
+        ((uint64_t *)(write_buf + layout.sampled_ns))[i] =
+            view->entries[i].sampled_ns;
+    }
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        uint64_t *sizes = (uint64_t *)(write_buf + layout.sizes) + type * count;
+        uint32_t *flags = (uint32_t *)(write_buf + layout.flags) + type * count;
+        int32_t *rets = (int32_t *)(write_buf + layout.rets) + type * count;
+        uint8_t *num_records = write_buf + layout.num_records + type * count;
+
+        for (i = 0; i < count; i++) {
+            const struct snapshot_entry *entry = &view->entries[i];
+
+            sizes[i] = entry->records[type][0].size_in_bytes;
+            flags[i] = entry->records[type][0].flags;
+            rets[i] = entry->ret[type];
+            num_records[i] = entry->num_records[type];
+        }
+    }
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, SHARED_SNAPSHOT_MODE);
+    if (fd < 0) {
+        return;
+    }
+    if (!write_all(fd, write_buf, layout.total) ||
+        rename(tmp_path, snapshot_path) < 0) {
+        ALOGW("failed to publish memtrack snapshot %s: %s", snapshot_path,
+              strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return;
+    }
+
+    /* Readers of the old inode see the flag through their shared mapping */
+    if (published_fd >= 0) {
+        pwrite(published_fd, &superseded, sizeof(superseded),
+               offsetof(struct shared_snapshot_header, superseded));
+        close(published_fd);
+    }
+    published_fd = fd;
+}
+
+static bool map_valid(const struct shared_map *m)
+{
+    const struct shared_snapshot_header *header = m->header;
+    struct shared_layout layout;
+
+    if (m->size < sizeof(*header) ||
+        header->magic != SHARED_SNAPSHOT_MAGIC ||
+        header->version != SHARED_SNAPSHOT_VERSION ||
+        header->num_types != MEMTRACK_NUM_TYPES) {
+        return false;
+    }
+
+    layout_of(header->count, &layout);
+
+    return layout.total <= m->size;
+}
+
+/*
+ * Replaces the current mapping with the file at snapshot_path, false when
+ * there is no valid one
+ */
+static bool remap(void)
+{
+    struct shared_map next = { 0 };
+    struct stat st;
+    void *base;
+    int fd;
+
+    fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    next.base = base;
+    next.size = st.st_size;
+    next.header = base;
+    if (!map_valid(&next)) {
+        munmap(base, st.st_size);
+        return false;
+    }
+    layout_of(next.header->count, &next.layout);
+
+    pthread_rwlock_wrlock(&map_lock);
+    if (map.base) {
+        munmap((void *)map.base, map.size);
+    }
+    map = next;
+    pthread_rwlock_unlock(&map_lock);
+
+    return true;
+}
+
+static bool map_current(void)
+{
+    return map.base &&
+           !atomic_load_explicit((atomic_uint *)&map.header->superseded,
+                                 memory_order_acquire);
+}
+
+/* Called without map_lock held */
+static void refresh(uint64_t now)
+{
+    bool current;
+
+    pthread_rwlock_rdlock(&map_lock);
+    current = map_current();
+    pthread_rwlock_unlock(&map_lock);
+    if (current) {
+        return;
+    }
+
+    /* A missing or broken file is only looked for again after a while */
+    if (now < atomic_load_explicit(&next_attempt_ns, memory_order_relaxed) ||
+        pthread_mutex_trylock(&remap_lock)) {
+        return;
+    }
+    if (!remap()) {
+        atomic_store_explicit(&next_attempt_ns,
+                              now + SHARED_SNAPSHOT_RETRY_NS,
+                              memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&remap_lock);
+}
+
+static long find_pid(const pid_t *pids, size_t count, pid_t pid)
+{
+    size_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (pids[mid] < pid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (lo < count && pids[lo] == pid) ? (long)lo : -1;
+}
+
+bool shared_snapshot_lookup(pid_t pid, int type, uint64_t max_age_ns,
+                            struct memtrack_record *records,
+                            size_t *num_records, int *ret)
+{
+    const struct shared_layout *layout;
+    uint64_t now, sampled_ns;
+    size_t count, stored, index;
+    bool found = false;
+    long i;
+
+    if (!reader || type < 0 || type >= MEMTRACK_NUM_TYPES) {
+        return false;
+    }
+
+    now = memtrack_now_ns();
+    refresh(now);
+
+    pthread_rwlock_rdlock(&map_lock);
+    if (map.base == NULL) {
+        goto out;
+    }
+
+    layout = &map.layout;
+    count = map.header->count;
+    i = find_pid((const pid_t *)(map.base + layout->pids), count, pid);
+    if (i < 0) {
+        goto out;
+    }
+
+    /* The pid may already belong to another process */
+    sampled_ns = ((const uint64_t *)(map.base + layout->sampled_ns))[i];
+    if (now - sampled_ns > max_age_ns ||
+        proc_events_exited_since(pid, sampled_ns)) {
+        goto out;
+    }
+
+    index = type * count + i;
+    stored = map.base[layout->num_records + index];
+    if (stored > 1) {
+        goto out;
+    }
+    if (*num_records && stored) {
+        records[0].size_in_bytes =
+            ((const uint64_t *)(map.base + layout->sizes))[index];
+        records[0].flags =
+            ((const uint32_t *)(map.base + layout->flags))[index];
+    }
+    *num_records = stored;
+    *ret = ((const int32_t *)(map.base + layout->rets))[index];
+    found = true;
+
+out:
+    pthread_rwlock_unlock(&map_lock);
+
+    return found;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_SHARED_SNAPSHOT_H_
+#define _MEMTRACK_SHARED_SNAPSHOT_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hardware/memtrack.h>
+
+#include "snapshot.h"
+
+/*
+ * Sampler snapshot shared with the HAL instances of other processes
+ * through a file on tmpfs.
+ *
+ * The instance holding the lock file is the writer: it runs the sampler
+ * and publishes every sweep by writing a new file and renaming it over
+ * the old one, then flags the old one as superseded.  Every other
+ * instance maps the file read-only and answers from it by binary search;
+ * a reader only goes back to the file system once the mapping it holds
+ * has been superseded.  The file is never modified after the rename
+ * apart from that flag.
+ *
+ * The files, <path>, <path>.tmp and <path>.lock, are created 0640: the
+ * snapshot lists every process with its memory use, so it must only be
+ * readable by the HAL's own clients.  <path> is expected in a tmpfs
+ * directory of its own, e.g. /dev/memtrack created by the vendor init.rc
+ * as "mkdir /dev/memtrack 0750 system system", whose group is the one
+ * every process loading the HAL runs with.  The directory and its files
+ * want a dedicated SELinux type, e.g. vendor_memtrack_snapshot_file via
+ * file_contexts and a type_transition for files created in it, that the
+ * domains loading the HAL may create, rename and map, and no one else may
+ * read.
+ *
+ * Layout, all fields native endian:
+ *   struct shared_snapshot_header
+ *   pid_t pids[count]                  (sorted ascending, padded to 8)
+ *   uint64_t sampled_ns[count]         (CLOCK_MONOTONIC)
+ *   for each type: uint64_t sizes[count]
+ *   for each type: uint32_t flags[count]
+ *   for each type: int32_t rets[count]
+ *   for each type: uint8_t num_records[count]
+ */
+
+#define SHARED_SNAPSHOT_MAGIC 0x4e53544d /* "MTSN" */
+#define SHARED_SNAPSHOT_VERSION 2
+
+struct shared_snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_types;
+    uint32_t count;
+    uint64_t generation;
+    /* CLOCK_MONOTONIC ns when the sweep started */
+    uint64_t timestamp_ns;
+    /* Set once a newer file has replaced this one */
+    atomic_uint superseded;
+    uint32_t reserved;
+};
+
+/*
+ * Returns 1 when this instance became the writer, 0 when it is a reader,
+ * or -errno.
+ */
+int shared_snapshot_init(const char *path);
+
+/* Writer only: publishes a committed sweep */
+void shared_snapshot_publish(const struct snapshot_view *view);
+
+/* Reader side, same contract as snapshot_lookup() */
+bool shared_snapshot_lookup(pid_t pid, int type, uint64_t max_age_ns,
+                            struct memtrack_record *records,
+                            size_t *num_records, int *ret);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "singleflight.h"
+
+/* Distinct (pid, type) queries that can be in flight at once */
+#define SINGLEFLIGHT_SLOTS 64
+#define SINGLEFLIGHT_MAX_RECORDS 1
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+struct flight {
+    bool used;
+    bool done;
+    pid_t pid;
+    int type;
+    unsigned int waiters;
+    int ret;
+    bool stale;
+    size_t num_records;
+    struct memtrack_record records[SINGLEFLIGHT_MAX_RECORDS];
+    pthread_cond_t cond;
+};
+
+static struct flight flights[SINGLEFLIGHT_SLOTS];
+static pthread_mutex_t flights_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t flights_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    atomic_uint_fast64_t leaders;
+    atomic_uint_fast64_t coalesced;
+    atomic_uint_fast64_t timeouts;
+    atomic_uint_fast64_t bypassed;
+} stats;
+
+static void stat_inc(atomic_uint_fast64_t *counter)
+{
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static void flights_init(void)
+{
+    pthread_condattr_t attr;
+    int i;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for (i = 0; i < SINGLEFLIGHT_SLOTS; i++) {
+        pthread_cond_init(&flights[i].cond, &attr);
+    }
+    pthread_condattr_destroy(&attr);
+}
+
+static void flight_release(struct flight *flight)
+{
+    if (flight->done && flight->waiters == 0) {
+        flight->used = false;
+    }
+}
+
+/* Waits for the leader of flight, called and returns with flights_lock held */
+static bool flight_wait(struct flight *flight, uint32_t max_wait_ms,
+                        struct memtrack_record *records,
+                        size_t *num_records, int *ret, bool *stale)
+{
+    struct timespec deadline;
+    bool served = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += max_wait_ms / 1000;
+    deadline.tv_nsec += (max_wait_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    flight->waiters++;
+    while (!flight->done) {
+        if (pthread_cond_timedwait(&flight->cond, &flights_lock,
+                                   &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    /* A result that did not fit the flight cannot be shared */
+    if (flight->done && flight->num_records <= SINGLEFLIGHT_MAX_RECORDS) {
+        memcpy(records, flight->records, sizeof(struct memtrack_record) *
+               min(*num_records, flight->num_records));
+        *num_records = flight->num_records;
+        *ret = flight->ret;
+        *stale = flight->stale;
+        served = true;
+    }
+
+    flight->waiters--;
+    flight_release(flight);
+
+    return served;
+}
+
+int memtrack_singleflight(pid_t pid, int type,
+                          struct memtrack_record *records,
+                          size_t *num_records, uint32_t max_wait_ms,
+                          memtrack_singleflight_fn fn, bool *stale)
+{
+    struct flight *flight = NULL;
+    struct flight *free_slot = NULL;
+    size_t allocated = *num_records;
+    int ret;
+    int i;
+
+    if (max_wait_ms == 0 || allocated == 0) {
+        return fn(pid, type, records, num_records, stale);
+    }
+
+    pthread_once(&flights_once, flights_init);
+    pthread_mutex_lock(&flights_lock);
+
+    for (i = 0; i < SINGLEFLIGHT_SLOTS; i++) {
+        if (!flights[i].used) {
+            if (free_slot == NULL) {
+                free_slot = &flights[i];
+            }
+        } else if (!flights[i].done && flights[i].pid == pid &&
+                   flights[i].type == type) {
+            flight = &flights[i];
+            break;
+        }
+    }
+
+    if (flight != NULL) {
+        bool served = flight_wait(flight, max_wait_ms, records,
+                                  num_records, &ret, stale);
+
+        pthread_mutex_unlock(&flights_lock);
+        if (served) {
+            stat_inc(&stats.coalesced);
+            return ret;
+        }
+
+        stat_inc(&stats.timeouts);
+        *num_records = allocated;
+        return fn(pid, type, records, num_records, stale);
+    }
+
+    if (free_slot == NULL) {
+        pthread_mutex_unlock(&flights_lock);
+        stat_inc(&stats.bypassed);
+        return fn(pid, type, records, num_records, stale);
+    }
+
+    flight = free_slot;
+    flight->used = true;
+    flight->done = false;
+    flight->pid = pid;
+    flight->type = type;
+    flight->waiters = 0;
+    pthread_mutex_unlock(&flights_lock);
+
+    stat_inc(&stats.leaders);
+    ret = fn(pid, type, records, num_records, stale);
+
+    pthread_mutex_lock(&flights_lock);
+    flight->ret = ret;
+    flight->stale = *stale;
+    flight->num_records = *num_records;
+    if (*num_records <= min(allocated, SINGLEFLIGHT_MAX_RECORDS)) {
+        memcpy(flight->records, records,
+               sizeof(struct memtrack_record) * *num_records);
+    } else {
+        /* Waiters will see the count and read for themselves */
+        flight->num_records = SIZE_MAX;
+    }
+    flight->done = true;
+    pthread_cond_broadcast(&flight->cond);
+    flight_release(flight);
+    pthread_mutex_unlock(&flights_lock);
+
+    return ret;
+}
+
+void memtrack_singleflight_get_stats(struct memtrack_singleflight_stats *out)
+{
+    out->leaders = atomic_load(&stats.leaders);
+    out->coalesced = atomic_load(&stats.coalesced);
+    out->timeouts = atomic_load(&stats.timeouts);
+    out->bypassed = atomic_load(&stats.bypassed);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_SINGLEFLIGHT_H_
+#define _MEMTRACK_SINGLEFLIGHT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memtrack_common.h"
+
+/*
+ * Coalesces concurrent identical queries.  The first caller for a
+ * (pid, type) runs fn, callers arriving while it runs wait for its result
+ * instead of repeating the I/O.  A waiter that has not been served after
+ * max_wait_ms runs fn itself.  *stale is fn's, shared with the result:
+ * a waiter served with a stale answer gets it flagged stale as well.
+ */
+typedef int (*memtrack_singleflight_fn)(pid_t pid, int type,
+                                        struct memtrack_record *records,
+                                        size_t *num_records, bool *stale);
+
+int memtrack_singleflight(pid_t pid, int type,
+                          struct memtrack_record *records,
+                          size_t *num_records, uint32_t max_wait_ms,
+                          memtrack_singleflight_fn fn, bool *stale);
+
+struct memtrack_singleflight_stats {
+    /* Queries that ran fn as the leader of a flight */
+    uint64_t leaders;
+    /* Queries served with another caller's result */
+    uint64_t coalesced;
+    /* Waiters that gave up and ran fn themselves */
+    uint64_t timeouts;
+    /* Queries that could not join or start a flight (table full) */
+    uint64_t bypassed;
+};
+
+void memtrack_singleflight_get_stats(struct memtrack_singleflight_stats *stats);
+
+#endif
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memtrack_common.h"
+#include "proc_events.h"
+#include "snapshot.h"
+#include "topn.h"
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+/* A reader gives up and reads live data after this many torn reads */
+#define SNAPSHOT_READ_RETRIES 4
+
+struct snapshot_buf {
+    atomic_uint seq;
+    _Atomic uint64_t generation;
+    _Atomic uint64_t timestamp_ns;
+    _Atomic size_t count;
+    pid_t *pids;
+    struct snapshot_entry *entries;
+    struct topn_list *tops;
+};
+
+static struct snapshot_buf bufs[2];
+static size_t capacity;
+static atomic_int active;
+static atomic_bool ready;
+static int writing;
+static uint64_t generation;
+/* Types with a provider, the only ones worth a top list */
+static unsigned int type_mask;
+
+int snapshot_init(size_t max_pids)
+{
+    int i;
+
+    if (atomic_load(&ready)) {
+        return 0;
+    }
+
+    for (i = 0; i < 2; i++) {
+        bufs[i].pids = calloc(max_pids, sizeof(pid_t));
+        bufs[i].entries = calloc(max_pids, sizeof(struct snapshot_entry));
+        bufs[i].tops = calloc(TOPN_MASKS, sizeof(struct topn_list));
+        if (bufs[i].pids == NULL || bufs[i].entries == NULL ||
+            bufs[i].tops == NULL) {
+            free(bufs[0].pids);
+            free(bufs[0].entries);
+            free(bufs[0].tops);
+            free(bufs[1].pids);
+            free(bufs[1].entries);
+            free(bufs[1].tops);
+            memset(bufs, 0, sizeof(bufs));
+            return -ENOMEM;
+        }
+    }
+
+    capacity = max_pids;
+    for (i = 0; i < MEMTRACK_NUM_TYPES; i++) {
+        if (memtrack_core_provider(i)) {
+            type_mask |= 1u << i;
+        }
+    }
+    atomic_store(&ready, true);
+
+    return 0;
+}
+
+bool snapshot_ready(void)
+{
+    return atomic_load(&ready);
+}
+
+static void fill_view(struct snapshot_view *view, struct snapshot_buf *buf)
+{
+    view->generation = atomic_load_explicit(&buf->generation,
+                                            memory_order_relaxed);
+    view->timestamp_ns = atomic_load_explicit(&buf->timestamp_ns,
+                                              memory_order_relaxed);
+    view->count = atomic_load_explicit(&buf->count, memory_order_relaxed);
+    view->capacity = capacity;
+    view->pids = buf->pids;
+    view->entries = buf->entries;
+    view->tops = buf->tops;
+}
+
+void snapshot_write_begin(struct snapshot_view *view)
+{
+    struct snapshot_buf *buf;
+
+    writing = !atomic_load_explicit(&active, memory_order_relaxed);
+    buf = &bufs[writing];
+
+    /* Odd: readers still looking at this buffer will retry */
+    atomic_fetch_add_explicit(&buf->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    fill_view(view, buf);
+}
+
+void snapshot_write_commit(struct snapshot_view *view, size_t count,
+                           uint64_t timestamp_ns)
+{
+    struct snapshot_buf *buf = &bufs[writing];
+
+    count = min(count, capacity);
+    topn_build(buf->entries, buf->pids, count, type_mask, buf->tops);
+
+    atomic_store_explicit(&buf->count, count, memory_order_relaxed);
+    atomic_store_explicit(&buf->timestamp_ns, timestamp_ns,
+                          memory_order_relaxed);
+    atomic_store_explicit(&buf->generation, ++generation,
+                          memory_order_relaxed);
+    atomic_fetch_add_explicit(&buf->seq, 1, memory_order_release);
+    atomic_store_explicit(&active, writing, memory_order_release);
+
+    fill_view(view, buf);
+}
+
+void snapshot_write_current(struct snapshot_view *view)
+{
+    fill_view(view, &bufs[atomic_load_explicit(&active,
+                                               memory_order_relaxed)]);
+}
+
+static long find_pid(const pid_t *pids, size_t count, pid_t pid)
+{
+    size_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (pids[mid] < pid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (lo < count && pids[lo] == pid) ? (long)lo : -1;
+}
+
+bool snapshot_lookup(pid_t pid, int type, uint64_t max_age_ns,
+                     struct memtrack_record *records, size_t *num_records,
+                     int *ret)
+{
+    uint64_t now;
+    int attempt;
+
+    if (!atomic_load_explicit(&ready, memory_order_acquire) ||
+        type < 0 || type >= MEMTRACK_NUM_TYPES) {
+        return false;
+    }
+
+    now = memtrack_now_ns();
+
+    for (attempt = 0; attempt < SNAPSHOT_READ_RETRIES; attempt++) {
+        struct snapshot_buf *buf;
+        struct memtrack_record copy[SNAPSHOT_MAX_RECORDS];
+        uint64_t sampled_ns;
+        unsigned int seq;
+        size_t count, stored;
+        int32_t stored_ret;
+        long index;
+
+        buf = &bufs[atomic_load_explicit(&active, memory_order_acquire)];
+        seq = atomic_load_explicit(&buf->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+
+        count = min(atomic_load_explicit(&buf->count, memory_order_relaxed),
+                    capacity);
+        if (count == 0) {
+            return false;
+        }
+
+        index = find_pid(buf->pids, count, pid);
+        if (index < 0) {
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&buf->seq, memory_order_relaxed) != seq) {
+                continue;
+            }
+            return false;
+        }
+
+        sampled_ns = buf->entries[index].sampled_ns;
+        stored_ret = buf->entries[index].ret[type];
+        stored = buf->entries[index].num_records[type];
+        memcpy(copy, buf->entries[index].records[type], sizeof(copy));
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&buf->seq, memory_order_relaxed) != seq) {
+            continue;
+        }
+
+        /* The pid may already belong to another process */
+        if (stored > SNAPSHOT_MAX_RECORDS || now - sampled_ns > max_age_ns ||
+            proc_events_exited_since(pid, sampled_ns)) {
+            return false;
+        }
+
+        memcpy(records, copy,
+               sizeof(struct memtrack_record) * min(*num_records, stored));
+        *num_records = stored;
+        *ret = stored_ret;
+        return true;
+    }
+
+    return false;
+}
+
+ssize_t snapshot_copy(pid_t *pids, struct snapshot_entry *entries, size_t max,
+                      uint64_t *timestamp_ns)
+{
+    int attempt;
+
+    if (!atomic_load_explicit(&ready, memory_order_acquire)) {
+        return -ENODEV;
+    }
+
+    for (attempt = 0; attempt < SNAPSHOT_READ_RETRIES; attempt++) {
+        struct snapshot_buf *buf;
+        unsigned int seq;
+        size_t count;
+
+        buf = &bufs[atomic_load_explicit(&active, memory_order_acquire)];
+        seq = atomic_load_explicit(&buf->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+
+        count = min(min(atomic_load_explicit(&buf->count, memory_order_relaxed),
+                        capacity), max);
+        *timestamp_ns = atomic_load_explicit(&buf->timestamp_ns,
+                                             memory_order_relaxed);
+        memcpy(pids, buf->pids, sizeof(pid_t) * count);
+        memcpy(entries, buf->entries, sizeof(struct snapshot_entry) * count);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&buf->seq, memory_order_relaxed) == seq) {
+            return count;
+        }
+    }
+
+    return -EAGAIN;
+}
+
+size_t snapshot_capacity(void)
+{
+    return capacity;
+}
+
+ssize_t snapshot_top(unsigned int mask, struct memtrack_top_entry *out,
+                     size_t n)
+{
+    int attempt;
+
+    if (!atomic_load_explicit(&ready, memory_order_acquire)) {
+        return -ENODEV;
+    }
+    if (mask == 0 || mask >= TOPN_MASKS) {
+        return -EINVAL;
+    }
+
+    for (attempt = 0; attempt < SNAPSHOT_READ_RETRIES; attempt++) {
+        struct snapshot_buf *buf;
+        unsigned int seq;
+        size_t count;
+
+        buf = &bufs[atomic_load_explicit(&active, memory_order_acquire)];
+        seq = atomic_load_explicit(&buf->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+
+        count = min(min(buf->tops[mask].count, MEMTRACK_TOP_MAX), n);
+        memcpy(out, buf->tops[mask].entries,
+               sizeof(struct memtrack_top_entry) * count);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&buf->seq, memory_order_relaxed) == seq) {
+            return count;
+        }
+    }
+
+    return -EAGAIN;
+}
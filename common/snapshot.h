@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_SNAPSHOT_H_
+#define _MEMTRACK_SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_common.h"
+
+/*
+ * pid -> records snapshot published by the sampler thread.
+ *
+ * Two fixed-capacity buffers are used in turn.  The single writer fills
+ * the one readers are not pointed at, then flips the active index.  Each
+ * buffer carries a sequence count that is odd while it is being written,
+ * so a reader that raced with a rewrite notices it and retries.  Readers
+ * never take a lock and never wait for the writer.
+ */
+
+/* Every provider in this tree reports a single record */
+#define SNAPSHOT_MAX_RECORDS 1
+
+struct snapshot_entry {
+    /* CLOCK_MONOTONIC ns when the pid was sampled */
+    uint64_t sampled_ns;
+    /* Provider return value, the records are only valid when it is 0 */
+    int32_t ret[MEMTRACK_NUM_TYPES];
+    uint8_t num_records[MEMTRACK_NUM_TYPES];
+    struct memtrack_record records[MEMTRACK_NUM_TYPES][SNAPSHOT_MAX_RECORDS];
+};
+
+struct topn_list;
+
+/* Writer side view of a buffer, pids are sorted ascending */
+struct snapshot_view {
+    uint64_t generation;
+    uint64_t timestamp_ns;
+    size_t count;
+    size_t capacity;
+    pid_t *pids;
+    struct snapshot_entry *entries;
+    /* Largest consumers per type mask, see topn.h */
+    struct topn_list *tops;
+};
+
+int snapshot_init(size_t max_pids);
+bool snapshot_ready(void);
+
+/*
+ * Writer only.  snapshot_write_begin() hands out the inactive buffer,
+ * snapshot_write_commit() builds its top lists and publishes count
+ * entries of it.  timestamp_ns is when the sweep started; entries carry
+ * their own sample time.
+ */
+void snapshot_write_begin(struct snapshot_view *view);
+void snapshot_write_commit(struct snapshot_view *view, size_t count,
+                           uint64_t timestamp_ns);
+
+/* Writer only: the currently published buffer */
+void snapshot_write_current(struct snapshot_view *view);
+
+/*
+ * Copies pid's records for type into records when they were sampled at
+ * most max_age_ns ago.  Returns false when the caller has to read
+ * live data (stale, pid unknown, concurrent rewrite), otherwise stores the
+ * provider's return value in *ret.
+ */
+bool snapshot_lookup(pid_t pid, int type, uint64_t max_age_ns,
+                     struct memtrack_record *records, size_t *num_records,
+                     int *ret);
+
+/*
+ * Copies up to max entries of the published snapshot, pids ascending.
+ * Returns the number copied, -ENODEV before the first sweep or -EAGAIN
+ * when every attempt raced with a rewrite.
+ */
+ssize_t snapshot_copy(pid_t *pids, struct snapshot_entry *entries, size_t max,
+                      uint64_t *timestamp_ns);
+
+/* Number of pids a snapshot holds at most */
+size_t snapshot_capacity(void);
+
+/*
+ * Copies up to n, at most MEMTRACK_TOP_MAX, entries of the published top
+ * list of mask.  Returns the number copied or -errno as snapshot_copy().
+ */
+ssize_t snapshot_top(unsigned int mask, struct memtrack_top_entry *out,
+                     size_t n);
+
+#endif
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+
+#include "config.h"
+#include "guard.h"
+#include "io_account.h"
+#include "source.h"
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+#define SOURCE_EXPLORE_PERIOD 32
+/* A new sample weighs 1/8 in the moving average */
+#define SOURCE_EWMA_DIV 8
+#define SOURCE_PID_SLOTS 4096
+/* Bytes of the reference source at which the larger classes start */
+#define SOURCE_MEDIUM_BYTES (16 * 1024)
+#define SOURCE_LARGE_BYTES (256 * 1024)
+
+enum {
+    SOURCE_UNKNOWN,
+    SOURCE_AVAILABLE,
+    SOURCE_MISSING,
+};
+
+struct source_cost {
+    _Atomic uint64_t cost_ns;
+    _Atomic uint64_t calls;
+};
+
+struct type_state {
+    atomic_int availability[MEMTRACK_SOURCES_MAX];
+    struct source_cost costs[MEMTRACK_SOURCE_NUM_CLASSES][MEMTRACK_SOURCES_MAX];
+    atomic_uint ticks[MEMTRACK_SOURCE_NUM_CLASSES];
+    atomic_uint explored[MEMTRACK_SOURCE_NUM_CLASSES];
+};
+
+static struct type_state types[MEMTRACK_NUM_TYPES];
+/* (pid << 2) | (class + 1), direct mapped, a collision just forgets */
+static atomic_uint pid_classes[SOURCE_PID_SLOTS];
+
+static const char *class_names[MEMTRACK_SOURCE_NUM_CLASSES] = {
+    [MEMTRACK_SOURCE_SMALL] = "small",
+    [MEMTRACK_SOURCE_MEDIUM] = "medium",
+    [MEMTRACK_SOURCE_LARGE] = "large",
+};
+
+const char *memtrack_source_class_name(int size_class)
+{
+    if (size_class < 0 || size_class >= MEMTRACK_SOURCE_NUM_CLASSES) {
+        return "unknown";
+    }
+
+    return class_names[size_class];
+}
+
+static size_t num_sources(const struct memtrack_provider *provider)
+{
+    return min(provider->num_sources, MEMTRACK_SOURCES_MAX);
+}
+
+static bool available(const struct memtrack_provider *provider, int type,
+                      size_t i)
+{
+    atomic_int *state = &types[type].availability[i];
+    int v = atomic_load_explicit(state, memory_order_relaxed);
+
+    if (v == SOURCE_UNKNOWN) {
+        v = provider->sources[i].available == NULL ||
+            provider->sources[i].available() ? SOURCE_AVAILABLE :
+                                               SOURCE_MISSING;
+        atomic_store_explicit(state, v, memory_order_relaxed);
+    }
+
+    return v == SOURCE_AVAILABLE;
+}
+
+static bool eligible(const struct memtrack_provider *provider, int type,
+                     size_t i, bool approximate)
+{
+    return available(provider, type, i) &&
+           (approximate || !provider->sources[i].approximate);
+}
+
+static int class_of(pid_t pid)
+{
+    unsigned int v = atomic_load_explicit(&pid_classes[pid % SOURCE_PID_SLOTS],
+                                          memory_order_relaxed);
+
+    if ((v >> 2) != (unsigned int)pid || (v & 3) == 0) {
+        return MEMTRACK_SOURCE_MEDIUM;
+    }
+
+    return (v & 3) - 1;
+}
+
+static void set_class(pid_t pid, uint64_t bytes)
+{
+    int size_class = bytes >= SOURCE_LARGE_BYTES ? MEMTRACK_SOURCE_LARGE :
+                     bytes >= SOURCE_MEDIUM_BYTES ? MEMTRACK_SOURCE_MEDIUM :
+                                                    MEMTRACK_SOURCE_SMALL;
+
+    atomic_store_explicit(&pid_classes[pid % SOURCE_PID_SLOTS],
+                          ((unsigned int)pid << 2) | (size_class + 1),
+                          memory_order_relaxed);
+}
+
+/*
+ * Cheapest eligible source of the class, unmeasured ones first, passing
+ * over those whose circuit is open while another one is eligible.
+ * Without an eligible one any available source will do, the reference
+ * otherwise.
+ */
+static size_t cheapest(const struct memtrack_provider *provider, int type,
+                       int size_class)
+{
+    bool approximate = memtrack_config_approximate(type, false);
+    size_t i, n = num_sources(provider);
+    size_t best = n, broken = n;
+    uint64_t best_ns = 0;
+
+    for (i = 0; i < n; i++) {
+        uint64_t ns;
+
+        if (!eligible(provider, type, i, approximate)) {
+            continue;
+        }
+        if (memtrack_guard_open(type, i)) {
+            if (broken == n) {
+                broken = i;
+            }
+            continue;
+        }
+
+        ns = atomic_load_explicit(&types[type].costs[size_class][i].cost_ns,
+                                  memory_order_relaxed);
+        if (ns == 0) {
+            return i;
+        }
+        if (best == n || ns < best_ns) {
+            best = i;
+            best_ns = ns;
+        }
+    }
+    if (best < n) {
+        return best;
+    }
+    if (broken < n) {
+        return broken;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (available(provider, type, i)) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+static size_t choose(const struct memtrack_provider *provider, int type,
+                     int size_class)
+{
+    struct type_state *t = &types[type];
+    size_t best = cheapest(provider, type, size_class);
+    bool approximate;
+    unsigned int cursor;
+    size_t i, n;
+
+    if ((atomic_fetch_add_explicit(&t->ticks[size_class], 1,
+                                   memory_order_relaxed) + 1) %
+        SOURCE_EXPLORE_PERIOD) {
+        return best;
+    }
+
+    /* Measure the other eligible sources in turn */
+    approximate = memtrack_config_approximate(type, false);
+    n = num_sources(provider);
+    cursor = atomic_fetch_add_explicit(&t->explored[size_class], 1,
+                                       memory_order_relaxed);
+    for (i = 1; i < n; i++) {
+        size_t candidate = (best + (cursor % (n - 1)) + i) % n;
+
+        if (candidate != best &&
+            eligible(provider, type, candidate, approximate) &&
+            !memtrack_guard_open(type, candidate)) {
+            return candidate;
+        }
+    }
+
+    return best;
+}
+
+static void record_cost(struct source_cost *cost, uint64_t ns)
+{
+    uint64_t old = atomic_load_explicit(&cost->cost_ns, memory_order_relaxed);
+    uint64_t avg = old ? old + (int64_t)(ns - old) / SOURCE_EWMA_DIV : ns;
+
+    /* Racing updates may lose a sample, which an average tolerates */
+    atomic_store_explicit(&cost->cost_ns, avg ? avg : 1, memory_order_relaxed);
+}
+
+/* Through a helper thread when the source can block */
+static int call_source(const struct memtrack_provider *provider, int type,
+                       size_t i, pid_t pid, struct memtrack_record *records,
+                       size_t *num_records, bool *stale)
+{
+    const struct memtrack_source *source = &provider->sources[i];
+    int32_t timeout_ms = memtrack_config_get()->read_timeout_ms[type];
+
+    *stale = false;
+    if (timeout_ms < 0) {
+        timeout_ms = source->timeout_ms;
+    }
+    if (source->timeout_ms == 0 || timeout_ms == 0) {
+        return source->get_memory(pid, type, records, num_records);
+    }
+
+    return memtrack_guard_call(source, type, i, timeout_ms, pid, records,
+                               num_records, stale);
+}
+
+int memtrack_source_get_memory(const struct memtrack_provider *provider,
+                               pid_t pid, int type,
+                               struct memtrack_record *records,
+                               size_t *num_records, bool *stale)
+{
+    struct memtrack_io_counters start, end;
+    struct source_cost *cost;
+    uint64_t start_ns;
+    int size_class;
+    size_t i;
+    int ret;
+
+    *stale = false;
+
+    /* The record count query reads nothing */
+    if (provider->num_sources == 0 || *num_records == 0) {
+        return provider->get_memory(pid, type, records, num_records);
+    }
+
+    size_class = class_of(pid);
+    i = choose(provider, type, size_class);
+    cost = &types[type].costs[size_class][i];
+
+    memtrack_io_thread_counters(&start);
+    start_ns = memtrack_now_ns();
+    ret = call_source(provider, type, i, pid, records, num_records, stale);
+    atomic_fetch_add_explicit(&cost->calls, 1, memory_order_relaxed);
+
+    /*
+     * A failed call, typically an exited pid, says nothing about cost,
+     * nor does an answer the source did not give in time.
+     */
+    if (ret < 0 || *stale) {
+        return ret;
+    }
+
+    record_cost(cost, memtrack_now_ns() - start_ns);
+    if (i == 0) {
+        memtrack_io_thread_counters(&end);
+        set_class(pid, end.bytes - start.bytes);
+    }
+
+    return ret;
+}
+
+int memtrack_source_get_stats(int type, int size_class, size_t index,
+                              struct memtrack_source_stats *stats)
+{
+    const struct memtrack_provider *provider = memtrack_core_provider(type);
+    struct source_cost *cost;
+
+    if (provider == NULL || size_class < 0 ||
+        size_class >= MEMTRACK_SOURCE_NUM_CLASSES) {
+        return -EINVAL;
+    }
+    if (index >= num_sources(provider)) {
+        return -ENOENT;
+    }
+
+    cost = &types[type].costs[size_class][index];
+    stats->name = provider->sources[index].name;
+    stats->available = available(provider, type, index);
+    stats->selected = cheapest(provider, type, size_class) == index;
+    stats->calls = atomic_load_explicit(&cost->calls, memory_order_relaxed);
+    stats->cost_ns = atomic_load_explicit(&cost->cost_ns, memory_order_relaxed);
+
+    return 0;
+}
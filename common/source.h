@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_SOURCE_H_
+#define _MEMTRACK_SOURCE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memtrack_common.h"
+
+/*
+ * Cost based choice among the sources of a provider.
+ *
+ * The wall time of every call is folded into a moving average per type,
+ * source and process size class, and each call goes to the cheapest
+ * available source that meets the configured precision of the type.
+ * Every SOURCE_EXPLORE_PERIOD calls of a class one of the other eligible
+ * sources is measured instead, so the choice follows changes in cost;
+ * sources never measured go first.
+ *
+ * The size class of a pid comes from the bytes its last call of the
+ * reference source read, since smaps grows with the process while its
+ * alternatives do not.  Pids never measured that way are medium.
+ */
+
+#define MEMTRACK_SOURCES_MAX 4
+
+enum memtrack_source_class {
+    MEMTRACK_SOURCE_SMALL,
+    MEMTRACK_SOURCE_MEDIUM,
+    MEMTRACK_SOURCE_LARGE,
+    MEMTRACK_SOURCE_NUM_CLASSES,
+};
+
+struct memtrack_source_stats {
+    const char *name;
+    bool available;
+    /* Would serve the next regular call of the class */
+    bool selected;
+    uint64_t calls;
+    /* Moving average, 0 until measured */
+    uint64_t cost_ns;
+};
+
+/*
+ * Answers through the provider's sources, or its get_memory without any.
+ * *stale is set when a source that can block did not answer in time and
+ * the last value was returned instead, see guard.h.
+ */
+int memtrack_source_get_memory(const struct memtrack_provider *provider,
+                               pid_t pid, int type,
+                               struct memtrack_record *records,
+                               size_t *num_records, bool *stale);
+
+/* -ENOENT past the provider's last source */
+int memtrack_source_get_stats(int type, int size_class, size_t index,
+                              struct memtrack_source_stats *stats);
+
+const char *memtrack_source_class_name(int size_class);
+
+#endif
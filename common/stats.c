@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aggregate.h"
+#include "batch_io.h"
+#include "cache.h"
+#include "guard.h"
+#include "io_account.h"
+#include "logging.h"
+#include "memtrack_common.h"
+#include "pipeline.h"
+#include "source.h"
+#include "stats.h"
+
+/* Range of the histogram buckets written by the text dump, 1 us to 16 s */
+#define DUMP_MIN_POW2 10
+#define DUMP_MAX_POW2 34
+
+struct type_shard {
+    _Atomic uint64_t calls;
+    _Atomic uint64_t errors;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t files;
+    _Atomic uint64_t ops;
+    _Atomic uint64_t latency_sum_ns;
+    _Atomic uint64_t latency_buckets[MEMTRACK_STATS_BUCKETS];
+    _Atomic uint64_t queries[MEMTRACK_STATS_NUM_SOURCES];
+};
+
+struct stats_shard {
+    struct type_shard types[MEMTRACK_NUM_TYPES];
+    struct stats_shard *next;
+};
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_shard *shards;
+/* Totals of the threads that exited */
+static struct memtrack_provider_stats retired[MEMTRACK_NUM_TYPES];
+
+static pthread_key_t shard_key;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+static __thread struct stats_shard *local_shard;
+
+/* Only the owning thread writes a shard, no read-modify-write needed */
+static void shard_add(_Atomic uint64_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter, memory_order_relaxed) +
+                          value, memory_order_relaxed);
+}
+
+static void type_merge(struct memtrack_provider_stats *out,
+                       const struct type_shard *in)
+{
+    size_t i;
+
+    out->calls += atomic_load_explicit(&in->calls, memory_order_relaxed);
+    out->errors += atomic_load_explicit(&in->errors, memory_order_relaxed);
+    out->bytes += atomic_load_explicit(&in->bytes, memory_order_relaxed);
+    out->files += atomic_load_explicit(&in->files, memory_order_relaxed);
+    out->ops += atomic_load_explicit(&in->ops, memory_order_relaxed);
+    out->latency_sum_ns += atomic_load_explicit(&in->latency_sum_ns,
+                                                memory_order_relaxed);
+    for (i = 0; i < MEMTRACK_STATS_BUCKETS; i++) {
+        out->latency_buckets[i] +=
+            atomic_load_explicit(&in->latency_buckets[i], memory_order_relaxed);
+    }
+    for (i = 0; i < MEMTRACK_STATS_NUM_SOURCES; i++) {
+        out->queries[i] += atomic_load_explicit(&in->queries[i],
+                                                memory_order_relaxed);
+    }
+}
+
+static void shard_retire(void *arg)
+{
+    struct stats_shard *shard = arg;
+    struct stats_shard **pp;
+    int type;
+
+    pthread_mutex_lock(&shards_lock);
+    for (pp = &shards; *pp; pp = &(*pp)->next) {
+        if (*pp == shard) {
+            *pp = shard->next;
+            break;
+        }
+    }
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        type_merge(&retired[type], &shard->types[type]);
+    }
+    pthread_mutex_unlock(&shards_lock);
+
+    free(shard);
+}
+
+static void shard_key_create(void)
+{
+    pthread_key_create(&shard_key, shard_retire);
+}
+
+static struct stats_shard *get_shard(void)
+{
+    struct stats_shard *shard = local_shard;
+
+    if (shard) {
+        return shard;
+    }
+
+    pthread_once(&shard_once, shard_key_create);
+    shard = calloc(1, sizeof(*shard));
+    if (shard == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&shards_lock);
+    shard->next = shards;
+    shards = shard;
+    pthread_mutex_unlock(&shards_lock);
+
+    pthread_setspecific(shard_key, shard);
+    local_shard = shard;
+
+    return shard;
+}
+
+static size_t bucket_of(uint64_t ns)
+{
+    int msb;
+
+    if (ns < MEMTRACK_STATS_SUB_BUCKETS) {
+        return ns;
+    }
+
+    msb = 63 - __builtin_clzll(ns);
+
+    return (msb - 1) * MEMTRACK_STATS_SUB_BUCKETS +
+           ((ns >> (msb - 2)) & (MEMTRACK_STATS_SUB_BUCKETS - 1));
+}
+
+uint64_t memtrack_stats_bucket_limit_ns(size_t bucket)
+{
+    size_t msb, sub;
+
+    if (bucket < MEMTRACK_STATS_SUB_BUCKETS) {
+        return bucket + 1;
+    }
+    /* The top bucket of 2^63 would overflow */
+    if (bucket >= 63 * MEMTRACK_STATS_SUB_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+
+    msb = bucket / MEMTRACK_STATS_SUB_BUCKETS + 1;
+    sub = bucket % MEMTRACK_STATS_SUB_BUCKETS;
+
+    return (uint64_t)(MEMTRACK_STATS_SUB_BUCKETS + sub + 1) << (msb - 2);
+}
+
+void memtrack_stats_call_begin(struct memtrack_stats_call *call)
+{
+    memtrack_io_thread_counters(&call->io);
+    call->start_ns = memtrack_now_ns();
+}
+
+void memtrack_stats_call_end(int type, const struct memtrack_stats_call *call,
+                             int ret)
+{
+    struct stats_shard *shard;
+    struct type_shard *t;
+    struct memtrack_io_counters io;
+    uint64_t elapsed;
+
+    elapsed = memtrack_now_ns() - call->start_ns;
+    memtrack_io_thread_counters(&io);
+
+    shard = get_shard();
+    if (shard == NULL || type < 0 || type >= MEMTRACK_NUM_TYPES) {
+        return;
+    }
+
+    t = &shard->types[type];
+    shard_add(&t->calls, 1);
+    if (ret < 0) {
+        shard_add(&t->errors, 1);
+    }
+    shard_add(&t->bytes, io.bytes - call->io.bytes);
+    shard_add(&t->files, io.opens - call->io.opens);
+    shard_add(&t->ops, memtrack_io_ops(&io) - memtrack_io_ops(&call->io));
+    shard_add(&t->latency_sum_ns, elapsed);
+    shard_add(&t->latency_buckets[bucket_of(elapsed)], 1);
+}
+
+void memtrack_stats_query(int type, enum memtrack_stats_source source)
+{
+    struct stats_shard *shard = get_shard();
+
+    if (shard == NULL || type < 0 || type >= MEMTRACK_NUM_TYPES) {
+        return;
+    }
+
+    shard_add(&shard->types[type].queries[source], 1);
+}
+
+int memtrack_stats_get(int type, struct memtrack_provider_stats *stats)
+{
+    struct stats_shard *shard;
+
+    if (type < 0 || type >= MEMTRACK_NUM_TYPES) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&shards_lock);
+    *stats = retired[type];
+    for (shard = shards; shard; shard = shard->next) {
+        type_merge(stats, &shard->types[type]);
+    }
+    pthread_mutex_unlock(&shards_lock);
+
+    return 0;
+}
+
+uint64_t memtrack_stats_quantile_ns(const struct memtrack_provider_stats *stats,
+                                    double q)
+{
+    uint64_t target, seen = 0;
+    size_t i;
+
+    if (stats->calls == 0) {
+        return 0;
+    }
+
+    target = (uint64_t)(q * stats->calls);
+    for (i = 0; i < MEMTRACK_STATS_BUCKETS; i++) {
+        seen += stats->latency_buckets[i];
+        if (seen > target) {
+            return memtrack_stats_bucket_limit_ns(i);
+        }
+    }
+
+    return memtrack_stats_bucket_limit_ns(MEMTRACK_STATS_BUCKETS - 1);
+}
+
+struct dump {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static void dump_printf(struct dump *d, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(d->len < d->size ? d->buf + d->len : NULL,
+                  d->len < d->size ? d->size - d->len : 0, fmt, ap);
+    va_end(ap);
+
+    if (n > 0) {
+        d->len += n;
+    }
+}
+
+static const char *source_names[MEMTRACK_STATS_NUM_SOURCES] = {
+    [MEMTRACK_STATS_SNAPSHOT] = "snapshot",
+    [MEMTRACK_STATS_SHARED_SNAPSHOT] = "shared_snapshot",
+    [MEMTRACK_STATS_CACHE] = "cache",
+    [MEMTRACK_STATS_LIVE] = "live",
+};
+
+static void dump_provider(struct dump *d, int type,
+                          const struct memtrack_provider_stats *s)
+{
+    const char *name = memtrack_core_provider(type)->name;
+    const char *type_name = memtrack_type_name(type);
+    uint64_t cumulative = 0;
+    size_t bucket = 0;
+    int pow2, i;
+
+#define LABELS "provider=\"%s\",type=\"%s\""
+    dump_printf(d, "memtrack_provider_calls_total{" LABELS "} %" PRIu64 "\n",
+                name, type_name, s->calls);
+    dump_printf(d, "memtrack_provider_errors_total{" LABELS "} %" PRIu64 "\n",
+                name, type_name, s->errors);
+    dump_printf(d, "memtrack_provider_read_bytes_total{" LABELS "} %" PRIu64 "\n",
+                name, type_name, s->bytes);
+    dump_printf(d, "memtrack_provider_files_total{" LABELS "} %" PRIu64 "\n",
+                name, type_name, s->files);
+    dump_printf(d, "memtrack_provider_io_ops_total{" LABELS "} %" PRIu64 "\n",
+                name, type_name, s->ops);
+    for (i = 0; i < MEMTRACK_STATS_NUM_SOURCES; i++) {
+        dump_printf(d, "memtrack_queries_total{" LABELS ",source=\"%s\"} %"
+                    PRIu64 "\n", name, type_name, source_names[i],
+                    s->queries[i]);
+    }
+
+    /* Cumulative buckets at every power of two in the dump range */
+    for (pow2 = DUMP_MIN_POW2; pow2 <= DUMP_MAX_POW2; pow2++) {
+        while (bucket < MEMTRACK_STATS_BUCKETS &&
+               memtrack_stats_bucket_limit_ns(bucket) <= (1ULL << pow2)) {
+            cumulative += s->latency_buckets[bucket++];
+        }
+        dump_printf(d, "memtrack_provider_latency_seconds_bucket{" LABELS
+                    ",le=\"%.9g\"} %" PRIu64 "\n", name, type_name,
+                    (double)(1ULL << pow2) / 1e9, cumulative);
+    }
+    dump_printf(d, "memtrack_provider_latency_seconds_bucket{" LABELS
+                ",le=\"+Inf\"} %" PRIu64 "\n", name, type_name, s->calls);
+    dump_printf(d, "memtrack_provider_latency_seconds_sum{" LABELS "} %.9f\n",
+                name, type_name, s->latency_sum_ns / 1e9);
+    dump_printf(d, "memtrack_provider_latency_seconds_count{" LABELS "} %"
+                PRIu64 "\n", name, type_name, s->calls);
+#undef LABELS
+}
+
+static void dump_sources(struct dump *d, int type)
+{
+    const char *name = memtrack_core_provider(type)->name;
+    const char *type_name = memtrack_type_name(type);
+    struct memtrack_source_stats src;
+    size_t i;
+    int c;
+
+#define LABELS "provider=\"%s\",type=\"%s\",class=\"%s\",source=\"%s\""
+    for (c = 0; c < MEMTRACK_SOURCE_NUM_CLASSES; c++) {
+        const char *class_name = memtrack_source_class_name(c);
+
+        for (i = 0; memtrack_source_get_stats(type, c, i, &src) == 0; i++) {
+            dump_printf(d, "memtrack_source_calls_total{" LABELS "} %" PRIu64
+                        "\n", name, type_name, class_name, src.name,
+                        src.calls);
+            dump_printf(d, "memtrack_source_cost_seconds{" LABELS "} %.9f\n",
+                        name, type_name, class_name, src.name,
+                        src.cost_ns / 1e9);
+            dump_printf(d, "memtrack_source_selected{" LABELS "} %d\n",
+                        name, type_name, class_name, src.name,
+                        src.available && src.selected);
+        }
+    }
+#undef LABELS
+}
+
+/* Only the sources run with a timeout */
+static void dump_guards(struct dump *d, int type)
+{
+    const struct memtrack_provider *provider = memtrack_core_provider(type);
+    const char *type_name = memtrack_type_name(type);
+    struct memtrack_guard_stats g;
+    size_t i;
+
+#define LABELS "provider=\"%s\",type=\"%s\",source=\"%s\""
+    for (i = 0; i < provider->num_sources && i < MEMTRACK_SOURCES_MAX; i++) {
+        const char *name = provider->sources[i].name;
+
+        if (provider->sources[i].timeout_ms == 0) {
+            continue;
+        }
+
+        memtrack_guard_get_stats(type, i, &g);
+        dump_printf(d, "memtrack_guard_calls_total{" LABELS "} %" PRIu64
+                    "\n", provider->name, type_name, name, g.calls);
+        dump_printf(d, "memtrack_guard_timeouts_total{" LABELS "} %" PRIu64
+                    "\n", provider->name, type_name, name, g.timeouts);
+        dump_printf(d, "memtrack_guard_short_circuits_total{" LABELS "} %"
+                    PRIu64 "\n", provider->name, type_name, name,
+                    g.short_circuits);
+        dump_printf(d, "memtrack_guard_stale_total{" LABELS "} %" PRIu64
+                    "\n", provider->name, type_name, name, g.stale);
+        dump_printf(d, "memtrack_guard_open{" LABELS "} %d\n",
+                    provider->name, type_name, name, g.open);
+    }
+#undef LABELS
+}
+
+size_t memtrack_stats_dump(char *buf, size_t size)
+{
+    struct dump d = { buf, size, 0 };
+    struct memtrack_provider_stats s;
+    struct memtrack_cache_stats cache;
+    struct batch_io_stats io;
+    struct pipeline_stats pipe;
+    struct memtrack_aggregate_stats agg;
+    const struct memtrack_log_event *event;
+    int type;
+
+    if (size) {
+        buf[0] = '\0';
+    }
+
+    dump_printf(&d, "# TYPE memtrack_provider_calls_total counter\n"
+                    "# TYPE memtrack_provider_errors_total counter\n"
+                    "# TYPE memtrack_provider_read_bytes_total counter\n"
+                    "# TYPE memtrack_provider_files_total counter\n"
+                    "# TYPE memtrack_provider_io_ops_total counter\n"
+                    "# TYPE memtrack_queries_total counter\n"
+                    "# TYPE memtrack_provider_latency_seconds histogram\n");
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (memtrack_core_provider(type) == NULL) {
+            continue;
+        }
+        memtrack_stats_get(type, &s);
+        dump_provider(&d, type, &s);
+    }
+
+    dump_printf(&d, "# TYPE memtrack_source_calls_total counter\n"
+                    "# TYPE memtrack_source_cost_seconds gauge\n"
+                    "# TYPE memtrack_source_selected gauge\n");
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (memtrack_core_provider(type) != NULL) {
+            dump_sources(&d, type);
+        }
+    }
+
+    dump_printf(&d, "# TYPE memtrack_guard_calls_total counter\n"
+                    "# TYPE memtrack_guard_timeouts_total counter\n"
+                    "# TYPE memtrack_guard_short_circuits_total counter\n"
+                    "# TYPE memtrack_guard_stale_total counter\n"
+                    "# TYPE memtrack_guard_open gauge\n");
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (memtrack_core_provider(type) != NULL) {
+            dump_guards(&d, type);
+        }
+    }
+
+    memtrack_cache_get_stats(&cache);
+    dump_printf(&d, "# TYPE memtrack_cache_lookups_total counter\n"
+                    "memtrack_cache_lookups_total{result=\"hit\"} %" PRIu64 "\n"
+                    "memtrack_cache_lookups_total{result=\"miss\"} %" PRIu64 "\n"
+                    "memtrack_cache_lookups_total{result=\"expired\"} %" PRIu64 "\n"
+                    "# TYPE memtrack_cache_evictions_total counter\n"
+                    "memtrack_cache_evictions_total %" PRIu64 "\n"
+                    "# TYPE memtrack_cache_entries gauge\n"
+                    "memtrack_cache_entries %zu\n",
+                cache.hits, cache.misses, cache.expired, cache.evictions,
+                cache.used);
+
+    batch_io_get_stats(&io);
+    dump_printf(&d, "# TYPE memtrack_io_files_total counter\n"
+                    "memtrack_io_files_total %" PRIu64 "\n"
+                    "# TYPE memtrack_io_bytes_total counter\n"
+                    "memtrack_io_bytes_total %" PRIu64 "\n"
+                    "# TYPE memtrack_io_syscalls_total counter\n"
+                    "memtrack_io_syscalls_total{path=\"io_uring\"} %" PRIu64 "\n"
+                    "memtrack_io_syscalls_total{path=\"sync\"} %" PRIu64 "\n",
+                io.files, io.bytes, io.ring_enters, io.sync_syscalls);
+
+    pipeline_get_stats(&pipe);
+    dump_printf(&d, "# TYPE memtrack_pipeline_sweeps_total counter\n"
+                    "memtrack_pipeline_sweeps_total %" PRIu64 "\n"
+                    "# TYPE memtrack_pipeline_reads_total counter\n"
+                    "memtrack_pipeline_reads_total{result=\"hit\"} %" PRIu64 "\n"
+                    "memtrack_pipeline_reads_total{result=\"miss\"} %" PRIu64 "\n"
+                    "# TYPE memtrack_pipeline_prefetched_bytes_total counter\n"
+                    "memtrack_pipeline_prefetched_bytes_total %" PRIu64 "\n"
+                    "# TYPE memtrack_pipeline_stall_seconds_total counter\n"
+                    "memtrack_pipeline_stall_seconds_total %.9f\n",
+                pipe.sweeps, pipe.hits, pipe.misses, pipe.prefetched_bytes,
+                pipe.stall_ns / 1e9);
+
+    memtrack_aggregate_get_stats(&agg);
+    dump_printf(&d, "# TYPE memtrack_aggregate_cgroups gauge\n"
+                    "memtrack_aggregate_cgroups %zu\n"
+                    "# TYPE memtrack_aggregate_cgroups_reclaimed_total counter\n"
+                    "memtrack_aggregate_cgroups_reclaimed_total %" PRIu64 "\n"
+                    "# TYPE memtrack_aggregate_cgroups_overflowed_total counter\n"
+                    "memtrack_aggregate_cgroups_overflowed_total %" PRIu64 "\n",
+                agg.cgroups, agg.cgroups_reclaimed, agg.cgroups_overflowed);
+
+    dump_printf(&d, "# TYPE memtrack_log_events_total counter\n");
+    for (event = memtrack_log_events(); event; event = event->next) {
+        dump_printf(&d, "memtrack_log_events_total{event=\"%s\"} %" PRIu64
+                    "\n", event->name,
+                    atomic_load_explicit(&event->count,
+                                         memory_order_relaxed));
+    }
+
+    dump_printf(&d, "# TYPE memtrack_io_budget_violations_total counter\n"
+                    "memtrack_io_budget_violations_total %" PRIu64 "\n",
+                memtrack_io_budget_violations());
+
+    return d.len;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_STATS_H_
+#define _MEMTRACK_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hardware/memtrack.h>
+
+#include "io_account.h"
+
+/*
+ * Per-provider instrumentation.
+ *
+ * Every live provider call is timed into a log-linear latency histogram
+ * (4 sub-buckets per power of two of nanoseconds) together with its
+ * error, byte and file counts, and every query records where its answer
+ * came from; the dump adds the cost and choice of every provider source
+ * (source.h), the timeouts of the sources that can block (guard.h) and
+ * the count of every logged event (logging.h).  Counters live in
+ * per-thread shards written without atomics read-modify-write; readers
+ * merge all shards plus the totals of threads that already exited.
+ */
+
+#define MEMTRACK_STATS_SUB_BUCKETS 4
+#define MEMTRACK_STATS_BUCKETS (64 * MEMTRACK_STATS_SUB_BUCKETS)
+
+enum memtrack_stats_source {
+    MEMTRACK_STATS_SNAPSHOT,
+    MEMTRACK_STATS_SHARED_SNAPSHOT,
+    MEMTRACK_STATS_CACHE,
+    MEMTRACK_STATS_LIVE,
+    MEMTRACK_STATS_NUM_SOURCES,
+};
+
+struct memtrack_provider_stats {
+    /* Live provider calls */
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t files;
+    /* File operations, see io_account.h */
+    uint64_t ops;
+    uint64_t latency_sum_ns;
+    uint64_t latency_buckets[MEMTRACK_STATS_BUCKETS];
+    /* getMemory answers by origin */
+    uint64_t queries[MEMTRACK_STATS_NUM_SOURCES];
+};
+
+/* Timing of one provider call, see memtrack_stats_call_end() */
+struct memtrack_stats_call {
+    uint64_t start_ns;
+    struct memtrack_io_counters io;
+};
+
+void memtrack_stats_call_begin(struct memtrack_stats_call *call);
+void memtrack_stats_call_end(int type, const struct memtrack_stats_call *call,
+                             int ret);
+void memtrack_stats_query(int type, enum memtrack_stats_source source);
+
+/* Merged counters of type, -EINVAL for an unknown type */
+int memtrack_stats_get(int type, struct memtrack_provider_stats *stats);
+
+/* Smallest latency that does not fit in bucket, in ns */
+uint64_t memtrack_stats_bucket_limit_ns(size_t bucket);
+
+/* Latency below which a fraction q (0..1) of the calls completed */
+uint64_t memtrack_stats_quantile_ns(const struct memtrack_provider_stats *stats,
+                                    double q);
+
+/*
+ * Writes every counter in the Prometheus text exposition format.
+ * Returns the length of the full dump, which was truncated when it is
+ * size or more, like snprintf().
+ */
+size_t memtrack_stats_dump(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "subscribe.h"
+
+#define MAX_SUBSCRIPTIONS 32
+/* Changes kept per eventfd subscription until the client reads them */
+#define CHANGE_QUEUE_SIZE 64
+/* Callback changes collected by one notify before they are dispatched */
+#define PENDING_MAX 4096
+
+struct subscription {
+    bool used;
+    pid_t pid;
+    int type;
+    enum memtrack_threshold kind;
+    uint64_t threshold;
+    memtrack_change_fn fn;
+    void *arg;
+    int efd;
+    /* Tells a reused slot apart from the subscription a change was for */
+    uint64_t serial;
+    /* Ring of pending changes for eventfd delivery */
+    struct memtrack_change queue[CHANGE_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+    uint64_t dropped;
+};
+
+struct pending_change {
+    int id;
+    uint64_t serial;
+    struct memtrack_change change;
+};
+
+static struct subscription subs[MAX_SUBSCRIPTIONS];
+static size_t nactive;
+static uint64_t next_serial;
+static pthread_mutex_t subs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Callback changes wait here until memtrack_subscriptions_dispatch(), so
+ * that no callback runs under subs_lock or the sampler's locks.
+ */
+static struct pending_change *pending;
+static size_t npending, pending_next, pending_cap;
+static bool dispatching;
+static pthread_t dispatcher;
+static int running_id = -1;
+static pthread_cond_t running_cond = PTHREAD_COND_INITIALIZER;
+
+int memtrack_subscribe(pid_t pid, int type, enum memtrack_threshold kind,
+                       uint64_t threshold, memtrack_change_fn fn, void *arg,
+                       int efd)
+{
+    int id;
+
+    if (type < 0 || type >= MEMTRACK_NUM_TYPES ||
+        (kind != MEMTRACK_THRESHOLD_ABSOLUTE &&
+         kind != MEMTRACK_THRESHOLD_RELATIVE) ||
+        (fn == NULL && efd < 0)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&subs_lock);
+    for (id = 0; id < MAX_SUBSCRIPTIONS; id++) {
+        if (!subs[id].used) {
+            break;
+        }
+    }
+    if (id == MAX_SUBSCRIPTIONS) {
+        pthread_mutex_unlock(&subs_lock);
+        return -ENOSPC;
+    }
+
+    subs[id].used = true;
+    subs[id].pid = pid;
+    subs[id].type = type;
+    subs[id].kind = kind;
+    subs[id].threshold = threshold;
+    subs[id].fn = fn;
+    subs[id].arg = arg;
+    subs[id].efd = efd;
+    subs[id].serial = ++next_serial;
+    subs[id].head = 0;
+    subs[id].count = 0;
+    subs[id].dropped = 0;
+    nactive++;
+    pthread_mutex_unlock(&subs_lock);
+
+    return id;
+}
+
+int memtrack_unsubscribe(int id)
+{
+    if (id < 0 || id >= MAX_SUBSCRIPTIONS) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&subs_lock);
+    if (!subs[id].used) {
+        pthread_mutex_unlock(&subs_lock);
+        return -ENOENT;
+    }
+    subs[id].used = false;
+    nactive--;
+
+    /* After this returns fn is not running and will not be called again */
+    while (dispatching && running_id == id &&
+           !pthread_equal(dispatcher, pthread_self())) {
+        pthread_cond_wait(&running_cond, &subs_lock);
+    }
+    pthread_mutex_unlock(&subs_lock);
+
+    return 0;
+}
+
+size_t memtrack_subscription_read(int id, struct memtrack_change *out,
+                                  size_t max, uint64_t *dropped)
+{
+    struct subscription *sub;
+    uint64_t value;
+    size_t n = 0;
+
+    if (id < 0 || id >= MAX_SUBSCRIPTIONS) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&subs_lock);
+    sub = &subs[id];
+    if (sub->used) {
+        while (n < max && sub->count) {
+            out[n++] = sub->queue[sub->head];
+            sub->head = (sub->head + 1) % CHANGE_QUEUE_SIZE;
+            sub->count--;
+        }
+        if (dropped) {
+            *dropped = sub->dropped;
+        }
+        sub->dropped = 0;
+
+        /* Leave the eventfd readable while changes are still queued */
+        if (read(sub->efd, &value, sizeof(value)) == sizeof(value) &&
+            sub->count) {
+            value = 1;
+            if (write(sub->efd, &value, sizeof(value)) < 0) {
+                /* cannot overflow right after the reset */
+            }
+        }
+    }
+    pthread_mutex_unlock(&subs_lock);
+
+    return n;
+}
+
+static bool crossed(const struct subscription *sub, uint64_t old_size,
+                    uint64_t new_size)
+{
+    uint64_t delta;
+
+    if (sub->kind == MEMTRACK_THRESHOLD_ABSOLUTE) {
+        return (old_size < sub->threshold) != (new_size < sub->threshold);
+    }
+
+    if (old_size == new_size) {
+        return false;
+    }
+    if (old_size == 0) {
+        return true;
+    }
+
+    delta = new_size > old_size ? new_size - old_size : old_size - new_size;
+    return delta * 100 >= sub->threshold * old_size;
+}
+
+static void defer(struct subscription *sub,
+                  const struct memtrack_change *change)
+{
+    struct pending_change *entry;
+
+    if (npending == pending_cap) {
+        size_t cap = pending_cap ? pending_cap * 2 : 64;
+        struct pending_change *grown;
+
+        if (cap > PENDING_MAX) {
+            cap = PENDING_MAX;
+        }
+        grown = cap > pending_cap ?
+            realloc(pending, cap * sizeof(*pending)) : NULL;
+        if (grown == NULL) {
+            MEMTRACK_LOGW_EVENT("subscription_overflow",
+                                "too many changes in one sweep, dropped");
+            return;
+        }
+        pending = grown;
+        pending_cap = cap;
+    }
+
+    entry = &pending[npending++];
+    entry->id = sub - subs;
+    entry->serial = sub->serial;
+    entry->change = *change;
+}
+
+static void deliver(struct subscription *sub,
+                    const struct memtrack_change *change)
+{
+    uint64_t one = 1;
+
+    if (sub->fn) {
+        defer(sub, change);
+        return;
+    }
+
+    if (sub->count == CHANGE_QUEUE_SIZE) {
+        sub->head = (sub->head + 1) % CHANGE_QUEUE_SIZE;
+        sub->count--;
+        sub->dropped++;
+    }
+    sub->queue[(sub->head + sub->count) % CHANGE_QUEUE_SIZE] = *change;
+    sub->count++;
+
+    if (write(sub->efd, &one, sizeof(one)) < 0) {
+        /* Counter overflow only, the change is queued regardless */
+    }
+}
+
+static uint64_t entry_size(const struct snapshot_entry *entry, int type)
+{
+    if (entry == NULL || entry->ret[type] != 0 ||
+        entry->num_records[type] == 0) {
+        return 0;
+    }
+
+    return entry->records[type][0].size_in_bytes;
+}
+
+static void check_pid(pid_t pid, const struct snapshot_entry *old_entry,
+                      const struct snapshot_entry *new_entry)
+{
+    int id;
+
+    for (id = 0; id < MAX_SUBSCRIPTIONS; id++) {
+        struct subscription *sub = &subs[id];
+        struct memtrack_change change;
+
+        if (!sub->used ||
+            (sub->pid != MEMTRACK_SUBSCRIBE_ALL_PIDS && sub->pid != pid)) {
+            continue;
+        }
+
+        change.pid = pid;
+        change.type = sub->type;
+        change.old_size = entry_size(old_entry, sub->type);
+        change.new_size = entry_size(new_entry, sub->type);
+
+        if (crossed(sub, change.old_size, change.new_size)) {
+            deliver(sub, &change);
+        }
+    }
+}
+
+void memtrack_subscriptions_notify(const struct snapshot_view *prev,
+                                   const struct snapshot_view *next)
+{
+    size_t i = 0, j = 0;
+
+    /* The first snapshot has nothing to compare against */
+    if (prev->generation == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&subs_lock);
+    if (nactive == 0) {
+        pthread_mutex_unlock(&subs_lock);
+        return;
+    }
+
+    while (i < prev->count || j < next->count) {
+        if (j == next->count ||
+            (i < prev->count && prev->pids[i] < next->pids[j])) {
+            check_pid(prev->pids[i], &prev->entries[i], NULL);
+            i++;
+        } else if (i == prev->count || next->pids[j] < prev->pids[i]) {
+            check_pid(next->pids[j], NULL, &next->entries[j]);
+            j++;
+        } else {
+            check_pid(next->pids[j], &prev->entries[i], &next->entries[j]);
+            i++;
+            j++;
+        }
+    }
+    pthread_mutex_unlock(&subs_lock);
+}
+
+void memtrack_subscriptions_dispatch(void)
+{
+    pthread_mutex_lock(&subs_lock);
+
+    /* A callback re-entering through a sweep leaves it to the outer loop */
+    if (dispatching) {
+        pthread_mutex_unlock(&subs_lock);
+        return;
+    }
+    dispatching = true;
+    dispatcher = pthread_self();
+
+    while (pending_next < npending) {
+        struct pending_change entry = pending[pending_next++];
+        struct subscription *sub = &subs[entry.id];
+        memtrack_change_fn fn;
+        void *arg;
+
+        if (!sub->used || sub->serial != entry.serial) {
+            continue;
+        }
+        fn = sub->fn;
+        arg = sub->arg;
+        running_id = entry.id;
+        pthread_mutex_unlock(&subs_lock);
+
+        fn(&entry.change, arg);
+
+        pthread_mutex_lock(&subs_lock);
+        running_id = -1;
+        pthread_cond_broadcast(&running_cond);
+    }
+
+    npending = 0;
+    pending_next = 0;
+    dispatching = false;
+    pthread_mutex_unlock(&subs_lock);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_SUBSCRIBE_H_
+#define _MEMTRACK_SUBSCRIBE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "snapshot.h"
+
+/*
+ * Threshold subscriptions fed by the sampler.
+ *
+ * After every sweep the new snapshot is compared with the previous one by
+ * walking both sorted pid arrays, and subscribers only hear about the
+ * values that crossed their threshold.  A process appearing or
+ * disappearing counts as a change from or to 0.
+ */
+
+/* pid value subscribing to every process */
+#define MEMTRACK_SUBSCRIBE_ALL_PIDS 0
+
+enum memtrack_threshold {
+    /* Fires when the size crosses threshold bytes, in either direction */
+    MEMTRACK_THRESHOLD_ABSOLUTE,
+    /* Fires when the size changed by at least threshold percent */
+    MEMTRACK_THRESHOLD_RELATIVE,
+};
+
+struct memtrack_change {
+    pid_t pid;
+    int type;
+    uint64_t old_size;
+    uint64_t new_size;
+};
+
+typedef void (*memtrack_change_fn)(const struct memtrack_change *change,
+                                   void *arg);
+
+/*
+ * Registers a subscription.  Changes are delivered either to fn, or, when
+ * fn is NULL, queued and signalled on the eventfd efd for
+ * memtrack_subscription_read().  Returns the subscription id or -errno.
+ *
+ * fn runs on the thread that published the snapshot, after the sampler
+ * released its locks, and never concurrently with another callback.  It
+ * may call back into the API, including memtrack_unsubscribe() of its
+ * own subscription.
+ */
+int memtrack_subscribe(pid_t pid, int type, enum memtrack_threshold kind,
+                       uint64_t threshold, memtrack_change_fn fn, void *arg,
+                       int efd);
+
+/*
+ * Waits for a running callback of the subscription unless called from
+ * that callback; fn is not called after this returns.
+ */
+int memtrack_unsubscribe(int id);
+
+/*
+ * Moves up to max queued changes of an eventfd subscription to out.
+ * Changes that did not fit in the queue are dropped oldest first and
+ * counted in *dropped when it is not NULL.
+ */
+size_t memtrack_subscription_read(int id, struct memtrack_change *out,
+                                  size_t max, uint64_t *dropped);
+
+/*
+ * Sampler only: collects the changes between two published snapshots.
+ * Callback subscriptions are only called by the dispatch that follows,
+ * which the sampler issues once it no longer holds its locks.
+ */
+void memtrack_subscriptions_notify(const struct snapshot_view *prev,
+                                   const struct snapshot_view *next);
+void memtrack_subscriptions_dispatch(void);
+
+#endif
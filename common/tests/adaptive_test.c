@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Runs the scheduler of adaptive.h over simulated pids, a few growing
+ * every tick and the others steady, and checks that the growing ones are
+ * sampled on almost every tick, the steady ones about once per long
+ * interval but never later, and that a tight I/O budget defers samples
+ * instead of exceeding it.  Each scenario runs in a child process, since
+ * the scheduler state is per process.  Prints the bytes read and the
+ * staleness next to what sampling every pid on every tick costs.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <hardware/memtrack.h>
+
+#include "adaptive.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "snapshot.h"
+
+#define TEST_PIDS 12
+/* pids[0] and pids[1] grow on every tick */
+#define TEST_VOLATILE 2
+#define TEST_TICK_MS 20
+#define TEST_TICKS 100
+#define TEST_WARMUP_TICKS 20
+#define TEST_MAX_INTERVAL_MS 200
+#define TEST_ERROR_BYTES (256 * 1024)
+#define TEST_GROWTH_BYTES (256 * 1024)
+#define TEST_COST 1000
+/* Sleeps overshoot on a loaded machine */
+#define TEST_SLACK_MS 100
+
+struct run {
+    unsigned int samples[TEST_PIDS];
+    /* Longest time without a sample after the warm-up, in ms */
+    uint64_t max_gap_ms[TEST_PIDS];
+    /* Summed over the ticks, what the kept entries are off by */
+    uint64_t stale_bytes;
+};
+
+static pid_t pids[TEST_PIDS];
+
+/* One tick as the sampler runs it, true sizes in truth */
+static void tick(int n, const uint64_t *truth, uint64_t *known,
+                 uint64_t *last_ns, struct run *run)
+{
+    uint8_t actions[TEST_PIDS];
+    struct snapshot_entry entry = { 0 };
+    uint64_t now;
+    size_t i;
+
+    adaptive_plan(pids, TEST_PIDS, TEST_TICK_MS, actions);
+    now = memtrack_now_ns();
+    for (i = 0; i < TEST_PIDS; i++) {
+        if (actions[i] == ADAPTIVE_SKIP) {
+            continue;
+        }
+        if (actions[i] == ADAPTIVE_SAMPLE) {
+            entry.sampled_ns = now;
+            entry.ret[MEMTRACK_TYPE_GL] = 0;
+            entry.num_records[MEMTRACK_TYPE_GL] = 1;
+            entry.records[MEMTRACK_TYPE_GL][0].size_in_bytes = truth[i];
+            known[i] = truth[i];
+            run->samples[i]++;
+            if (n >= TEST_WARMUP_TICKS && last_ns[i] &&
+                (now - last_ns[i]) / 1000000 > run->max_gap_ms[i]) {
+                run->max_gap_ms[i] = (now - last_ns[i]) / 1000000;
+            }
+            last_ns[i] = now;
+        }
+        adaptive_record(i, pids[i], &entry, TEST_COST);
+        run->stale_bytes += truth[i] > known[i] ? truth[i] - known[i] :
+                                                  known[i] - truth[i];
+    }
+    adaptive_commit();
+}
+
+static void simulate(struct run *run)
+{
+    uint64_t truth[TEST_PIDS], known[TEST_PIDS] = { 0 };
+    uint64_t last_ns[TEST_PIDS] = { 0 };
+    size_t i;
+    int n;
+
+    for (i = 0; i < TEST_PIDS; i++) {
+        truth[i] = 64 * 1024 * 1024;
+    }
+    for (n = 0; n < TEST_TICKS; n++) {
+        for (i = 0; i < TEST_VOLATILE; i++) {
+            truth[i] += TEST_GROWTH_BYTES;
+        }
+        tick(n, truth, known, last_ns, run);
+        usleep(TEST_TICK_MS * 1000);
+    }
+}
+
+/* Simulates with budget in a child, which reports through a pipe */
+static bool run_child(uint64_t budget, struct run *run,
+                      struct memtrack_adaptive_stats *stats)
+{
+    int fds[2], status;
+    bool ok;
+    pid_t child;
+
+    if (pipe(fds) < 0) {
+        return false;
+    }
+    child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        if (adaptive_init(TEST_PIDS, budget, TEST_MAX_INTERVAL_MS,
+                          TEST_ERROR_BYTES) < 0) {
+            _exit(1);
+        }
+        simulate(run);
+        memtrack_adaptive_get_stats(stats);
+        _exit(write(fds[1], run, sizeof(*run)) == sizeof(*run) &&
+              write(fds[1], stats, sizeof(*stats)) == sizeof(*stats) ?
+              0 : 1);
+    }
+    close(fds[1]);
+    ok = child > 0 && read(fds[0], run, sizeof(*run)) == sizeof(*run) &&
+         read(fds[0], stats, sizeof(*stats)) == sizeof(*stats);
+    close(fds[0]);
+
+    return ok && waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+           WEXITSTATUS(status) == 0;
+}
+
+int main(void)
+{
+    struct memtrack_adaptive_stats stats;
+    struct run run = { { 0 } };
+    unsigned int stable_max = 0;
+    size_t i;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    for (i = 0; i < TEST_PIDS; i++) {
+        pids[i] = 1000 + i;
+    }
+    EXPECT_EQ(adaptive_init(TEST_PIDS, 0, TEST_MAX_INTERVAL_MS,
+                            TEST_ERROR_BYTES), -EINVAL);
+
+    /* A budget that never binds */
+    EXPECT(run_child(UINT32_MAX, &run, &stats));
+    printf("unbounded: read %" PRIu64 " of %" PRIu64 " bytes, %" PRIu64
+           " stale bytes per tick\n", stats.bytes_read, stats.fixed_bytes,
+           run.stale_bytes / TEST_TICKS);
+    for (i = 0; i < TEST_VOLATILE; i++) {
+        EXPECT(run.samples[i] >= TEST_TICKS * 8 / 10);
+    }
+    for (i = TEST_VOLATILE; i < TEST_PIDS; i++) {
+        stable_max = run.samples[i] > stable_max ? run.samples[i] :
+                                                   stable_max;
+        EXPECT(run.samples[i] >= 4);
+        EXPECT(run.max_gap_ms[i] <= TEST_MAX_INTERVAL_MS + TEST_SLACK_MS);
+    }
+    EXPECT(stable_max * 3 < run.samples[0]);
+    EXPECT(stats.bytes_read * 2 < stats.fixed_bytes);
+    EXPECT_EQ(stats.deferred, 0);
+
+    /* Three samples per tick */
+    memset(&run, 0, sizeof(run));
+    EXPECT(run_child(3 * TEST_COST * 1000 / TEST_TICK_MS, &run, &stats));
+    printf("3 samples per tick: read %" PRIu64 " of %" PRIu64 " bytes, %"
+           PRIu64 " deferred\n", stats.bytes_read, stats.fixed_bytes,
+           stats.deferred);
+    EXPECT(stats.deferred > 0);
+    EXPECT(stats.sampled <= 3 * TEST_TICKS);
+    for (i = 0; i < TEST_PIDS; i++) {
+        EXPECT(run.samples[i] > 0);
+    }
+    /* The growing pids still come first */
+    for (i = 0; i < TEST_VOLATILE; i++) {
+        EXPECT(run.samples[i] >= TEST_TICKS / 2);
+    }
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Sweeps the fixture plus a second process of the test app's uid and
+ * cgroup, and checks the per-uid and per-cgroup totals of aggregate.h
+ * against the sizes the provider gave: processes leaving, cgroups left
+ * empty reclaimed, an identity kept while the process lives and read again
+ * for a new process behind the same pid.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "aggregate.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "sampler.h"
+#include "snapshot.h"
+
+#define TEST_MAX_PIDS 16
+/* Second process of the test app */
+#define TEST_PID_SIBLING 102
+#define TEST_UID_APP 10100
+#define TEST_UID_IDLE 10101
+#define TEST_UID_OTHER 10200
+#define TEST_CGROUP_APP "/apps/uid_10100"
+#define TEST_CGROUP_IDLE "/apps/uid_10101"
+
+static int get_memory(pid_t pid, enum memtrack_type type,
+                      struct memtrack_record *records, size_t *num_records)
+{
+    if (*num_records) {
+        records[0].size_in_bytes = pid * 4096;
+        records[0].flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                           MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    }
+    *num_records = 1;
+
+    return 0;
+}
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "test",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = get_memory,
+    },
+};
+
+static int write_identity(pid_t pid, uid_t uid, const char *cgroup,
+                          int start_time)
+{
+    char path[64];
+    int ret = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    ret |= memtrack_test_write(path, "%d (sibling) S 1 %d %d 0 -1 4194560 0 "
+                               "0 0 0 0 0 0 0 20 0 1 0 %d 0 0\n", pid, pid,
+                               pid, start_time);
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    ret |= memtrack_test_write(path, "Name:\tsibling\nTgid:\t%d\nPid:\t%d\n"
+                               "Uid:\t%u\t%u\t%u\t%u\n", pid, pid, uid, uid,
+                               uid, uid);
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+    ret |= memtrack_test_write(path, "4:memory:%s\n", cgroup);
+
+    return ret;
+}
+
+static int remove_pid(pid_t pid)
+{
+    static const char *const files[] = {
+        "stat", "status", "cgroup", "comm", "smaps",
+    };
+    char path[PATH_MAX];
+    size_t i;
+
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        if (snprintf(path, sizeof(path), "%s/proc/%d/%s",
+                     memtrack_test_root(), pid, files[i]) >=
+            (int)sizeof(path)) {
+            return -ENAMETOOLONG;
+        }
+        unlink(path);
+    }
+    *strrchr(path, '/') = '\0';
+
+    return rmdir(path) < 0 ? -errno : 0;
+}
+
+/* GL bytes of uid, -1 when it has no total */
+static long long uid_bytes(uid_t uid, uint32_t *processes)
+{
+    struct memtrack_aggregate agg;
+    uint64_t timestamp_ns;
+
+    if (memtrack_aggregate_uid(uid, &agg, &timestamp_ns) < 0) {
+        return -1;
+    }
+    *processes = agg.processes;
+
+    return agg.bytes[MEMTRACK_TYPE_GL];
+}
+
+static long long cgroup_bytes(const char *cgroup, uint32_t *processes)
+{
+    struct memtrack_aggregate agg;
+    uint64_t timestamp_ns;
+
+    if (memtrack_aggregate_cgroup(cgroup, &agg, &timestamp_ns) < 0) {
+        return -1;
+    }
+    *processes = agg.processes;
+
+    return agg.bytes[MEMTRACK_TYPE_GL];
+}
+
+static void sum_uid(void *arg, uid_t uid, const struct memtrack_aggregate *agg)
+{
+    *(uint64_t *)arg += agg->bytes[MEMTRACK_TYPE_GL];
+}
+
+int main(void)
+{
+    struct memtrack_aggregate_stats stats;
+    struct memtrack_aggregate agg;
+    uint64_t timestamp_ns, total = 0;
+    uint32_t processes = 0;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(write_identity(TEST_PID_SIBLING, TEST_UID_APP, TEST_CGROUP_APP,
+                             2000), 0);
+    EXPECT_EQ(memtrack_core_init(providers, 1), 0);
+    EXPECT_EQ(snapshot_init(TEST_MAX_PIDS), 0);
+    EXPECT_EQ(memtrack_aggregate_init(TEST_MAX_PIDS), 0);
+    EXPECT_EQ(memtrack_aggregate_uid(TEST_UID_APP, &agg, &timestamp_ns),
+              -EAGAIN);
+
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(uid_bytes(TEST_UID_APP, &processes),
+              (MEMTRACK_TEST_PID + TEST_PID_SIBLING) * 4096);
+    EXPECT_EQ(processes, 2);
+    EXPECT_EQ(uid_bytes(TEST_UID_IDLE, &processes),
+              MEMTRACK_TEST_PID_IDLE * 4096);
+    EXPECT_EQ(processes, 1);
+    EXPECT_EQ(uid_bytes(TEST_UID_OTHER, &processes), -1);
+    EXPECT_EQ(cgroup_bytes(TEST_CGROUP_APP, &processes),
+              (MEMTRACK_TEST_PID + TEST_PID_SIBLING) * 4096);
+    EXPECT_EQ(processes, 2);
+    EXPECT_EQ(cgroup_bytes(TEST_CGROUP_IDLE, &processes),
+              MEMTRACK_TEST_PID_IDLE * 4096);
+    EXPECT_EQ(cgroup_bytes("/apps", &processes), -1);
+    EXPECT_EQ(memtrack_aggregate_foreach_uid(sum_uid, &total), 0);
+    EXPECT_EQ(total, (MEMTRACK_TEST_PID_INIT + MEMTRACK_TEST_PID +
+                      MEMTRACK_TEST_PID_IDLE + TEST_PID_SIBLING) * 4096);
+    memtrack_aggregate_get_stats(&stats);
+    EXPECT_EQ(stats.cgroups, 2);
+
+    /* Exits, the idle app's cgroup is left empty */
+    EXPECT_EQ(remove_pid(TEST_PID_SIBLING), 0);
+    EXPECT_EQ(remove_pid(MEMTRACK_TEST_PID_IDLE), 0);
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(uid_bytes(TEST_UID_APP, &processes), MEMTRACK_TEST_PID * 4096);
+    EXPECT_EQ(processes, 1);
+    EXPECT_EQ(uid_bytes(TEST_UID_IDLE, &processes), -1);
+    EXPECT_EQ(cgroup_bytes(TEST_CGROUP_IDLE, &processes), -1);
+    memtrack_aggregate_get_stats(&stats);
+    EXPECT_EQ(stats.cgroups, 1);
+    EXPECT_EQ(stats.cgroups_reclaimed, 1);
+
+    /* A confirmed identity is not read again while the process lives */
+    EXPECT_EQ(write_identity(TEST_PID_SIBLING, TEST_UID_APP, TEST_CGROUP_APP,
+                             2000), 0);
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(write_identity(TEST_PID_SIBLING, TEST_UID_OTHER,
+                             TEST_CGROUP_APP, 2000), 0);
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(uid_bytes(TEST_UID_APP, &processes),
+              (MEMTRACK_TEST_PID + TEST_PID_SIBLING) * 4096);
+    EXPECT_EQ(uid_bytes(TEST_UID_OTHER, &processes), -1);
+
+    /* Another process behind the pid, told apart by its start time */
+    EXPECT_EQ(write_identity(TEST_PID_SIBLING, TEST_UID_OTHER,
+                             TEST_CGROUP_APP, 3000), 0);
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(uid_bytes(TEST_UID_APP, &processes), MEMTRACK_TEST_PID * 4096);
+    EXPECT_EQ(uid_bytes(TEST_UID_OTHER, &processes),
+              TEST_PID_SIBLING * 4096);
+    EXPECT_EQ(processes, 1);
+
+    return memtrack_test_finish();
+}
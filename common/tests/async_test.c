@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Runs queries on the async executor, see async.h, with a provider that
+ * is slow for one pid: a query still running at its deadline completes
+ * with -ETIMEDOUT, the others with their answer.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "async.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+
+#define TEST_SLOW_MS 300
+#define TEST_DEADLINE_MS 50
+#define TEST_WAIT_MS 5000
+
+static int slow_get_memory(pid_t pid, enum memtrack_type type,
+                           struct memtrack_record *records,
+                           size_t *num_records)
+{
+    if (pid == MEMTRACK_TEST_PID) {
+        usleep(TEST_SLOW_MS * 1000);
+    }
+    if (*num_records) {
+        records[0].size_in_bytes = pid * 4096;
+        records[0].flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                           MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    }
+    *num_records = 1;
+
+    return 0;
+}
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "slow",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = slow_get_memory,
+    },
+};
+
+/* Waits for the completion of one request */
+static bool wait_completion(struct memtrack_async *ctx,
+                            struct memtrack_async_completion *completion)
+{
+    struct pollfd pfd = { .fd = memtrack_async_fd(ctx), .events = POLLIN };
+
+    while (memtrack_async_reap(ctx, completion, 1) == 0) {
+        if (poll(&pfd, 1, TEST_WAIT_MS) <= 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int query(struct memtrack_async *ctx, pid_t pid, uint32_t deadline_ms,
+                 size_t *num_records)
+{
+    struct memtrack_async_completion completion;
+    struct memtrack_record records[2];
+    uint64_t id;
+
+    *num_records = 0;
+    if (!EXPECT_EQ(memtrack_async_submit(ctx, pid, MEMTRACK_TYPE_GL, records,
+                                         2, deadline_ms, pid, &id), 0) ||
+        !EXPECT(wait_completion(ctx, &completion))) {
+        return -EIO;
+    }
+    EXPECT_EQ(completion.id, id);
+    EXPECT_EQ(completion.cookie, pid);
+    *num_records = completion.num_records;
+    if (completion.ret == 0 && completion.num_records) {
+        EXPECT_EQ(records[0].size_in_bytes, pid * 4096);
+    }
+
+    return completion.ret;
+}
+
+int main(void)
+{
+    struct memtrack_async *ctx;
+    size_t num_records;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(memtrack_core_init(providers, 1), 0);
+
+    ctx = memtrack_async_create(1);
+    EXPECT(ctx != NULL);
+    if (ctx == NULL) {
+        return memtrack_test_finish();
+    }
+
+    /* Running past the deadline, not only queued past it */
+    EXPECT_EQ(query(ctx, MEMTRACK_TEST_PID, TEST_DEADLINE_MS, &num_records),
+              -ETIMEDOUT);
+    EXPECT_EQ(num_records, 0);
+
+    EXPECT_EQ(query(ctx, MEMTRACK_TEST_PID, 0, &num_records), 0);
+    EXPECT_EQ(num_records, 1);
+    EXPECT_EQ(query(ctx, MEMTRACK_TEST_PID_IDLE, TEST_DEADLINE_MS,
+                    &num_records), 0);
+    EXPECT_EQ(num_records, 1);
+
+    memtrack_async_destroy(ctx);
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Reads the per-process files of the device fixture, plus one missing
+ * file, in batches of batch_io.h, once with io_uring off and once with
+ * it on, each in a child process since the engine is chosen once per
+ * process.  Checks that both engines parse the same content and report
+ * the same errors, and prints the syscalls each spent per file from
+ * batch_io_get_stats(); with io_uring available, the ring has to need
+ * several times fewer.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "batch_io.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+
+#define TEST_BATCHES 200
+#define TEST_BUF_SIZE 4096
+/* The ring has to spend at most this fraction of the synchronous calls */
+#define TEST_MIN_REDUCTION 4
+
+static const char *const files[] = {
+    "stat", "status", "cgroup", "comm", "smaps",
+};
+
+static const pid_t pids[] = {
+    MEMTRACK_TEST_PID_INIT, MEMTRACK_TEST_PID, MEMTRACK_TEST_PID_IDLE,
+};
+
+#define TEST_FILES (sizeof(pids) / sizeof(pids[0]) * \
+                    sizeof(files) / sizeof(files[0]) + 1)
+
+struct engine_result {
+    int uring;
+    uint64_t checksum;
+    /* Per batch, which requests failed and how */
+    int errors[TEST_FILES];
+    struct batch_io_stats stats;
+};
+
+/* FNV-1a over everything parsed */
+static void hash(void *arg, const char *data, size_t len)
+{
+    uint64_t *h = arg;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        *h = (*h ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+}
+
+static void run_batches(struct engine_result *result)
+{
+    static char paths[TEST_FILES][64];
+    static char bufs[TEST_FILES][TEST_BUF_SIZE];
+    struct batch_io_req reqs[TEST_FILES];
+    size_t i, j, n = 0;
+    int batch;
+
+    for (i = 0; i < sizeof(pids) / sizeof(pids[0]); i++) {
+        for (j = 0; j < sizeof(files) / sizeof(files[0]); j++) {
+            snprintf(paths[n++], sizeof(paths[0]), "/proc/%d/%s", pids[i],
+                     files[j]);
+        }
+    }
+    snprintf(paths[n], sizeof(paths[0]), "/proc/%d/stat",
+             MEMTRACK_TEST_PID_MISSING);
+
+    result->checksum = 14695981039346656037ULL;
+    for (batch = 0; batch < TEST_BATCHES; batch++) {
+        for (i = 0; i < TEST_FILES; i++) {
+            reqs[i] = (struct batch_io_req) {
+                .path = paths[i],
+                .buf = bufs[i],
+                .buf_size = sizeof(bufs[i]),
+                .parse = hash,
+                .arg = &result->checksum,
+            };
+        }
+        batch_io_run(reqs, TEST_FILES);
+    }
+    for (i = 0; i < TEST_FILES; i++) {
+        result->errors[i] = reqs[i].error;
+    }
+    batch_io_get_stats(&result->stats);
+}
+
+/* Runs the batches in a child with io_uring as configured */
+static bool run_engine(bool uring, struct engine_result *result)
+{
+    int fds[2], status;
+    bool ok;
+    pid_t child;
+
+    if (pipe(fds) < 0) {
+        return false;
+    }
+    child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        if (memtrack_test_config("io_uring = %s\n",
+                                 uring ? "true" : "false") < 0) {
+            _exit(1);
+        }
+        memset(result, 0, sizeof(*result));
+        result->uring = batch_io_uring_available();
+        run_batches(result);
+        _exit(write(fds[1], result, sizeof(*result)) == sizeof(*result) ?
+              0 : 1);
+    }
+    close(fds[1]);
+    ok = child > 0 && read(fds[0], result, sizeof(*result)) ==
+                      sizeof(*result);
+    close(fds[0]);
+
+    return ok && waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+           WEXITSTATUS(status) == 0;
+}
+
+static uint64_t syscalls(const struct batch_io_stats *stats)
+{
+    return stats->ring_enters + stats->sync_syscalls;
+}
+
+int main(void)
+{
+    struct engine_result sync, ring;
+    size_t i;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+
+    EXPECT(run_engine(false, &sync));
+    EXPECT_EQ(sync.uring, 0);
+    EXPECT_EQ(sync.stats.batches, TEST_BATCHES);
+    EXPECT_EQ(sync.stats.files, TEST_BATCHES * TEST_FILES);
+    EXPECT_EQ(sync.stats.ring_enters, 0);
+    /* open, read, read of EOF, close; just the open of the missing one */
+    EXPECT_EQ(sync.stats.sync_syscalls,
+              TEST_BATCHES * ((TEST_FILES - 1) * 4 + 1));
+    for (i = 0; i < TEST_FILES - 1; i++) {
+        EXPECT_EQ(sync.errors[i], 0);
+    }
+    EXPECT_EQ(sync.errors[TEST_FILES - 1], -ENOENT);
+    printf("stdio: %.2f syscalls per file\n",
+           (double)syscalls(&sync.stats) / sync.stats.files);
+
+    EXPECT(run_engine(true, &ring));
+    if (!ring.uring) {
+        printf("io_uring: unavailable here, not compared\n");
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(ring.checksum, sync.checksum);
+    EXPECT(memcmp(ring.errors, sync.errors, sizeof(ring.errors)) == 0);
+    EXPECT_EQ(ring.stats.bytes, sync.stats.bytes);
+    EXPECT_EQ(ring.stats.ring_sqes, TEST_BATCHES * TEST_FILES * 3);
+    printf("io_uring: %.2f syscalls per file, %" PRIu64 " enters, %" PRIu64
+           " files finished synchronously\n",
+           (double)syscalls(&ring.stats) / ring.stats.files,
+           ring.stats.ring_enters, ring.stats.regrows);
+    printf("%.1fx fewer syscalls\n",
+           (double)syscalls(&sync.stats) / syscalls(&ring.stats));
+    EXPECT(syscalls(&ring.stats) * TEST_MIN_REDUCTION <
+           syscalls(&sync.stats));
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,699 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Measurements on the device fixture, run by hand:
+ *
+ *   memtrack_bench [cache|history|adaptive|overhead|sweep|perf] ...
+ *
+ * every one of them without arguments; perf needs a MEMTRACK_PERF build.
+ * Each runs in a child process, since what it measures is mostly per
+ * process state, and prints its numbers.  The checks only catch a
+ * measurement that went wrong, not a slow machine.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <hardware/memtrack.h>
+
+#include "adaptive.h"
+#include "batch_io.h"
+#include "cache.h"
+#include "history.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "perf.h"
+#include "pipeline.h"
+#include "sampler.h"
+#include "snapshot.h"
+#include "stats.h"
+
+#define BENCH_THREADS 4
+#define BENCH_START_TIME 1234
+
+#define BENCH_CACHE_BYTES (64 * 1024)
+#define BENCH_CACHE_OPS 500000
+
+#define BENCH_HISTORY_BYTES (4 * 1024 * 1024)
+#define BENCH_HISTORY_PIDS 200
+/* Ten minutes of sweeps, one per second */
+#define BENCH_HISTORY_SWEEPS 600
+
+#define BENCH_ADAPTIVE_PIDS 256
+/* One in this many pids moves on every tick */
+#define BENCH_ADAPTIVE_VOLATILE 10
+#define BENCH_ADAPTIVE_TICK_MS 20
+#define BENCH_ADAPTIVE_TICKS 150
+#define BENCH_ADAPTIVE_MAX_INTERVAL_MS 1000
+#define BENCH_ADAPTIVE_ERROR_BYTES (256 * 1024)
+
+#define BENCH_OVERHEAD_CALLS 20000
+#define BENCH_OVERHEAD_PID 400
+/* A small native daemon; apps map several thousand */
+#define BENCH_OVERHEAD_MAPPINGS 500
+
+#define BENCH_SWEEP_PIDS 128
+#define BENCH_SWEEP_FIRST_PID 2000
+#define BENCH_SWEEP_MAPPINGS 200
+#define BENCH_SWEEP_MAX_PIDS 256
+#define BENCH_SWEEP_DEPTH 8
+#define BENCH_SWEEPS 10
+
+struct cache_load {
+    pid_t first_pid;
+    unsigned int pids;
+    /* Percent of the lookups going to the first tenth of the pids */
+    unsigned int hot_percent;
+};
+
+static void *cache_thread(void *arg)
+{
+    const struct cache_load *load = arg;
+    unsigned int seed = (unsigned int)(uintptr_t)pthread_self();
+    struct memtrack_record record = {
+        .flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED | MEMTRACK_FLAG_PRIVATE,
+    };
+    struct memtrack_record records[1];
+    size_t num_records;
+    unsigned int hot = load->pids / 10 ? load->pids / 10 : 1;
+    pid_t pid;
+    int i, ret;
+
+    for (i = 0; i < BENCH_CACHE_OPS; i++) {
+        if ((unsigned int)rand_r(&seed) % 100 < load->hot_percent) {
+            pid = load->first_pid + rand_r(&seed) % hot;
+        } else {
+            pid = load->first_pid + rand_r(&seed) % load->pids;
+        }
+        num_records = 1;
+        if (!memtrack_cache_lookup(pid, BENCH_START_TIME, MEMTRACK_TYPE_GL,
+                                   UINT32_MAX, records, &num_records, &ret)) {
+            record.size_in_bytes = pid * 4096;
+            memtrack_cache_insert(pid, BENCH_START_TIME, MEMTRACK_TYPE_GL,
+                                  &record, 1, 0);
+        }
+    }
+
+    return NULL;
+}
+
+/* Lookups from every thread, a miss inserting like a provider call would */
+static bool cache_run(const char *name, const struct cache_load *load)
+{
+    struct memtrack_cache_stats before, after;
+    pthread_t threads[BENCH_THREADS];
+    uint64_t start, lookups;
+    unsigned int i;
+    bool ok = true;
+
+    memtrack_cache_get_stats(&before);
+    start = memtrack_now_ns();
+    for (i = 0; i < BENCH_THREADS; i++) {
+        ok &= EXPECT_EQ(pthread_create(&threads[i], NULL, cache_thread,
+                                       (void *)load), 0);
+    }
+    for (i = 0; i < BENCH_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    start = memtrack_now_ns() - start;
+    memtrack_cache_get_stats(&after);
+
+    /* Expired lookups count as misses too */
+    lookups = after.hits + after.misses - before.hits - before.misses;
+    ok &= EXPECT_EQ(lookups, BENCH_THREADS * BENCH_CACHE_OPS);
+    ok &= EXPECT(after.footprint_bytes <= BENCH_CACHE_BYTES);
+    ok &= EXPECT_EQ(after.expired, before.expired);
+    printf("cache %s: %u pids, %.1f%% hits, %" PRIu64 " evictions, %" PRIu64
+           " insert races, %zu of %zu slots in %zu bytes, %.1f Mlookups/s\n",
+           name, load->pids,
+           100.0 * (after.hits - before.hits) / lookups,
+           after.evictions - before.evictions,
+           after.insert_races - before.insert_races, after.used,
+           after.capacity, after.footprint_bytes,
+           lookups * 1000.0 / start);
+
+    for (i = 0; i < load->pids; i++) {
+        memtrack_cache_evict_pid(load->first_pid + i);
+    }
+
+    return ok;
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Memory of the history per process, every process reporting two types,
+ * a tenth of them moving on every sweep, over the ten minutes the rings
+ * keep.
+ */
+static bool bench_history(void)
+{
+    static pid_t pids[BENCH_HISTORY_PIDS];
+    static struct snapshot_entry entries[BENCH_HISTORY_PIDS];
+    struct snapshot_view view = {
+        .count = BENCH_HISTORY_PIDS,
+        .capacity = BENCH_HISTORY_PIDS,
+        .pids = pids,
+        .entries = entries,
+    };
+    struct memtrack_history_stats stats;
+    uint64_t start_ns = memtrack_now_ns(), cpu_ns = 0, start;
+    size_t i;
+    int sweep, type;
+    bool ok = true;
+
+    ok &= EXPECT_EQ(memtrack_history_init(BENCH_HISTORY_BYTES), 0);
+    for (i = 0; i < BENCH_HISTORY_PIDS; i++) {
+        pids[i] = 1000 + i;
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            entries[i].ret[type] = -EINVAL;
+        }
+        entries[i].ret[MEMTRACK_TYPE_GL] = 0;
+        entries[i].ret[MEMTRACK_TYPE_GRAPHICS] = 0;
+        entries[i].num_records[MEMTRACK_TYPE_GL] = 1;
+        entries[i].num_records[MEMTRACK_TYPE_GRAPHICS] = 1;
+        entries[i].records[MEMTRACK_TYPE_GL][0].size_in_bytes =
+            (64 + i) * 1024 * 1024;
+        entries[i].records[MEMTRACK_TYPE_GRAPHICS][0].size_in_bytes =
+            (16 + i) * 1024 * 1024;
+    }
+
+    for (sweep = 0; sweep < BENCH_HISTORY_SWEEPS; sweep++) {
+        for (i = 0; i < BENCH_HISTORY_PIDS; i++) {
+            entries[i].sampled_ns = start_ns + sweep * 1000000000ULL;
+            if (i % 10 == 0) {
+                entries[i].records[MEMTRACK_TYPE_GL][0].size_in_bytes +=
+                    (sweep % 7) * 65536;
+            }
+        }
+        start = thread_cpu_ns();
+        memtrack_history_record(&view);
+        cpu_ns += thread_cpu_ns() - start;
+    }
+    memtrack_history_get_stats(&stats);
+
+    ok &= EXPECT_EQ(stats.used, 2 * BENCH_HISTORY_PIDS);
+    ok &= EXPECT_EQ(stats.recycled, 0);
+    ok &= EXPECT(stats.footprint_bytes <= BENCH_HISTORY_BYTES);
+    printf("history: %zu bytes per series, %zu per process of two types, "
+           "%zu of %zu series in %zu bytes, %.1f us CPU per sweep of %d "
+           "processes\n", stats.bytes_per_series, 2 * stats.bytes_per_series,
+           stats.used, stats.capacity, stats.footprint_bytes,
+           cpu_ns / 1000.0 / BENCH_HISTORY_SWEEPS, BENCH_HISTORY_PIDS);
+
+    return ok;
+}
+
+/* Hit rate and footprint with the working set below, at and over capacity */
+static bool bench_cache(void)
+{
+    static const struct cache_load fits = { 1000, 256, 0 };
+    static const struct cache_load full = { 2000, 1024, 0 };
+    static const struct cache_load skewed = { 4000, 8192, 80 };
+    uint32_t ttl_ms[MEMTRACK_NUM_TYPES] = { 0 };
+    bool ok = true;
+
+    ttl_ms[MEMTRACK_TYPE_GL] = 60000;
+    ok &= EXPECT_EQ(memtrack_cache_init(BENCH_CACHE_BYTES, ttl_ms), 0);
+    ok &= cache_run("fits", &fits);
+    ok &= cache_run("full", &full);
+    ok &= cache_run("skewed", &skewed);
+
+    return ok;
+}
+
+
+/* True sizes at tick n, the same sequence on every call */
+static void adaptive_truth(int n, uint64_t *truth)
+{
+    unsigned int seed = n;
+    size_t i;
+
+    for (i = 0; i < BENCH_ADAPTIVE_PIDS; i++) {
+        if (n == 0) {
+            truth[i] = (64 + i) * 1024 * 1024;
+        } else if (i % BENCH_ADAPTIVE_VOLATILE == 0) {
+            /* Drifting up by 512 KB per tick on average */
+            truth[i] += rand_r(&seed) % (2 * 1024 * 1024);
+            truth[i] -= 512 * 1024;
+        } else if (rand_r(&seed) % 1000 == 0) {
+            truth[i] += 4096;
+        }
+    }
+}
+
+static uint64_t adaptive_cost(size_t i)
+{
+    return 4096 + (i % 8) * 16384;
+}
+
+static uint64_t distance(uint64_t a, uint64_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+/*
+ * The scheduler against sampling every pid each few ticks, as many as
+ * makes it read about the same bytes; staleness is how far the known
+ * sizes are from the true ones, over every pid and tick.
+ */
+static bool bench_adaptive(void)
+{
+    static pid_t pids[BENCH_ADAPTIVE_PIDS];
+    static uint64_t truth[BENCH_ADAPTIVE_PIDS], known[BENCH_ADAPTIVE_PIDS];
+    static uint8_t actions[BENCH_ADAPTIVE_PIDS];
+    struct memtrack_adaptive_stats stats;
+    struct snapshot_entry entry = { 0 };
+    uint64_t cpu_ns = 0, start, stale = 0, fixed_stale = 0, fixed_bytes = 0;
+    uint64_t max_stale = 0, fixed_max_stale = 0, every;
+    size_t i;
+    int n;
+    bool ok = true;
+
+    for (i = 0; i < BENCH_ADAPTIVE_PIDS; i++) {
+        pids[i] = 1000 + i;
+    }
+    ok &= EXPECT_EQ(adaptive_init(BENCH_ADAPTIVE_PIDS, UINT32_MAX,
+                                  BENCH_ADAPTIVE_MAX_INTERVAL_MS,
+                                  BENCH_ADAPTIVE_ERROR_BYTES), 0);
+
+    for (n = 0; n < BENCH_ADAPTIVE_TICKS; n++) {
+        adaptive_truth(n, truth);
+        start = thread_cpu_ns();
+        adaptive_plan(pids, BENCH_ADAPTIVE_PIDS, BENCH_ADAPTIVE_TICK_MS,
+                      actions);
+        cpu_ns += thread_cpu_ns() - start;
+        for (i = 0; i < BENCH_ADAPTIVE_PIDS; i++) {
+            if (actions[i] == ADAPTIVE_SAMPLE) {
+                entry.sampled_ns = memtrack_now_ns();
+                entry.ret[MEMTRACK_TYPE_GL] = 0;
+                entry.num_records[MEMTRACK_TYPE_GL] = 1;
+                entry.records[MEMTRACK_TYPE_GL][0].size_in_bytes = truth[i];
+                known[i] = truth[i];
+            }
+            start = thread_cpu_ns();
+            if (actions[i] != ADAPTIVE_SKIP) {
+                adaptive_record(i, pids[i], &entry, adaptive_cost(i));
+            }
+            cpu_ns += thread_cpu_ns() - start;
+            if (distance(truth[i], known[i]) > max_stale) {
+                max_stale = distance(truth[i], known[i]);
+            }
+            stale += distance(truth[i], known[i]);
+        }
+        start = thread_cpu_ns();
+        adaptive_commit();
+        cpu_ns += thread_cpu_ns() - start;
+        usleep(BENCH_ADAPTIVE_TICK_MS * 1000);
+    }
+    memtrack_adaptive_get_stats(&stats);
+    ok &= EXPECT_EQ(stats.ticks, BENCH_ADAPTIVE_TICKS);
+    ok &= EXPECT(stats.bytes_read > 0 && stats.bytes_read < stats.fixed_bytes);
+
+    /* Every pid once per every ticks, staggered, from the same sizes */
+    every = (stats.fixed_bytes + stats.bytes_read / 2) / stats.bytes_read;
+    memset(known, 0, sizeof(known));
+    for (n = 0; n < BENCH_ADAPTIVE_TICKS; n++) {
+        adaptive_truth(n, truth);
+        for (i = 0; i < BENCH_ADAPTIVE_PIDS; i++) {
+            if (n == 0 || (n + i) % every == 0) {
+                known[i] = truth[i];
+                fixed_bytes += adaptive_cost(i);
+            }
+            if (distance(truth[i], known[i]) > fixed_max_stale) {
+                fixed_max_stale = distance(truth[i], known[i]);
+            }
+            fixed_stale += distance(truth[i], known[i]);
+        }
+    }
+
+    printf("adaptive: %" PRIu64 " bytes read, %" PRIu64 " KB mean and %"
+           PRIu64 " KB max staleness, %.1f us CPU per tick of %d pids (%.2f%%)"
+           "\n", stats.bytes_read,
+           stale / BENCH_ADAPTIVE_TICKS / BENCH_ADAPTIVE_PIDS / 1024,
+           max_stale / 1024, cpu_ns / 1000.0 / BENCH_ADAPTIVE_TICKS,
+           BENCH_ADAPTIVE_PIDS,
+           cpu_ns / 10000.0 / BENCH_ADAPTIVE_TICKS / BENCH_ADAPTIVE_TICK_MS);
+    printf("fixed every %" PRIu64 " ticks: %" PRIu64 " bytes read, %" PRIu64
+           " KB mean and %" PRIu64 " KB max staleness\n", every, fixed_bytes,
+           fixed_stale / BENCH_ADAPTIVE_TICKS / BENCH_ADAPTIVE_PIDS / 1024,
+           fixed_max_stale / 1024);
+
+    return ok;
+}
+
+static void sum_rss(void *arg, const char *data, size_t len)
+{
+    uint64_t *rss = arg;
+    const char *pos = data, *end = data + len;
+    unsigned long long kb;
+    char line[256];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        if (sscanf(line, "Rss: %llu kB", &kb) == 1) {
+            *rss += kb * 1024;
+        }
+    }
+}
+
+/* A provider call: one smaps read and parsed */
+static int smaps_rss(pid_t pid, uint64_t *rss)
+{
+    char path[32];
+
+    snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+    *rss = 0;
+
+    return batch_io_read_file(path, batch_io_scratch(), BATCH_IO_SCRATCH_SIZE,
+                              sum_rss, rss);
+}
+
+static int write_smaps(pid_t pid, int mappings)
+{
+    static const char mapping[] =
+        "%08x-%08x rw-p 00000000 00:00 0 [anon:scudo:primary]\n"
+        "Size: 1024 kB\nKernelPageSize: 4 kB\nMMUPageSize: 4 kB\n"
+        "Rss: 64 kB\nPss: 64 kB\nShared_Clean: 0 kB\nShared_Dirty: 0 kB\n"
+        "Private_Clean: 0 kB\nPrivate_Dirty: 64 kB\nReferenced: 64 kB\n"
+        "Anonymous: 64 kB\nLazyFree: 0 kB\nAnonHugePages: 0 kB\n"
+        "ShmemPmdMapped: 0 kB\nShared_Hugetlb: 0 kB\n"
+        "Private_Hugetlb: 0 kB\nSwap: 0 kB\nSwapPss: 0 kB\nLocked: 0 kB\n"
+        "VmFlags: rd wr mr mw me ac\n";
+    char path[32], *smaps, *pos;
+    size_t size = mappings * (sizeof(mapping) + 8);
+    int i, ret;
+
+    smaps = malloc(size);
+    if (smaps == NULL) {
+        return -ENOMEM;
+    }
+    for (i = 0, pos = smaps; i < mappings; i++) {
+        pos += snprintf(pos, size - (pos - smaps), mapping,
+                        0x10000000 + i * 0x100000,
+                        0x10000000 + (i + 1) * 0x100000);
+    }
+    snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+    ret = memtrack_test_write(path, "%s", smaps);
+    free(smaps);
+
+    return ret;
+}
+
+/* CPU time of a call to smaps_rss(pid), averaged over calls, in ns */
+static uint64_t smaps_rss_ns(pid_t pid, int calls)
+{
+    uint64_t start, rss;
+    int i;
+
+    /* Warms the page cache */
+    smaps_rss(pid, &rss);
+    start = thread_cpu_ns();
+    for (i = 0; i < calls; i++) {
+        smaps_rss(pid, &rss);
+    }
+
+    return (thread_cpu_ns() - start) / calls;
+}
+
+/*
+ * What the stats of a live query cost, timing and counting the call and
+ * its origin, next to a provider call reading the few mappings of the
+ * fixture and the hundreds of a small daemon.
+ */
+static bool bench_overhead(void)
+{
+    struct memtrack_provider_stats stats;
+    struct memtrack_stats_call call;
+    uint64_t start, call_ns, small_ns, stats_ns, rss;
+    int i;
+    bool ok = true;
+
+    ok &= EXPECT_EQ(write_smaps(BENCH_OVERHEAD_PID, BENCH_OVERHEAD_MAPPINGS),
+                    0);
+    ok &= EXPECT_EQ(smaps_rss(BENCH_OVERHEAD_PID, &rss), 0);
+    ok &= EXPECT_EQ(rss, BENCH_OVERHEAD_MAPPINGS * 64 * 1024);
+    small_ns = smaps_rss_ns(MEMTRACK_TEST_PID, BENCH_OVERHEAD_CALLS);
+    call_ns = smaps_rss_ns(BENCH_OVERHEAD_PID, BENCH_OVERHEAD_CALLS / 100);
+
+    /* Sets up this thread's shard */
+    memtrack_stats_call_begin(&call);
+    memtrack_stats_call_end(MEMTRACK_TYPE_GL, &call, 0);
+
+    start = thread_cpu_ns();
+    for (i = 0; i < BENCH_OVERHEAD_CALLS; i++) {
+        memtrack_stats_call_begin(&call);
+        memtrack_stats_call_end(MEMTRACK_TYPE_GL, &call, 0);
+        memtrack_stats_query(MEMTRACK_TYPE_GL, MEMTRACK_STATS_LIVE);
+    }
+    stats_ns = (thread_cpu_ns() - start) / BENCH_OVERHEAD_CALLS;
+
+    ok &= EXPECT_EQ(memtrack_stats_get(MEMTRACK_TYPE_GL, &stats), 0);
+    ok &= EXPECT_EQ(stats.calls, BENCH_OVERHEAD_CALLS + 1);
+    printf("overhead: %" PRIu64 " ns of stats per call, %.2f%% of a %" PRIu64
+           " ns call of the fixture, %.2f%% of a %" PRIu64 " ns call of %d "
+           "mappings\n", stats_ns, 100.0 * stats_ns / small_ns, small_ns,
+           100.0 * stats_ns / call_ns, call_ns, BENCH_OVERHEAD_MAPPINGS);
+    ok &= EXPECT(stats_ns * 100 < call_ns);
+
+    return ok;
+}
+
+static int sweep_get_memory(pid_t pid, enum memtrack_type type,
+                            struct memtrack_record *records,
+                            size_t *num_records)
+{
+    uint64_t rss;
+    int ret = smaps_rss(pid, &rss);
+
+    if (ret < 0) {
+        return ret;
+    }
+    if (*num_records) {
+        records[0].size_in_bytes = rss;
+        records[0].flags = MEMTRACK_FLAG_SMAPS_ACCOUNTED |
+                           MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    }
+    *num_records = 1;
+
+    return 0;
+}
+
+static const struct memtrack_provider sweep_providers[] = {
+    {
+        .name = "bench",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = sweep_get_memory,
+    },
+};
+
+/* Sweeps count times, returns the ns per sweep and the sizes summed */
+static uint64_t sweep_ns(int count, uint64_t *total)
+{
+    static pid_t pids[BENCH_SWEEP_MAX_PIDS];
+    static struct snapshot_entry entries[BENCH_SWEEP_MAX_PIDS];
+    uint64_t start, timestamp_ns;
+    ssize_t n, i;
+    int sweep;
+
+    start = memtrack_now_ns();
+    for (sweep = 0; sweep < count; sweep++) {
+        memtrack_sampler_sweep();
+    }
+    start = memtrack_now_ns() - start;
+
+    *total = 0;
+    n = snapshot_copy(pids, entries, BENCH_SWEEP_MAX_PIDS, &timestamp_ns);
+    for (i = 0; i < n; i++) {
+        *total += entries[i].records[MEMTRACK_TYPE_GL][0].size_in_bytes;
+    }
+
+    return start / count;
+}
+
+/* Processes of a few hundred mappings each, and the provider reading them */
+static bool sweep_fixture(void)
+{
+    char path[32];
+    pid_t pid;
+    bool ok = true;
+
+    for (pid = BENCH_SWEEP_FIRST_PID;
+         pid < BENCH_SWEEP_FIRST_PID + BENCH_SWEEP_PIDS; pid++) {
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        ok &= EXPECT_EQ(memtrack_test_write(path, "%d (bench) S 1 %d %d 0 -1 "
+                                            "0 0 0 0 0 0 0 0 0 20 0 1 0 %d 0 "
+                                            "0\n", pid, pid, pid, pid), 0);
+        ok &= EXPECT_EQ(write_smaps(pid, BENCH_SWEEP_MAPPINGS), 0);
+    }
+    ok &= EXPECT_EQ(memtrack_core_init(sweep_providers, 1), 0);
+    ok &= EXPECT_EQ(snapshot_init(BENCH_SWEEP_MAX_PIDS), 0);
+
+    return ok;
+}
+
+/*
+ * Sweeps sequential and then pipelined, once the pipeline learned what to
+ * read ahead.
+ */
+static bool bench_sweep(void)
+{
+    struct pipeline_stats stats;
+    uint64_t plain_ns, pipelined_ns, plain_total, total;
+    bool ok = sweep_fixture();
+
+    /* Warms the page cache */
+    sweep_ns(1, &plain_total);
+    plain_ns = sweep_ns(BENCH_SWEEPS, &plain_total);
+
+    ok &= EXPECT_EQ(memtrack_sampler_set_pipeline(BENCH_SWEEP_DEPTH), 0);
+    /* Learns what to read ahead */
+    sweep_ns(1, &total);
+    pipelined_ns = sweep_ns(BENCH_SWEEPS, &total);
+    pipeline_get_stats(&stats);
+
+    ok &= EXPECT_EQ(total, plain_total);
+    ok &= EXPECT(stats.hits > 0);
+    printf("sweep of %d pids: sequential %.2f ms, pipelined %.2f ms (%.2fx), "
+           "%" PRIu64 " hits, %" PRIu64 " misses, %.2f ms stalled per "
+           "sweep\n", BENCH_SWEEP_PIDS, plain_ns / 1e6, pipelined_ns / 1e6,
+           (double)plain_ns / pipelined_ns, stats.hits, stats.misses,
+           stats.stall_ns / 1e6 / (BENCH_SWEEPS + 1));
+
+    return ok;
+}
+
+#ifdef MEMTRACK_PERF
+/*
+ * Hardware counters of the provider calls and their parse callbacks over
+ * the sweeps, with whichever counters this kernel and CPU allow.
+ */
+static bool bench_perf(void)
+{
+    static char dump[16384];
+    struct memtrack_perf_stats call, parse;
+    uint64_t total;
+    bool ok = true;
+
+    ok &= EXPECT_EQ(memtrack_test_config("perf_counters = true\n"), 0);
+    ok &= sweep_fixture();
+    if (memtrack_perf_available() == 0) {
+        printf("perf: no usable counter here\n");
+        return ok;
+    }
+    sweep_ns(BENCH_SWEEPS, &total);
+
+    ok &= EXPECT_EQ(memtrack_perf_get(MEMTRACK_TYPE_GL, MEMTRACK_PERF_CALL,
+                                      &call), 0);
+    ok &= EXPECT_EQ(memtrack_perf_get(MEMTRACK_TYPE_GL, MEMTRACK_PERF_PARSE,
+                                      &parse), 0);
+    ok &= EXPECT(call.count >= BENCH_SWEEPS * BENCH_SWEEP_PIDS);
+    ok &= EXPECT(parse.count >= call.count);
+    ok &= EXPECT(memtrack_perf_dump(dump, sizeof(dump)) < sizeof(dump));
+    printf("perf: counters 0x%x\n%s", memtrack_perf_available(), dump);
+
+    return ok;
+}
+#endif
+
+static const struct bench {
+    const char *name;
+    bool (*run)(void);
+} benches[] = {
+    { "cache", bench_cache },
+    { "history", bench_history },
+    { "adaptive", bench_adaptive },
+    { "overhead", bench_overhead },
+    { "sweep", bench_sweep },
+#ifdef MEMTRACK_PERF
+    { "perf", bench_perf },
+#endif
+};
+
+static const struct bench *find(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (strcmp(benches[i].name, name) == 0) {
+            return &benches[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Runs bench in a child, failed checks fail its exit status */
+static bool run_child(const struct bench *bench)
+{
+    int status;
+    pid_t child;
+
+    fflush(stdout);
+    child = fork();
+    if (child == 0) {
+        bool ok = bench->run();
+
+        fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
+
+    return child > 0 && waitpid(child, &status, 0) == child &&
+           WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t i;
+    int arg;
+
+    for (arg = 1; arg < argc; arg++) {
+        if (find(argv[arg]) == NULL) {
+            fprintf(stderr, "unknown measurement %s\n", argv[arg]);
+            return 2;
+        }
+    }
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+
+    if (argc < 2) {
+        for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+            EXPECT(run_child(&benches[i]));
+        }
+    }
+    for (arg = 1; arg < argc; arg++) {
+        EXPECT(run_child(find(argv[arg])));
+    }
+
+    return memtrack_test_finish();
+}
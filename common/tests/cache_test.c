@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Drives the result cache, see cache.h, in its smallest size, a single
+ * probe window: hits, misses for another process start time, expiry after
+ * the TTL, eviction of the least recently used slot of a full window, and
+ * no torn slot while threads insert and look up the same keys.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "cache.h"
+#include "memtrack_test.h"
+
+/* Fits the 8 slots of one probe window, not 16 */
+#define TEST_CACHE_BYTES 512
+#define TEST_SLOTS 8
+#define TEST_TTL_MS 200
+#define TEST_START_TIME 1234
+#define TEST_THREADS 4
+#define TEST_ROUNDS 200000
+
+static atomic_uint torn;
+static atomic_uint hits;
+
+static void insert_flags(pid_t pid, uint64_t size, uint32_t flags)
+{
+    struct memtrack_record record = {
+        .flags = flags,
+        .size_in_bytes = size,
+    };
+
+    memtrack_cache_insert(pid, TEST_START_TIME, MEMTRACK_TYPE_GL, &record, 1,
+                          0);
+}
+
+static void insert(pid_t pid, uint64_t size)
+{
+    insert_flags(pid, size,
+                 MEMTRACK_FLAG_SMAPS_UNACCOUNTED | MEMTRACK_FLAG_PRIVATE);
+}
+
+static bool lookup_flags(pid_t pid, uint64_t start_time, uint64_t *size,
+                         uint32_t *flags)
+{
+    struct memtrack_record records[2];
+    size_t num_records = 2;
+    int ret = -1;
+
+    if (!memtrack_cache_lookup(pid, start_time, MEMTRACK_TYPE_GL, UINT32_MAX,
+                               records, &num_records, &ret)) {
+        return false;
+    }
+    *size = num_records == 1 && ret == 0 ? records[0].size_in_bytes : 0;
+    *flags = num_records == 1 && ret == 0 ? records[0].flags : 0;
+
+    return true;
+}
+
+static bool lookup(pid_t pid, uint64_t start_time, uint64_t *size)
+{
+    uint32_t flags;
+
+    return lookup_flags(pid, start_time, size, &flags);
+}
+
+/*
+ * Sizes carry their pid in the low bits and a counter above, which the
+ * flags repeat: a slot copied during an insert would not match.
+ */
+static void *race_thread(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    uint64_t size;
+    uint32_t flags;
+    pid_t pid;
+    int i;
+
+    for (i = 0; i < TEST_ROUNDS; i++) {
+        pid = 1 + rand_r(&seed) % (TEST_SLOTS / 2);
+        if (i % 4 == 0) {
+            insert_flags(pid, ((uint64_t)i << 16) | pid, i);
+        } else if (lookup_flags(pid, TEST_START_TIME, &size, &flags)) {
+            if ((size & 0xffff) != (uint64_t)pid || size >> 16 != flags) {
+                atomic_fetch_add(&torn, 1);
+            }
+            atomic_fetch_add(&hits, 1);
+        }
+    }
+
+    return NULL;
+}
+
+int main(void)
+{
+    uint32_t ttl_ms[MEMTRACK_NUM_TYPES] = { 0 };
+    struct memtrack_cache_stats stats;
+    pthread_t threads[TEST_THREADS];
+    uint64_t size;
+    pid_t pid;
+    int i;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+
+    ttl_ms[MEMTRACK_TYPE_GL] = TEST_TTL_MS;
+    EXPECT_EQ(memtrack_cache_init(64, ttl_ms), -EINVAL);
+    EXPECT(!memtrack_cache_enabled(MEMTRACK_TYPE_GL));
+    EXPECT_EQ(memtrack_cache_init(TEST_CACHE_BYTES, ttl_ms), 0);
+    EXPECT(memtrack_cache_enabled(MEMTRACK_TYPE_GL));
+    EXPECT(!memtrack_cache_enabled(MEMTRACK_TYPE_GRAPHICS));
+    memtrack_cache_get_stats(&stats);
+    EXPECT_EQ(stats.capacity, TEST_SLOTS);
+    EXPECT(stats.footprint_bytes <= TEST_CACHE_BYTES);
+
+    /* Hit, then misses for an unknown pid and a restarted process */
+    EXPECT(!lookup(10, TEST_START_TIME, &size));
+    insert(10, 4096);
+    EXPECT(lookup(10, TEST_START_TIME, &size));
+    EXPECT_EQ(size, 4096);
+    EXPECT(!lookup(11, TEST_START_TIME, &size));
+    EXPECT(!lookup(10, TEST_START_TIME + 1, &size));
+    insert(10, 8192);
+    EXPECT(lookup(10, TEST_START_TIME, &size));
+    EXPECT_EQ(size, 8192);
+    memtrack_cache_get_stats(&stats);
+    EXPECT_EQ(stats.hits, 2);
+    EXPECT_EQ(stats.misses, 3);
+    EXPECT_EQ(stats.inserts, 2);
+    EXPECT_EQ(stats.used, 1);
+
+    /* Uncached type */
+    memtrack_cache_insert(10, TEST_START_TIME, MEMTRACK_TYPE_GRAPHICS, NULL, 0,
+                          0);
+    memtrack_cache_get_stats(&stats);
+    EXPECT_EQ(stats.inserts, 2);
+
+    /* Expiry */
+    usleep((TEST_TTL_MS + 50) * 1000);
+    EXPECT(!lookup(10, TEST_START_TIME, &size));
+    memtrack_cache_get_stats(&stats);
+    EXPECT_EQ(stats.expired, 1);
+
+    /* Exit of the process */
+    insert(10, 4096);
+    memtrack_cache_evict_pid(10);
+    EXPECT(!lookup(10, TEST_START_TIME, &size));
+    memtrack_cache_get_stats(&stats);
+    EXPECT_EQ(stats.used, 0);
+
+    /*
+     * Fills the window, uses every slot but pid 1's, then inserts one
+     * more: pid 1 goes, the others stay.
+     */
+    for (pid = 1; pid <= TEST_SLOTS; pid++) {
+        insert(pid, pid * 4096);
+    }
+    usleep(5 * 1000);
+    for (pid = 2; pid <= TEST_SLOTS; pid++) {
+        EXPECT(lookup(pid, TEST_START_TIME, &size));
+    }
+    usleep(5 * 1000);
+    insert(TEST_SLOTS + 1, (TEST_SLOTS + 1) * 4096);
+    EXPECT(!lookup(1, TEST_START_TIME, &size));
+    for (pid = 2; pid <= TEST_SLOTS + 1; pid++) {
+        EXPECT(lookup(pid, TEST_START_TIME, &size));
+        EXPECT_EQ(size, pid * 4096);
+    }
+    memtrack_cache_get_stats(&stats);
+    EXPECT_EQ(stats.evictions, 1);
+    EXPECT_EQ(stats.used, TEST_SLOTS);
+
+    for (pid = 1; pid <= TEST_SLOTS + 1; pid++) {
+        memtrack_cache_evict_pid(pid);
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        EXPECT_EQ(pthread_create(&threads[i], NULL, race_thread,
+                                 (void *)(uintptr_t)(i + 1)), 0);
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    memtrack_cache_get_stats(&stats);
+    printf("%u hits while racing, %" PRIu64 " insert races\n",
+           atomic_load(&hits), stats.insert_races);
+    EXPECT_EQ(atomic_load(&torn), 0);
+    EXPECT(atomic_load(&hits) > 0);
+
+    return memtrack_test_finish();
+}
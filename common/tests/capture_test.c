@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Captures the device fixture with memtrack_capture, included below under
+ * another main, extracts the archive and checks that the providers give
+ * the same answers on the extracted tree, with and without -a.
+ *
+ * Every capture and replay runs in a child process, so each one starts
+ * with its own module state and no answer comes from another's cache.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+
+#define main memtrack_capture_main
+#include "../memtrack_capture.c"
+#undef main
+
+#define TEST_MAX_RECORDS 16
+
+static const pid_t test_pids[] = {
+    MEMTRACK_TEST_PID_INIT,
+    MEMTRACK_TEST_PID,
+    MEMTRACK_TEST_PID_IDLE,
+};
+#define TEST_NUM_PIDS (sizeof(test_pids) / sizeof(test_pids[0]))
+
+struct answer {
+    int ret;
+    unsigned long long bytes;
+};
+
+/* Answers of every type for pids[i], standing for test_pids[i] */
+struct answers {
+    struct answer a[TEST_NUM_PIDS][MEMTRACK_NUM_TYPES];
+};
+
+static void read_answers(const pid_t *pids, struct answers *out)
+{
+    struct memtrack_record records[TEST_MAX_RECORDS];
+    size_t i, r, num_records;
+    int type;
+
+    for (i = 0; i < TEST_NUM_PIDS; i++) {
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            struct answer *answer = &out->a[i][type];
+
+            if (!memtrack_core_enabled(type)) {
+                answer->ret = -ENODEV;
+                continue;
+            }
+            num_records = TEST_MAX_RECORDS;
+            answer->ret = memtrack_core_read_live(pids[i], type, records,
+                                                  &num_records, NULL);
+            for (r = 0; answer->ret == 0 && r < num_records; r++) {
+                answer->bytes += records[r].size_in_bytes;
+            }
+        }
+    }
+}
+
+/* Waits for a child, true when it exited with 0 */
+static bool wait_child(pid_t child)
+{
+    int status;
+
+    while (waitpid(child, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool capture(const char *root, const char *archive, bool anon)
+{
+    char *argv[] = { "memtrack_capture", "-r", (char *)root, "-o",
+                     (char *)archive, anon ? "-a" : NULL, NULL };
+    pid_t child = fork();
+
+    if (child == 0) {
+        _exit(memtrack_capture_main(anon ? 6 : 5, argv));
+    }
+
+    return child > 0 && wait_child(child);
+}
+
+/* Answers of the providers on root, read by a child */
+static bool replay(const char *root, const pid_t *pids, struct answers *out)
+{
+    ssize_t len = 0, ret;
+    int fds[2];
+    pid_t child;
+
+    memset(out, 0, sizeof(*out));
+    if (pipe(fds) < 0) {
+        return false;
+    }
+
+    child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        if (memtrack_io_set_root(root) < 0 ||
+            HAL_MODULE_INFO_SYM.init(&HAL_MODULE_INFO_SYM) < 0) {
+            _exit(1);
+        }
+        read_answers(pids, out);
+        _exit(write(fds[1], out, sizeof(*out)) == sizeof(*out) ? 0 : 1);
+    }
+    close(fds[1]);
+
+    while (child > 0 && len < (ssize_t)sizeof(*out)) {
+        ret = read(fds[0], (char *)out + len, sizeof(*out) - len);
+        if (ret <= 0 && !(ret < 0 && errno == EINTR)) {
+            break;
+        }
+        len += ret > 0 ? ret : 0;
+    }
+    close(fds[0]);
+
+    return child > 0 && wait_child(child) && len == sizeof(*out);
+}
+
+/* Full path of name below the root, false when it does not fit */
+static bool root_path(char *buf, size_t size, const char *name)
+{
+    return snprintf(buf, size, "%s%s", memtrack_test_root(), name) <
+           (int)size;
+}
+
+/* Extracts a ustar archive below dir, a path relative to the test root */
+static bool extract(const char *archive, const char *dir)
+{
+    struct tar_header h;
+    char path[PATH_MAX], name[sizeof(h.prefix) + sizeof(h.name) + 2];
+    char *data;
+    size_t size, blocks;
+    bool ok = true;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s", memtrack_test_root(), dir);
+    fp = fopen(archive, "re");
+    if (fp == NULL || (mkdir(path, 0755) < 0 && errno != EEXIST)) {
+        if (fp) {
+            fclose(fp);
+        }
+        return false;
+    }
+
+    while (fread(&h, sizeof(h), 1, fp) == 1 && h.name[0]) {
+        if (memcmp(h.magic, "ustar", 6) != 0) {
+            ok = false;
+            break;
+        }
+        snprintf(name, sizeof(name), "%.*s%s%.*s",
+                 (int)strnlen(h.prefix, sizeof(h.prefix)), h.prefix,
+                 h.prefix[0] ? "/" : "", (int)strnlen(h.name, sizeof(h.name)),
+                 h.name);
+        size = strtoull(h.size, NULL, 8);
+        blocks = (size + TAR_BLOCK - 1) / TAR_BLOCK;
+
+        if (h.typeflag == '5') {
+            snprintf(path, sizeof(path), "%s/%s/%s", memtrack_test_root(),
+                     dir, name);
+            ok &= mkdir(path, 0755) == 0 || errno == EEXIST;
+            continue;
+        }
+
+        data = calloc(blocks + 1, TAR_BLOCK);
+        if (data == NULL || fread(data, TAR_BLOCK, blocks, fp) != blocks) {
+            free(data);
+            ok = false;
+            break;
+        }
+        snprintf(path, sizeof(path), "/%s/%s", dir, name);
+        ok &= memtrack_test_write(path, "%.*s", (int)size, data) == 0;
+        free(data);
+    }
+    fclose(fp);
+
+    return ok;
+}
+
+static bool archive_has(const char *dir, const char *path, const char *text)
+{
+    char full[PATH_MAX], buf[512];
+    size_t len;
+    FILE *fp;
+
+    snprintf(full, sizeof(full), "%s/%s%s", memtrack_test_root(), dir, path);
+    fp = fopen(full, "re");
+    if (fp == NULL) {
+        return false;
+    }
+    len = fread(buf, 1, sizeof(buf) - 1, fp);
+    buf[len] = '\0';
+    fclose(fp);
+
+    return text == NULL || strstr(buf, text) != NULL;
+}
+
+int main(void)
+{
+    /* What -a makes of test_pids, handed out in pid order */
+    static const pid_t anon_pids[] = {
+        ANON_PID_BASE, ANON_PID_BASE + 1, ANON_PID_BASE + 2,
+    };
+    struct answers live, plain, anon;
+    char root[PATH_MAX], path[PATH_MAX];
+    size_t i, nonzero = 0;
+    int type;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    snprintf(root, sizeof(root), "%s", memtrack_test_root());
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+
+    EXPECT(replay(root, test_pids, &live));
+
+    EXPECT(root_path(path, sizeof(path), "/plain.tar"));
+    EXPECT(capture(root, path, false));
+    EXPECT(extract(path, "plain"));
+    EXPECT(root_path(path, sizeof(path), "/plain"));
+    EXPECT(replay(path, test_pids, &plain));
+
+    EXPECT(root_path(path, sizeof(path), "/anon.tar"));
+    EXPECT(capture(root, path, true));
+    EXPECT(extract(path, "anon"));
+    EXPECT(root_path(path, sizeof(path), "/anon"));
+    EXPECT(replay(path, anon_pids, &anon));
+
+    for (i = 0; i < TEST_NUM_PIDS; i++) {
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            EXPECT_EQ(plain.a[i][type].ret, live.a[i][type].ret);
+            EXPECT_EQ(plain.a[i][type].bytes, live.a[i][type].bytes);
+
+            /* HMM pools are charged to pid 1, which -a renames */
+            if (test_pids[i] == 1) {
+                continue;
+            }
+            EXPECT_EQ(anon.a[i][type].ret, live.a[i][type].ret);
+            EXPECT_EQ(anon.a[i][type].bytes, live.a[i][type].bytes);
+        }
+    }
+
+    /* The fixture pid itself answers something, or nothing was compared */
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        nonzero += live.a[1][type].bytes != 0;
+    }
+    EXPECT(nonzero > 0);
+
+    EXPECT(archive_has("plain", "/proc/100/stat", "100 (test_app)"));
+    EXPECT(archive_has("anon", "/proc/1001/stat", "1001 (test_app) S 1000"));
+    EXPECT(archive_has("anon", "/proc/1001/cgroup", "pid_1001"));
+    EXPECT(!archive_has("anon", "/proc/100/stat", NULL));
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Loads and reloads configuration files through config.h and checks the
+ * values taken, the defaults and derived values, that a file with an
+ * unknown key, an invalid value or a malformed line is rejected as a whole
+ * while the previous configuration stays current, and that readers racing
+ * reloads always see one configuration, never parts of two.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <hardware/memtrack.h>
+
+#include "config.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+
+#define TEST_RELOADS 2000
+#define TEST_READERS 4
+
+static atomic_bool stop;
+
+/* Every reload sets both to the same value */
+static void *reader_thread(void *arg)
+{
+    unsigned long *torn = arg;
+
+    while (!atomic_load(&stop)) {
+        const struct memtrack_config *cfg = memtrack_config_get();
+
+        if (cfg->sampler_interval_ms != cfg->coalesce_wait_ms ||
+            cfg->cache_ttl_ms[MEMTRACK_TYPE_GL] !=
+            (uint32_t)cfg->coalesce_wait_ms) {
+            (*torn)++;
+        }
+    }
+
+    return NULL;
+}
+
+/* The first load of a process, from a file that has to be rejected */
+static bool first_load_rejected(void)
+{
+    int status;
+    pid_t child = fork();
+
+    if (child == 0) {
+        const struct memtrack_config *cfg;
+
+        if (memtrack_test_config("cache_bytes = 4096\nno_such_key = 1\n") < 0) {
+            _exit(1);
+        }
+        cfg = memtrack_config_get();
+        /* Runs with the defaults rather than not at all */
+        _exit(cfg->generation == 1 && cfg->cache_bytes == 0 &&
+              cfg->provider_enabled[MEMTRACK_TYPE_GL] ? 0 : 1);
+    }
+
+    return child > 0 && waitpid(child, &status, 0) == child &&
+           WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int reload(const char *text)
+{
+    int ret = memtrack_test_config("%s", text);
+
+    return ret < 0 ? ret : memtrack_config_reload();
+}
+
+int main(void)
+{
+    const struct memtrack_config *cfg, *old;
+    pthread_t readers[TEST_READERS];
+    unsigned long torn[TEST_READERS] = { 0 };
+    char text[256];
+    int i;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT(first_load_rejected());
+
+    EXPECT_EQ(memtrack_test_config(
+        "# comment\n"
+        "cache_bytes = 65536\n"
+        "cache_ttl_ms = 500   # all types\n"
+        "cache_ttl_ms.gl = 50\n"
+        "provider.graphics = false\n"
+        "precision.other = approximate\n"
+        "sampler_interval_ms = 1000\n"
+        "\n"
+        "psi_trigger = some 150000 1000000\n"), 0);
+    cfg = memtrack_config_get();
+    EXPECT_EQ(cfg->generation, 1);
+    EXPECT_EQ(cfg->cache_bytes, 65536);
+    EXPECT_EQ(cfg->cache_ttl_ms[MEMTRACK_TYPE_GL], 50);
+    EXPECT_EQ(cfg->cache_ttl_ms[MEMTRACK_TYPE_OTHER], 500);
+    EXPECT(cfg->provider_enabled[MEMTRACK_TYPE_GL]);
+    EXPECT(!cfg->provider_enabled[MEMTRACK_TYPE_GRAPHICS]);
+    EXPECT_EQ(cfg->precision[MEMTRACK_TYPE_OTHER],
+              MEMTRACK_PRECISION_APPROXIMATE);
+    EXPECT_EQ(cfg->precision[MEMTRACK_TYPE_GL], MEMTRACK_PRECISION_DEFAULT);
+    /* Derived from the sampler interval */
+    EXPECT_EQ(cfg->sampler_idle_interval_ms, 1000);
+    EXPECT(strcmp(cfg->psi_trigger, "some 150000 1000000") == 0);
+    EXPECT_EQ(cfg->coalesce_wait_ms, 100);
+
+    /* Rejected as a whole, the previous configuration stays */
+    old = cfg;
+    EXPECT_EQ(reload("cache_bytes = 1024\nno_such_key = 1\n"), -EINVAL);
+    EXPECT_EQ(reload("cache_bytes = 1024\ncache_ttl_ms.nosuchtype = 1\n"),
+              -EINVAL);
+    EXPECT_EQ(reload("cache_bytes = 1024\nasync_max_threads = 9\n"), -EINVAL);
+    EXPECT_EQ(reload("cache_bytes = 1024\nsampler_interval_ms = 10ms\n"),
+              -EINVAL);
+    EXPECT_EQ(reload("cache_bytes = 1024\nprecision.gl = rough\n"), -EINVAL);
+    EXPECT_EQ(reload("cache_bytes = 1024\naggregate\n"), -EINVAL);
+    cfg = memtrack_config_get();
+    EXPECT(cfg == old);
+    EXPECT_EQ(cfg->generation, 1);
+    EXPECT_EQ(cfg->cache_bytes, 65536);
+
+    /* Taken, unset keys back to their defaults, the old one still readable */
+    EXPECT_EQ(reload("cache_bytes = 1024\nsampler_idle_interval_ms = 5000\n"),
+              0);
+    cfg = memtrack_config_get();
+    EXPECT(cfg != old);
+    EXPECT_EQ(cfg->generation, 2);
+    EXPECT_EQ(cfg->cache_bytes, 1024);
+    EXPECT_EQ(cfg->cache_ttl_ms[MEMTRACK_TYPE_GL], 1000);
+    EXPECT(cfg->provider_enabled[MEMTRACK_TYPE_GRAPHICS]);
+    EXPECT_EQ(cfg->sampler_interval_ms, 0);
+    EXPECT_EQ(cfg->sampler_idle_interval_ms, 5000);
+    EXPECT_EQ(old->cache_bytes, 65536);
+
+    /* Without a file, the defaults */
+    memtrack_config_set_path("/nonexistent/memtrack.conf");
+    EXPECT_EQ(memtrack_config_reload(), 0);
+    cfg = memtrack_config_get();
+    EXPECT_EQ(cfg->generation, 3);
+    EXPECT_EQ(cfg->cache_bytes, 0);
+
+    /* Readers racing reloads */
+    EXPECT_EQ(reload("sampler_interval_ms = 0\ncoalesce_wait_ms = 0\n"
+                     "cache_ttl_ms.gl = 0\n"), 0);
+    for (i = 0; i < TEST_READERS; i++) {
+        EXPECT_EQ(pthread_create(&readers[i], NULL, reader_thread, &torn[i]),
+                  0);
+    }
+    for (i = 1; i <= TEST_RELOADS; i++) {
+        snprintf(text, sizeof(text), "sampler_interval_ms = %d\n"
+                 "coalesce_wait_ms = %d\ncache_ttl_ms.gl = %d\n%s", i, i, i,
+                 i % 3 ? "" : "no_such_key = 1\n");
+        if (!EXPECT_EQ(reload(text), i % 3 ? 0 : -EINVAL)) {
+            break;
+        }
+    }
+    atomic_store(&stop, true);
+    for (i = 0; i < TEST_READERS; i++) {
+        pthread_join(readers[i], NULL);
+        EXPECT_EQ(torn[i], 0);
+    }
+    cfg = memtrack_config_get();
+    EXPECT_EQ(cfg->coalesce_wait_ms, TEST_RELOADS - (TEST_RELOADS % 3 == 0));
+    EXPECT_EQ(cfg->generation, 4 + TEST_RELOADS - TEST_RELOADS / 3);
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Hangs a guarded source, see guard.h, on a FIFO in place of its file and
+ * checks that calls return within the timeout with the last value flagged
+ * stale, that the open circuit answers without the source, that stale
+ * answers stay out of the cache, and that the source is used again once
+ * it answers.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "batch_io.h"
+#include "cache.h"
+#include "guard.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "procfs.h"
+
+#define TEST_TIMEOUT_MS 100
+/* Scheduling slack on top of the timeout */
+#define TEST_SLACK_MS 400
+#define TEST_FILE_FMT "/proc/%d/memtrack_test"
+
+static void parse_size(void *arg, const char *data, size_t len)
+{
+    sscanf(data, "size %zu", (size_t *)arg);
+}
+
+static int file_get_memory(pid_t pid, enum memtrack_type type,
+                           struct memtrack_record *records,
+                           size_t *num_records)
+{
+    char path[64], buf[64];
+    size_t size = 0;
+    int ret;
+
+    snprintf(path, sizeof(path), TEST_FILE_FMT, pid);
+    ret = batch_io_read_file(path, buf, sizeof(buf), parse_size, &size);
+    if (ret < 0) {
+        return ret;
+    }
+    if (*num_records) {
+        records[0].size_in_bytes = size;
+        records[0].flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                           MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    }
+    *num_records = 1;
+
+    return 0;
+}
+
+static const struct memtrack_source guarded_sources[] = {
+    {
+        .name = "guarded_file",
+        .get_memory = file_get_memory,
+        .timeout_ms = TEST_TIMEOUT_MS,
+    },
+};
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "guarded",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = file_get_memory,
+        .sources = guarded_sources,
+        .num_sources = 1,
+    },
+};
+
+static int write_size(pid_t pid, size_t size)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), TEST_FILE_FMT, pid);
+
+    return memtrack_test_write(path, "size %zu\n", size);
+}
+
+/* A live call, its answer in *size and its duration in *elapsed_ms */
+static int call(pid_t pid, size_t *size, bool *stale, uint64_t *elapsed_ms)
+{
+    struct memtrack_record records[GUARD_MAX_RECORDS];
+    size_t num_records = GUARD_MAX_RECORDS;
+    uint64_t start = memtrack_now_ns();
+    int ret;
+
+    ret = memtrack_core_read_live(pid, MEMTRACK_TYPE_GL, records,
+                                  &num_records, stale);
+    *elapsed_ms = (memtrack_now_ns() - start) / 1000000;
+    *size = ret == 0 && num_records ? records[0].size_in_bytes : 0;
+
+    return ret;
+}
+
+int main(void)
+{
+    struct memtrack_record records[GUARD_MAX_RECORDS];
+    struct memtrack_guard_stats stats;
+    char path[64], fifo[PATH_MAX];
+    uint64_t elapsed_ms, start_time;
+    size_t size, num_records;
+    bool stale;
+    int fd, ret;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(write_size(MEMTRACK_TEST_PID, 4096), 0);
+    /* The result cache is off by default */
+    EXPECT_EQ(memtrack_test_config("cache_bytes = 131072\n"), 0);
+    EXPECT_EQ(memtrack_core_init(providers, 1), 0);
+
+    /* Answers in time, which keeps the last value */
+    EXPECT_EQ(call(MEMTRACK_TEST_PID, &size, &stale, &elapsed_ms), 0);
+    EXPECT_EQ(size, 4096);
+    EXPECT(!stale);
+
+    /* Opening a FIFO without a writer blocks like a wedged driver */
+    snprintf(path, sizeof(path), TEST_FILE_FMT, MEMTRACK_TEST_PID);
+    EXPECT_EQ(memtrack_test_mkfifo(path), 0);
+    EXPECT_EQ(call(MEMTRACK_TEST_PID, &size, &stale, &elapsed_ms), 0);
+    EXPECT_EQ(size, 4096);
+    EXPECT(stale);
+    EXPECT(elapsed_ms >= TEST_TIMEOUT_MS - 1);
+    EXPECT(elapsed_ms < TEST_TIMEOUT_MS + TEST_SLACK_MS);
+    memtrack_guard_get_stats(MEMTRACK_TYPE_GL, 0, &stats);
+    EXPECT_EQ(stats.timeouts, 1);
+    EXPECT(stats.open);
+
+    /* The open circuit answers without waiting for the source */
+    EXPECT_EQ(call(MEMTRACK_TEST_PID, &size, &stale, &elapsed_ms), 0);
+    EXPECT_EQ(size, 4096);
+    EXPECT(stale);
+    EXPECT(elapsed_ms < TEST_SLACK_MS);
+    EXPECT_EQ(call(MEMTRACK_TEST_PID_IDLE, &size, &stale, &elapsed_ms),
+              -ETIMEDOUT);
+    EXPECT(stale);
+    memtrack_guard_get_stats(MEMTRACK_TYPE_GL, 0, &stats);
+    EXPECT_EQ(stats.timeouts, 1);
+    EXPECT_EQ(stats.short_circuits, 2);
+    EXPECT_EQ(stats.stale, 3);
+
+    /* A cached stale answer would outlive the hang */
+    EXPECT(memtrack_cache_enabled(MEMTRACK_TYPE_GL));
+    num_records = GUARD_MAX_RECORDS;
+    EXPECT_EQ(memtrack_core_get_memory(MEMTRACK_TEST_PID, MEMTRACK_TYPE_GL,
+                                       records, &num_records), 0);
+    EXPECT_EQ(records[0].size_in_bytes, 4096);
+    EXPECT_EQ(procfs_start_time(MEMTRACK_TEST_PID, &start_time), 0);
+    num_records = GUARD_MAX_RECORDS;
+    EXPECT(!memtrack_cache_lookup(MEMTRACK_TEST_PID, start_time,
+                                  MEMTRACK_TYPE_GL, UINT32_MAX, records,
+                                  &num_records, &ret));
+
+    /* The driver recovers: the hung helper returns, the file is back */
+    snprintf(fifo, sizeof(fifo), "%s%s", memtrack_test_root(), path);
+    fd = open(fifo, O_WRONLY | O_CLOEXEC);
+    EXPECT(fd >= 0);
+    if (fd >= 0) {
+        EXPECT(write(fd, "size 1\n", 7) == 7);
+        close(fd);
+    }
+    EXPECT_EQ(write_size(MEMTRACK_TEST_PID, 8192), 0);
+
+    /* Still open until the first backoff has passed */
+    usleep(100 * 1000);
+    memtrack_guard_get_stats(MEMTRACK_TYPE_GL, 0, &stats);
+    EXPECT(stats.open);
+    usleep(1000 * 1000);
+
+    EXPECT_EQ(call(MEMTRACK_TEST_PID, &size, &stale, &elapsed_ms), 0);
+    EXPECT_EQ(size, 8192);
+    EXPECT(!stale);
+    memtrack_guard_get_stats(MEMTRACK_TYPE_GL, 0, &stats);
+    EXPECT(!stats.open);
+    EXPECT_EQ(stats.timeouts, 1);
+
+    return memtrack_test_finish();
+}
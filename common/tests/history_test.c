@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Feeds the history of history.h with snapshots dated seconds to minutes
+ * after its start, so no test time passes, and checks what it keeps: raw
+ * samples of the last seconds, coarser buckets further back, the min, max
+ * and average over all of it, and the stalest series recycled once the
+ * table is full.  Prints what a series costs.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <hardware/memtrack.h>
+
+#include "history.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "snapshot.h"
+
+/* The smallest table, a single probe window */
+#define TEST_HISTORY_BYTES 1
+#define TEST_SERIES 8
+#define TEST_MINUTES 10
+#define TEST_MAX_POINTS 64
+#define MiB (1024 * 1024)
+
+static uint64_t start_ns;
+
+/* Records pid's GL size as sampled at second t of the history */
+static void record(pid_t pid, uint32_t t, uint64_t size)
+{
+    struct snapshot_entry entry = {
+        .sampled_ns = start_ns + t * 1000000000ULL,
+    };
+    struct snapshot_view view = {
+        .count = 1,
+        .capacity = 1,
+        .pids = &pid,
+        .entries = &entry,
+    };
+    int type;
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        entry.ret[type] = -EINVAL;
+    }
+    entry.ret[MEMTRACK_TYPE_GL] = 0;
+    entry.num_records[MEMTRACK_TYPE_GL] = 1;
+    entry.records[MEMTRACK_TYPE_GL][0].size_in_bytes = size;
+
+    memtrack_history_record(&view);
+}
+
+static size_t range(pid_t pid, struct memtrack_history_point *points)
+{
+    return memtrack_history_range(pid, MEMTRACK_TYPE_GL, 0, UINT64_MAX,
+                                  points, TEST_MAX_POINTS);
+}
+
+int main(void)
+{
+    struct memtrack_history_point points[TEST_MAX_POINTS], agg;
+    struct memtrack_history_stats stats;
+    size_t count, i, coarse = 0;
+    uint32_t t;
+    pid_t pid;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_history_init(TEST_HISTORY_BYTES), 0);
+    start_ns = memtrack_now_ns();
+    memtrack_history_get_stats(&stats);
+    EXPECT_EQ(stats.capacity, TEST_SERIES);
+    EXPECT_EQ(stats.used, 0);
+    printf("%zu bytes per (pid, type) series\n", stats.bytes_per_series);
+
+    /* A steady size, one raw point per second */
+    for (t = 0; t < 5; t++) {
+        record(MEMTRACK_TEST_PID, t, 4 * MiB);
+    }
+    count = range(MEMTRACK_TEST_PID, points);
+    EXPECT_EQ(count, 5);
+    for (i = 0; i < count; i++) {
+        EXPECT_EQ(points[i].avg_bytes, 4 * MiB);
+        EXPECT_EQ(points[i].span_s, 1);
+    }
+    EXPECT_EQ(memtrack_history_aggregate(MEMTRACK_TEST_PID, MEMTRACK_TYPE_GL,
+                                         0, UINT64_MAX, &agg), 0);
+    EXPECT_EQ(agg.min_bytes, 4 * MiB);
+    EXPECT_EQ(agg.max_bytes, 4 * MiB);
+    EXPECT_EQ(agg.avg_bytes, 4 * MiB);
+
+    /* A type never used gets no series */
+    record(MEMTRACK_TEST_PID_IDLE, 0, 0);
+    EXPECT_EQ(range(MEMTRACK_TEST_PID_IDLE, points), 0);
+    EXPECT_EQ(memtrack_history_aggregate(MEMTRACK_TEST_PID_IDLE,
+                                         MEMTRACK_TYPE_GL, 0, UINT64_MAX,
+                                         &agg), -ENOENT);
+    memtrack_history_get_stats(&stats);
+    EXPECT_EQ(stats.used, 1);
+
+    /*
+     * Minutes of a size flipping between 2 and 4 MiB every second: the
+     * oldest minutes only survive as buckets, which still know both.
+     */
+    for (t = 5; t < TEST_MINUTES * 60; t++) {
+        record(MEMTRACK_TEST_PID, t, t % 2 ? 2 * MiB : 4 * MiB);
+    }
+    count = range(MEMTRACK_TEST_PID, points);
+    EXPECT(count > 0 && count < TEST_MAX_POINTS);
+    for (i = 0; i < count; i++) {
+        if (i > 0) {
+            EXPECT(points[i].time_ms > points[i - 1].time_ms);
+        }
+        if (points[i].span_s >= 10) {
+            coarse++;
+            EXPECT_EQ(points[i].min_bytes, 2 * MiB);
+            EXPECT_EQ(points[i].max_bytes, 4 * MiB);
+        }
+    }
+    EXPECT(coarse > 0);
+    /* Covers more than the raw ring, back to the first minutes */
+    EXPECT(points[count - 1].time_ms - points[0].time_ms >=
+           (TEST_MINUTES - 2) * 60 * 1000ULL);
+    EXPECT_EQ(memtrack_history_aggregate(MEMTRACK_TEST_PID, MEMTRACK_TYPE_GL,
+                                         0, UINT64_MAX, &agg), 0);
+    EXPECT_EQ(agg.min_bytes, 2 * MiB);
+    EXPECT_EQ(agg.max_bytes, 4 * MiB);
+    EXPECT(agg.avg_bytes > 2 * MiB + MiB / 2 &&
+           agg.avg_bytes < 4 * MiB - MiB / 2);
+
+    /* The last seconds only */
+    count = memtrack_history_range(MEMTRACK_TEST_PID, MEMTRACK_TYPE_GL,
+                                   start_ns / 1000000 +
+                                   (TEST_MINUTES * 60 - 3) * 1000ULL,
+                                   UINT64_MAX, points, TEST_MAX_POINTS);
+    EXPECT_EQ(count, 3);
+    EXPECT_EQ(points[count - 1].avg_bytes, 2 * MiB);
+
+    /* A full table recycles the series updated longest ago, pid 100's */
+    for (pid = 1000; pid < 1000 + TEST_SERIES - 1; pid++) {
+        record(pid, TEST_MINUTES * 60 + pid - 1000, MiB);
+    }
+    memtrack_history_get_stats(&stats);
+    EXPECT_EQ(stats.used, TEST_SERIES);
+    EXPECT_EQ(stats.recycled, 0);
+    record(2000, TEST_MINUTES * 60 + TEST_SERIES, MiB);
+    memtrack_history_get_stats(&stats);
+    EXPECT_EQ(stats.recycled, 1);
+    EXPECT_EQ(range(MEMTRACK_TEST_PID, points), 0);
+    EXPECT_EQ(range(1000, points), 1);
+    EXPECT_EQ(range(2000, points), 1);
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Checks a platform's providers against its committed I/O budgets,
+ * io_budgets.conf next to the test, on the device fixture.  A change that
+ * makes a call or a sweep read more than budgeted, such as a second smaps
+ * walk, fails here.  The measured numbers are printed for updating the
+ * budgets after an intended change.
+ */
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <hardware/memtrack.h>
+
+#include "io_account.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "sampler.h"
+
+/* A sampler that never sweeps on its own */
+#define TEST_SAMPLER_INTERVAL_MS (24 * 3600 * 1000)
+
+extern struct memtrack_module HAL_MODULE_INFO_SYM;
+
+/* Whether a call stayed within its budget */
+static bool measure_call(int type, pid_t pid, const char *scenario)
+{
+    const struct memtrack_provider *provider = memtrack_core_provider(type);
+    struct memtrack_io_counters start, end;
+    struct memtrack_record records[4];
+    size_t num_records = sizeof(records) / sizeof(records[0]);
+    uint64_t violations = memtrack_io_budget_violations();
+    int ret;
+
+    memtrack_io_thread_counters(&start);
+    ret = memtrack_core_read_live(pid, type, records, &num_records, NULL);
+    memtrack_io_thread_counters(&end);
+
+    printf("%-11s %-8s pid %-4d ret %-4d %" PRIu64 " ops %" PRIu64 " bytes\n",
+           scenario, provider->name, pid, ret,
+           memtrack_io_ops(&end) - memtrack_io_ops(&start),
+           end.bytes - start.bytes);
+
+    return memtrack_io_budget_violations() == violations;
+}
+
+int main(void)
+{
+    struct memtrack_io_counters start, end;
+    uint64_t violations;
+    char path[PATH_MAX];
+    int type;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(HAL_MODULE_INFO_SYM.init(&HAL_MODULE_INFO_SYM), 0);
+    /* After the init, which applies the configured budgets */
+    EXPECT_EQ(memtrack_io_budget_load(memtrack_test_data("io_budgets.conf")),
+              0);
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (!memtrack_core_enabled(type)) {
+            continue;
+        }
+
+        /* The first call also measures every source */
+        EXPECT(measure_call(type, MEMTRACK_TEST_PID, "call"));
+        EXPECT(measure_call(type, MEMTRACK_TEST_PID, "call"));
+        EXPECT(measure_call(type, MEMTRACK_TEST_PID_INIT, "call"));
+        EXPECT(measure_call(type, MEMTRACK_TEST_PID_MISSING, "missing"));
+    }
+
+    EXPECT_EQ(memtrack_sampler_start(TEST_SAMPLER_INTERVAL_MS, 64), 0);
+    violations = memtrack_io_budget_violations();
+    memtrack_io_thread_counters(&start);
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    memtrack_io_thread_counters(&end);
+    printf("%-11s %-8s %" PRIu64 " ops %" PRIu64 " bytes\n", "sweep", "*",
+           memtrack_io_ops(&end) - memtrack_io_ops(&start),
+           end.bytes - start.bytes);
+    EXPECT_EQ(memtrack_io_budget_violations(), violations);
+
+    /* The check itself has to catch a call over its budget */
+    EXPECT_EQ(memtrack_test_write("/io_budgets.conf", "call * 0 0\n"), 0);
+    snprintf(path, sizeof(path), "%s/io_budgets.conf", memtrack_test_root());
+    EXPECT_EQ(memtrack_io_budget_load(path), 0);
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (memtrack_core_enabled(type)) {
+            EXPECT(!measure_call(type, MEMTRACK_TEST_PID, "over"));
+            break;
+        }
+    }
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Fires logging events of logging.h from racing threads, with a log
+ * macro that counts lines instead of writing them, and checks that each
+ * call site writes at most one line per log_interval_ms carrying the
+ * count so far, that every occurrence is counted and listed once in the
+ * stats dump, and that dump_pid selects which queries get dumped.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "logging.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "stats.h"
+
+#define TEST_THREADS 4
+#define TEST_INTERVAL_MS 200
+#define TEST_RUN_MS 1000
+#define TEST_DUMP_SIZE 65536
+
+static atomic_uint lines;
+static _Atomic uint64_t last_count;
+static atomic_bool stop;
+
+/* Stands in for ALOGW, keeps the count the line was written with */
+#define COUNT_LINE(fmt, what, count)                                       \
+    do {                                                                   \
+        atomic_fetch_add(&lines, 1);                                       \
+        atomic_store(&last_count, count);                                  \
+    } while (0)
+
+static void fire(void)
+{
+    MEMTRACK_LOG_EVENT_(COUNT_LINE, "test_event", "%s", "test");
+}
+
+static void fire_other(void)
+{
+    MEMTRACK_LOG_EVENT_(COUNT_LINE, "test_other", "%s", "other");
+}
+
+static void *fire_thread(void *arg)
+{
+    unsigned long *calls = arg;
+
+    while (!atomic_load(&stop)) {
+        fire();
+        (*calls)++;
+    }
+
+    return NULL;
+}
+
+/* Listed events named name */
+static unsigned int listed(const char *name, uint64_t *count)
+{
+    const struct memtrack_log_event *event;
+    unsigned int found = 0;
+
+    for (event = memtrack_log_events(); event; event = event->next) {
+        if (strcmp(event->name, name) == 0) {
+            *count = atomic_load(&event->count);
+            found++;
+        }
+    }
+
+    return found;
+}
+
+int main(void)
+{
+    static char dump[TEST_DUMP_SIZE];
+    pthread_t threads[TEST_THREADS];
+    unsigned long calls[TEST_THREADS] = { 0 }, total = 1;
+    char expected[128];
+    uint64_t count = 0;
+    unsigned int i, before;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(memtrack_test_config("log_interval_ms = %d\n",
+                                   TEST_INTERVAL_MS), 0);
+    EXPECT_EQ(memtrack_core_init(NULL, 0), 0);
+
+    /* The first occurrence writes its line */
+    EXPECT_EQ(listed("test_event", &count), 0);
+    fire();
+    EXPECT_EQ(lines, 1);
+    EXPECT_EQ(last_count, 1);
+
+    /* Then at most one line per interval, however many occur */
+    for (i = 0; i < TEST_THREADS; i++) {
+        EXPECT_EQ(pthread_create(&threads[i], NULL, fire_thread, &calls[i]),
+                  0);
+    }
+    usleep(TEST_RUN_MS * 1000);
+    atomic_store(&stop, true);
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        total += calls[i];
+    }
+    printf("%lu events, %u lines\n", total, lines);
+    EXPECT(lines >= 1 + TEST_RUN_MS / TEST_INTERVAL_MS - 1);
+    EXPECT(lines <= 1 + TEST_RUN_MS / TEST_INTERVAL_MS + 1);
+    EXPECT(last_count > 1 && last_count <= total);
+    EXPECT_EQ(listed("test_event", &count), 1);
+    EXPECT_EQ(count, total);
+
+    /* Call sites are counted apart, and listed in the stats dump */
+    before = lines;
+    fire_other();
+    EXPECT_EQ(lines, before + 1);
+    EXPECT_EQ(listed("test_other", &count), 1);
+    EXPECT_EQ(count, 1);
+    EXPECT(memtrack_stats_dump(dump, sizeof(dump)) < sizeof(dump));
+    snprintf(expected, sizeof(expected),
+             "memtrack_log_events_total{event=\"test_event\"} %lu\n", total);
+    EXPECT(strstr(dump, expected) != NULL);
+    EXPECT(strstr(dump, "memtrack_log_events_total{event=\"test_other\"} 1\n")
+           != NULL);
+
+    /* Without an interval every occurrence writes */
+    EXPECT_EQ(memtrack_test_config("log_interval_ms = 0\n"), 0);
+    EXPECT_EQ(memtrack_core_reload_config(), 0);
+    /* After the quiet time set under the old interval */
+    usleep(TEST_INTERVAL_MS * 1000);
+    lines = 0;
+    for (i = 0; i < 10; i++) {
+        fire();
+    }
+    EXPECT_EQ(lines, 10);
+
+    /* Queries dumped for dump_pid only */
+    EXPECT(!memtrack_log_dump_wanted(MEMTRACK_TEST_PID));
+    EXPECT_EQ(memtrack_test_config("dump_pid = 100\n"), 0);
+    EXPECT_EQ(memtrack_core_reload_config(), 0);
+    EXPECT(memtrack_log_dump_wanted(MEMTRACK_TEST_PID));
+    EXPECT(!memtrack_log_dump_wanted(MEMTRACK_TEST_PID_IDLE));
+    EXPECT_EQ(memtrack_test_config("dump_pid = -1\n"), 0);
+    EXPECT_EQ(memtrack_core_reload_config(), 0);
+    EXPECT(memtrack_log_dump_wanted(MEMTRACK_TEST_PID_IDLE));
+
+    EXPECT_EQ(memtrack_log_dump_file("/proc/100/smaps"), 0);
+    EXPECT_EQ(memtrack_log_dump_file("/proc/999/smaps"), -ENOENT);
+
+    return memtrack_test_finish();
+}
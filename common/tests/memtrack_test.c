@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "io_account.h"
+#include "memtrack_test.h"
+
+static char root[PATH_MAX];
+/* Setting up the root failed, nothing was tested */
+static bool root_failed;
+static unsigned int checks;
+static unsigned int failures;
+
+bool memtrack_test_expect(bool ok, const char *file, int line,
+                          const char *expr)
+{
+    checks++;
+    if (!ok) {
+        failures++;
+        fprintf(stderr, "%s:%d: expected %s\n", file, line, expr);
+    }
+
+    return ok;
+}
+
+bool memtrack_test_expect_eq(long long a, long long b, const char *file,
+                             int line, const char *expr)
+{
+    checks++;
+    if (a != b) {
+        failures++;
+        fprintf(stderr, "%s:%d: expected %s, got %lld and %lld\n", file,
+                line, expr, a, b);
+    }
+
+    return a == b;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw)
+{
+    remove(path);
+
+    return 0;
+}
+
+const char *memtrack_test_root(void)
+{
+    const char *tmp = getenv("TMPDIR");
+
+    if (root[0] || root_failed) {
+        return root[0] ? root : NULL;
+    }
+
+    /* /data/local/tmp on a device, /tmp on a host */
+    if (tmp == NULL) {
+        tmp = access("/data/local/tmp", W_OK) == 0 ? "/data/local/tmp" :
+                                                     "/tmp";
+    }
+    snprintf(root, sizeof(root), "%s/memtrack_test.XXXXXX", tmp);
+    if (mkdtemp(root) == NULL) {
+        fprintf(stderr, "mkdtemp %s: %s\n", root, strerror(errno));
+        root[0] = '\0';
+        root_failed = true;
+        return NULL;
+    }
+    if (memtrack_io_set_root(root) < 0) {
+        fprintf(stderr, "memtrack_io_set_root %s failed\n", root);
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        root[0] = '\0';
+        root_failed = true;
+        return NULL;
+    }
+
+    return root;
+}
+
+/* Full path of path below the root, with its parents created */
+static int fixture_path(const char *path, char *full, size_t size)
+{
+    char *p;
+
+    if (memtrack_test_root() == NULL) {
+        return -ENOENT;
+    }
+
+    if (snprintf(full, size, "%s%s", root, path) >= (int)size) {
+        return -ENAMETOOLONG;
+    }
+    for (p = full + strlen(root) + 1; (p = strchr(p, '/')) != NULL; p++) {
+        *p = '\0';
+        if (mkdir(full, 0755) < 0 && errno != EEXIST) {
+            *p = '/';
+            return -errno;
+        }
+        *p = '/';
+    }
+
+    return 0;
+}
+
+int memtrack_test_write(const char *path, const char *fmt, ...)
+{
+    char full[PATH_MAX], tmp[PATH_MAX];
+    va_list ap;
+    FILE *fp;
+    int ret;
+
+    ret = fixture_path(path, full, sizeof(full));
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Readers only ever see the old or the new content */
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", full) >= (int)sizeof(tmp)) {
+        return -ENAMETOOLONG;
+    }
+    fp = fopen(tmp, "we");
+    if (fp == NULL) {
+        return -errno;
+    }
+    va_start(ap, fmt);
+    vfprintf(fp, fmt, ap);
+    va_end(ap);
+    if (fclose(fp) != 0 || rename(tmp, full) < 0) {
+        ret = -errno;
+        unlink(tmp);
+    }
+
+    return ret;
+}
+
+int memtrack_test_config(const char *fmt, ...)
+{
+    char path[PATH_MAX], text[4096];
+    va_list ap;
+    int ret;
+
+    va_start(ap, fmt);
+    ret = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    if (ret >= (int)sizeof(text)) {
+        return -E2BIG;
+    }
+
+    ret = memtrack_test_write("/memtrack.conf", "%s", text);
+    if (ret < 0) {
+        return ret;
+    }
+    if (snprintf(path, sizeof(path), "%s/memtrack.conf", root) >=
+        (int)sizeof(path)) {
+        return -ENAMETOOLONG;
+    }
+    memtrack_config_set_path(path);
+
+    return 0;
+}
+
+int memtrack_test_mkfifo(const char *path)
+{
+    char full[PATH_MAX];
+    int ret;
+
+    ret = fixture_path(path, full, sizeof(full));
+    if (ret < 0) {
+        return ret;
+    }
+    if ((unlink(full) < 0 && errno != ENOENT) || mkfifo(full, 0600) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+static int write_process(pid_t pid, const char *comm, const char *smaps,
+                         const char *cgroup)
+{
+    char path[64];
+    int ret = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    ret |= memtrack_test_write(path, "%d (%s) S 1 %d %d 0 -1 4194560 0 0 0 "
+                               "0 0 0 0 0 20 0 1 0 %d 0 0\n", pid, comm,
+                               pid, pid, 1000 + pid);
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    ret |= memtrack_test_write(path, "Name:\t%s\nTgid:\t%d\nPid:\t%d\n"
+                               "Uid:\t10%03d\t10%03d\t10%03d\t10%03d\n",
+                               comm, pid, pid, pid, pid, pid, pid);
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+    ret |= memtrack_test_write(path, "4:memory:%s\n0::%s/pid_%d\n", cgroup,
+                               cgroup, pid);
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    ret |= memtrack_test_write(path, "%s\n", comm);
+    snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+    ret |= memtrack_test_write(path, "%s", smaps);
+
+    return ret;
+}
+
+static const char app_smaps[] =
+    "7f0000000000-7f0000100000 r-xp 00000000 fe:00 1000 /system/lib64/libc.so\n"
+    "Size:               1024 kB\n"
+    "Rss:                 512 kB\n"
+    "PSwap:              1024 kB\n"
+    "7f0000200000-7f0000300000 rw-s 00000000 00:06 200 /dev/dri/card0\n"
+    "Size:               1024 kB\n"
+    "Rss:                1000 kB\n"
+    "PSwap:                 0 kB\n"
+    "7f0000400000-7f0000800000 rw-p 00000000 00:00 0 [anon:scudo]\n"
+    "Size:               4096 kB\n"
+    "Rss:                1024 kB\n"
+    "PSwap:              3072 kB\n";
+
+static const char idle_smaps[] =
+    "7f0000000000-7f0000100000 r-xp 00000000 fe:00 1000 /system/lib64/libc.so\n"
+    "Size:               1024 kB\n"
+    "Rss:                 256 kB\n"
+    "PSwap:                 0 kB\n";
+
+int memtrack_test_device_fixture(void)
+{
+    int ret = 0;
+
+    ret |= write_process(MEMTRACK_TEST_PID, "test_app", app_smaps,
+                         "/apps/uid_10100");
+    ret |= write_process(MEMTRACK_TEST_PID_IDLE, "test_idle", idle_smaps,
+                         "/apps/uid_10101");
+    ret |= write_process(MEMTRACK_TEST_PID_INIT, "init", idle_smaps, "");
+
+    ret |= memtrack_test_write("/proc/meminfo",
+                               "MemTotal:        4194304 kB\n"
+                               "MemFree:         2097152 kB\n"
+                               "SwapTotal:       1048576 kB\n"
+                               "SwapFree:         983040 kB\n");
+    ret |= memtrack_test_write("/sys/block/zram0/mem_used_total",
+                               "16777216\n");
+
+    /* gen */
+    ret |= memtrack_test_write("/sys/class/drm/card0/gfx_memtrack/100",
+                               "%d 3000K test_app\n", MEMTRACK_TEST_PID);
+    ret |= memtrack_test_write("/sys/devices/pci0000:00/0000:00:03.0/"
+                               "active_bo", "39 p buffer objects: 9696 KB\n");
+    ret |= memtrack_test_write("/sys/devices/pci0000:00/0000:00:03.0/"
+                               "reserved_pool", "16008 out of 18432 pages\n");
+    ret |= memtrack_test_write("/sys/devices/pci0000:00/0000:00:03.0/"
+                               "dynamic_pool", "2048 (max 4096) pages\n");
+
+    /* mali */
+    ret |= memtrack_test_write("/sys/kernel/debug/mali/gpu_memory",
+                               "%-25s %-8s %-12s %s\n"
+                               "%-25s %-8d %-12d %s\n"
+                               "%-25s %-8d %-12d %s\n",
+                               "Name (:bytes)", "pid", "mali_mem",
+                               "max_mali_mem external_mem ump_mem dma_mem",
+                               "surfaceflinger", 2, 65536, "65536 0 0 0",
+                               "RenderThread", MEMTRACK_TEST_PID, 13008896,
+                               "37167104 0 0 11640832");
+    ret |= memtrack_test_write("/d/ion/heaps/cma-heap",
+                               "%16s %16s %16s\n%16s %16d %16d\n",
+                               "client", "pid", "size",
+                               "test_app", MEMTRACK_TEST_PID, 33423360);
+    ret |= memtrack_test_write("/d/ion/heaps/system-heap",
+                               "%16s %16s %16s\n%16s %16d %16d\n"
+                               "%16s %16d %16d\n",
+                               "client", "pid", "size",
+                               "surfaceflinger", 2, 8192,
+                               "test_app", MEMTRACK_TEST_PID, 4096000);
+
+    /* mali-midgard, whose ion heaps hold a proportional size */
+    ret |= memtrack_test_write("/sys/kernel/debug/mali0/ctx/100_1/"
+                               "mem_profile", "Channel: Default\n"
+                               "Total allocated memory: 2822048\n");
+    ret |= memtrack_test_write("/sys/kernel/debug/mali0/ctx/2_1/mem_profile",
+                               "Total allocated memory: 65536\n");
+    ret |= memtrack_test_write("/d/ion/heaps/midgard-heap",
+                               "%16s %16s %16s %16s\n"
+                               "%16s %16d %16d %16d\n",
+                               "client", "pid", "size", "proportional_size",
+                               "test_app", MEMTRACK_TEST_PID, 33423360,
+                               16711680);
+    ret |= memtrack_test_write("/d/ion/heaps/midgard-system",
+                               "%16s %16s %16s %16s\n"
+                               "%16s %16d %16d %16d\n",
+                               "client", "pid", "size", "proportional_size",
+                               "test_app", MEMTRACK_TEST_PID, 2048000,
+                               2048000);
+
+    return ret ? -EIO : 0;
+}
+
+const char *memtrack_test_data(const char *name)
+{
+    static char path[PATH_MAX];
+    char exe[PATH_MAX];
+    ssize_t len;
+
+    len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len < 0) {
+        len = 0;
+    }
+    exe[len] = '\0';
+    snprintf(path, sizeof(path), "%s/%s", dirname(exe), name);
+
+    return path;
+}
+
+int memtrack_test_finish(void)
+{
+    if (root[0]) {
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    /* A test that could not check anything did not pass */
+    if (root_failed || checks == 0) {
+        printf("FAIL: %s\n", root_failed ? "no fixture root" : "no checks");
+        return 1;
+    }
+
+    printf("%s: %u checks, %u failed\n", failures ? "FAIL" : "PASS", checks,
+           failures);
+
+    return failures ? 1 : 0;
+}
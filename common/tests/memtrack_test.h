@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _MEMTRACK_TEST_H_
+#define _MEMTRACK_TEST_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Helpers of the native tests.
+ *
+ * A test reads a fixture tree written below a temporary root, which
+ * memtrack_io_set_root() puts in place of /, so its results do not depend
+ * on the device or host it runs on.  Failed expectations are printed and
+ * counted, and memtrack_test_finish() turns them into the exit code.
+ */
+
+/* Pids of memtrack_test_device_fixture() */
+#define MEMTRACK_TEST_PID 100
+/* Runs without any GPU or ION memory */
+#define MEMTRACK_TEST_PID_IDLE 101
+/* Charged the global camera pools */
+#define MEMTRACK_TEST_PID_INIT 1
+#define MEMTRACK_TEST_PID_MISSING 999
+
+#define EXPECT(cond) \
+    memtrack_test_expect(!!(cond), __FILE__, __LINE__, #cond)
+#define EXPECT_EQ(a, b) \
+    memtrack_test_expect_eq((long long)(a), (long long)(b), __FILE__, \
+                            __LINE__, #a " == " #b)
+
+bool memtrack_test_expect(bool ok, const char *file, int line,
+                          const char *expr);
+bool memtrack_test_expect_eq(long long a, long long b, const char *file,
+                             int line, const char *expr);
+
+/*
+ * Creates the fixture root below TMPDIR, /data/local/tmp or /tmp and makes
+ * it the I/O root of the module.  Returns its path, the test is over when
+ * it is NULL.
+ */
+const char *memtrack_test_root(void);
+
+/* Writes path below the root, creating its directories, 0 or -errno */
+int memtrack_test_write(const char *path, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+/*
+ * Writes the module's config file below the root and reads it from the
+ * next load on, see memtrack_config_set_path().  0 or -errno.
+ */
+int memtrack_test_config(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+/* Replaces path below the root by a FIFO, 0 or -errno */
+int memtrack_test_mkfifo(const char *path);
+
+/*
+ * Writes what every platform's providers read for the pids above, the
+ * numbers are the MEMTRACK_TEST_* sizes below.
+ */
+int memtrack_test_device_fixture(void);
+
+/* Expected answers of the device fixture for MEMTRACK_TEST_PID, in bytes */
+#define MEMTRACK_TEST_GEN_BYTES ((3000 - 1000) * 1024)
+#define MEMTRACK_TEST_MALI_BYTES 13008896
+#define MEMTRACK_TEST_ION_BYTES (33423360 + 4096000)
+#define MEMTRACK_TEST_MIDGARD_BYTES 2822048
+#define MEMTRACK_TEST_MIDGARD_ION_BYTES (16711680 + 2048000)
+/* PSwap scaled by mem_used_total over the swap in use */
+#define MEMTRACK_TEST_ZRAM_BYTES (4096 * 1024 / 4)
+/* For MEMTRACK_TEST_PID_INIT */
+#define MEMTRACK_TEST_HMM_BYTES ((9696 + (16008 + 2048) * 4) * 1024)
+
+/* Path of a file installed next to the test binary, in a static buffer */
+const char *memtrack_test_data(const char *name);
+
+/*
+ * Prints the result and removes the root, returns the exit code: a test
+ * without a root or without any check fails.
+ */
+int memtrack_test_finish(void);
+
+#endif
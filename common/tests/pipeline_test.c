@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Sweeps more processes than the pipeline of pipeline.h has slots, with
+ * a provider reading each process's smaps and a system wide file, and
+ * checks that pipelined sweeps answer exactly what plain ones do, that
+ * the per-process file is learned in the first sweep and served from the
+ * slots from the second on while the system wide one never is, that
+ * files changed between sweeps are read again, and that a process gone
+ * before its turn is answered like in a plain sweep.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "batch_io.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "pipeline.h"
+#include "sampler.h"
+#include "snapshot.h"
+
+#define TEST_PIDS 64
+#define TEST_FIRST_PID 1000
+#define TEST_MAX_PIDS 128
+/* Fewer slots than pids, the rings wrap within a sweep */
+#define TEST_DEPTH 4
+#define TEST_PID_GONE (TEST_FIRST_PID + TEST_PIDS / 2)
+
+struct rss_arg {
+    unsigned long long kb;
+};
+
+static void sum_rss(void *arg, const char *data, size_t len)
+{
+    struct rss_arg *rss = arg;
+    const char *pos = data, *end = data + len;
+    unsigned long long kb;
+    char line[256];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        if (sscanf(line, "Rss: %llu kB", &kb) == 1) {
+            rss->kb += kb;
+        }
+    }
+}
+
+static void ignore(void *arg, const char *data, size_t len)
+{
+}
+
+static int get_memory(pid_t pid, enum memtrack_type type,
+                      struct memtrack_record *records, size_t *num_records)
+{
+    struct rss_arg rss = { 0 };
+    char path[32];
+    int ret;
+
+    /* System wide, not worth prefetching */
+    batch_io_read_file("/proc/meminfo", batch_io_scratch(),
+                       BATCH_IO_SCRATCH_SIZE, ignore, NULL);
+
+    snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+    ret = batch_io_read_file(path, batch_io_scratch(), BATCH_IO_SCRATCH_SIZE,
+                             sum_rss, &rss);
+    if (ret < 0) {
+        return ret;
+    }
+    if (*num_records) {
+        records[0].size_in_bytes = rss.kb * 1024;
+        records[0].flags = MEMTRACK_FLAG_SMAPS_ACCOUNTED |
+                           MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    }
+    *num_records = 1;
+
+    return 0;
+}
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "test",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = get_memory,
+    },
+};
+
+static int write_smaps(pid_t pid, unsigned int kb)
+{
+    char path[32];
+
+    snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+
+    return memtrack_test_write(path, "00400000-00500000 rw-p 00000000 00:00 "
+                               "0 [anon:scudo]\nRss: %u kB\n", kb);
+}
+
+static int write_pids(unsigned int scale)
+{
+    char path[32];
+    pid_t pid;
+    int ret = 0;
+
+    for (pid = TEST_FIRST_PID; pid < TEST_FIRST_PID + TEST_PIDS; pid++) {
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        ret |= memtrack_test_write(path, "%d (test) S 1 %d %d 0 -1 0 0 0 0 0 "
+                                   "0 0 0 0 20 0 1 0 %d 0 0\n", pid, pid, pid,
+                                   pid);
+        ret |= write_smaps(pid, (pid - TEST_FIRST_PID + 1) * scale);
+    }
+
+    return ret;
+}
+
+/* Sweeps and copies out the GL sizes, -1 for a failed provider */
+static int sweep(pid_t *pids, long long *sizes)
+{
+    static struct snapshot_entry entries[TEST_MAX_PIDS];
+    uint64_t timestamp_ns;
+    ssize_t count, i;
+
+    if (memtrack_sampler_sweep() < 0) {
+        return -1;
+    }
+    count = snapshot_copy(pids, entries, TEST_MAX_PIDS, &timestamp_ns);
+    for (i = 0; i < count; i++) {
+        sizes[i] = entries[i].ret[MEMTRACK_TYPE_GL] != 0 ? -1 :
+            (long long)entries[i].records[MEMTRACK_TYPE_GL][0].size_in_bytes;
+    }
+
+    return count;
+}
+
+static bool same_sweep(const pid_t *pids_a, const long long *sizes_a,
+                       int count_a, const pid_t *pids_b,
+                       const long long *sizes_b, int count_b)
+{
+    return count_a > 0 && count_a == count_b &&
+           memcmp(pids_a, pids_b, count_a * sizeof(*pids_a)) == 0 &&
+           memcmp(sizes_a, sizes_b, count_a * sizeof(*sizes_a)) == 0;
+}
+
+/*
+ * Test pids, gone aside, whose size is scale times the plain one; the
+ * gone pid has to have failed
+ */
+static int changed(const pid_t *pids, const long long *sizes, int count,
+                   const long long *plain, int scale, pid_t gone)
+{
+    int i, n = 0;
+
+    for (i = 0; i < count; i++) {
+        if (pids[i] == gone) {
+            if (sizes[i] != -1) {
+                return -1;
+            }
+        } else if (pids[i] >= TEST_FIRST_PID && sizes[i] == scale * plain[i]) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+static void stats_since(const struct pipeline_stats *before,
+                        struct pipeline_stats *delta)
+{
+    pipeline_get_stats(delta);
+    delta->hits -= before->hits;
+    delta->misses -= before->misses;
+    delta->sweeps -= before->sweeps;
+}
+
+int main(void)
+{
+    pid_t plain_pids[TEST_MAX_PIDS], pids[TEST_MAX_PIDS];
+    long long plain[TEST_MAX_PIDS], sizes[TEST_MAX_PIDS];
+    struct pipeline_stats before, delta;
+    int plain_count, count;
+    char path[PATH_MAX];
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(memtrack_test_write("/proc/meminfo", "MemTotal: 4096 kB\n"), 0);
+    EXPECT_EQ(write_pids(4), 0);
+    EXPECT_EQ(memtrack_core_init(providers, 1), 0);
+    EXPECT_EQ(snapshot_init(TEST_MAX_PIDS), 0);
+    EXPECT_EQ(memtrack_sampler_set_pipeline(0), -EINVAL);
+    EXPECT(!pipeline_enabled());
+
+    plain_count = sweep(plain_pids, plain);
+    EXPECT(plain_count >= TEST_PIDS);
+
+    /* The first pipelined sweep learns what to read ahead */
+    EXPECT_EQ(memtrack_sampler_set_pipeline(TEST_DEPTH), 0);
+    EXPECT(pipeline_enabled());
+    pipeline_get_stats(&before);
+    count = sweep(pids, sizes);
+    EXPECT(same_sweep(plain_pids, plain, plain_count, pids, sizes, count));
+    stats_since(&before, &delta);
+    EXPECT_EQ(delta.sweeps, 1);
+    EXPECT_EQ(delta.hits, 0);
+
+    /* From then on every smaps is served from a slot, meminfo never */
+    pipeline_get_stats(&before);
+    count = sweep(pids, sizes);
+    EXPECT(same_sweep(plain_pids, plain, plain_count, pids, sizes, count));
+    stats_since(&before, &delta);
+    printf("%d pids, %" PRIu64 " hits, %" PRIu64 " misses\n", count,
+           delta.hits, delta.misses);
+    EXPECT_EQ(delta.hits, count);
+    EXPECT_EQ(delta.misses, count);
+
+    /* Changed files are read again */
+    EXPECT_EQ(write_pids(8), 0);
+    count = sweep(pids, sizes);
+    EXPECT_EQ(count, plain_count);
+    EXPECT_EQ(changed(pids, sizes, count, plain, 2, 0), TEST_PIDS);
+
+    /* A process gone before its turn fails like in a plain sweep */
+    EXPECT(snprintf(path, sizeof(path), "%s/proc/%d/smaps",
+                    memtrack_test_root(), TEST_PID_GONE) < (int)sizeof(path));
+    EXPECT_EQ(unlink(path), 0);
+    count = sweep(pids, sizes);
+    EXPECT_EQ(count, plain_count);
+    EXPECT_EQ(changed(pids, sizes, count, plain, 2, TEST_PID_GONE),
+              TEST_PIDS - 1);
+
+    return memtrack_test_finish();
+}
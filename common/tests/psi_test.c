@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Drives the sampler with a PSI stand-in file, see psi.h: without
+ * pressure it only sweeps every idle interval, pressure makes it refresh
+ * at once and sweep at the regular interval again.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "sampler.h"
+
+#define TEST_INTERVAL_MS 100
+#define TEST_IDLE_INTERVAL_MS 60000
+/* Fires at 15% "some" stall, the stand-in is checked every 100 ms */
+#define TEST_TRIGGER "some 150000 1000000"
+#define TEST_PSI_PATH "/proc/pressure/memory"
+
+static atomic_uint calls;
+
+static int count_get_memory(pid_t pid, enum memtrack_type type,
+                            struct memtrack_record *records,
+                            size_t *num_records)
+{
+    atomic_fetch_add(&calls, 1);
+    if (*num_records) {
+        records[0].size_in_bytes = pid * 4096;
+        records[0].flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                           MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    }
+    *num_records = 1;
+
+    return 0;
+}
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "count",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = count_get_memory,
+    },
+};
+
+static int write_pressure(const char *avg10)
+{
+    return memtrack_test_write(TEST_PSI_PATH,
+                               "some avg10=%s avg60=0.00 avg300=0.00 "
+                               "total=0\nfull avg10=0.00 avg60=0.00 "
+                               "avg300=0.00 total=0\n", avg10);
+}
+
+/* Provider calls during ms */
+static unsigned int calls_during(unsigned int ms)
+{
+    atomic_store(&calls, 0);
+    usleep(ms * 1000);
+
+    return atomic_load(&calls);
+}
+
+int main(void)
+{
+    unsigned int n;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(write_pressure("0.00"), 0);
+    EXPECT_EQ(memtrack_core_init(providers, 1), 0);
+
+    EXPECT_EQ(memtrack_sampler_set_pressure(TEST_PSI_PATH, TEST_TRIGGER,
+                                            TEST_IDLE_INTERVAL_MS), 0);
+    EXPECT_EQ(memtrack_sampler_start(TEST_INTERVAL_MS, 64), 0);
+
+    /* The first sweep, then nothing until the idle interval */
+    usleep(3 * TEST_INTERVAL_MS * 1000);
+    n = calls_during(10 * TEST_INTERVAL_MS);
+    printf("idle: %u calls\n", n);
+    EXPECT_EQ(n, 0);
+
+    /* Above the trigger's 15% */
+    EXPECT_EQ(write_pressure("42.00"), 0);
+    n = calls_during(10 * TEST_INTERVAL_MS);
+    printf("pressure: %u calls\n", n);
+    EXPECT(n >= 5 * 3);
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Walks a large smaps of a fixture process with the resumable walks of
+ * scan.h under deadlines that already passed, so every call reads a
+ * single chunk, and checks that the walk resumes where it stopped and
+ * adds up to what a walk in one go finds, that the last value is answered
+ * as stale while a new walk is under way, and that a new process behind
+ * the pid never gets its predecessor's value.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "scan.h"
+
+#define TEST_PID 300
+#define TEST_MAPPINGS 2000
+/* Larger than the smaps of TEST_MAPPINGS mappings */
+#define TEST_SMAPS_MAX (TEST_MAPPINGS * 128)
+/* The chunk a walk reads per call, see scan.c */
+#define TEST_CHUNK 8192
+#define TEST_DEADLINE_LATE 0
+#define TEST_DEADLINE_NEVER UINT64_MAX
+
+struct rss_state {
+    uint64_t rss_kb;
+};
+
+static int begin_ret;
+static unsigned int num_begins;
+
+static int rss_begin(pid_t pid, void *state)
+{
+    num_begins++;
+
+    return begin_ret;
+}
+
+static void rss_line(void *state, const char *line)
+{
+    struct rss_state *st = state;
+    unsigned long long kb;
+
+    if (sscanf(line, "Rss: %llu kB", &kb) == 1) {
+        st->rss_kb += kb;
+    }
+}
+
+static int rss_finish(pid_t pid, void *state, int error,
+                      struct memtrack_record *records, size_t *num_records)
+{
+    const struct rss_state *st = state;
+
+    if (error) {
+        return error;
+    }
+    if (*num_records) {
+        records[0].size_in_bytes = begin_ret ? 4096 : st->rss_kb * 1024;
+        records[0].flags = MEMTRACK_FLAG_SMAPS_ACCOUNTED |
+                           MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    }
+    *num_records = 1;
+
+    return 0;
+}
+
+static const struct memtrack_scan_ops rss_ops = {
+    .state_size = sizeof(struct rss_state),
+    .begin = rss_begin,
+    .line = rss_line,
+    .finish = rss_finish,
+};
+
+static const struct memtrack_scan_ops big_ops = {
+    .state_size = 1024,
+    .begin = rss_begin,
+    .line = rss_line,
+    .finish = rss_finish,
+};
+
+/* Writes TEST_PID started at start_time, each mapping scale kB; its size */
+static long long write_process(int start_time, unsigned int scale,
+                               size_t *smaps_len)
+{
+    char *smaps = malloc(TEST_SMAPS_MAX);
+    unsigned long long kb = 0;
+    size_t len = 0;
+    int i, ret;
+
+    if (smaps == NULL) {
+        return -ENOMEM;
+    }
+    for (i = 0; i < TEST_MAPPINGS; i++) {
+        len += snprintf(smaps + len, TEST_SMAPS_MAX - len,
+                        "%08x-%08x rw-p 00000000 00:00 0          "
+                        "[anon:scudo]\nRss:         %8u kB\n"
+                        "Private_Dirty:  %8u kB\n",
+                        i * 0x1000, (i + 1) * 0x1000, (i % 7 + 1) * scale,
+                        (i % 7 + 1) * scale);
+        kb += (i % 7 + 1) * scale;
+    }
+    ret = memtrack_test_write("/proc/300/stat", "300 (test_scan) S 1 300 300 "
+                              "0 -1 4194560 0 0 0 0 0 0 0 0 20 0 1 0 %d 0 "
+                              "0\n", start_time);
+    ret |= memtrack_test_write("/proc/300/smaps", "%s", smaps);
+    free(smaps);
+    *smaps_len = len;
+
+    return ret < 0 ? ret : (long long)kb * 1024;
+}
+
+static int run(uint64_t deadline_ns, uint64_t *size, bool *stale)
+{
+    struct memtrack_record records[2];
+    size_t num_records = 2;
+    int ret;
+
+    *stale = false;
+    ret = memtrack_scan_run(TEST_PID, MEMTRACK_TYPE_OTHER, &rss_ops, records,
+                            &num_records, deadline_ns, stale);
+    if (ret == 0) {
+        *size = num_records == 1 ? records[0].size_in_bytes : 0;
+    }
+
+    return ret;
+}
+
+/* Late calls until the walk completes, -1 when it never does */
+static int calls_to_complete(uint64_t *size, bool *stale)
+{
+    int calls, ret;
+
+    for (calls = 1; calls < TEST_SMAPS_MAX / TEST_CHUNK + 2; calls++) {
+        ret = run(TEST_DEADLINE_LATE, size, stale);
+        if (ret != -EAGAIN && !(ret == 0 && *stale)) {
+            return ret == 0 ? calls : -1;
+        }
+    }
+
+    return -1;
+}
+
+int main(void)
+{
+    struct memtrack_record records[1];
+    size_t num_records = 1, smaps_len;
+    long long expected, changed;
+    uint64_t size = 0;
+    bool stale;
+    int calls;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    expected = write_process(1000, 4, &smaps_len);
+    EXPECT(expected > 0);
+    EXPECT(smaps_len > 4 * TEST_CHUNK);
+
+    EXPECT_EQ(memtrack_scan_run(TEST_PID, MEMTRACK_TYPE_OTHER, &big_ops,
+                                records, &num_records, TEST_DEADLINE_NEVER,
+                                &stale), -EINVAL);
+    EXPECT(memtrack_scan_run(MEMTRACK_TEST_PID_MISSING, MEMTRACK_TYPE_OTHER,
+                             &rss_ops, records, &num_records,
+                             TEST_DEADLINE_NEVER, &stale) < 0);
+
+    /* Chunk by chunk, nothing to answer until the first walk completes */
+    EXPECT_EQ(run(TEST_DEADLINE_LATE, &size, &stale), -EAGAIN);
+    calls = calls_to_complete(&size, &stale);
+    printf("%zu bytes of smaps walked in %d late calls\n", smaps_len,
+           calls + 1);
+    EXPECT(calls + 1 >= (int)(smaps_len / TEST_CHUNK));
+    EXPECT(!stale);
+    EXPECT_EQ(size, expected);
+    EXPECT_EQ(num_begins, 1);
+
+    /* The next walk answers the last value meanwhile */
+    EXPECT_EQ(run(TEST_DEADLINE_LATE, &size, &stale), 0);
+    EXPECT(stale);
+    EXPECT_EQ(size, expected);
+
+    /* The file changes mid-walk; the walk finishes on what it opened */
+    changed = write_process(1000, 8, &smaps_len);
+    EXPECT_EQ(changed, 2 * expected);
+    EXPECT(calls_to_complete(&size, &stale) > 0);
+    EXPECT_EQ(size, expected);
+    EXPECT_EQ(num_begins, 2);
+    EXPECT_EQ(run(TEST_DEADLINE_NEVER, &size, &stale), 0);
+    EXPECT(!stale);
+    EXPECT_EQ(size, changed);
+
+    /* A new process behind the pid starts over without a last value */
+    EXPECT_EQ(run(TEST_DEADLINE_LATE, &size, &stale), 0);
+    EXPECT(stale);
+    EXPECT_EQ(write_process(2000, 4, &smaps_len), expected);
+    EXPECT_EQ(run(TEST_DEADLINE_LATE, &size, &stale), -EAGAIN);
+    EXPECT_EQ(run(TEST_DEADLINE_NEVER, &size, &stale), 0);
+    EXPECT_EQ(size, expected);
+
+    /* Known without walking */
+    begin_ret = 1;
+    EXPECT_EQ(run(TEST_DEADLINE_LATE, &size, &stale), 0);
+    EXPECT(!stale);
+    EXPECT_EQ(size, 4096);
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Runs the writer of a shared snapshot, see shared_snapshot.h, in a child
+ * process publishing on command, and checks from the parent, a reader,
+ * that every publication flags the file it replaces as superseded and
+ * that the next lookup already answers from the new one, and that the
+ * file is not world readable.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "shared_snapshot.h"
+#include "snapshot.h"
+
+/* Longer than a reader waits before looking for a missing file again */
+#define TEST_RETRY_US 1100000
+#define TEST_AGE_NS (60 * 1000000000ULL)
+
+/* Publishes generation gen, pid 100 using gen pages of GL */
+static void publish(uint64_t gen)
+{
+    pid_t pids[2] = { MEMTRACK_TEST_PID_INIT, MEMTRACK_TEST_PID };
+    struct snapshot_entry entries[2] = { { 0 } };
+    struct snapshot_view view = {
+        .generation = gen,
+        .timestamp_ns = memtrack_now_ns(),
+        .count = 2,
+        .capacity = 2,
+        .pids = pids,
+        .entries = entries,
+    };
+    int i, type;
+
+    for (i = 0; i < 2; i++) {
+        entries[i].sampled_ns = view.timestamp_ns;
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            entries[i].ret[type] = -EINVAL;
+        }
+        entries[i].ret[MEMTRACK_TYPE_GL] = 0;
+        entries[i].num_records[MEMTRACK_TYPE_GL] = 1;
+    }
+    entries[1].records[MEMTRACK_TYPE_GL][0].size_in_bytes = gen * 4096;
+
+    shared_snapshot_publish(&view);
+}
+
+/* Takes the lock, then publishes the generation of every command byte */
+static int writer(const char *path, int cmd, int ack)
+{
+    unsigned char gen;
+    int ret = shared_snapshot_init(path);
+
+    if (write(ack, &ret, sizeof(ret)) != sizeof(ret)) {
+        return 1;
+    }
+    while (read(cmd, &gen, 1) == 1) {
+        publish(gen);
+        if (write(ack, &gen, 1) != 1) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static bool command(int cmd, int ack, unsigned char gen)
+{
+    unsigned char done;
+
+    return write(cmd, &gen, 1) == 1 && read(ack, &done, 1) == 1 &&
+           done == gen;
+}
+
+static bool lookup(pid_t pid, uint64_t max_age_ns, uint64_t *size)
+{
+    struct memtrack_record records[2];
+    size_t num_records = 2;
+    int ret;
+
+    if (!shared_snapshot_lookup(pid, MEMTRACK_TYPE_GL, max_age_ns, records,
+                                &num_records, &ret) ||
+        ret != 0 || num_records != 1) {
+        return false;
+    }
+    *size = records[0].size_in_bytes;
+
+    return true;
+}
+
+/* Maps the file currently published at path */
+static const struct shared_snapshot_header *map_published(const char *path)
+{
+    void *base;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    base = mmap(NULL, sizeof(struct shared_snapshot_header), PROT_READ,
+                MAP_SHARED, fd, 0);
+    close(fd);
+
+    return base == MAP_FAILED ? NULL : base;
+}
+
+static bool superseded(const struct shared_snapshot_header *header)
+{
+    return atomic_load((atomic_uint *)&header->superseded) != 0;
+}
+
+int main(void)
+{
+    const struct shared_snapshot_header *first, *second;
+    char path[PATH_MAX];
+    struct stat st;
+    int cmd[2], ack[2], ret;
+    uint64_t size;
+    pid_t child;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    if (!EXPECT(snprintf(path, sizeof(path), "%s/snapshot",
+                         memtrack_test_root()) < (int)sizeof(path)) ||
+        !EXPECT(pipe(cmd) == 0 && pipe(ack) == 0)) {
+        return memtrack_test_finish();
+    }
+
+    child = fork();
+    if (child == 0) {
+        close(cmd[1]);
+        close(ack[0]);
+        _exit(writer(path, cmd[0], ack[1]));
+    }
+    close(cmd[0]);
+    close(ack[1]);
+    EXPECT(child > 0);
+    EXPECT(read(ack[0], &ret, sizeof(ret)) == sizeof(ret));
+    EXPECT_EQ(ret, 1);
+
+    /* The writer holds the lock */
+    EXPECT_EQ(shared_snapshot_init(path), 0);
+    EXPECT(!lookup(MEMTRACK_TEST_PID, TEST_AGE_NS, &size));
+
+    /* A missing file is looked for again after a while */
+    EXPECT(command(cmd[1], ack[0], 1));
+    usleep(TEST_RETRY_US);
+    EXPECT(lookup(MEMTRACK_TEST_PID, TEST_AGE_NS, &size));
+    EXPECT_EQ(size, 4096);
+    EXPECT(!lookup(MEMTRACK_TEST_PID_IDLE, TEST_AGE_NS, &size));
+    EXPECT(!lookup(MEMTRACK_TEST_PID, 0, &size));
+
+    /* Not for every process to read */
+    EXPECT(stat(path, &st) == 0 && (st.st_mode & 0777) == 0640);
+
+    /* Every publication supersedes the file before, readers follow */
+    first = map_published(path);
+    EXPECT(first != NULL);
+    EXPECT(command(cmd[1], ack[0], 2));
+    EXPECT(first && superseded(first));
+    EXPECT(lookup(MEMTRACK_TEST_PID, TEST_AGE_NS, &size));
+    EXPECT_EQ(size, 2 * 4096);
+
+    second = map_published(path);
+    EXPECT(second != NULL && !superseded(second));
+    EXPECT(command(cmd[1], ack[0], 3));
+    EXPECT(second && superseded(second));
+    EXPECT(lookup(MEMTRACK_TEST_PID, TEST_AGE_NS, &size));
+    EXPECT_EQ(size, 3 * 4096);
+
+    close(cmd[1]);
+    EXPECT(waitpid(child, &ret, 0) == child && WIFEXITED(ret) &&
+           WEXITSTATUS(ret) == 0);
+    close(ack[0]);
+
+    return memtrack_test_finish();
+}
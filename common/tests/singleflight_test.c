@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Starts TEST_THREADS threads querying the same (pid, type) at once, see
+ * singleflight.h, and checks that a few leaders read smaps for all of
+ * them and that everyone gets the same answer.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "io_account.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "singleflight.h"
+
+#define TEST_THREADS 16
+#define TEST_ROUNDS 4
+/* How long a smaps walk takes, well within coalesce_wait_ms */
+#define TEST_WALK_MS 20
+
+static pthread_barrier_t barrier;
+static atomic_uint smaps_opens;
+static atomic_uint wrong_answers;
+
+/* zram over a smaps walk slow enough for the threads to meet */
+static int slow_zram_get_memory(pid_t pid, enum memtrack_type type,
+                                struct memtrack_record *records,
+                                size_t *num_records)
+{
+    int ret = zram_memtrack_get_memory(pid, type, records, num_records);
+
+    usleep(TEST_WALK_MS * 1000);
+
+    return ret;
+}
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "zram",
+        .type = MEMTRACK_TYPE_OTHER,
+        .get_memory = slow_zram_get_memory,
+    },
+};
+
+static void count_smaps(void *arg, const char *path)
+{
+    if (strstr(path, "/smaps")) {
+        atomic_fetch_add(&smaps_opens, 1);
+    }
+}
+
+static void *query_thread(void *arg)
+{
+    struct memtrack_record records[4];
+    size_t num_records;
+    int round;
+
+    memtrack_io_set_observer(count_smaps, NULL);
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        pthread_barrier_wait(&barrier);
+        num_records = 4;
+        if (memtrack_core_get_memory(MEMTRACK_TEST_PID, MEMTRACK_TYPE_OTHER,
+                                     records, &num_records) != 0 ||
+            records[0].size_in_bytes != MEMTRACK_TEST_ZRAM_BYTES) {
+            atomic_fetch_add(&wrong_answers, 1);
+        }
+    }
+    memtrack_io_set_observer(NULL, NULL);
+
+    return NULL;
+}
+
+int main(void)
+{
+    struct memtrack_singleflight_stats stats;
+    pthread_t threads[TEST_THREADS];
+    unsigned int queries = TEST_THREADS * TEST_ROUNDS;
+    int i;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(memtrack_core_init(providers, 1), 0);
+
+    pthread_barrier_init(&barrier, NULL, TEST_THREADS);
+    for (i = 0; i < TEST_THREADS; i++) {
+        EXPECT_EQ(pthread_create(&threads[i], NULL, query_thread, NULL), 0);
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    memtrack_singleflight_get_stats(&stats);
+    printf("%u queries: %" PRIu64 " leaders, %" PRIu64 " coalesced, %" PRIu64
+           " timeouts, %" PRIu64 " bypassed, %u smaps opens\n", queries,
+           stats.leaders, stats.coalesced, stats.timeouts, stats.bypassed,
+           atomic_load(&smaps_opens));
+
+    EXPECT_EQ(atomic_load(&wrong_answers), 0);
+    EXPECT_EQ(stats.leaders + stats.coalesced + stats.timeouts +
+              stats.bypassed, queries);
+    /* At most a few leaders per round of simultaneous queries */
+    EXPECT(stats.leaders <= queries / 4);
+    EXPECT(stats.coalesced > 0);
+    EXPECT(atomic_load(&smaps_opens) < queries / 2);
+    EXPECT_EQ(atomic_load(&smaps_opens),
+              stats.leaders + stats.timeouts + stats.bypassed);
+
+    return memtrack_test_finish();
+}
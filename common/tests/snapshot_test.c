@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Publishes snapshots, see snapshot.h, and checks what lookups see: the
+ * published pids only, nothing older than the asked age, and never an
+ * entry mixing two sweeps while a writer publishes under the readers.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "snapshot.h"
+
+#define TEST_MAX_PIDS 64
+#define TEST_READERS 4
+#define TEST_GENERATIONS 20000
+#define TEST_AGE_NS (60 * 1000000000ULL)
+
+static atomic_bool writing;
+static atomic_uint torn;
+static atomic_uint hits;
+static atomic_uint copies;
+
+static int get_memory(pid_t pid, enum memtrack_type type,
+                      struct memtrack_record *records, size_t *num_records)
+{
+    *num_records = 0;
+
+    return 0;
+}
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "gl",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = get_memory,
+    },
+    {
+        .name = "graphics",
+        .type = MEMTRACK_TYPE_GRAPHICS,
+        .get_memory = get_memory,
+    },
+};
+
+/* Sweep gen gives pid pid * gen pages of GL and as many of GRAPHICS */
+static void publish(uint64_t gen, size_t count, uint64_t sampled_ns)
+{
+    struct snapshot_view view;
+    size_t i;
+
+    snapshot_write_begin(&view);
+    for (i = 0; i < count; i++) {
+        struct snapshot_entry *entry = &view.entries[i];
+        pid_t pid = (pid_t)(i + 1) * 10;
+
+        view.pids[i] = pid;
+        entry->sampled_ns = sampled_ns;
+        entry->ret[MEMTRACK_TYPE_GL] = 0;
+        entry->num_records[MEMTRACK_TYPE_GL] = 1;
+        entry->records[MEMTRACK_TYPE_GL][0].size_in_bytes = pid * gen * 4096;
+        entry->ret[MEMTRACK_TYPE_GRAPHICS] = 0;
+        entry->num_records[MEMTRACK_TYPE_GRAPHICS] = 1;
+        entry->records[MEMTRACK_TYPE_GRAPHICS][0].size_in_bytes =
+            pid * gen * 4096;
+    }
+    snapshot_write_commit(&view, count, sampled_ns);
+}
+
+static bool lookup(pid_t pid, int type, uint64_t max_age_ns, uint64_t *size)
+{
+    struct memtrack_record records[SNAPSHOT_MAX_RECORDS];
+    size_t num_records = SNAPSHOT_MAX_RECORDS;
+    int ret;
+
+    if (!snapshot_lookup(pid, type, max_age_ns, records, &num_records,
+                         &ret) ||
+        ret != 0 || num_records != 1) {
+        return false;
+    }
+    *size = records[0].size_in_bytes;
+
+    return true;
+}
+
+static void *writer_thread(void *arg)
+{
+    uint64_t gen;
+
+    for (gen = 2; gen < TEST_GENERATIONS; gen++) {
+        publish(gen, TEST_MAX_PIDS, memtrack_now_ns());
+    }
+    atomic_store(&writing, false);
+
+    return NULL;
+}
+
+/* Lookups while the writer runs see a record of a single sweep */
+static void *lookup_thread(void *arg)
+{
+    uint64_t size;
+    unsigned int i = 0;
+    pid_t pid;
+
+    while (atomic_load(&writing)) {
+        pid = (pid_t)(1 + i++ % TEST_MAX_PIDS) * 10;
+        if (lookup(pid, MEMTRACK_TYPE_GL, TEST_AGE_NS, &size)) {
+            if (size == 0 || size % ((uint64_t)pid * 4096) != 0) {
+                atomic_fetch_add(&torn, 1);
+            }
+            atomic_fetch_add(&hits, 1);
+        }
+    }
+
+    return NULL;
+}
+
+/* True when every entry of a copy comes from the same sweep */
+static bool same_sweep(const pid_t *pids, const struct snapshot_entry *entries,
+                       size_t count)
+{
+    uint64_t gen, size;
+    size_t i;
+
+    gen = entries[0].records[MEMTRACK_TYPE_GL][0].size_in_bytes /
+          ((uint64_t)pids[0] * 4096);
+    for (i = 0; i < count; i++) {
+        size = (uint64_t)pids[i] * gen * 4096;
+        if (pids[i] != (pid_t)(i + 1) * 10 ||
+            entries[i].records[MEMTRACK_TYPE_GL][0].size_in_bytes != size ||
+            entries[i].records[MEMTRACK_TYPE_GRAPHICS][0].size_in_bytes !=
+            size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Copies made while the writer runs each hold a single sweep */
+static void *copy_thread(void *arg)
+{
+    pid_t pids[TEST_MAX_PIDS];
+    struct snapshot_entry entries[TEST_MAX_PIDS];
+    uint64_t timestamp_ns;
+    ssize_t count;
+
+    while (atomic_load(&writing)) {
+        count = snapshot_copy(pids, entries, TEST_MAX_PIDS, &timestamp_ns);
+        if (count == -EAGAIN) {
+            continue;
+        }
+        if (count != TEST_MAX_PIDS) {
+            atomic_fetch_add(&torn, 1);
+            continue;
+        }
+        if (!same_sweep(pids, entries, count)) {
+            atomic_fetch_add(&torn, 1);
+        }
+        atomic_fetch_add(&copies, 1);
+    }
+
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t writer, readers[TEST_READERS];
+    pid_t pids[TEST_MAX_PIDS];
+    struct snapshot_entry entries[TEST_MAX_PIDS];
+    uint64_t timestamp_ns, size;
+    int i;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_core_init(providers, 2), 0);
+    EXPECT_EQ(snapshot_init(TEST_MAX_PIDS), 0);
+    EXPECT(snapshot_ready());
+    EXPECT_EQ(snapshot_capacity(), TEST_MAX_PIDS);
+
+    /* Nothing published yet */
+    EXPECT(!lookup(10, MEMTRACK_TYPE_GL, TEST_AGE_NS, &size));
+    EXPECT_EQ(snapshot_copy(pids, entries, TEST_MAX_PIDS, &timestamp_ns), 0);
+
+    publish(1, 3, memtrack_now_ns() - 1000000);
+    EXPECT(lookup(20, MEMTRACK_TYPE_GL, TEST_AGE_NS, &size));
+    EXPECT_EQ(size, 20 * 4096);
+    EXPECT(lookup(30, MEMTRACK_TYPE_GRAPHICS, TEST_AGE_NS, &size));
+    EXPECT_EQ(size, 30 * 4096);
+    EXPECT(!lookup(40, MEMTRACK_TYPE_GL, TEST_AGE_NS, &size));
+    EXPECT(!lookup(15, MEMTRACK_TYPE_GL, TEST_AGE_NS, &size));
+    /* Sampled a millisecond ago */
+    EXPECT(!lookup(20, MEMTRACK_TYPE_GL, 1000, &size));
+    EXPECT(!lookup(20, MEMTRACK_NUM_TYPES, TEST_AGE_NS, &size));
+
+    /* A full buffer, copied whole */
+    publish(1, TEST_MAX_PIDS, memtrack_now_ns());
+    EXPECT_EQ(snapshot_copy(pids, entries, TEST_MAX_PIDS, &timestamp_ns),
+              TEST_MAX_PIDS);
+    EXPECT(same_sweep(pids, entries, TEST_MAX_PIDS));
+
+    atomic_store(&writing, true);
+    for (i = 0; i < TEST_READERS; i++) {
+        EXPECT_EQ(pthread_create(&readers[i], NULL,
+                                 i % 2 ? copy_thread : lookup_thread, NULL),
+                  0);
+    }
+    EXPECT_EQ(pthread_create(&writer, NULL, writer_thread, NULL), 0);
+    pthread_join(writer, NULL);
+    for (i = 0; i < TEST_READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    printf("%u lookups and %u copies during %d sweeps\n",
+           atomic_load(&hits), atomic_load(&copies), TEST_GENERATIONS - 2);
+
+    EXPECT_EQ(atomic_load(&torn), 0);
+    EXPECT(atomic_load(&hits) > 0);
+    EXPECT(atomic_load(&copies) > 0);
+
+    /* The last sweep is what stays published */
+    EXPECT(lookup(TEST_MAX_PIDS * 10, MEMTRACK_TYPE_GL, TEST_AGE_NS, &size));
+    EXPECT_EQ(size, (uint64_t)TEST_MAX_PIDS * 10 * (TEST_GENERATIONS - 1) *
+                    4096);
+
+    return memtrack_test_finish();
+}
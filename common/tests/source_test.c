@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Calls a provider with sources of known cost through source.h and checks
+ * the choice: every eligible source measured first, the cheapest one
+ * taking nearly every call while the others are still measured now and
+ * then, approximate sources only at approximate precision, a missing one
+ * never, the choice following a source that gets slower, and costs kept
+ * apart per size class of the process.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "config.h"
+#include "io_account.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "source.h"
+
+#define TEST_PID_LARGE 300
+/* Larger than where the large class starts */
+#define TEST_LARGE_BYTES (512 * 1024)
+#define TEST_CALLS 320
+/* Calls of a class between two measurements of another source */
+#define TEST_EXPLORE_PERIOD 32
+/* A preempted call can make the cheapest source look dear for a while */
+#define TEST_MOST (TEST_CALLS * 3 / 4)
+
+enum {
+    SOURCE_REF,
+    SOURCE_FAST,
+    SOURCE_APPROX,
+    SOURCE_MISSING,
+    TEST_SOURCES,
+};
+
+static unsigned int cost_us[TEST_SOURCES] = { 1500, 400, 20, 0 };
+static unsigned int calls[TEST_SOURCES];
+
+static int answer(int source, pid_t pid, struct memtrack_record *records,
+                  size_t *num_records)
+{
+    calls[source]++;
+    usleep(cost_us[source]);
+    records[0].size_in_bytes = 4096;
+    records[0].flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                       MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    *num_records = 1;
+
+    return 0;
+}
+
+/* Reads the smaps of pid, which sizes the process */
+static int ref_get_memory(pid_t pid, enum memtrack_type type,
+                          struct memtrack_record *records, size_t *num_records)
+{
+    char path[32], buf[8192];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+    fd = memtrack_io_open(path, O_RDONLY);
+    if (fd < 0) {
+        calls[SOURCE_REF]++;
+        return -errno;
+    }
+    while ((n = memtrack_io_read(fd, buf, sizeof(buf))) > 0) {
+    }
+    memtrack_io_close(fd);
+
+    return answer(SOURCE_REF, pid, records, num_records);
+}
+
+static int fast_get_memory(pid_t pid, enum memtrack_type type,
+                           struct memtrack_record *records,
+                           size_t *num_records)
+{
+    return answer(SOURCE_FAST, pid, records, num_records);
+}
+
+static int approx_get_memory(pid_t pid, enum memtrack_type type,
+                             struct memtrack_record *records,
+                             size_t *num_records)
+{
+    return answer(SOURCE_APPROX, pid, records, num_records);
+}
+
+static int missing_get_memory(pid_t pid, enum memtrack_type type,
+                              struct memtrack_record *records,
+                              size_t *num_records)
+{
+    return answer(SOURCE_MISSING, pid, records, num_records);
+}
+
+static bool missing_available(void)
+{
+    return false;
+}
+
+static const struct memtrack_source sources[TEST_SOURCES] = {
+    [SOURCE_REF] = { .name = "ref", .get_memory = ref_get_memory },
+    [SOURCE_FAST] = { .name = "fast", .get_memory = fast_get_memory },
+    [SOURCE_APPROX] = {
+        .name = "approx",
+        .approximate = true,
+        .get_memory = approx_get_memory,
+    },
+    [SOURCE_MISSING] = {
+        .name = "missing",
+        .get_memory = missing_get_memory,
+        .available = missing_available,
+    },
+};
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "test",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = ref_get_memory,
+        .sources = sources,
+        .num_sources = TEST_SOURCES,
+    },
+};
+
+static int get(pid_t pid)
+{
+    struct memtrack_record records[1];
+    size_t num_records = 1;
+    bool stale;
+
+    return memtrack_source_get_memory(&providers[0], pid, MEMTRACK_TYPE_GL,
+                                      records, &num_records, &stale);
+}
+
+/* Calls of each source over count calls for pid */
+static void run(pid_t pid, int count, unsigned int *out)
+{
+    int i;
+
+    memset(calls, 0, sizeof(calls));
+    for (i = 0; i < count; i++) {
+        get(pid);
+    }
+    memcpy(out, calls, sizeof(calls));
+}
+
+static int selected(int size_class)
+{
+    struct memtrack_source_stats stats;
+    size_t i;
+
+    for (i = 0; memtrack_source_get_stats(MEMTRACK_TYPE_GL, size_class, i,
+                                          &stats) == 0; i++) {
+        if (stats.selected) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static uint64_t class_calls(int size_class)
+{
+    struct memtrack_source_stats stats;
+    uint64_t total = 0;
+    size_t i;
+
+    for (i = 0; memtrack_source_get_stats(MEMTRACK_TYPE_GL, size_class, i,
+                                          &stats) == 0; i++) {
+        total += stats.calls;
+    }
+
+    return total;
+}
+
+static int write_large(void)
+{
+    char *smaps = malloc(TEST_LARGE_BYTES + 1);
+    int ret;
+
+    if (smaps == NULL) {
+        return -ENOMEM;
+    }
+    memset(smaps, 'x', TEST_LARGE_BYTES);
+    smaps[TEST_LARGE_BYTES] = '\0';
+    ret = memtrack_test_write("/proc/300/smaps", "%s", smaps);
+    free(smaps);
+
+    return ret;
+}
+
+int main(void)
+{
+    struct memtrack_source_stats stats;
+    unsigned int got[TEST_SOURCES];
+    uint64_t cost_ns;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(write_large(), 0);
+    EXPECT_EQ(memtrack_test_config("precision.gl = exact\n"), 0);
+    EXPECT_EQ(memtrack_core_init(providers, 1), 0);
+
+    /*
+     * Unsized, the pid is medium until the reference reads its smaps; then
+     * each eligible source measured once for the small class
+     */
+    run(MEMTRACK_TEST_PID, 3, got);
+    EXPECT_EQ(got[SOURCE_REF], 2);
+    EXPECT_EQ(got[SOURCE_FAST], 1);
+    run(MEMTRACK_TEST_PID, TEST_CALLS, got);
+    printf("exact: ref %u fast %u approx %u missing %u\n", got[SOURCE_REF],
+           got[SOURCE_FAST], got[SOURCE_APPROX], got[SOURCE_MISSING]);
+    EXPECT(got[SOURCE_FAST] >= TEST_MOST);
+    /* Still measured now and then */
+    EXPECT(got[SOURCE_REF] >= TEST_CALLS / TEST_EXPLORE_PERIOD / 2);
+    EXPECT_EQ(got[SOURCE_APPROX], 0);
+    EXPECT_EQ(got[SOURCE_MISSING], 0);
+    EXPECT_EQ(selected(MEMTRACK_SOURCE_SMALL), SOURCE_FAST);
+    EXPECT_EQ(memtrack_source_get_stats(MEMTRACK_TYPE_GL,
+                                        MEMTRACK_SOURCE_SMALL, SOURCE_MISSING,
+                                        &stats), 0);
+    EXPECT(!stats.available);
+    EXPECT_EQ(memtrack_source_get_stats(MEMTRACK_TYPE_GL,
+                                        MEMTRACK_SOURCE_SMALL, TEST_SOURCES,
+                                        &stats), -ENOENT);
+
+    /* Approximate precision lets the approximate source in */
+    EXPECT_EQ(memtrack_test_config("precision.gl = approximate\n"), 0);
+    EXPECT_EQ(memtrack_config_reload(), 0);
+    run(MEMTRACK_TEST_PID, TEST_CALLS, got);
+    printf("approximate: ref %u fast %u approx %u\n", got[SOURCE_REF],
+           got[SOURCE_FAST], got[SOURCE_APPROX]);
+    EXPECT(got[SOURCE_APPROX] >= TEST_MOST);
+    EXPECT_EQ(selected(MEMTRACK_SOURCE_SMALL), SOURCE_APPROX);
+
+    /* The fast source gets slower than the reference, the choice follows */
+    EXPECT_EQ(memtrack_test_config("precision.gl = exact\n"), 0);
+    EXPECT_EQ(memtrack_config_reload(), 0);
+    cost_us[SOURCE_FAST] = 6000;
+    run(MEMTRACK_TEST_PID, TEST_CALLS, got);
+    printf("fast slowed down: ref %u fast %u\n", got[SOURCE_REF],
+           got[SOURCE_FAST]);
+    EXPECT_EQ(selected(MEMTRACK_SOURCE_SMALL), SOURCE_REF);
+    EXPECT(got[SOURCE_REF] > got[SOURCE_FAST]);
+
+    /* A process with a large smaps has costs of its own */
+    EXPECT_EQ(class_calls(MEMTRACK_SOURCE_LARGE), 0);
+    run(TEST_PID_LARGE, 4, got);
+    EXPECT_EQ(class_calls(MEMTRACK_SOURCE_MEDIUM), 3);
+    EXPECT_EQ(class_calls(MEMTRACK_SOURCE_LARGE), 2);
+
+    /* A failed call costs nothing */
+    EXPECT_EQ(memtrack_source_get_stats(MEMTRACK_TYPE_GL,
+                                        MEMTRACK_SOURCE_MEDIUM, SOURCE_REF,
+                                        &stats), 0);
+    cost_ns = stats.cost_ns;
+    EXPECT(get(MEMTRACK_TEST_PID_MISSING) < 0);
+    EXPECT_EQ(memtrack_source_get_stats(MEMTRACK_TYPE_GL,
+                                        MEMTRACK_SOURCE_MEDIUM, SOURCE_REF,
+                                        &stats), 0);
+    EXPECT_EQ(stats.cost_ns, cost_ns);
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Sweeps the fixture's /proc with a provider whose sizes the test sets,
+ * and checks which changes the subscriptions of subscribe.h hear about:
+ * absolute thresholds crossed either way, relative changes, processes
+ * appearing and disappearing, and nothing after unsubscribing.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "sampler.h"
+#include "snapshot.h"
+#include "subscribe.h"
+
+#define TEST_MAX_PIDS 16
+#define TEST_PID_NEW 200
+#define MiB (1024 * 1024)
+
+static uint64_t sizes[TEST_PID_NEW + 1];
+
+static struct memtrack_change heard[8];
+static size_t num_heard;
+static int self_id = -1;
+static unsigned int self_calls;
+
+static int get_memory(pid_t pid, enum memtrack_type type,
+                      struct memtrack_record *records, size_t *num_records)
+{
+    if (pid < 0 || pid > TEST_PID_NEW) {
+        return -ESRCH;
+    }
+    if (*num_records) {
+        records[0].size_in_bytes = sizes[pid];
+        records[0].flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                           MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    }
+    *num_records = 1;
+
+    return 0;
+}
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "test",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = get_memory,
+    },
+};
+
+static void record_change(const struct memtrack_change *change, void *arg)
+{
+    if (num_heard < sizeof(heard) / sizeof(heard[0])) {
+        heard[num_heard] = *change;
+    }
+    num_heard++;
+}
+
+/* Unsubscribes itself on its first change */
+static void once(const struct memtrack_change *change, void *arg)
+{
+    self_calls++;
+    memtrack_unsubscribe(self_id);
+}
+
+static bool is_change(const struct memtrack_change *change, pid_t pid,
+                      uint64_t old_size, uint64_t new_size)
+{
+    return change->pid == pid && change->type == MEMTRACK_TYPE_GL &&
+           change->old_size == old_size && change->new_size == new_size;
+}
+
+/* Changes queued on the eventfd subscription id since the last call */
+static size_t read_queued(int efd, int id, struct memtrack_change *out,
+                          size_t max)
+{
+    uint64_t count;
+
+    if (read(efd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+
+    return memtrack_subscription_read(id, out, max, NULL);
+}
+
+static int remove_pid(pid_t pid)
+{
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s/proc/%d/stat", memtrack_test_root(),
+                 pid) >= (int)sizeof(path) ||
+        unlink(path) < 0) {
+        return -errno;
+    }
+    *strrchr(path, '/') = '\0';
+
+    return rmdir(path) < 0 ? -errno : 0;
+}
+
+int main(void)
+{
+    struct memtrack_change queued[8];
+    size_t num_queued;
+    int absolute, relative, efd;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    EXPECT_EQ(memtrack_core_init(providers, 1), 0);
+    EXPECT_EQ(snapshot_init(TEST_MAX_PIDS), 0);
+
+    efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    EXPECT(efd >= 0);
+    EXPECT_EQ(memtrack_subscribe(MEMTRACK_TEST_PID, MEMTRACK_TYPE_GL,
+                                 MEMTRACK_THRESHOLD_ABSOLUTE, MiB, NULL,
+                                 NULL, -1), -EINVAL);
+
+    sizes[MEMTRACK_TEST_PID] = MiB / 2;
+    sizes[MEMTRACK_TEST_PID_IDLE] = MiB;
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+
+    absolute = memtrack_subscribe(MEMTRACK_TEST_PID, MEMTRACK_TYPE_GL,
+                                  MEMTRACK_THRESHOLD_ABSOLUTE, MiB,
+                                  record_change, NULL, -1);
+    EXPECT(absolute >= 0);
+    relative = memtrack_subscribe(MEMTRACK_SUBSCRIBE_ALL_PIDS,
+                                  MEMTRACK_TYPE_GL,
+                                  MEMTRACK_THRESHOLD_RELATIVE, 50, NULL, NULL,
+                                  efd);
+    EXPECT(relative >= 0);
+    self_id = memtrack_subscribe(MEMTRACK_TEST_PID_IDLE, MEMTRACK_TYPE_GL,
+                                 MEMTRACK_THRESHOLD_RELATIVE, 10, once, NULL,
+                                 -1);
+    EXPECT(self_id >= 0);
+
+    /* Up across 1 MiB, +300%; the idle pid +20% */
+    sizes[MEMTRACK_TEST_PID] = 2 * MiB;
+    sizes[MEMTRACK_TEST_PID_IDLE] = MiB + MiB / 5;
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(num_heard, 1);
+    EXPECT(is_change(&heard[0], MEMTRACK_TEST_PID, MiB / 2, 2 * MiB));
+    num_queued = read_queued(efd, relative, queued, 8);
+    EXPECT_EQ(num_queued, 1);
+    EXPECT(is_change(&queued[0], MEMTRACK_TEST_PID, MiB / 2, 2 * MiB));
+    EXPECT_EQ(self_calls, 1);
+
+    /* -25%, still above 1 MiB; the idle pid again, but unsubscribed */
+    sizes[MEMTRACK_TEST_PID] = 3 * MiB / 2;
+    sizes[MEMTRACK_TEST_PID_IDLE] = 2 * MiB;
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(num_heard, 1);
+    EXPECT_EQ(self_calls, 1);
+    num_queued = read_queued(efd, relative, queued, 8);
+    EXPECT_EQ(num_queued, 1);
+    EXPECT(is_change(&queued[0], MEMTRACK_TEST_PID_IDLE, MiB + MiB / 5,
+                     2 * MiB));
+
+    /* Down across 1 MiB, and a process appears */
+    sizes[MEMTRACK_TEST_PID] = MiB / 2;
+    sizes[TEST_PID_NEW] = MiB;
+    EXPECT_EQ(memtrack_test_write("/proc/200/stat",
+                                  "200 (test_new) S 1 200 0 0 -1 0 0 0 0 0 0 "
+                                  "0 0 0 20 0 1 0 500 0 0\n"), 0);
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(num_heard, 2);
+    EXPECT(is_change(&heard[1], MEMTRACK_TEST_PID, 3 * MiB / 2, MiB / 2));
+    num_queued = read_queued(efd, relative, queued, 8);
+    EXPECT_EQ(num_queued, 2);
+    EXPECT(is_change(&queued[0], MEMTRACK_TEST_PID, 3 * MiB / 2, MiB / 2));
+    EXPECT(is_change(&queued[1], TEST_PID_NEW, 0, MiB));
+
+    /* It disappears; the absolute subscription is gone */
+    EXPECT_EQ(memtrack_unsubscribe(absolute), 0);
+    sizes[MEMTRACK_TEST_PID] = 2 * MiB;
+    EXPECT_EQ(remove_pid(TEST_PID_NEW), 0);
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(num_heard, 2);
+    num_queued = read_queued(efd, relative, queued, 8);
+    EXPECT_EQ(num_queued, 2);
+    EXPECT(is_change(&queued[0], MEMTRACK_TEST_PID, MiB / 2, 2 * MiB));
+    EXPECT(is_change(&queued[1], TEST_PID_NEW, MiB, 0));
+
+    /* Nothing changed, nothing heard */
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+    EXPECT_EQ(read_queued(efd, relative, queued, 8), 0);
+
+    EXPECT_EQ(memtrack_unsubscribe(relative), 0);
+    close(efd);
+
+    return memtrack_test_finish();
+}
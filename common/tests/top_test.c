@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Runs memtrack_top, included below under another main, in CSV mode on
+ * the device fixture and checks its rows against the fixture's sizes and
+ * against calls to the providers.
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+
+#define TEST_MAX_COLUMNS (MEMTRACK_NUM_TYPES + 4)
+
+#define main memtrack_top_main
+#include "../memtrack_top.c"
+#undef main
+
+/* Fixture size of a provider for MEMTRACK_TEST_PID, -1 when unknown */
+static long long expected_bytes(const char *name)
+{
+    int type;
+
+    if (strcmp(name, "gen") == 0) {
+        return MEMTRACK_TEST_GEN_BYTES;
+    }
+    if (strcmp(name, "mali") == 0) {
+        return MEMTRACK_TEST_MALI_BYTES;
+    }
+    if (strcmp(name, "mali-midgard") == 0) {
+        return MEMTRACK_TEST_MIDGARD_BYTES;
+    }
+    if (strcmp(name, "zram") == 0) {
+        return MEMTRACK_TEST_ZRAM_BYTES;
+    }
+    if (strcmp(name, "hmm") == 0) {
+        return 0;
+    }
+    if (strcmp(name, "ion") == 0) {
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            const struct memtrack_provider *provider =
+                memtrack_core_provider(type);
+
+            if (provider && strcmp(provider->name, "mali-midgard") == 0) {
+                return MEMTRACK_TEST_MIDGARD_ION_BYTES;
+            }
+        }
+        return MEMTRACK_TEST_ION_BYTES;
+    }
+
+    return -1;
+}
+
+static long long live_bytes(pid_t pid, int type)
+{
+    struct memtrack_record records[16];
+    size_t num_records = sizeof(records) / sizeof(records[0]);
+    long long bytes = 0;
+    size_t i;
+
+    if (memtrack_core_read_live(pid, type, records, &num_records, NULL) < 0) {
+        return 0;
+    }
+    for (i = 0; i < num_records; i++) {
+        bytes += records[i].size_in_bytes;
+    }
+
+    return bytes;
+}
+
+/* Splits line at the commas in place, returns the number of fields */
+static int split_csv(char *line, char **fields, int max)
+{
+    int num = 0;
+    char *p = line;
+
+    line[strcspn(line, "\n")] = '\0';
+    while (num < max) {
+        fields[num++] = p;
+        p = strchr(p, ',');
+        if (p == NULL) {
+            break;
+        }
+        *p++ = '\0';
+    }
+
+    return num;
+}
+
+static void check_row(char **fields, int num_fields, int *types,
+                      char **names, int num_columns, unsigned int *seen)
+{
+    pid_t pid = atoi(fields[1]);
+    long long total = 0, bytes;
+    int c;
+
+    EXPECT_EQ(num_fields, num_columns + 4);
+    if (num_fields != num_columns + 4) {
+        return;
+    }
+
+    for (c = 0; c < num_columns; c++) {
+        bytes = strtoll(fields[3 + c], NULL, 10);
+        total += bytes;
+        EXPECT_EQ(bytes, live_bytes(pid, types[c]));
+        if (pid == MEMTRACK_TEST_PID && expected_bytes(names[c]) >= 0) {
+            EXPECT_EQ(bytes, expected_bytes(names[c]));
+        }
+        if (pid == MEMTRACK_TEST_PID_INIT && strcmp(names[c], "hmm") == 0) {
+            EXPECT_EQ(bytes, MEMTRACK_TEST_HMM_BYTES);
+        }
+    }
+    EXPECT_EQ(strtoll(fields[3 + num_columns], NULL, 10), total);
+
+    switch (pid) {
+    case MEMTRACK_TEST_PID:
+        EXPECT(strcmp(fields[2], "\"test_app\"") == 0);
+        EXPECT(total > 0);
+        seen[0]++;
+        break;
+    case MEMTRACK_TEST_PID_IDLE:
+        EXPECT(strcmp(fields[2], "\"test_idle\"") == 0);
+        seen[1]++;
+        break;
+    case MEMTRACK_TEST_PID_INIT:
+        EXPECT(strcmp(fields[2], "\"init\"") == 0);
+        seen[2]++;
+        break;
+    default:
+        EXPECT(!"row of a pid outside the fixture");
+        break;
+    }
+}
+
+int main(void)
+{
+    char root[PATH_MAX], out[PATH_MAX], line[512];
+    char *argv[] = { "memtrack_top", "-b", "-s", "pid", "-N", "0", "-n", "3",
+                     "-d", "200", "-B", "0", "-r", root, NULL };
+    char *fields[TEST_MAX_COLUMNS], *names[MEMTRACK_NUM_TYPES];
+    int types[MEMTRACK_NUM_TYPES];
+    unsigned int seen[3] = { 0, 0, 0 };
+    int num_columns = 0, num_fields, type, fd = -1, saved;
+    FILE *fp;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    snprintf(root, sizeof(root), "%s", memtrack_test_root());
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+
+    /* Runs with stdout in a file below the root */
+    if (EXPECT(snprintf(out, sizeof(out), "%s/top.csv", root) <
+               (int)sizeof(out))) {
+        fd = open(out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    EXPECT(fd >= 0);
+    if (fd < 0) {
+        return memtrack_test_finish();
+    }
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    EXPECT_EQ(memtrack_top_main(sizeof(argv) / sizeof(argv[0]) - 1, argv), 0);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    /* Columns in the order memtrack_top prints them */
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        const struct memtrack_provider *provider = memtrack_core_provider(type);
+
+        if (provider) {
+            types[num_columns] = type;
+            names[num_columns++] = (char *)provider->name;
+        }
+    }
+    EXPECT(num_columns > 0);
+
+    fp = fopen(out, "re");
+    EXPECT(fp != NULL);
+    if (fp == NULL) {
+        return memtrack_test_finish();
+    }
+
+    EXPECT(fgets(line, sizeof(line), fp) != NULL);
+    num_fields = split_csv(line, fields, TEST_MAX_COLUMNS);
+    EXPECT_EQ(num_fields, num_columns + 4);
+    if (num_fields == num_columns + 4) {
+        int c;
+
+        EXPECT(strcmp(fields[0], "timestamp_ms") == 0);
+        EXPECT(strcmp(fields[1], "pid") == 0);
+        EXPECT(strcmp(fields[2], "name") == 0);
+        for (c = 0; c < num_columns; c++) {
+            EXPECT(strcmp(fields[3 + c], names[c]) == 0);
+        }
+        EXPECT(strcmp(fields[3 + num_columns], "total") == 0);
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        num_fields = split_csv(line, fields, TEST_MAX_COLUMNS);
+        check_row(fields, num_fields, types, names, num_columns, seen);
+    }
+    fclose(fp);
+
+    /* The first refreshes may race with the first sweep */
+    EXPECT(seen[0] > 0);
+    EXPECT_EQ(seen[1], seen[0]);
+    EXPECT_EQ(seen[2], seen[0]);
+
+    return memtrack_test_finish();
+}
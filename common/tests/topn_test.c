@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Publishes snapshots of pseudo-random sizes, with many ties, failed
+ * providers and processes using nothing, and checks that the largest
+ * consumers of memtrack_core_top(), from the lists kept with the snapshot
+ * and from the selection beyond them, match a full sort for every mask.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "snapshot.h"
+#include "topn.h"
+
+#define TEST_MAX_PIDS 512
+#define TEST_ROUNDS 20
+
+static int get_memory(pid_t pid, enum memtrack_type type,
+                      struct memtrack_record *records, size_t *num_records)
+{
+    return -ENODEV;
+}
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "gl",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = get_memory,
+    },
+    {
+        .name = "graphics",
+        .type = MEMTRACK_TYPE_GRAPHICS,
+        .get_memory = get_memory,
+    },
+};
+
+static const unsigned int masks[] = {
+    1u << MEMTRACK_TYPE_GL,
+    1u << MEMTRACK_TYPE_GRAPHICS,
+    1u << MEMTRACK_TYPE_GL | 1u << MEMTRACK_TYPE_GRAPHICS,
+    /* No provider of the other types, they add nothing */
+    1u << MEMTRACK_TYPE_GL | 1u << MEMTRACK_TYPE_OTHER,
+    1u << MEMTRACK_TYPE_OTHER,
+};
+
+static const size_t sizes_n[] = {
+    1, 5, MEMTRACK_TOP_MAX, MEMTRACK_TOP_MAX + 1, 100, TEST_MAX_PIDS,
+};
+
+static uint32_t seed = 1;
+
+static uint32_t next_random(void)
+{
+    seed = seed * 1103515245 + 12345;
+
+    return seed >> 16;
+}
+
+static void fill_type(struct snapshot_entry *entry, int type)
+{
+    uint32_t r = next_random() % 64;
+
+    /* One in 64 failed, one in 16 using nothing, few distinct sizes */
+    entry->ret[type] = r == 0 ? -EIO : 0;
+    entry->num_records[type] = r % 16 == 1 ? 0 : 1;
+    entry->records[type][0].size_in_bytes = (r % 8) * 4096;
+}
+
+static void publish(size_t count, pid_t *pids, struct snapshot_entry *copy)
+{
+    struct snapshot_view view;
+    size_t i;
+
+    snapshot_write_begin(&view);
+    for (i = 0; i < count; i++) {
+        struct snapshot_entry *entry = &view.entries[i];
+        int type;
+
+        memset(entry, 0, sizeof(*entry));
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            entry->ret[type] = -ENODEV;
+        }
+        fill_type(entry, MEMTRACK_TYPE_GL);
+        fill_type(entry, MEMTRACK_TYPE_GRAPHICS);
+        /* Not sorted by pid */
+        view.pids[i] = pids[i] = (pid_t)((i * 7919) % 30011 + 2);
+        copy[i] = *entry;
+    }
+    snapshot_write_commit(&view, count, memtrack_now_ns());
+}
+
+static int compare_rank(const void *a, const void *b)
+{
+    const struct memtrack_top_entry *x = a, *y = b;
+
+    if (x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
+    }
+
+    return x->pid < y->pid ? -1 : x->pid > y->pid;
+}
+
+/* The expected ranking of mask, by summing and sorting everything */
+static size_t full_sort(const pid_t *pids, const struct snapshot_entry *entries,
+                        size_t count, unsigned int mask,
+                        struct memtrack_top_entry *out)
+{
+    size_t i, used = 0;
+    int type;
+
+    for (i = 0; i < count; i++) {
+        uint64_t size = 0;
+
+        for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+            size_t r;
+
+            if (!(mask & (1u << type)) || entries[i].ret[type] != 0) {
+                continue;
+            }
+            for (r = 0; r < entries[i].num_records[type]; r++) {
+                size += entries[i].records[type][r].size_in_bytes;
+            }
+        }
+        if (size) {
+            out[used].pid = pids[i];
+            out[used].size = size;
+            used++;
+        }
+    }
+    qsort(out, used, sizeof(*out), compare_rank);
+
+    return used;
+}
+
+static bool same_entries(const struct memtrack_top_entry *a,
+                         const struct memtrack_top_entry *b, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (a[i].pid != b[i].pid || a[i].size != b[i].size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(void)
+{
+    static struct snapshot_entry entries[TEST_MAX_PIDS];
+    static struct memtrack_top_entry expected[TEST_MAX_PIDS];
+    static struct memtrack_top_entry got[TEST_MAX_PIDS];
+    pid_t pids[TEST_MAX_PIDS];
+    size_t count, used, m, s;
+    ssize_t n;
+    int round;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_core_init(providers, 2), 0);
+    EXPECT_EQ(memtrack_core_top(1u << MEMTRACK_TYPE_GL, got, 1), -ENODEV);
+    EXPECT_EQ(snapshot_init(TEST_MAX_PIDS), 0);
+    EXPECT_EQ(memtrack_core_top(0, got, 1), -EINVAL);
+    EXPECT_EQ(memtrack_core_top(TOPN_MASKS, got, 1), -EINVAL);
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        /* Fewer processes than kept entries now and then */
+        count = round % 5 == 0 ? MEMTRACK_TOP_MAX / 2 :
+                next_random() % TEST_MAX_PIDS + 1;
+        publish(count, pids, entries);
+
+        for (m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+            used = full_sort(pids, entries, count, masks[m], expected);
+            for (s = 0; s < sizeof(sizes_n) / sizeof(sizes_n[0]); s++) {
+                size_t want = sizes_n[s] < used ? sizes_n[s] : used;
+
+                n = memtrack_core_top(masks[m], got, sizes_n[s]);
+                if (!EXPECT_EQ(n, want) ||
+                    !EXPECT(same_entries(got, expected, want))) {
+                    printf("round %d mask %#x n %zu\n", round, masks[m],
+                           sizes_n[s]);
+                }
+            }
+        }
+    }
+
+    /* topn_select on its own, n at every position of a tied array */
+    count = full_sort(pids, entries, TEST_MAX_PIDS / 4,
+                      1u << MEMTRACK_TYPE_GL, expected);
+    for (s = 0; s <= count + 1; s++) {
+        size_t i;
+
+        for (i = 0; i < count; i++) {
+            got[i] = expected[(i * 31) % count];
+        }
+        EXPECT_EQ(topn_select(got, count, s), s < count ? s : count);
+        EXPECT(same_entries(got, expected, s < count ? s : count));
+    }
+
+    return memtrack_test_finish();
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Traces a sweep over a fixture tree, see trace.h, and checks the Chrome
+ * trace JSON: balanced spans, the file reads with their paths, and
+ * provider spans carrying the bytes their call read, also for a guarded
+ * source that reads on a helper thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/memtrack.h>
+
+#include "batch_io.h"
+#include "memtrack_common.h"
+#include "memtrack_test.h"
+#include "sampler.h"
+#include "snapshot.h"
+#include "source.h"
+#include "trace.h"
+
+#ifndef MEMTRACK_TRACE
+#error memtrack_trace_test needs a MEMTRACK_TRACE := true build
+#endif
+
+#define TEST_SAMPLER_INTERVAL_MS (24 * 3600 * 1000)
+#define TEST_FILE_FMT "/proc/%d/memtrack_test"
+#define TEST_FILE_TEXT "size 4096\n"
+
+static void parse_size(void *arg, const char *data, size_t len)
+{
+    sscanf(data, "size %zu", (size_t *)arg);
+}
+
+static int file_get_memory(pid_t pid, enum memtrack_type type,
+                           struct memtrack_record *records,
+                           size_t *num_records)
+{
+    char path[64], buf[64];
+    size_t size = 0;
+    int ret;
+
+    snprintf(path, sizeof(path), TEST_FILE_FMT, pid);
+    ret = batch_io_read_file(path, buf, sizeof(buf), parse_size, &size);
+    if (ret < 0) {
+        return ret;
+    }
+    if (*num_records) {
+        records[0].size_in_bytes = size;
+        records[0].flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                           MEMTRACK_FLAG_PRIVATE | MEMTRACK_FLAG_NONSECURE;
+    }
+    *num_records = 1;
+
+    return 0;
+}
+
+static const struct memtrack_source guarded_sources[] = {
+    {
+        .name = "guarded_file",
+        .get_memory = file_get_memory,
+        .timeout_ms = 1000,
+    },
+};
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "plain",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = file_get_memory,
+    },
+    {
+        .name = "guarded",
+        .type = MEMTRACK_TYPE_GRAPHICS,
+        .get_memory = file_get_memory,
+        .sources = guarded_sources,
+        .num_sources = 1,
+    },
+};
+
+static const pid_t pids[] = {
+    MEMTRACK_TEST_PID_INIT,
+    MEMTRACK_TEST_PID,
+    MEMTRACK_TEST_PID_IDLE,
+};
+
+static unsigned int count(const char *json, const char *needle)
+{
+    unsigned int n = 0;
+
+    while ((json = strstr(json, needle)) != NULL) {
+        n++;
+        json += strlen(needle);
+    }
+
+    return n;
+}
+
+/* Ends of name that carry bytes, every one of them has to */
+static unsigned int count_ends(const char *json, const char *name,
+                               unsigned long long bytes)
+{
+    char end[128];
+    const char *p = json;
+    unsigned int n = 0;
+
+    snprintf(end, sizeof(end), "{\"name\":\"%s\",\"cat\":\"memtrack\","
+             "\"ph\":\"E\"", name);
+    while ((p = strstr(p, end)) != NULL) {
+        unsigned long long got;
+        const char *args = strstr(p, "\"bytes\":");
+
+        p += strlen(end);
+        if (args && sscanf(args, "\"bytes\":%llu", &got) == 1 &&
+            got == bytes) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/* The sampler thread sweeps once right away, outside of the trace */
+static bool wait_first_sweep(void)
+{
+    struct memtrack_record records[1];
+    size_t num_records;
+    int i, ret;
+
+    for (i = 0; i < 200; i++) {
+        num_records = 1;
+        if (snapshot_lookup(MEMTRACK_TEST_PID, MEMTRACK_TYPE_GL, UINT64_MAX,
+                            records, &num_records, &ret)) {
+            return true;
+        }
+        usleep(10000);
+    }
+
+    return false;
+}
+
+int main(void)
+{
+    char path[64], needle[128];
+    uint64_t start_ns;
+    size_t len;
+    char *json;
+    size_t i;
+
+    if (memtrack_test_root() == NULL) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_test_device_fixture(), 0);
+    for (i = 0; i < sizeof(pids) / sizeof(pids[0]); i++) {
+        snprintf(path, sizeof(path), TEST_FILE_FMT, pids[i]);
+        EXPECT_EQ(memtrack_test_write(path, TEST_FILE_TEXT), 0);
+    }
+
+    EXPECT_EQ(memtrack_core_init(providers, 2), 0);
+    EXPECT_EQ(memtrack_sampler_start(TEST_SAMPLER_INTERVAL_MS, 64), 0);
+    EXPECT(wait_first_sweep());
+
+    start_ns = memtrack_now_ns();
+    EXPECT_EQ(memtrack_sampler_sweep(), 0);
+
+    len = memtrack_trace_dump(NULL, 0, start_ns);
+    json = malloc(len + 1);
+    if (!EXPECT(json != NULL)) {
+        return memtrack_test_finish();
+    }
+    EXPECT_EQ(memtrack_trace_dump(json, len + 1, start_ns), len);
+
+    EXPECT(strncmp(json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[",
+                   39) == 0);
+    EXPECT_EQ(count(json, "\"ph\":\"B\""), count(json, "\"ph\":\"E\""));
+    EXPECT(count(json, "{\"name\":\"sweep\",") >= 2);
+
+    for (i = 0; i < sizeof(pids) / sizeof(pids[0]); i++) {
+        snprintf(path, sizeof(path), TEST_FILE_FMT, pids[i]);
+        snprintf(needle, sizeof(needle), "\"path\":\"%s\"", path);
+        /* Read once by each provider */
+        EXPECT(count(json, needle) >= 2);
+    }
+
+    /* The helper's reads are charged to the guarded call, see guard.h */
+    EXPECT_EQ(count_ends(json, "plain", strlen(TEST_FILE_TEXT)), 3);
+    EXPECT_EQ(count_ends(json, "guarded", strlen(TEST_FILE_TEXT)), 3);
+
+    if (memtrack_test_finish() != 0) {
+        fputs(json, stderr);
+        return 1;
+    }
+    free(json);
+
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "topn.h"
+
+/* a ranks before b: larger first, ties by ascending pid */
+static bool ranks_before(const struct memtrack_top_entry *a,
+                         const struct memtrack_top_entry *b)
+{
+    return a->size != b->size ? a->size > b->size : a->pid < b->pid;
+}
+
+static void swap_entries(struct memtrack_top_entry *a,
+                         struct memtrack_top_entry *b)
+{
+    struct memtrack_top_entry tmp = *a;
+
+    *a = *b;
+    *b = tmp;
+}
+
+/* Min-heap on rank, the root is the entry to evict first */
+static void sift_down(struct memtrack_top_entry *heap, size_t count, size_t i)
+{
+    while (1) {
+        size_t l = 2 * i + 1, r = l + 1, last = i;
+
+        if (l < count && ranks_before(&heap[last], &heap[l])) {
+            last = l;
+        }
+        if (r < count && ranks_before(&heap[last], &heap[r])) {
+            last = r;
+        }
+        if (last == i) {
+            return;
+        }
+        swap_entries(&heap[i], &heap[last]);
+        i = last;
+    }
+}
+
+static void sift_up(struct memtrack_top_entry *heap, size_t i)
+{
+    while (i > 0 && ranks_before(&heap[(i - 1) / 2], &heap[i])) {
+        swap_entries(&heap[i], &heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_offer(struct topn_list *list,
+                       const struct memtrack_top_entry *entry)
+{
+    if (list->count < MEMTRACK_TOP_MAX) {
+        list->entries[list->count] = *entry;
+        sift_up(list->entries, list->count++);
+    } else if (ranks_before(entry, &list->entries[0])) {
+        list->entries[0] = *entry;
+        sift_down(list->entries, list->count, 0);
+    }
+}
+
+/* Heap sort, popping the smallest to the back leaves the largest first */
+static void heap_finish(struct topn_list *list)
+{
+    size_t n;
+
+    for (n = list->count; n > 1; n--) {
+        swap_entries(&list->entries[0], &list->entries[n - 1]);
+        sift_down(list->entries, n - 1, 0);
+    }
+}
+
+static uint64_t type_size(const struct snapshot_entry *entry, int type)
+{
+    uint64_t size = 0;
+    size_t r;
+
+    if (entry->ret[type] != 0) {
+        return 0;
+    }
+    for (r = 0; r < entry->num_records[type] && r < SNAPSHOT_MAX_RECORDS; r++) {
+        size += entry->records[type][r].size_in_bytes;
+    }
+
+    return size;
+}
+
+uint64_t topn_entry_size(const struct snapshot_entry *entry, unsigned int mask)
+{
+    uint64_t size = 0;
+    int type;
+
+    for (type = 0; type < MEMTRACK_NUM_TYPES; type++) {
+        if (mask & (1u << type)) {
+            size += type_size(entry, type);
+        }
+    }
+
+    return size;
+}
+
+void topn_build(const struct snapshot_entry *entries, const pid_t *pids,
+                size_t count, unsigned int type_mask,
+                struct topn_list *lists)
+{
+    uint64_t sums[TOPN_MASKS];
+    unsigned int mask;
+    size_t i;
+
+    for (mask = 0; mask < TOPN_MASKS; mask++) {
+        lists[mask].count = 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        sums[0] = 0;
+        for (mask = 1; mask < TOPN_MASKS; mask++) {
+            struct memtrack_top_entry entry;
+
+            if (mask & ~type_mask) {
+                continue;
+            }
+
+            /* Every mask is a smaller one plus its lowest type */
+            sums[mask] = sums[mask & (mask - 1)] +
+                         type_size(&entries[i], __builtin_ctz(mask));
+            if (sums[mask] == 0) {
+                continue;
+            }
+
+            entry.pid = pids[i];
+            entry.size = sums[mask];
+            heap_offer(&lists[mask], &entry);
+        }
+    }
+
+    for (mask = 1; mask < TOPN_MASKS; mask++) {
+        heap_finish(&lists[mask]);
+    }
+}
+
+static int compare_rank(const void *a, const void *b)
+{
+    if (ranks_before(a, b)) {
+        return -1;
+    }
+    return ranks_before(b, a) ? 1 : 0;
+}
+
+size_t topn_select(struct memtrack_top_entry *entries, size_t count, size_t n)
+{
+    size_t lo = 0, hi = count;
+
+    if (n >= count) {
+        qsort(entries, count, sizeof(*entries), compare_rank);
+        return count;
+    }
+
+    /* Partition until position n separates the n largest from the rest */
+    while (hi - lo > 1) {
+        struct memtrack_top_entry pivot = entries[lo + (hi - lo) / 2];
+        size_t i = lo, j = hi - 1;
+
+        while (i <= j) {
+            while (ranks_before(&entries[i], &pivot)) {
+                i++;
+            }
+            while (ranks_before(&pivot, &entries[j])) {
+                j--;
+            }
+            if (i <= j) {
+                swap_entries(&entries[i], &entries[j]);
+                i++;
+                if (j == 0) {
+                    break;
+                }
+                j--;
+            }
+        }
+
+        if (n <= j) {
+            hi = j + 1;
+        } else if (n >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+
+    qsort(entries, n, sizeof(*entries), compare_rank);
+
+    return n;
+}
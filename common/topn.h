@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_TOPN_H_
+#define _MEMTRACK_TOPN_H_
+
+#include <stddef.h>
+
+#include "memtrack_common.h"
+#include "snapshot.h"
+
+/*
+ * Largest consumers per combination of types, built by the sampler with
+ * one bounded min-heap per type mask while it commits a snapshot, and
+ * published with it.  Masks outside the registered types stay empty.
+ */
+
+#define TOPN_MASKS (1u << MEMTRACK_NUM_TYPES)
+
+struct topn_list {
+    size_t count;
+    /* Largest first, ties by ascending pid */
+    struct memtrack_top_entry entries[MEMTRACK_TOP_MAX];
+};
+
+/* Memory of entry in the types of mask, failed providers count as 0 */
+uint64_t topn_entry_size(const struct snapshot_entry *entry,
+                         unsigned int mask);
+
+/* Fills lists[mask] for every non-empty mask within type_mask */
+void topn_build(const struct snapshot_entry *entries, const pid_t *pids,
+                size_t count, unsigned int type_mask,
+                struct topn_list *lists);
+
+/*
+ * Moves the n largest of entries to the front, sorted, by quickselect
+ * and a sort of only those.  Returns min(n, count).
+ */
+size_t topn_select(struct memtrack_top_entry *entries, size_t count,
+                   size_t n);
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "io_account.h"
+#include "memtrack_common.h"
+#include "trace.h"
+
+struct trace_event {
+    uint64_t ts_ns;
+    const char *name;
+    uint64_t bytes;
+    pid_t pid;
+    char phase;
+    char path[MEMTRACK_TRACE_PATH_MAX];
+};
+
+/*
+ * Single writer ring.  claimed moves before a slot is overwritten and
+ * head once it is complete, so a reader can tell which of the events it
+ * copied were overwritten meanwhile, as with a seqlock.
+ */
+struct trace_ring {
+    _Atomic uint64_t claimed;
+    _Atomic uint64_t head;
+    pid_t tid;
+    struct trace_ring *next;
+    struct trace_event events[MEMTRACK_TRACE_EVENTS];
+};
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring *rings;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static __thread struct trace_ring *local_ring;
+static char trace_file[256];
+
+static void ring_release(void *arg)
+{
+    struct trace_ring *ring = arg;
+    struct trace_ring **pp;
+
+    pthread_mutex_lock(&rings_lock);
+    for (pp = &rings; *pp; pp = &(*pp)->next) {
+        if (*pp == ring) {
+            *pp = ring->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    free(ring);
+}
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+static struct trace_ring *get_ring(void)
+{
+    struct trace_ring *ring = local_ring;
+
+    if (ring) {
+        return ring;
+    }
+
+    pthread_once(&ring_once, ring_key_create);
+    ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->tid = syscall(__NR_gettid);
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+
+    return ring;
+}
+
+static void record(char phase, const char *name, pid_t pid, const char *path,
+                   uint64_t bytes)
+{
+    struct trace_ring *ring = get_ring();
+    struct trace_event *e;
+    uint64_t index;
+
+    if (ring == NULL) {
+        return;
+    }
+
+    index = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->claimed, index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    e = &ring->events[index % MEMTRACK_TRACE_EVENTS];
+    e->ts_ns = memtrack_now_ns();
+    e->name = name;
+    e->bytes = bytes;
+    e->pid = pid;
+    e->phase = phase;
+    if (path) {
+        snprintf(e->path, sizeof(e->path), "%s", path);
+    } else {
+        e->path[0] = '\0';
+    }
+
+    atomic_store_explicit(&ring->head, index + 1, memory_order_release);
+}
+
+void memtrack_trace_begin(const char *name, pid_t pid, const char *path)
+{
+    record('B', name, pid, path, 0);
+}
+
+void memtrack_trace_end(const char *name, uint64_t bytes)
+{
+    record('E', name, 0, NULL, bytes);
+}
+
+uint64_t memtrack_trace_thread_bytes(void)
+{
+    struct memtrack_io_counters io;
+
+    memtrack_io_thread_counters(&io);
+    return io.bytes;
+}
+
+void memtrack_trace_init(const char *path)
+{
+    snprintf(trace_file, sizeof(trace_file), "%s", path ? path : "");
+}
+
+struct dump {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static void dump_printf(struct dump *d, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(d->len < d->size ? d->buf + d->len : NULL,
+                  d->len < d->size ? d->size - d->len : 0, fmt, ap);
+    va_end(ap);
+
+    if (n > 0) {
+        d->len += n;
+    }
+}
+
+static void dump_string(struct dump *d, const char *s)
+{
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            dump_printf(d, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            dump_printf(d, "\\u%04x", *s);
+        } else {
+            dump_printf(d, "%c", *s);
+        }
+    }
+}
+
+static void dump_ring(struct dump *d, struct trace_ring *ring,
+                      uint64_t since_ns, pid_t self, bool *first)
+{
+    uint64_t head, index;
+    int depth = 0;
+
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    index = head > MEMTRACK_TRACE_EVENTS ? head - MEMTRACK_TRACE_EVENTS : 0;
+
+    for (; index < head; index++) {
+        struct trace_event e = ring->events[index % MEMTRACK_TRACE_EVENTS];
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&ring->claimed, memory_order_relaxed) >
+            index + MEMTRACK_TRACE_EVENTS) {
+            /* Overwritten while it was being copied */
+            continue;
+        }
+        if (e.ts_ns < since_ns) {
+            continue;
+        }
+
+        /* An end whose begin was overwritten or filtered out */
+        if (e.phase == 'E' && depth == 0) {
+            continue;
+        }
+        depth += e.phase == 'B' ? 1 : -1;
+
+        dump_printf(d, "%s{\"name\":\"%s\",\"cat\":\"memtrack\",\"ph\":\"%c\","
+                    "\"ts\":%" PRIu64 ".%03u,\"pid\":%d,\"tid\":%d,\"args\":{",
+                    *first ? "" : ",\n", e.name, e.phase, e.ts_ns / 1000,
+                    (unsigned)(e.ts_ns % 1000), self, ring->tid);
+        if (e.phase == 'B') {
+            dump_printf(d, "\"pid\":%d", e.pid);
+            if (e.path[0]) {
+                e.path[sizeof(e.path) - 1] = '\0';
+                dump_printf(d, ",\"path\":\"");
+                dump_string(d, e.path);
+                dump_printf(d, "\"");
+            }
+        } else {
+            dump_printf(d, "\"bytes\":%" PRIu64, e.bytes);
+        }
+        dump_printf(d, "}}");
+        *first = false;
+    }
+}
+
+size_t memtrack_trace_dump(char *buf, size_t size, uint64_t since_ns)
+{
+    struct dump d = { buf, size, 0 };
+    struct trace_ring *ring;
+    bool first = true;
+
+    if (size) {
+        buf[0] = '\0';
+    }
+
+    dump_printf(&d, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    pthread_mutex_lock(&rings_lock);
+    for (ring = rings; ring; ring = ring->next) {
+        dump_ring(&d, ring, since_ns, getpid(), &first);
+    }
+    pthread_mutex_unlock(&rings_lock);
+    dump_printf(&d, "\n]}\n");
+
+    return d.len;
+}
+
+int memtrack_trace_flush(uint64_t since_ns)
+{
+    char tmp[sizeof(trace_file) + 4];
+    char *buf = NULL;
+    size_t size = 0, len;
+    ssize_t written;
+    int fd, ret = 0;
+
+    if (trace_file[0] == '\0') {
+        return 0;
+    }
+
+    /* Events keep arriving from other threads, allow for some growth */
+    while ((len = memtrack_trace_dump(buf, size, since_ns)) >= size) {
+        char *grown;
+
+        size = len + 64 * 1024;
+        grown = realloc(buf, size);
+        if (grown == NULL) {
+            free(buf);
+            return -ENOMEM;
+        }
+        buf = grown;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", trace_file);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(buf);
+        return -errno;
+    }
+
+    written = write(fd, buf, len);
+    if (written < 0) {
+        ret = -errno;
+    } else if ((size_t)written != len) {
+        ret = -EIO;
+    }
+    close(fd);
+    free(buf);
+
+    if (ret == 0 && rename(tmp, trace_file) < 0) {
+        ret = -errno;
+    }
+    if (ret < 0) {
+        unlink(tmp);
+    }
+
+    return ret;
+}
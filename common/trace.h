@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_TRACE_H_
+#define _MEMTRACK_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Phase tracing, built only with -DMEMTRACK_TRACE (MEMTRACK_TRACE := true
+ * in the environment of the build).  Otherwise every macro below compiles
+ * to nothing.
+ *
+ * Each thread records begin/end events into its own ring, overwriting the
+ * oldest ones, without taking any lock.  The rings are written out in the
+ * Chrome trace event format, which chrome://tracing and Perfetto load.
+ * name must be a string literal or otherwise outlive the module; path is
+ * copied, truncated to MEMTRACK_TRACE_PATH_MAX.
+ */
+
+#define MEMTRACK_TRACE_EVENTS 8192
+#define MEMTRACK_TRACE_PATH_MAX 48
+
+#ifdef MEMTRACK_TRACE
+
+void memtrack_trace_begin(const char *name, pid_t pid, const char *path);
+void memtrack_trace_end(const char *name, uint64_t bytes);
+
+/* Bytes read by the calling thread so far, for spans around whole calls */
+uint64_t memtrack_trace_thread_bytes(void);
+
+/* Sets the file memtrack_trace_flush() writes, NULL or "" disables it */
+void memtrack_trace_init(const char *path);
+
+/*
+ * Writes the events recorded since since_ns as Chrome trace JSON.  Returns
+ * the length of the full dump, which was truncated when it is size or
+ * more, like snprintf().
+ */
+size_t memtrack_trace_dump(char *buf, size_t size, uint64_t since_ns);
+
+/* Replaces the trace file with the events since since_ns, 0 or -errno */
+int memtrack_trace_flush(uint64_t since_ns);
+
+#define MEMTRACK_TRACE_BEGIN(name, pid, path) \
+    memtrack_trace_begin(name, pid, path)
+#define MEMTRACK_TRACE_END(name, bytes) memtrack_trace_end(name, bytes)
+#define MEMTRACK_TRACE_FLUSH(since_ns) memtrack_trace_flush(since_ns)
+
+#else
+
+#define MEMTRACK_TRACE_BEGIN(name, pid, path) do { } while (0)
+#define MEMTRACK_TRACE_END(name, bytes) do { } while (0)
+#define MEMTRACK_TRACE_FLUSH(since_ns) do { } while (0)
+
+#endif
+
+#endif
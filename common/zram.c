@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <cutils/log.h>
+
+#include <hardware/memtrack.h>
+
+#include "batch_io.h"
+#include "config.h"
+#include "logging.h"
+#include "memtrack_common.h"
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+static struct memtrack_record record_templates[] = {
+    {
+        .flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                 MEMTRACK_FLAG_PRIVATE |
+                 MEMTRACK_FLAG_NONSECURE,
+    },
+};
+
+struct zram_sources {
+    long zram_used;
+    unsigned long swap_total;
+    unsigned long swap_free;
+    unsigned long pswap_total;
+};
+
+/* zram bytes per swapped byte, stored as the bits of a double */
+static _Atomic uint64_t cached_ratio;
+static _Atomic uint64_t cached_ratio_ns;
+static atomic_uint ratio_ttl_ms = 1000;
+
+static void parse_zram_used_total(void *arg, const char *data, size_t len)
+{
+    struct zram_sources *src = arg;
+    unsigned long used_total;
+
+    if (sscanf(data, "%lu", &used_total) == 1) {
+        src->zram_used = used_total;
+    } else if (len > 0) {
+        src->zram_used = -EINVAL;
+    }
+}
+
+static void parse_meminfo(void *arg, const char *data, size_t len)
+{
+    struct zram_sources *src = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        if (sscanf(line, "SwapTotal: %lu kB", &src->swap_total) == 1) {
+            break;
+        }
+    }
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        if (sscanf(line, "SwapFree: %lu kB", &src->swap_free) == 1) {
+            break;
+        }
+    }
+}
+
+static void pswap_line(void *arg, const char *line)
+{
+    struct zram_sources *src = arg;
+    unsigned long pswap_size;
+
+    if (sscanf(line, "PSwap: %lu kB", &pswap_size) == 1) {
+        src->pswap_total += pswap_size;
+    }
+}
+
+static void parse_smaps_pswap(void *arg, const char *data, size_t len)
+{
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        pswap_line(arg, line);
+    }
+}
+
+static double compute_ratio(const struct zram_sources *src,
+                            const struct batch_io_req *meminfo_req)
+{
+    long swapped;
+
+    /* A missing zram device only means nothing is compressed */
+    if (meminfo_req->error) {
+        swapped = meminfo_req->error;
+    } else {
+        swapped = (src->swap_total - src->swap_free) * 1024;
+    }
+
+    return swapped > 0 ? (double)src->zram_used / swapped : 0.0;
+}
+
+static void store_ratio(double ratio)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &ratio, sizeof(bits));
+    atomic_store_explicit(&cached_ratio, bits, memory_order_relaxed);
+    atomic_store_explicit(&cached_ratio_ns, memtrack_now_ns(),
+                          memory_order_release);
+}
+
+static bool load_ratio(double *ratio)
+{
+    uint64_t stamp, bits, ttl_ns;
+
+    /* Exact answers read the system wide files with every query */
+    if (!memtrack_config_approximate(MEMTRACK_TYPE_OTHER, false)) {
+        return false;
+    }
+
+    ttl_ns = atomic_load_explicit(&ratio_ttl_ms, memory_order_relaxed) *
+             1000000ULL;
+    stamp = atomic_load_explicit(&cached_ratio_ns, memory_order_acquire);
+    if (stamp == 0 || memtrack_now_ns() - stamp > ttl_ns) {
+        return false;
+    }
+
+    bits = atomic_load_explicit(&cached_ratio, memory_order_relaxed);
+    memcpy(ratio, &bits, sizeof(*ratio));
+
+    return true;
+}
+
+void zram_memtrack_set_ratio_ttl(uint32_t ttl_ms)
+{
+    atomic_store_explicit(&ratio_ttl_ms, ttl_ms, memory_order_relaxed);
+}
+
+static double refresh_ratio(int *error)
+{
+    char used_buf[64];
+    char meminfo_buf[4096];
+    struct zram_sources src;
+    double ratio;
+    struct batch_io_req reqs[] = {
+        {
+            .path = "/sys/block/zram0/mem_used_total",
+            .buf = used_buf,
+            .buf_size = sizeof(used_buf),
+            .parse = parse_zram_used_total,
+            .arg = &src,
+        },
+        {
+            .path = "/proc/meminfo",
+            .buf = meminfo_buf,
+            .buf_size = sizeof(meminfo_buf),
+            .parse = parse_meminfo,
+            .arg = &src,
+        },
+    };
+
+    memset(&src, 0, sizeof(src));
+    batch_io_run(reqs, ARRAY_SIZE(reqs));
+    ratio = compute_ratio(&src, &reqs[1]);
+    store_ratio(ratio);
+    *error = reqs[1].error;
+
+    return ratio;
+}
+
+int zram_memtrack_refresh_ratio(void)
+{
+    int error;
+
+    refresh_ratio(&error);
+
+    return error;
+}
+
+static void dump_query(pid_t pid, const char *file_name, double ratio,
+                       const struct memtrack_record *record)
+{
+    ALOGI("memtrack dump pid %d zram: ratio (swapped/zram) %f, %zu kB", pid,
+          ratio > 0.0 ? 1 / ratio : 1.0, record->size_in_bytes / 1024);
+    memtrack_log_dump_file(file_name);
+}
+
+/* smaps names the per-process file summed for PSwap */
+static int get_memory(pid_t pid, enum memtrack_type type,
+                      struct memtrack_record *records, size_t *num_records,
+                      const char *smaps)
+{
+
+    if (type != MEMTRACK_TYPE_OTHER) {
+        return 0;
+    }
+
+    size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
+    char used_buf[64];
+    char meminfo_buf[4096];
+    char file_name[128];
+    struct zram_sources src;
+    size_t count;
+
+    double ratio = 0.0;
+    bool have_ratio;
+
+    *num_records = ARRAY_SIZE(record_templates);
+
+    /* fastpath to return the necessary number of records */
+    if (allocated_records == 0) {
+        return 0;
+    }
+
+    memcpy(records, record_templates,
+           sizeof(struct memtrack_record) * allocated_records);
+
+    memset(&src, 0, sizeof(src));
+    snprintf(file_name, sizeof(file_name), "/proc/%d/%s", pid, smaps);
+
+    struct batch_io_req reqs[] = {
+        {
+            .path = file_name,
+            .buf = batch_io_scratch(),
+            .buf_size = BATCH_IO_SCRATCH_SIZE,
+            .parse = parse_smaps_pswap,
+            .arg = &src,
+        },
+        {
+            .path = "/sys/block/zram0/mem_used_total",
+            .buf = used_buf,
+            .buf_size = sizeof(used_buf),
+            .parse = parse_zram_used_total,
+            .arg = &src,
+        },
+        {
+            .path = "/proc/meminfo",
+            .buf = meminfo_buf,
+            .buf_size = sizeof(meminfo_buf),
+            .parse = parse_meminfo,
+            .arg = &src,
+        },
+    };
+
+    /* The global files are only read when the cached ratio is too old */
+    have_ratio = load_ratio(&ratio);
+    count = have_ratio ? 1 : ARRAY_SIZE(reqs);
+
+    batch_io_run(reqs, count);
+
+    if (!have_ratio) {
+        ratio = compute_ratio(&src, &reqs[2]);
+        store_ratio(ratio);
+    }
+
+    if (reqs[0].error) {
+        return reqs[0].error;
+    }
+
+    records[0].size_in_bytes = (size_t)(src.pswap_total * (1024 * ratio));
+
+    if (memtrack_log_dump_wanted(pid)) {
+        dump_query(pid, file_name, ratio, &records[0]);
+    }
+
+    return 0;
+}
+
+int zram_memtrack_get_memory(pid_t pid, enum memtrack_type type,
+                             struct memtrack_record *records,
+                             size_t *num_records)
+{
+    return get_memory(pid, type, records, num_records, "smaps");
+}
+
+static int get_memory_rollup(pid_t pid, enum memtrack_type type,
+                             struct memtrack_record *records,
+                             size_t *num_records)
+{
+    return get_memory(pid, type, records, num_records, "smaps_rollup");
+}
+
+static void find_pswap(void *arg, const char *data, size_t len)
+{
+    *(bool *)arg = strstr(data, "\nPSwap:") != NULL;
+}
+
+/* 4.14+, and only useful where the vendor PSwap field is rolled up too */
+static bool rollup_available(void)
+{
+    char buf[4096];
+    bool found = false;
+
+    return batch_io_read_file("/proc/self/smaps_rollup", buf, sizeof(buf),
+                              find_pswap, &found) == 0 && found;
+}
+
+const struct memtrack_source zram_memtrack_sources[ZRAM_MEMTRACK_NUM_SOURCES] = {
+    {
+        .name = "smaps",
+        .get_memory = zram_memtrack_get_memory,
+    },
+    {
+        .name = "smaps_rollup",
+        .get_memory = get_memory_rollup,
+        .available = rollup_available,
+    },
+};
+
+static int zram_scan_begin(pid_t pid, void *state)
+{
+    return 0;
+}
+
+static int zram_scan_finish(pid_t pid, void *state, int error,
+                            struct memtrack_record *records,
+                            size_t *num_records)
+{
+    const struct zram_sources *src = state;
+    size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
+    double ratio;
+
+    *num_records = ARRAY_SIZE(record_templates);
+    if (error) {
+        return error;
+    }
+
+    if (!load_ratio(&ratio)) {
+        ratio = refresh_ratio(&error);
+    }
+
+    memcpy(records, record_templates,
+           sizeof(struct memtrack_record) * allocated_records);
+    if (allocated_records) {
+        records[0].size_in_bytes = (size_t)(src->pswap_total * (1024 * ratio));
+    }
+
+    return 0;
+}
+
+const struct memtrack_scan_ops zram_scan_ops = {
+    .state_size = sizeof(struct zram_sources),
+    .begin = zram_scan_begin,
+    .line = pswap_line,
+    .finish = zram_scan_finish,
+};
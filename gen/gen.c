@@ -19,10 +19,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/utsname.h>
 #include <cutils/hashmap.h>
 
 #include <hardware/memtrack.h>
 
+#include "batch_io.h"
+#include "config.h"
+#include "fdinfo.h"
 #include "memtrack_intel.h"
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
@@ -36,17 +40,115 @@ static struct memtrack_record record_templates[] = {
     },
 };
 
+struct gfx_memtrack_match {
+    pid_t pid;
+    bool matched;
+    int Gfxmem;
+};
+
+static void parse_gfx_memtrack(void *arg, const char *data, size_t len)
+{
+    struct gfx_memtrack_match *match = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        int ret, matched_pid, Gfxmem;
+
+        /* Format:
+         *  PID    GfxMem   Process
+         * 2454    37060K /system/bin/surfaceflinger
+        */
+
+        ret = sscanf(line, "%d %dK %*[^\n]", &matched_pid, &Gfxmem);
+
+        if (ret == 2 && matched_pid == match->pid) {
+            match->matched = true;
+            match->Gfxmem = Gfxmem;
+            break;
+        }
+    }
+}
+
+struct gen_scan_state {
+    struct gfx_memtrack_match match;
+    int mapped_size;
+    /* The current mapping is backed by the DRM device */
+    bool drm;
+};
+
+static void drm_line(void *arg, const char *line)
+{
+    struct gen_scan_state *st = arg;
+    char cmdline[1024];
+    unsigned long smaps_size;
+
+    if (sscanf(line, "%*s %*s %*s %*s %*s %1000[^\n]", cmdline) == 1) {
+        st->drm = !strcmp(cmdline, "/dev/dri/card0") ||
+                  !strncmp(cmdline, "/drm mm object", 12);
+        return;
+    }
+
+    if (!st->drm) {
+        return;
+    }
+
+    if (sscanf(line, "Rss: %lu kB", &smaps_size) == 1) {
+        st->mapped_size += smaps_size;
+    }
+}
+
+static void parse_smaps_drm(void *arg, const char *data, size_t len)
+{
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        drm_line(arg, line);
+    }
+}
+
+static int read_gfx_memtrack(pid_t pid, struct gfx_memtrack_match *match)
+{
+    char gfx_buf[1024];
+    char tmp[128];
+
+    match->pid = pid;
+    snprintf(tmp, sizeof(tmp), "/sys/class/drm/card0/gfx_memtrack/%d", pid);
+    return batch_io_read_file(tmp, gfx_buf, sizeof(gfx_buf),
+                              parse_gfx_memtrack, match);
+}
+
+static void fill_records(const struct gen_scan_state *st, int smaps_error,
+                         struct memtrack_record *records,
+                         size_t allocated_records)
+{
+    memcpy(records, record_templates,
+           sizeof(struct memtrack_record) * allocated_records);
+    if (allocated_records == 0) {
+        return;
+    }
+
+    if (!st->match.matched) {
+        records[0].size_in_bytes = 0;
+    } else if (smaps_error < 0) {
+        records[0].size_in_bytes = st->match.Gfxmem * 1024;
+    } else {
+        records[0].size_in_bytes =
+            (size_t)(st->match.Gfxmem - st->mapped_size) * 1024;
+    }
+}
+
 int gen_memtrack_get_memory(pid_t pid, enum memtrack_type type,
                              struct memtrack_record *records,
                              size_t *num_records)
 {
     size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
-    int i;
-    FILE *fp;
-    FILE *smaps_fp;
-    char line[1024];
+    struct gen_scan_state st;
     char tmp[128];
-    size_t unaccounted_size = 0;
+    int ret;
 
     *num_records = ARRAY_SIZE(record_templates);
 
@@ -55,87 +157,146 @@ int gen_memtrack_get_memory(pid_t pid, enum memtrack_type type,
         return 0;
     }
 
-    memcpy(records, record_templates,
-           sizeof(struct memtrack_record) * allocated_records);
+    memset(&st, 0, sizeof(st));
+    ret = read_gfx_memtrack(pid, &st.match);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* The smaps walk is only worth it for pids the driver knows about */
+    if (st.match.matched) {
+        snprintf(tmp, sizeof(tmp), "/proc/%d/smaps", pid);
+        ret = batch_io_read_file(tmp, batch_io_scratch(),
+                                 BATCH_IO_SCRATCH_SIZE, parse_smaps_drm, &st);
+    }
+
+    fill_records(&st, ret, records, allocated_records);
+
+    return 0;
+}
 
-    sprintf(tmp, "/sys/class/drm/card0/gfx_memtrack/%d", pid);
+/* Leaves in the part that is also mapped, saving the smaps walk */
+static int gen_gfx_get_memory(pid_t pid, enum memtrack_type type,
+                              struct memtrack_record *records,
+                              size_t *num_records)
+{
+    size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
+    struct gen_scan_state st;
+    int ret;
 
-    fp = fopen(tmp, "r");
-    if (fp == NULL) {
-        return -errno;
+    *num_records = ARRAY_SIZE(record_templates);
+    if (allocated_records == 0) {
+        return 0;
     }
 
-    snprintf(tmp, sizeof(tmp), "/proc/%d/smaps", pid);
-    smaps_fp = fopen(tmp, "r");
-    if (smaps_fp == NULL) {
-        while (1) {
-            char line[1024];
-            int ret, matched_pid, Gfxmem;
+    memset(&st, 0, sizeof(st));
+    ret = read_gfx_memtrack(pid, &st.match);
+    if (ret < 0) {
+        return ret;
+    }
 
-            if (fgets(line, sizeof(line), fp) == NULL) {
-                break;
-            }
-            ret = sscanf(line, "%d %dK %*[^\n]", &matched_pid, &Gfxmem);
+    fill_records(&st, 0, records, allocated_records);
 
-            if (ret == 2 && matched_pid == pid) {
-                records[0].size_in_bytes = Gfxmem * 1024;
-                break;
-            }
-        }
+    return 0;
+}
 
-        fclose(fp);
+/* Resident memory of the process' DRM clients, mapped or not */
+static int gen_fdinfo_get_memory(pid_t pid, enum memtrack_type type,
+                                 struct memtrack_record *records,
+                                 size_t *num_records)
+{
+    size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
+    uint64_t bytes;
+    int ret;
+
+    *num_records = ARRAY_SIZE(record_templates);
+    if (allocated_records == 0) {
         return 0;
     }
 
-    while (1) {
-        char line[1024];
-        int size;
-        int ret, matched_pid, Gfxmem, mapped_size = 0;
+    ret = fdinfo_drm_bytes(pid, &bytes);
+    if (ret < 0) {
+        return ret;
+    }
 
-        if (fgets(line, sizeof(line), fp) == NULL) {
-             break;
-        }
+    memcpy(records, record_templates,
+           sizeof(struct memtrack_record) * allocated_records);
+    records[0].size_in_bytes = bytes;
 
-        /* Format:
-         *  PID    GfxMem   Process
-         * 2454    37060K /system/bin/surfaceflinger
-        */
+    return 0;
+}
 
-        ret = sscanf(line, "%d %dK %*[^\n]", &matched_pid, &Gfxmem);
+/* i915 reports drm-resident-* in fdinfo since 6.8 */
+static bool drm_fdinfo_available(void)
+{
+    struct utsname u;
+    unsigned int major, minor;
 
-        if (ret == 2 && matched_pid == pid) {
-            while (1) {
-                char cmdline[1024];
-                unsigned long smaps_size;
-
-                if (fgets(line, sizeof(line), smaps_fp) == NULL) {
-                    break;
-                }
-
-                if (sscanf(line, "%*s %*s %*s %*s %*s %1000[^\n]", cmdline) == 1) {
-                    continue;
-                }
-
-                if (strcmp(cmdline, "/dev/dri/card0") && strncmp(cmdline, "/drm mm object", 12)) {
-                    continue;
-                }
-
-                if (sscanf(line, "Rss: %lu kB", &smaps_size) == 1) {
-                    if (smaps_size) {
-                        mapped_size += smaps_size;
-                        continue;
-                    }
-                }
-            }
-            unaccounted_size = Gfxmem - mapped_size;
-            break;
-        }
+    if (uname(&u) < 0 || sscanf(u.release, "%u.%u", &major, &minor) != 2) {
+        return false;
+    }
+
+    return (major > 6 || (major == 6 && minor >= 8)) && fdinfo_available();
+}
+
+const struct memtrack_source gen_sources[GEN_NUM_SOURCES] = {
+    {
+        .name = "gfx_smaps",
+        .get_memory = gen_memtrack_get_memory,
+    },
+    {
+        .name = "gfx",
+        .approximate = true,
+        .get_memory = gen_gfx_get_memory,
+    },
+    {
+        .name = "fdinfo",
+        .approximate = true,
+        .get_memory = gen_fdinfo_get_memory,
+        .available = drm_fdinfo_available,
+    },
+};
+
+static int gen_scan_begin(pid_t pid, void *state)
+{
+    struct gen_scan_state *st = state;
+    int ret;
+
+    ret = read_gfx_memtrack(pid, &st->match);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (!st->match.matched ||
+        memtrack_config_approximate(MEMTRACK_TYPE_GRAPHICS, false)) {
+        return 1;
     }
 
-    records[0].size_in_bytes = unaccounted_size * 1024;
+    return 0;
+}
+
+static int gen_scan_finish(pid_t pid, void *state, int error,
+                           struct memtrack_record *records,
+                           size_t *num_records)
+{
+    const struct gen_scan_state *st = state;
+    size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
+
+    *num_records = ARRAY_SIZE(record_templates);
 
-    fclose(smaps_fp);
-    fclose(fp);
+    /* Failing to read gfx_memtrack fails the query, smaps only degrades it */
+    if (error < 0 && !st->match.matched) {
+        return error;
+    }
+
+    fill_records(st, error, records, allocated_records);
 
     return 0;
 }
+
+const struct memtrack_scan_ops gen_scan_ops = {
+    .state_size = sizeof(struct gen_scan_state),
+    .begin = gen_scan_begin,
+    .line = drm_line,
+    .finish = gen_scan_finish,
+};
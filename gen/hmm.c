@@ -23,6 +23,7 @@
 
 #include <hardware/memtrack.h>
 
+#include "batch_io.h"
 #include "memtrack_intel.h"
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
@@ -36,41 +37,17 @@ static struct memtrack_record record_templates[] = {
     },
 };
 
-int hmm_memtrack_get_memory(pid_t pid, enum memtrack_type type,
-                             struct memtrack_record *records,
-                             size_t *num_records)
+static void parse_active_bo(void *arg, const char *data, size_t len)
 {
-    size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
-    int i;
-    FILE *fp;
+    unsigned long *total = arg;
+    const char *pos = data;
+    const char *end = data + len;
     char line[1024];
-    char tmp[128];
-    size_t unaccounted_size = 0;
-
-    *num_records = ARRAY_SIZE(record_templates);
-
-    /* fastpath to return the necessary number of records */
-    if (allocated_records == 0) {
-        return 0;
-    }
-
-    memcpy(records, record_templates,
-           sizeof(struct memtrack_record) * allocated_records);
 
-    /* Calculate active buffer */
-    fp = fopen("/sys/devices/pci0000:00/0000:00:03.0/active_bo", "r");
-    if (fp == NULL) {
-        return -errno;
-    }
-
-    while (1) {
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
         unsigned long size;
         int ret;
 
-        if (fgets(line, sizeof(line), fp) == NULL) {
-            break;
-        }
-
         /* Format:
          * 39 p buffer objects: 9696 KB
          */
@@ -79,76 +56,97 @@ int hmm_memtrack_get_memory(pid_t pid, enum memtrack_type type,
             continue;
         }
 
-        if (pid == 1) {
-            unaccounted_size += size;
-        }
+        *total += size;
     }
+}
 
-    records[0].size_in_bytes = unaccounted_size * 1024;
-
-    fclose(fp);
-
-    /* Calculate reserved_pool's buffer */
-    fp = fopen("/sys/devices/pci0000:00/0000:00:03.0/reserved_pool", "r");
-    if (fp == NULL) {
-        return -errno;
-    }
+static void parse_pool_pages(void *arg, const char *data, size_t len)
+{
+    unsigned long *total = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
 
-    while (1) {
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
         unsigned long size;
         int ret;
 
-        if (fgets(line, sizeof(line), fp) == NULL) {
-            break;
-        }
-
         /* Format:
          * 16008 out of 18432 pages available
+         * 16008 (max 18432) pages available
          */
         ret = sscanf(line, "%ld %*s\n", &size);
         if (ret != 1) {
             continue;
         }
 
-        if (pid == 1) {
-            unaccounted_size += size * 4;
-        }
+        *total += size * 4;
     }
+}
 
-    records[0].size_in_bytes = unaccounted_size * 1024;
+int hmm_memtrack_get_memory(pid_t pid, enum memtrack_type type,
+                             struct memtrack_record *records,
+                             size_t *num_records)
+{
+    size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
+    char active_buf[4096];
+    char reserved_buf[1024];
+    char dynamic_buf[1024];
+    unsigned long sizes[3] = { 0, 0, 0 };
+    size_t unaccounted_size = 0;
+    size_t i;
 
-    fclose(fp);
+    *num_records = ARRAY_SIZE(record_templates);
 
-    /* Calculate dynamic_pool's buffer */
-    fp = fopen("/sys/devices/pci0000:00/0000:00:03.0/dynamic_pool", "r");
-    if (fp == NULL) {
-        return -errno;
+    /* fastpath to return the necessary number of records */
+    if (allocated_records == 0) {
+        return 0;
     }
 
-    while (1) {
-        unsigned long size;
-        int ret;
-
-        if (fgets(line, sizeof(line), fp) == NULL) {
-            break;
-        }
+    memcpy(records, record_templates,
+           sizeof(struct memtrack_record) * allocated_records);
 
-        /* Format:
-         * 16008 (max 18432) pages available
-         */
-        ret = sscanf(line, "%ld %*s\n", &size);
-        if (ret != 1) {
-            continue;
+    struct batch_io_req reqs[] = {
+        /* Calculate active buffer */
+        {
+            .path = "/sys/devices/pci0000:00/0000:00:03.0/active_bo",
+            .buf = active_buf,
+            .buf_size = sizeof(active_buf),
+            .parse = parse_active_bo,
+            .arg = &sizes[0],
+        },
+        /* Calculate reserved_pool's buffer */
+        {
+            .path = "/sys/devices/pci0000:00/0000:00:03.0/reserved_pool",
+            .buf = reserved_buf,
+            .buf_size = sizeof(reserved_buf),
+            .parse = parse_pool_pages,
+            .arg = &sizes[1],
+        },
+        /* Calculate dynamic_pool's buffer */
+        {
+            .path = "/sys/devices/pci0000:00/0000:00:03.0/dynamic_pool",
+            .buf = dynamic_buf,
+            .buf_size = sizeof(dynamic_buf),
+            .parse = parse_pool_pages,
+            .arg = &sizes[2],
+        },
+    };
+
+    batch_io_run(reqs, ARRAY_SIZE(reqs));
+
+    for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+        if (reqs[i].error) {
+            return reqs[i].error;
         }
 
+        /* The pools are global, they are all charged to init */
         if (pid == 1) {
-            unaccounted_size += size * 4;
+            unaccounted_size += sizes[i];
         }
-    }
-
-    records[0].size_in_bytes = unaccounted_size * 1024;
 
-    fclose(fp);
+        records[0].size_in_bytes = unaccounted_size * 1024;
+    }
 
     return 0;
 }
@@ -20,9 +20,35 @@
 
 #include "memtrack_intel.h"
 
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "gen",
+        .type = MEMTRACK_TYPE_GRAPHICS,
+        .get_memory = gen_memtrack_get_memory,
+        .scan = &gen_scan_ops,
+        .sources = gen_sources,
+        .num_sources = GEN_NUM_SOURCES,
+    },
+    {
+        .name = "zram",
+        .type = MEMTRACK_TYPE_OTHER,
+        .get_memory = zram_memtrack_get_memory,
+        .scan = &zram_scan_ops,
+        .sources = zram_memtrack_sources,
+        .num_sources = ZRAM_MEMTRACK_NUM_SOURCES,
+    },
+    {
+        .name = "hmm",
+        .type = MEMTRACK_TYPE_CAMERA,
+        .get_memory = hmm_memtrack_get_memory,
+    },
+};
+
 int intel_memtrack_init(const struct memtrack_module *module)
 {
-    return 0;
+    return memtrack_core_init(providers, ARRAY_SIZE(providers));
 }
 
 int intel_memtrack_get_memory(const struct memtrack_module *module,
@@ -31,19 +57,7 @@ int intel_memtrack_get_memory(const struct memtrack_module *module,
                                 struct memtrack_record *records,
                                 size_t *num_records)
 {
-    if (type == MEMTRACK_TYPE_GRAPHICS) {
-        return gen_memtrack_get_memory(pid, type, records, num_records);
-    }
-
-    if (type == MEMTRACK_TYPE_OTHER) {
-        return zram_memtrack_get_memory(pid, type, records, num_records);
-    }
-
-    if (type == MEMTRACK_TYPE_CAMERA) {
-        return hmm_memtrack_get_memory(pid, type, records, num_records);
-    }
-
-    return -EINVAL;
+    return memtrack_core_get_memory(pid, type, records, num_records);
 }
 
 static struct hw_module_methods_t memtrack_module_methods = {
@@ -17,13 +17,17 @@
 #ifndef _MEMTRACK_INTEL_H_
 #define _MEMTRACK_INTEL_H_
 
+#include "memtrack_common.h"
+
 int gen_memtrack_get_memory(pid_t pid, enum memtrack_type type,
                              struct memtrack_record *records,
                              size_t *num_records);
 
-int zram_memtrack_get_memory(pid_t pid, enum memtrack_type type,
-                             struct memtrack_record *records,
-                             size_t *num_records);
+extern const struct memtrack_scan_ops gen_scan_ops;
+
+/* gfx_memtrack less its smaps mapped part, gfx_memtrack alone, DRM fdinfo */
+#define GEN_NUM_SOURCES 3
+extern const struct memtrack_source gen_sources[];
 
 int hmm_memtrack_get_memory(pid_t pid, enum memtrack_type type,
                              struct memtrack_record *records,
@@ -19,12 +19,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
-#include <dirent.h>
 #include <cutils/log.h>
 
 #include <hardware/memtrack.h>
 
+#include "batch_io.h"
+#include "fdinfo.h"
+#include "io_account.h"
+#include "logging.h"
 #include "memtrack_intel.h"
+#include "trace.h"
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
 #define min(x, y) ((x) < (y) ? (x) : (y))
@@ -39,28 +43,25 @@ static struct memtrack_record record_templates[] = {
     },
 };
 
-size_t get_ion(pid_t pid, char* ion_heap)
-{
-    FILE *fp;
-    char tmp[128];
-    size_t unaccounted_size = 0;
+/* Heaps read per batch, /d/ion/heaps rarely has more than a handful */
+#define ION_HEAPS_PER_BATCH 8
 
-    snprintf(tmp, 128, "/d/ion/heaps/%s", ion_heap);
+struct ion_heap_match {
+    pid_t pid;
+    size_t size;
+};
 
-    fp = fopen(tmp, "r");
-    if (fp == NULL) {
-        return 0;
-    }
+static void parse_ion_heap(void *arg, const char *data, size_t len)
+{
+    struct ion_heap_match *match = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
 
-    while(1) {
-        char line[1024];
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
         int ret, matched_pid;
         size_t IONmem;
 
-        if (fgets(line, sizeof(line), fp) == NULL) {
-            break;
-        }
-
         /* Format:
          *           client              pid             size proportional_size
          *   surfaceflinger              179         33423360          33423360
@@ -68,14 +69,12 @@ size_t get_ion(pid_t pid, char* ion_heap)
 
         ret = sscanf(line, "%*s %d %*zd %zd %*[^\n]", &matched_pid, &IONmem);
 
-        if (ret == 2 && matched_pid == pid) {
-            ALOGD("ION is %zd", IONmem);
-            unaccounted_size += IONmem;
+        if (ret == 2 && matched_pid == match->pid) {
+            MEMTRACK_LOGV("ION is %zd", IONmem);
+            match->size += IONmem;
             continue;
         }
     }
-    fclose(fp);
-    return unaccounted_size;
 }
 
 
@@ -84,13 +83,13 @@ int ion_memtrack_get_memory(pid_t pid, enum memtrack_type type,
                              size_t *num_records)
 {
     size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
-    int i;
-    FILE *fp;
-    DIR *pdir;
-    struct dirent *pdirent;
-    char line[1024];
-    char tmp[128];
-    size_t unaccounted_size = 0;
+    struct memtrack_dir *pdir;
+    const char *name;
+    char paths[ION_HEAPS_PER_BATCH][128];
+    char bufs[ION_HEAPS_PER_BATCH][4096];
+    struct batch_io_req reqs[ION_HEAPS_PER_BATCH];
+    struct ion_heap_match match = { .pid = pid };
+    size_t nreqs = 0;
 
     *num_records = ARRAY_SIZE(record_templates);
 
@@ -102,23 +101,107 @@ int ion_memtrack_get_memory(pid_t pid, enum memtrack_type type,
     memcpy(records, record_templates,
            sizeof(struct memtrack_record) * allocated_records);
 
-    pdir = opendir("/d/ion/heaps");
+    pdir = memtrack_io_opendir("/d/ion/heaps");
     if (pdir == NULL) {
-        ALOGE("Couldn't opendir /d/ion/heaps");
+        MEMTRACK_LOGE_EVENT("ion_heaps_missing",
+                            "Couldn't opendir /d/ion/heaps");
         return -errno;
     }
 
-    while((pdirent = readdir(pdir)) != NULL) {
-        if (strcmp(pdirent->d_name, ".") == 0 ||
-            strcmp(pdirent->d_name, "..") == 0) {
-            continue;
+    MEMTRACK_TRACE_BEGIN("heap_scan", pid, "/d/ion/heaps");
+
+    memset(reqs, 0, sizeof(reqs));
+    while (1) {
+        name = memtrack_io_readdir(pdir);
+
+        if (name != NULL) {
+            snprintf(paths[nreqs], sizeof(paths[nreqs]),
+                     "/d/ion/heaps/%s", name);
+            reqs[nreqs].path = paths[nreqs];
+            reqs[nreqs].buf = bufs[nreqs];
+            reqs[nreqs].buf_size = sizeof(bufs[nreqs]);
+            reqs[nreqs].parse = parse_ion_heap;
+            reqs[nreqs].arg = &match;
+            nreqs++;
+        }
+
+        if (nreqs == ION_HEAPS_PER_BATCH || (name == NULL && nreqs)) {
+            batch_io_run(reqs, nreqs);
+            nreqs = 0;
         }
 
-        unaccounted_size += get_ion(pid, pdirent->d_name);
+        if (name == NULL) {
+            break;
+        }
     }
-    closedir(pdir);
+    memtrack_io_closedir(pdir);
+    MEMTRACK_TRACE_END("heap_scan", match.size);
 
-    records[0].size_in_bytes = unaccounted_size;
+    records[0].size_in_bytes = match.size;
 
     return 0;
 }
+
+/* Buffers held through fds only, a mapping alone is not seen */
+static int ion_dmabuf_get_memory(pid_t pid, enum memtrack_type type,
+                                 struct memtrack_record *records,
+                                 size_t *num_records)
+{
+    size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
+    uint64_t bytes;
+    int ret;
+
+    *num_records = ARRAY_SIZE(record_templates);
+    if (allocated_records == 0) {
+        return 0;
+    }
+
+    ret = fdinfo_dmabuf_bytes(pid, &bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    memcpy(records, record_templates,
+           sizeof(struct memtrack_record) * allocated_records);
+    records[0].size_in_bytes = bytes;
+
+    return 0;
+}
+
+static bool dir_exists(const char *path)
+{
+    struct memtrack_dir *dir = memtrack_io_opendir(path);
+
+    if (dir == NULL) {
+        return false;
+    }
+    memtrack_io_closedir(dir);
+
+    return true;
+}
+
+static bool ion_debugfs_available(void)
+{
+    return dir_exists("/d/ion/heaps");
+}
+
+/* dma-buf sysfs stats and fdinfo exp_name came with the same kernels */
+static bool ion_dmabuf_available(void)
+{
+    return dir_exists("/sys/kernel/dmabuf") && fdinfo_available();
+}
+
+const struct memtrack_source ion_sources[ION_NUM_SOURCES] = {
+    {
+        .name = "debugfs",
+        .get_memory = ion_memtrack_get_memory,
+        .available = ion_debugfs_available,
+        .timeout_ms = MEMTRACK_DEBUGFS_TIMEOUT_MS,
+    },
+    {
+        .name = "dmabuf",
+        .approximate = true,
+        .get_memory = ion_dmabuf_get_memory,
+        .available = ion_dmabuf_available,
+    },
+};
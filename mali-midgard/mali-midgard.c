@@ -19,12 +19,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
-#include <dirent.h>
 #include <cutils/log.h>
 
 #include <hardware/memtrack.h>
 
+#include "batch_io.h"
+#include "io_account.h"
+#include "logging.h"
 #include "memtrack_intel.h"
+#include "trace.h"
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
 #define min(x, y) ((x) < (y) ? (x) : (y))
@@ -37,17 +40,40 @@ static struct memtrack_record record_templates[] = {
     },
 };
 
+static void parse_mem_profile(void *arg, const char *data, size_t len)
+{
+    size_t *total = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        size_t Gfxmem;
+        int ret;
+
+        /* Format:
+         * .....
+         * Total allocated memory: 2822048
+        */
+
+        ret = sscanf(line, "Total allocated memory: %zd", &Gfxmem);
+
+        if (ret == 1) {
+            MEMTRACK_LOGV("Gfxmem is %zd", Gfxmem);
+            *total += Gfxmem;
+            break;
+        }
+    }
+}
+
 int mali_midgard_memtrack_get_memory(pid_t pid, enum memtrack_type type,
                              struct memtrack_record *records,
                              size_t *num_records)
 {
     size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
-    int i;
-    FILE *fp;
-    DIR *pdir;
-    struct dirent *pdirent;
-    char line[1024];
-    char cmdline[64];
+    struct memtrack_dir *pdir;
+    const char *name;
+    char buf[4096];
     char tmp[128];
     size_t unaccounted_size = 0;
 
@@ -61,61 +87,45 @@ int mali_midgard_memtrack_get_memory(pid_t pid, enum memtrack_type type,
     memcpy(records, record_templates,
            sizeof(struct memtrack_record) * allocated_records);
 
-    pdir = opendir("/sys/kernel/debug/mali0/ctx");
+    pdir = memtrack_io_opendir("/sys/kernel/debug/mali0/ctx");
 
     if (pdir == NULL) {
         return -errno;
     }
 
-    while (pdirent = readdir(pdir)) {
-        int ret, matched_pid;
+    MEMTRACK_TRACE_BEGIN("ctx_scan", pid, "/sys/kernel/debug/mali0/ctx");
 
-        if (strcmp(pdirent->d_name, ".") == 0 ||
-            strcmp(pdirent->d_name, "..") == 0) {
-            continue;
-        }
+    while (name = memtrack_io_readdir(pdir)) {
+        int ret, matched_pid;
 
-        ret = sscanf(pdirent->d_name, "%d_%*d", &matched_pid);
+        ret = sscanf(name, "%d_%*d", &matched_pid);
 
         if (ret == 1 && matched_pid == pid) { 
-            snprintf(tmp, 128, "/sys/kernel/debug/mali0/ctx/%s/mem_profile", pdirent->d_name);
-
-            fp = fopen(tmp, "r");
-
-            if (fp == NULL) {
-               closedir(pdir);
-               return -errno;
+            snprintf(tmp, 128, "/sys/kernel/debug/mali0/ctx/%s/mem_profile", name);
+
+            ret = batch_io_read_file(tmp, buf, sizeof(buf),
+                                     parse_mem_profile, &unaccounted_size);
+            if (ret < 0) {
+               memtrack_io_closedir(pdir);
+               MEMTRACK_TRACE_END("ctx_scan", 0);
+               return ret;
             }
-
-            while(1) {
-                size_t Gfxmem;
-                fseek(fp, -50, SEEK_END);
-
-                if (fgets(line, sizeof(line), fp) == NULL) {
-                     break;
-                }
-
-                /* Format:
-                 * .....
-                 * Total allocated memory: 2822048
-                */
-
-                ret = sscanf(line, "Total allocated memory: %zd", &Gfxmem);
-
-                if (ret == 1) {
-                    ALOGD("Gfxmem is %zd", Gfxmem);
-                    unaccounted_size += Gfxmem;
-                    break;
-                }
-            }
-            fclose(fp);
             break;
         }
     }
 
-    closedir(pdir);
+    memtrack_io_closedir(pdir);
+    MEMTRACK_TRACE_END("ctx_scan", unaccounted_size);
 
     records[0].size_in_bytes = unaccounted_size;
 
     return 0;
 }
+
+const struct memtrack_source mali_midgard_sources[MALI_MIDGARD_NUM_SOURCES] = {
+    {
+        .name = "mem_profile",
+        .get_memory = mali_midgard_memtrack_get_memory,
+        .timeout_ms = MEMTRACK_DEBUGFS_TIMEOUT_MS,
+    },
+};
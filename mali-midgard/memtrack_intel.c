@@ -20,9 +20,36 @@
 
 #include "memtrack_intel.h"
 
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+static const struct memtrack_provider providers[] = {
+    {
+        .name = "mali-midgard",
+        .type = MEMTRACK_TYPE_GRAPHICS,
+        .get_memory = mali_midgard_memtrack_get_memory,
+        .sources = mali_midgard_sources,
+        .num_sources = MALI_MIDGARD_NUM_SOURCES,
+    },
+    {
+        .name = "zram",
+        .type = MEMTRACK_TYPE_OTHER,
+        .get_memory = zram_memtrack_get_memory,
+        .scan = &zram_scan_ops,
+        .sources = zram_memtrack_sources,
+        .num_sources = ZRAM_MEMTRACK_NUM_SOURCES,
+    },
+    {
+        .name = "ion",
+        .type = MEMTRACK_TYPE_GL,
+        .get_memory = ion_memtrack_get_memory,
+        .sources = ion_sources,
+        .num_sources = ION_NUM_SOURCES,
+    },
+};
+
 int intel_memtrack_init(const struct memtrack_module *module)
 {
-    return 0;
+    return memtrack_core_init(providers, ARRAY_SIZE(providers));
 }
 
 int intel_memtrack_get_memory(const struct memtrack_module *module,
@@ -31,19 +58,7 @@ int intel_memtrack_get_memory(const struct memtrack_module *module,
                                 struct memtrack_record *records,
                                 size_t *num_records)
 {
-    if (type == MEMTRACK_TYPE_GRAPHICS) {
-        return mali_midgard_memtrack_get_memory(pid, type, records, num_records);
-    }
-
-    if (type == MEMTRACK_TYPE_OTHER) {
-        return zram_memtrack_get_memory(pid, type, records, num_records);
-    }
-
-    if (type == MEMTRACK_TYPE_GL) {
-        return ion_memtrack_get_memory(pid, type, records, num_records);
-    }
-
-    return -EINVAL;
+    return memtrack_core_get_memory(pid, type, records, num_records);
 }
 
 static struct hw_module_methods_t memtrack_module_methods = {
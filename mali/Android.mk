@@ -21,7 +21,68 @@ include $(CLEAR_VARS)
 LOCAL_MODULE_RELATIVE_PATH := hw
 LOCAL_C_INCLUDES += hardware/libhardware/include
 LOCAL_SHARED_LIBRARIES := liblog libcutils
-LOCAL_SRC_FILES := memtrack_intel.c mali.c ion.c zram.c
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := memtrack_intel.c mali.c ion.c
 LOCAL_MODULE := memtrack.$(TARGET_BOARD_PLATFORM)
 LOCAL_PROPRIETARY_MODULE := true
 include $(BUILD_SHARED_LIBRARY)
+
+# Command line monitor running the same providers in-process
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES += hardware/libhardware/include
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := memtrack_intel.c mali.c ion.c ../common/memtrack_top.c
+LOCAL_MODULE := memtrack_top
+LOCAL_PROPRIETARY_MODULE := true
+include $(BUILD_EXECUTABLE)
+
+# Archives the files the providers read, for replay on a host
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES += hardware/libhardware/include
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := memtrack_intel.c mali.c ion.c ../common/memtrack_capture.c
+LOCAL_MODULE := memtrack_capture
+LOCAL_PROPRIETARY_MODULE := true
+include $(BUILD_EXECUTABLE)
+
+# Checks the providers against io_budgets.conf on a fixture tree
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/../common/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := memtrack_intel.c mali.c ion.c ../common/tests/memtrack_test.c ../common/tests/io_budget_test.c
+LOCAL_TEST_DATA := io_budgets.conf
+LOCAL_MODULE := memtrack_io_budget_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_HEADER_LIBRARIES += libutils_headers
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Runs memtrack_top in CSV mode on a fixture tree
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/../common/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := memtrack_intel.c mali.c ion.c ../common/tests/memtrack_test.c ../common/tests/top_test.c
+LOCAL_MODULE := memtrack_top_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_HEADER_LIBRARIES += libutils_headers
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
+
+# Replays a memtrack_capture archive of a fixture tree
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -Wno-error
+LOCAL_C_INCLUDES += hardware/libhardware/include $(LOCAL_PATH)/../common/tests
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libmemtrack_intel_common
+LOCAL_SRC_FILES := memtrack_intel.c mali.c ion.c ../common/tests/memtrack_test.c ../common/tests/capture_test.c
+LOCAL_MODULE := memtrack_capture_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_HEADER_LIBRARIES += libutils_headers
+LOCAL_GTEST := false
+include $(BUILD_NATIVE_TEST)
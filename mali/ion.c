@@ -24,6 +24,10 @@
 
 #include <hardware/memtrack.h>
 
+#include "batch_io.h"
+#include "fdinfo.h"
+#include "io_account.h"
+#include "logging.h"
 #include "memtrack_intel.h"
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
@@ -37,29 +41,22 @@ static struct memtrack_record record_templates[] = {
     },
 };
 
-size_t get_ion(pid_t pid, char* ion_heap)
-{
-    FILE *fp;
-    char tmp[128];
-    size_t unaccounted_size = 0;
-
-    snprintf(tmp, 128, "/d/ion/heaps/%s", ion_heap);
+struct ion_heap_match {
+    pid_t pid;
+    size_t size;
+};
 
-    fp = fopen(tmp, "r");
-    if (fp == NULL) {
-        ALOGE("%s not found", ion_heap);
-        return 0;
-    }
+static void parse_ion_heap(void *arg, const char *data, size_t len)
+{
+    struct ion_heap_match *match = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
 
-    while(1) {
-        char line[1024];
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
         int ret, matched_pid;
         size_t IONmem;
 
-        if (fgets(line, sizeof(line), fp) == NULL) {
-            break;
-        }
-
         /* Format:
          *           client              pid             size
          *   surfaceflinger              179         33423360
@@ -67,14 +64,12 @@ size_t get_ion(pid_t pid, char* ion_heap)
 
         ret = sscanf(line, "%*s %d %zd %*[^\n]", &matched_pid, &IONmem);
 
-        if (ret == 2 && matched_pid == pid) {
-            ALOGE("ION is %zd", IONmem);
-            unaccounted_size += IONmem;
+        if (ret == 2 && matched_pid == match->pid) {
+            MEMTRACK_LOGV("ION is %zd", IONmem);
+            match->size += IONmem;
             continue;
         }
     }
-    fclose(fp);
-    return unaccounted_size;
 }
 
 
@@ -83,13 +78,12 @@ int ion_memtrack_get_memory(pid_t pid, enum memtrack_type type,
                              size_t *num_records)
 {
     size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
-    int i;
-    FILE *fp;
-    DIR *pdir;
-    struct dirent *pdirent;
-    char line[1024];
-    char tmp[128];
-    size_t unaccounted_size = 0;
+    static const char *ion_heaps[] = { "cma-heap", "system-heap" };
+    char paths[ARRAY_SIZE(ion_heaps)][128];
+    char bufs[ARRAY_SIZE(ion_heaps)][4096];
+    struct batch_io_req reqs[ARRAY_SIZE(ion_heaps)];
+    struct ion_heap_match match = { .pid = pid };
+    size_t i;
 
     *num_records = ARRAY_SIZE(record_templates);
 
@@ -101,10 +95,90 @@ int ion_memtrack_get_memory(pid_t pid, enum memtrack_type type,
     memcpy(records, record_templates,
            sizeof(struct memtrack_record) * allocated_records);
 
-    unaccounted_size += get_ion(pid, "cma-heap");
-    unaccounted_size += get_ion(pid, "system-heap");
+    memset(reqs, 0, sizeof(reqs));
+    for (i = 0; i < ARRAY_SIZE(ion_heaps); i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/d/ion/heaps/%s", ion_heaps[i]);
+        reqs[i].path = paths[i];
+        reqs[i].buf = bufs[i];
+        reqs[i].buf_size = sizeof(bufs[i]);
+        reqs[i].parse = parse_ion_heap;
+        reqs[i].arg = &match;
+    }
 
-    records[0].size_in_bytes = unaccounted_size;
+    batch_io_run(reqs, ARRAY_SIZE(reqs));
+
+    for (i = 0; i < ARRAY_SIZE(ion_heaps); i++) {
+        if (reqs[i].error) {
+            MEMTRACK_LOGE_EVENT("ion_heap_missing", "%s not found",
+                                ion_heaps[i]);
+        }
+    }
+
+    records[0].size_in_bytes = match.size;
 
     return 0;
 }
+
+/* Buffers held through fds only, a mapping alone is not seen */
+static int ion_dmabuf_get_memory(pid_t pid, enum memtrack_type type,
+                                 struct memtrack_record *records,
+                                 size_t *num_records)
+{
+    size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
+    uint64_t bytes;
+    int ret;
+
+    *num_records = ARRAY_SIZE(record_templates);
+    if (allocated_records == 0) {
+        return 0;
+    }
+
+    ret = fdinfo_dmabuf_bytes(pid, &bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    memcpy(records, record_templates,
+           sizeof(struct memtrack_record) * allocated_records);
+    records[0].size_in_bytes = bytes;
+
+    return 0;
+}
+
+static bool dir_exists(const char *path)
+{
+    struct memtrack_dir *dir = memtrack_io_opendir(path);
+
+    if (dir == NULL) {
+        return false;
+    }
+    memtrack_io_closedir(dir);
+
+    return true;
+}
+
+static bool ion_debugfs_available(void)
+{
+    return dir_exists("/d/ion/heaps");
+}
+
+/* dma-buf sysfs stats and fdinfo exp_name came with the same kernels */
+static bool ion_dmabuf_available(void)
+{
+    return dir_exists("/sys/kernel/dmabuf") && fdinfo_available();
+}
+
+const struct memtrack_source ion_sources[ION_NUM_SOURCES] = {
+    {
+        .name = "debugfs",
+        .get_memory = ion_memtrack_get_memory,
+        .available = ion_debugfs_available,
+        .timeout_ms = MEMTRACK_DEBUGFS_TIMEOUT_MS,
+    },
+    {
+        .name = "dmabuf",
+        .approximate = true,
+        .get_memory = ion_dmabuf_get_memory,
+        .available = ion_dmabuf_available,
+    },
+};
@@ -23,6 +23,8 @@
 
 #include <hardware/memtrack.h>
 
+#include "batch_io.h"
+#include "logging.h"
 #include "memtrack_intel.h"
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
@@ -36,16 +38,44 @@ static struct memtrack_record record_templates[] = {
     },
 };
 
+struct gpu_memory_match {
+    pid_t pid;
+    size_t size;
+};
+
+static void parse_gpu_memory(void *arg, const char *data, size_t len)
+{
+    struct gpu_memory_match *match = arg;
+    const char *pos = data;
+    const char *end = data + len;
+    char line[1024];
+
+    while (batch_io_getline(line, sizeof(line), &pos, end) != NULL) {
+        int ret, matched_pid, Gfxmem;
+
+        /* Format:
+         * Name (:bytes)              pid         mali_mem    max_mali_mem     external_mem     ump_mem     dma_mem
+         * RenderThread               3941        13008896    37167104         0                0           11640832
+        */
+
+        ret = sscanf(line, "  %*25[^\n] %d %d %*[^\n]", &matched_pid, &Gfxmem);
+
+        if (ret == 2 && matched_pid == match->pid) {
+            MEMTRACK_LOGV("Gfxmem is %d", Gfxmem);
+            match->size += Gfxmem;
+            break;
+        }
+    }
+}
+
 int mali_memtrack_get_memory(pid_t pid, enum memtrack_type type,
                              struct memtrack_record *records,
                              size_t *num_records)
 {
     size_t allocated_records = min(*num_records, ARRAY_SIZE(record_templates));
-    int i;
-    FILE *fp;
-    char line[1024];
-    char tmp[128];
-    size_t unaccounted_size = 0;
+    char buf[8192];
+    struct gpu_memory_match match = { .pid = pid };
+    int ret;
 
     *num_records = ARRAY_SIZE(record_templates);
 
@@ -57,39 +87,21 @@ int mali_memtrack_get_memory(pid_t pid, enum memtrack_type type,
     memcpy(records, record_templates,
            sizeof(struct memtrack_record) * allocated_records);
 
-    sprintf(tmp, "/sys/kernel/debug/mali/gpu_memory");
-
-    fp = fopen(tmp, "r");
-    if (fp == NULL) {
-        return -errno;
+    ret = batch_io_read_file("/sys/kernel/debug/mali/gpu_memory",
+                             buf, sizeof(buf), parse_gpu_memory, &match);
+    if (ret < 0) {
+        return ret;
     }
 
-    while (1) {
-        char line[1024];
-        int size;
-        int ret, matched_pid, Gfxmem;
-
-        if (fgets(line, sizeof(line), fp) == NULL) {
-             break;
-        }
-
-        /* Format:
-         * Name (:bytes)              pid         mali_mem    max_mali_mem     external_mem     ump_mem     dma_mem
-         * RenderThread               3941        13008896    37167104         0                0           11640832
-        */
-
-        ret = sscanf(line, "  %*25[^\n] %d %d %*[^\n]", &matched_pid, &Gfxmem);
-
-        if (ret == 2 && matched_pid == pid) {
-            ALOGD("Gfxmem is %d", Gfxmem);
-            unaccounted_size += Gfxmem;
-            break;
-        }
-    }
-
-    fclose(fp);
-
-    records[0].size_in_bytes = unaccounted_size;
+    records[0].size_in_bytes = match.size;
 
     return 0;
 }
+
+const struct memtrack_source mali_sources[MALI_NUM_SOURCES] = {
+    {
+        .name = "gpu_memory",
+        .get_memory = mali_memtrack_get_memory,
+        .timeout_ms = MEMTRACK_DEBUGFS_TIMEOUT_MS,
+    },
+};
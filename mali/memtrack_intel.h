@@ -17,16 +17,22 @@
 #ifndef _MEMTRACK_INTEL_H_
 #define _MEMTRACK_INTEL_H_
 
+#include "memtrack_common.h"
+
 int mali_memtrack_get_memory(pid_t pid, enum memtrack_type type,
                              struct memtrack_record *records,
                              size_t *num_records);
 
+/* gpu_memory only, a single source so that it runs with a timeout */
+#define MALI_NUM_SOURCES 1
+extern const struct memtrack_source mali_sources[];
+
 int ion_memtrack_get_memory(pid_t pid, enum memtrack_type type,
                              struct memtrack_record *records,
                              size_t *num_records);
 
-int zram_memtrack_get_memory(pid_t pid, enum memtrack_type type,
-                               struct memtrack_record *records,
-                               size_t *num_records);
+/* The debugfs heap tables, then the dma-bufs in the process' fdinfo */
+#define ION_NUM_SOURCES 2
+extern const struct memtrack_source ion_sources[];
 
 #endif